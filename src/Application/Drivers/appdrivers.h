@@ -135,5 +135,6 @@
 #endif
 
 #include "dflib.h"
+#include "sd_minimal.h"
 
 #endif /* _APPDRIVERS_H_ */
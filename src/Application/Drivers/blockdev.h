@@ -0,0 +1,84 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+#include <stdint.h>
+#include "systypes.h"
+
+// Block device interface used by the filesystem layer. A backend fills a BDEV_Ops table;
+// sector numbers are device relative and every buffer is word aligned.
+
+// Asynchronous read request (optional backend feature). The backend owns the request from
+// read_async() until 'done' runs; completion always happens in main loop context.
+// A backend with read_async must also provide busy and wait, and its blocking read/write must
+// wait for an in-flight request rather than fail. Without wait, read_async is not used.
+// A failed request may succeed when issued again: a backend that adapts its link after an error
+// (the SD driver steps down sample edge, clock and bus width on a data CRC error) reports the
+// failure and leaves the retry to the caller, which re-issues the same sectors a few times
+// (BDEV_ASYNC_RETRIES) before giving up, as the backend's blocking read does internally.
+typedef struct BDEV_Request BDEV_Request;
+typedef void (*BDEV_Callback)(BDEV_Request *req, boolean ok);
+
+#define BDEV_ASYNC_RETRIES  3   // re-issues of a failed read_async request before it is an error
+
+#define BDEV_REQ_IDLE   0
+#define BDEV_REQ_BUSY   1
+#define BDEV_REQ_DONE   2
+#define BDEV_REQ_ERROR  3
+
+struct BDEV_Request {
+    uint32_t lba;
+    uint32_t count;           // sectors
+    uint8_t *buf;             // word aligned, count * sector_size bytes
+    BDEV_Callback done;       // optional, called in main loop context
+    void *user;
+    volatile uint32_t *wp;    // backend private: next destination word
+    volatile uint32_t words_left;
+    volatile uint8_t state;   // BDEV_REQ_*
+};
+
+typedef struct {
+    boolean (*read)(void *ctx, uint32_t lba, uint32_t count, uint8_t *buf);
+    boolean (*write)(void *ctx, uint32_t lba, uint32_t count, const uint8_t *buf); // NULL = read-only device
+    boolean (*flush)(void *ctx);                                                  // NULL = writes are durable on return
+    boolean (*geometry)(void *ctx, uint32_t *sector_size, uint32_t *sector_count);
+    boolean (*read_async)(void *ctx, BDEV_Request *req); // NULL = synchronous reads only
+    boolean (*busy)(void *ctx);                          // asynchronous transfer in flight
+    boolean (*wait)(void *ctx, BDEV_Request *req);       // poll req to completion (callback runs), required with read_async
+} BDEV_Ops;
+
+typedef struct {
+    const BDEV_Ops *ops;
+    void *ctx;
+} BDEV_Device;
+
+static inline boolean BDEV_Read(const BDEV_Device *dev, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    return dev->ops->read(dev->ctx, lba, count, buf);
+}
+
+static inline boolean BDEV_Write(const BDEV_Device *dev, uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    return dev->ops->write ? dev->ops->write(dev->ctx, lba, count, buf) : false;
+}
+
+static inline boolean BDEV_Flush(const BDEV_Device *dev)
+{
+    return dev->ops->flush ? dev->ops->flush(dev->ctx) : true;
+}
+
+static inline boolean BDEV_Busy(const BDEV_Device *dev)
+{
+    return dev->ops->busy ? dev->ops->busy(dev->ctx) : false;
+}
+
+// True if read_async can be used (the backend can also be waited on)
+static inline boolean BDEV_CanReadAsync(const BDEV_Device *dev)
+{
+    return dev->ops->read_async && dev->ops->wait;
+}
+
+static inline boolean BDEV_Wait(const BDEV_Device *dev, BDEV_Request *req)
+{
+    return dev->ops->wait ? dev->ops->wait(dev->ctx, req) : false;
+}
+
+#endif // BLOCKDEV_H
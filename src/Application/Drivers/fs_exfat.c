@@ -0,0 +1,383 @@
+#include "systemconfig.h"
+#include "fs_exfat.h"
+#include "sd_minimal.h"
+#include <string.h>
+
+// Directory/data sector buffer and a separate one for FAT misses, so a FAT lookup
+// in the middle of a directory walk does not clobber the directory sector
+static uint8_t g_xsec[512] __attribute__((aligned(4)));
+static uint8_t g_xfat[512] __attribute__((aligned(4)));
+
+static uint16_t rd16(const uint8_t *p){ return (uint16_t)p[0] | ((uint16_t)p[1]<<8); }
+static uint32_t rd32(const uint8_t *p){ return (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24); }
+static uint64_t rd64(const uint8_t *p){ return (uint64_t)rd32(p) | ((uint64_t)rd32(p + 4) << 32); }
+
+#define EXFAT_ENTRY_EOD         0x00
+#define EXFAT_ENTRY_BITMAP      0x81
+#define EXFAT_ENTRY_FILE        0x85
+#define EXFAT_ENTRY_STREAM      0xC0
+#define EXFAT_ENTRY_NAME        0xC1
+#define EXFAT_FLAG_NOFATCHAIN   0x02
+#define EXFAT_ATTR_DIR          0x10
+
+// One parsed file entry set (file + stream extension + name entries)
+typedef struct {
+    uint16_t attr;
+    uint8_t  flags;           // stream GeneralSecondaryFlags
+    uint8_t  name_len;
+    uint16_t name_hash;
+    uint32_t first_cluster;
+    uint64_t valid_bytes;
+    uint64_t size_bytes;
+    char     name[EXFAT_NAME_MAX + 1]; // ASCII view, '?' for other characters
+} exfat_entry;
+
+// Position inside a directory's cluster chain
+typedef struct {
+    uint32_t cl;
+    uint32_t index;           // cluster index within the directory
+    uint32_t clusters;        // NoFatChain directories: length in clusters (0 = follow the FAT)
+    uint32_t sec;
+    uint32_t off;
+    uint32_t loaded_lba;
+} exfat_dir;
+
+static uint32_t cluster_lba(const EXFAT_Volume *vol, uint32_t cl)
+{
+    return vol->cluster_begin_lba + ((cl - 2) << vol->sectors_per_cluster_shift);
+}
+
+static boolean fat_next(EXFAT_Volume *vol, uint32_t cl, uint32_t *next)
+{
+    uint32_t lba = vol->fat_begin_lba + (cl * 4) / 512;
+    const uint8_t *p = vol->fat_cache ? FSC_GetDataBlock(vol->fat_cache, lba) : NULL;
+    if (!p) {
+        if (!BDEV_Read(vol->dev, lba, 1, g_xfat)) return false;
+        if (vol->fat_cache) FSC_StoreDataBlock(vol->fat_cache, lba, g_xfat);
+        p = g_xfat;
+    }
+    *next = rd32(&p[(cl * 4) % 512]);
+    return true;
+}
+
+static boolean valid_cluster(const EXFAT_Volume *vol, uint32_t cl)
+{
+    return cl >= 2 && cl < vol->cluster_count + 2;
+}
+
+boolean EXFAT_Mount(EXFAT_Volume *vol, const BDEV_Device *dev)
+{
+    if (!vol || !dev || !dev->ops || !dev->ops->read) return false;
+    struct tag_FCACHE *cache = vol->fat_cache;
+    memset(vol, 0, sizeof(*vol));
+    if (cache) FSC_Invalidate(cache, FSC_INVALIDATEALL, 0);
+    else cache = FSC_Create(512, EXFAT_FAT_CACHE_SECTORS);
+    vol->fat_cache = cache;
+    vol->dev = dev;
+    vol->free_clusters = 0xFFFFFFFFu;
+    // LBA0 is either the exFAT boot sector or an MBR whose first exFAT (0x07) partition holds it
+    uint32_t vbr = 0;
+    if (!BDEV_Read(dev, 0, 1, g_xsec) || rd16(&g_xsec[510]) != 0xAA55) return false;
+    if (memcmp(&g_xsec[3], "EXFAT   ", 8)) {
+        int i;
+        for (i=0; i<4; ++i) if (g_xsec[0x1BE + i*16 + 4] == 0x07) break;
+        if (i == 4) return false;
+        vbr = rd32(&g_xsec[0x1BE + i*16 + 8]);
+        if (!BDEV_Read(dev, vbr, 1, g_xsec) || memcmp(&g_xsec[3], "EXFAT   ", 8)) return false;
+    }
+    if (g_xsec[108] != 9 || g_xsec[109] > 25) return false; // only 512 byte sectors supported
+    vol->fat_begin_lba = vbr + rd32(&g_xsec[80]);
+    vol->cluster_begin_lba = vbr + rd32(&g_xsec[88]);
+    vol->cluster_count = rd32(&g_xsec[92]);
+    vol->root_dir_first_cluster = rd32(&g_xsec[96]);
+    vol->sectors_per_cluster_shift = g_xsec[109];
+    return valid_cluster(vol, vol->root_dir_first_cluster);
+}
+
+void EXFAT_Unmount(EXFAT_Volume *vol)
+{
+    if (!vol) return;
+    FSC_Destroy(vol->fat_cache);
+    memset(vol, 0, sizeof(*vol));
+}
+
+static void dir_begin(exfat_dir *d, uint32_t first_cluster, uint32_t clusters)
+{
+    memset(d, 0, sizeof(*d));
+    d->cl = first_cluster;
+    d->clusters = clusters;
+}
+
+// Next 32-byte directory entry, NULL at the end of the chain or on a read error
+static const uint8_t *dir_next(EXFAT_Volume *vol, exfat_dir *d)
+{
+    if (d->off == 512) {
+        d->off = 0;
+        if (++d->sec == (1u << vol->sectors_per_cluster_shift)) {
+            d->sec = 0;
+            d->index++;
+            if (d->clusters) {
+                if (d->index >= d->clusters) return NULL;
+                d->cl++;
+            } else if (!fat_next(vol, d->cl, &d->cl)) return NULL;
+            if (!valid_cluster(vol, d->cl)) return NULL;
+        }
+    }
+    uint32_t lba = cluster_lba(vol, d->cl) + d->sec;
+    if (lba != d->loaded_lba) {
+        if (!BDEV_Read(vol->dev, lba, 1, g_xsec)) return NULL;
+        d->loaded_lba = lba;
+    }
+    const uint8_t *e = &g_xsec[d->off];
+    d->off += 32;
+    return e;
+}
+
+// Next in-use file entry set of the directory; false at the end of the directory
+static boolean dir_read_entry(EXFAT_Volume *vol, exfat_dir *d, exfat_entry *out)
+{
+    const uint8_t *e;
+    while ((e = dir_next(vol, d)) != NULL) {
+        uint8_t type = e[0];
+        if (type == EXFAT_ENTRY_EOD) return false;
+        if (type == EXFAT_ENTRY_BITMAP && !vol->bitmap_first_cluster) {
+            vol->bitmap_first_cluster = rd32(&e[20]);
+            continue;
+        }
+        if (type != EXFAT_ENTRY_FILE) continue; // deleted, label, up-case table, ...
+        uint8_t secondaries = e[1];
+        uint32_t n = 0;
+        memset(out, 0, sizeof(*out));
+        out->attr = rd16(&e[4]);
+        // Entry sets may cross sector and cluster boundaries; dir_next hides that
+        while (secondaries--) {
+            if ((e = dir_next(vol, d)) == NULL) return false;
+            if (e[0] == EXFAT_ENTRY_STREAM) {
+                out->flags = e[1];
+                out->name_len = e[3];
+                out->name_hash = rd16(&e[4]);
+                out->valid_bytes = rd64(&e[8]);
+                out->first_cluster = rd32(&e[20]);
+                out->size_bytes = rd64(&e[24]);
+            } else if (e[0] == EXFAT_ENTRY_NAME) {
+                for (int i=0; i<15 && n<out->name_len; ++i, ++n) {
+                    uint16_t c = rd16(&e[2 + i*2]);
+                    out->name[n] = (c < 0x80) ? (char)c : '?';
+                }
+            }
+        }
+        out->name[n] = '\0';
+        return true;
+    }
+    return false;
+}
+
+static char up_ascii(char c)
+{
+    return (c >= 'a' && c <= 'z') ? (char)(c - ('a' - 'A')) : c;
+}
+
+// exFAT NameHash over the up-cased UTF-16 name (ASCII names only)
+static uint16_t name_hash(const char *s, size_t len)
+{
+    uint16_t h = 0;
+    for (size_t i=0; i<len; ++i) {
+        uint8_t c = (uint8_t)up_ascii(s[i]);
+        h = (uint16_t)(((h & 1) ? 0x8000 : 0) + (h >> 1) + c);
+        h = (uint16_t)(((h & 1) ? 0x8000 : 0) + (h >> 1)); // high byte of the UTF-16 unit is 0
+    }
+    return h;
+}
+
+static uint32_t clusters_of(const EXFAT_Volume *vol, const exfat_entry *ent)
+{
+    uint64_t cb = 512ull << vol->sectors_per_cluster_shift;
+    return (uint32_t)((ent->size_bytes + cb - 1) / cb);
+}
+
+// Resolve 'path' to its entry set; the root directory itself is not an entry
+static boolean lookup(EXFAT_Volume *vol, const char *path, exfat_entry *ent)
+{
+    exfat_dir d;
+    dir_begin(&d, vol->root_dir_first_cluster, 0);
+    for (;;) {
+        while (*path == '/' || *path == '\\') path++;
+        const char *end = path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        size_t len = (size_t)(end - path);
+        if (!len || len > EXFAT_NAME_MAX) return false;
+        uint16_t h = name_hash(path, len);
+        boolean found = false;
+        while (!found && dir_read_entry(vol, &d, ent)) {
+            // Stored hash rules out almost every entry before the name is compared
+            if (ent->name_len != len || ent->name_hash != h) continue;
+            found = true;
+            for (size_t i=0; i<len && found; ++i)
+                if (up_ascii(ent->name[i]) != up_ascii(path[i])) found = false;
+        }
+        if (!found) return false;
+        path = end;
+        while (*path == '/' || *path == '\\') path++;
+        if (!*path) return true;
+        if (!(ent->attr & EXFAT_ATTR_DIR) || !valid_cluster(vol, ent->first_cluster)) return false;
+        dir_begin(&d, ent->first_cluster, (ent->flags & EXFAT_FLAG_NOFATCHAIN) ? clusters_of(vol, ent) : 0);
+    }
+}
+
+boolean EXFAT_Open(EXFAT_Volume *vol, const char *path, EXFAT_File *file)
+{
+    exfat_entry ent;
+    if (!vol || !file || !path || !vol->dev) return false;
+    memset(file, 0, sizeof(*file));
+    if (!lookup(vol, path, &ent) || (ent.attr & EXFAT_ATTR_DIR)) return false;
+    file->first_cluster = ent.first_cluster;
+    file->current_cluster = ent.first_cluster;
+    file->size_bytes = ent.size_bytes;
+    file->valid_bytes = (ent.valid_bytes < ent.size_bytes) ? ent.valid_bytes : ent.size_bytes;
+    file->attr = ent.attr;
+    file->no_fat_chain = (ent.flags & EXFAT_FLAG_NOFATCHAIN) ? 1 : 0;
+    return true;
+}
+
+// Cluster after 'cl' (file cluster index 'idx'); false at the end of the chain
+static boolean cluster_after(EXFAT_Volume *vol, const EXFAT_File *file, uint32_t cl, uint32_t idx, uint32_t *next)
+{
+    if (file->no_fat_chain) *next = file->first_cluster + idx + 1;
+    else if (!fat_next(vol, cl, next)) return false;
+    return valid_cluster(vol, *next);
+}
+
+// Position current_cluster on file cluster 'idx' (forward walk unless the file is contiguous)
+static boolean goto_cluster(EXFAT_Volume *vol, EXFAT_File *file, uint32_t idx)
+{
+    if (file->no_fat_chain) {
+        file->current_cluster = file->first_cluster + idx;
+        file->cluster_index = idx;
+        return valid_cluster(vol, file->current_cluster);
+    }
+    if (file->cluster_index > idx) {
+        file->current_cluster = file->first_cluster;
+        file->cluster_index = 0;
+    }
+    while (file->cluster_index < idx) {
+        uint32_t next;
+        if (!cluster_after(vol, file, file->current_cluster, file->cluster_index, &next)) return false;
+        file->current_cluster = next;
+        file->cluster_index++;
+    }
+    return true;
+}
+
+size_t EXFAT_Read(EXFAT_Volume *vol, EXFAT_File *file, void *buf, size_t bytes)
+{
+    if (!vol || !file || !buf) return 0;
+    if (file->file_pos >= file->size_bytes) return 0;
+    if (bytes > file->size_bytes - file->file_pos) bytes = (size_t)(file->size_bytes - file->file_pos);
+    uint8_t *out = (uint8_t*)buf;
+    uint32_t spc = 1u << vol->sectors_per_cluster_shift;
+    uint32_t cluster_shift = vol->sectors_per_cluster_shift + 9;
+    while (bytes) {
+        uint32_t copy;
+        if (file->file_pos >= file->valid_bytes) {
+            // Allocated but never written: defined to read as zeros, no I/O
+            memset(out, 0, bytes);
+            copy = (uint32_t)bytes;
+        } else {
+            uint32_t idx = (uint32_t)(file->file_pos >> cluster_shift);
+            if (file->cluster_index != idx && !goto_cluster(vol, file, idx)) break;
+            uint32_t sector_in_cluster = (uint32_t)(file->file_pos >> 9) & (spc - 1);
+            uint32_t within_sector = (uint32_t)file->file_pos & 511u;
+            uint32_t lba = cluster_lba(vol, file->current_cluster) + sector_in_cluster;
+            uint64_t readable = file->valid_bytes - file->file_pos;
+            if (readable > bytes) readable = bytes;
+            if (within_sector == 0 && readable >= 512u && ((uintptr_t)out & 3u) == 0) {
+                uint32_t want = (readable / 512u > 0xFFFFu) ? 0xFFFFu : (uint32_t)(readable / 512u);
+                uint32_t run = spc - sector_in_cluster;
+                if (run > want) run = want;
+                if (file->no_fat_chain) run = want; // contiguous by definition: pure LBA arithmetic
+                else {
+                    uint32_t cl = file->current_cluster, ci = file->cluster_index;
+                    while (run < want) {
+                        uint32_t next;
+                        if (!cluster_after(vol, file, cl, ci, &next) || next != cl + 1) break;
+                        cl = next; ci++;
+                        run += (want - run < spc) ? want - run : spc;
+                    }
+                }
+                if (!BDEV_Read(vol->dev, lba, run, out)) break;
+                // Leave current_cluster on the cluster holding the last sector read
+                if (!goto_cluster(vol, file, idx + (sector_in_cluster + run - 1) / spc)) break;
+                copy = run * 512u;
+            } else {
+                if (!BDEV_Read(vol->dev, lba, 1, g_xsec)) break;
+                copy = 512u - within_sector;
+                if (copy > readable) copy = (uint32_t)readable;
+                memcpy(out, &g_xsec[within_sector], copy);
+            }
+        }
+        out += copy;
+        file->file_pos += copy;
+        bytes -= copy;
+    }
+    return (size_t)(out - (uint8_t*)buf);
+}
+
+boolean EXFAT_Seek(EXFAT_Volume *vol, EXFAT_File *file, uint64_t pos)
+{
+    if (!vol || !file) return false;
+    if (pos > file->size_bytes) pos = file->size_bytes;
+    uint32_t cluster_shift = vol->sectors_per_cluster_shift + 9;
+    uint32_t idx = (uint32_t)(pos >> cluster_shift);
+    // At EOF on a cluster boundary stay on the last cluster (there is no next one)
+    if (idx && pos == file->size_bytes && (pos & ((1ull << cluster_shift) - 1)) == 0) idx--;
+    if (!valid_cluster(vol, file->first_cluster)) { file->file_pos = pos; return true; } // empty file
+    if (!goto_cluster(vol, file, idx)) return false;
+    file->file_pos = pos;
+    return true;
+}
+
+boolean EXFAT_ListDirectory(EXFAT_Volume *vol, const char *path, EXFAT_ListCallback cb, void *user)
+{
+    exfat_entry ent;
+    exfat_dir d;
+    if (!vol || !cb || !vol->dev) return false;
+    while (path && (*path == '/' || *path == '\\')) path++;
+    if (path && *path) {
+        if (!lookup(vol, path, &ent) || !(ent.attr & EXFAT_ATTR_DIR)) return false;
+        dir_begin(&d, ent.first_cluster, (ent.flags & EXFAT_FLAG_NOFATCHAIN) ? clusters_of(vol, &ent) : 0);
+    } else dir_begin(&d, vol->root_dir_first_cluster, 0);
+    while (dir_read_entry(vol, &d, &ent)) cb(ent.name, ent.attr, ent.size_bytes, user);
+    return true;
+}
+
+boolean EXFAT_GetFreeClusters(EXFAT_Volume *vol, uint32_t *free_clusters)
+{
+    if (!vol || !free_clusters || !vol->dev) return false;
+    if (vol->free_clusters != 0xFFFFFFFFu) { *free_clusters = vol->free_clusters; return true; }
+    if (!vol->bitmap_first_cluster) {
+        // The allocation bitmap entry lives in the root directory
+        exfat_entry ent;
+        exfat_dir d;
+        dir_begin(&d, vol->root_dir_first_cluster, 0);
+        while (!vol->bitmap_first_cluster && dir_read_entry(vol, &d, &ent)) {}
+        if (!valid_cluster(vol, vol->bitmap_first_cluster)) return false;
+    }
+    // One bit per cluster from cluster 2; count set bits sector by sector along the bitmap chain
+    uint32_t cl = vol->bitmap_first_cluster, used = 0, bits_left = vol->cluster_count;
+    uint32_t spc = 1u << vol->sectors_per_cluster_shift;
+    while (bits_left) {
+        for (uint32_t s=0; s<spc && bits_left; ++s) {
+            if (!BDEV_Read(vol->dev, cluster_lba(vol, cl) + s, 1, g_xsec)) return false;
+            for (uint32_t w=0; w<128 && bits_left; ++w) {
+                uint32_t v = rd32(&g_xsec[w*4]);
+                if (bits_left < 32) { v &= (1u << bits_left) - 1; bits_left = 0; }
+                else bits_left -= 32;
+                used += (uint32_t)__builtin_popcount(v);
+            }
+        }
+        if (bits_left && (!fat_next(vol, cl, &cl) || !valid_cluster(vol, cl))) return false;
+    }
+    vol->free_clusters = vol->cluster_count - used;
+    *free_clusters = vol->free_clusters;
+    return true;
+}
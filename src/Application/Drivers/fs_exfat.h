@@ -0,0 +1,60 @@
+#ifndef FS_EXFAT_H
+#define FS_EXFAT_H
+#include <stdint.h>
+#include <stddef.h>
+#include "systypes.h"
+#include "blockdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Read-only exFAT (512 byte sectors). Names are matched case-insensitively for ASCII;
+// listing shows non-ASCII UTF-16 characters as '?'.
+
+// Number of FAT sectors kept in the per-volume LRU (128 cluster entries each)
+#ifndef EXFAT_FAT_CACHE_SECTORS
+#define EXFAT_FAT_CACHE_SECTORS 8
+#endif
+
+#define EXFAT_NAME_MAX 255
+
+struct tag_FCACHE;
+
+typedef struct {
+    const BDEV_Device *dev;
+    uint32_t fat_begin_lba;
+    uint32_t cluster_begin_lba;
+    uint32_t cluster_count;
+    uint32_t root_dir_first_cluster;
+    uint8_t  sectors_per_cluster_shift;
+    uint32_t bitmap_first_cluster;  // allocation bitmap, 0 until the root entry was seen
+    uint32_t free_clusters;         // 0xFFFFFFFF until counted from the bitmap
+    struct tag_FCACHE *fat_cache;   // FAT sector LRU, created on first mount and kept across remounts
+} EXFAT_Volume;
+
+typedef struct {
+    uint32_t first_cluster;
+    uint64_t size_bytes;      // DataLength
+    uint64_t valid_bytes;     // ValidDataLength; bytes past it read as zero
+    uint32_t current_cluster;
+    uint32_t cluster_index;   // index of current_cluster within the file
+    uint64_t file_pos;
+    uint16_t attr;
+    uint8_t  no_fat_chain;    // contiguous allocation: cluster = first + index, FAT never read
+} EXFAT_File;
+
+typedef void (*EXFAT_ListCallback)(const char *name, uint16_t attr, uint64_t sizeBytes, void *user);
+
+boolean EXFAT_Mount(EXFAT_Volume *vol, const BDEV_Device *dev); // first exFAT partition or raw volume (vol zeroed or previously mounted)
+void    EXFAT_Unmount(EXFAT_Volume *vol);
+boolean EXFAT_Open(EXFAT_Volume *vol, const char *path, EXFAT_File *file); // "/DIR/Long Name.ext"
+size_t  EXFAT_Read(EXFAT_Volume *vol, EXFAT_File *file, void *buf, size_t bytes);
+boolean EXFAT_Seek(EXFAT_Volume *vol, EXFAT_File *file, uint64_t pos); // absolute seek, clamped to file size
+boolean EXFAT_ListDirectory(EXFAT_Volume *vol, const char *path, EXFAT_ListCallback cb, void *user); // "" or "/" = root
+boolean EXFAT_GetFreeClusters(EXFAT_Volume *vol, uint32_t *free_clusters); // counted once from the allocation bitmap
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,19 +1,45 @@
+#include "systemconfig.h"
 #include "fs_fat32.h"
 #include "sd_minimal.h"
 #include <string.h>
 
-// Minimal static buffer for one sector
-static uint8_t g_sec[512];
+// Volume-level sector buffer for boot/FSInfo/directory sectors and FAT misses (word aligned for the
+// MSDC FIFO reads); file data goes through each handle's own sector
+static uint8_t g_sec[512] __attribute__((aligned(4)));
 
 static uint16_t rd16(const uint8_t *p){ return (uint16_t)p[0] | ((uint16_t)p[1]<<8); }
 static uint32_t rd32(const uint8_t *p){ return (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24); }
+static void wr16(uint8_t *p, uint16_t v){ p[0]=(uint8_t)v; p[1]=(uint8_t)(v>>8); }
+static void wr32(uint8_t *p, uint32_t v){ p[0]=(uint8_t)v; p[1]=(uint8_t)(v>>8); p[2]=(uint8_t)(v>>16); p[3]=(uint8_t)(v>>24); }
+
+#define FAT32_EOC           0x0FFFFFFFu
+#define FSINFO_LEAD_SIG     0x41615252u
+#define FSINFO_STRUC_SIG    0x61417272u
+
+static boolean fat_writeback(void *ctx, uint32_t lba, void *data);
 
 boolean FAT32_Mount(FAT32_Volume *vol)
 {
-    if (!vol) return false;
+    return FAT32_MountDevice(vol, &SDM_BlockDevice);
+}
+
+boolean FAT32_MountDevice(FAT32_Volume *vol, const BDEV_Device *dev)
+{
+    uint32_t sector_size, sector_count;
+    if (!vol || !dev || !dev->ops || !dev->ops->read) return false;
+    if (dev->ops->geometry && (!dev->ops->geometry(dev->ctx, &sector_size, &sector_count) || sector_size != 512))
+        return false; // only 512 byte sectors supported
+    struct tag_FCACHE *cache = vol->fat_cache;
+    if (vol->free_bitmap) free(vol->free_bitmap);
     memset(vol,0,sizeof(*vol));
+    vol->dev = dev;
+    // Keep the cache allocation across remounts but drop sectors of the previous card
+    if (cache) FSC_Invalidate(cache, FSC_INVALIDATEALL, 0);
+    else cache = FSC_Create(512, FAT32_FAT_CACHE_SECTORS);
+    vol->fat_cache = cache;
+    FSC_SetWriteBack(cache, fat_writeback, vol);
     // Read LBA0 (could be MBR or VBR). Assume either FAT32 boot sector or MBR with first partition FAT32.
-    if (!SDM_ReadBlock(0, g_sec)) return false;
+    if (!BDEV_Read(vol->dev, 0, 1, g_sec)) return false;
     uint16_t sig = rd16(&g_sec[510]);
     if (sig != 0xAA55) {
         return false; // not a valid boot / mbr sector
@@ -28,7 +54,7 @@ boolean FAT32_Mount(FAT32_Volume *vol)
         // Treat sector 0 as boot sector directly
         bpb_lba = 0;
     }
-    if (!SDM_ReadBlock(bpb_lba, g_sec)) return false;
+    if (!BDEV_Read(vol->dev, bpb_lba, 1, g_sec)) return false;
     if (rd16(&g_sec[510]) != 0xAA55) return false;
     uint16_t bytes_per_sector = rd16(&g_sec[11]);
     uint8_t spc = g_sec[13];
@@ -39,11 +65,22 @@ boolean FAT32_Mount(FAT32_Volume *vol)
     uint32_t sectors_per_fat = rd16(&g_sec[22]);
     if (sectors_per_fat == 0) sectors_per_fat = rd32(&g_sec[36]);
     uint32_t root_cluster = rd32(&g_sec[44]);
+    uint16_t fsinfo_sec = rd16(&g_sec[48]);
     if (bytes_per_sector != 512 || spc == 0) return false; // only 512 supported now
     uint32_t fat_begin = bpb_lba + rsvd;
     uint32_t cluster_begin = fat_begin + fats * sectors_per_fat;
     uint32_t data_sectors = total_sectors - (rsvd + fats * sectors_per_fat);
     uint32_t total_clusters = data_sectors / spc;
+    if (total_clusters > sectors_per_fat * 128u - 2) total_clusters = sectors_per_fat * 128u - 2; // FAT must map every cluster
+    vol->free_count = 0xFFFFFFFFu;
+    vol->next_free = 0xFFFFFFFFu;
+    if (fsinfo_sec && fsinfo_sec != 0xFFFF && BDEV_Read(vol->dev, bpb_lba + fsinfo_sec, 1, g_sec) &&
+        rd32(&g_sec[0]) == FSINFO_LEAD_SIG && rd32(&g_sec[484]) == FSINFO_STRUC_SIG) {
+        vol->fsinfo_lba = bpb_lba + fsinfo_sec;
+        vol->free_count = rd32(&g_sec[488]);
+        vol->next_free = rd32(&g_sec[492]);
+        if (vol->free_count > total_clusters) vol->free_count = 0xFFFFFFFFu; // stale value
+    }
     vol->sectors_per_fat = sectors_per_fat;
     vol->fat_begin_lba = fat_begin;
     vol->cluster_begin_lba = cluster_begin;
@@ -53,14 +90,193 @@ boolean FAT32_Mount(FAT32_Volume *vol)
     vol->total_clusters = total_clusters;
     vol->bytes_per_sector = bytes_per_sector;
     vol->sectors_per_cluster = spc;
+    vol->num_fats = fats;
     return true;
 }
 
+void FAT32_Unmount(FAT32_Volume *vol)
+{
+    if (!vol) return;
+    FAT32_Sync(vol);
+    FSC_Destroy(vol->fat_cache);
+    if (vol->free_bitmap) free(vol->free_bitmap);
+    memset(vol,0,sizeof(*vol));
+}
+
 static uint32_t lba_of_cluster(const FAT32_Volume *vol, uint32_t clust)
 {
     return vol->cluster_begin_lba + (clust - 2) * vol->sectors_per_cluster;
 }
 
+// Return FAT sector contents from the volume cache, reading the card on a miss
+static const uint8_t *fat_sector(FAT32_Volume *vol, uint32_t lba)
+{
+    const uint8_t *p = vol->fat_cache ? FSC_GetDataBlock(vol->fat_cache, lba) : NULL;
+    if (p) { vol->fat_cache_hits++; return p; }
+    vol->fat_cache_misses++;
+    if (!BDEV_Read(vol->dev, lba, 1, g_sec)) return NULL;
+    if (vol->fat_cache) FSC_StoreDataBlock(vol->fat_cache, lba, g_sec);
+    return g_sec;
+}
+
+// Read the FAT entry for cluster 'cl' (next cluster in chain or >= 0x0FFFFFF8 for EOF)
+static boolean fat_next(FAT32_Volume *vol, uint32_t cl, uint32_t *next)
+{
+    const uint8_t *sec = fat_sector(vol, vol->fat_begin_lba + (cl * 4) / 512);
+    if (!sec) return false;
+    *next = rd32(&sec[(cl * 4) % 512]) & 0x0FFFFFFF;
+    return true;
+}
+
+// FAT cache write-back: every FAT copy gets the sector
+static boolean fat_writeback(void *ctx, uint32_t lba, void *data)
+{
+    FAT32_Volume *vol = (FAT32_Volume*)ctx;
+    for (uint8_t i=0; i<vol->num_fats; ++i)
+        if (!BDEV_Write(vol->dev, lba + i * vol->sectors_per_fat, 1, data)) return false;
+    return true;
+}
+
+// Update the FAT entry for cluster 'cl' in the cached sector (upper 4 reserved bits are kept)
+static boolean fat_set(FAT32_Volume *vol, uint32_t cl, uint32_t val)
+{
+    uint32_t lba = vol->fat_begin_lba + (cl * 4) / 512;
+    if (!vol->fat_cache || !fat_sector(vol, lba)) return false;
+    uint8_t *sec = FSC_GetDataBlock(vol->fat_cache, lba);
+    if (!sec) return false;
+    uint8_t *e = &sec[(cl * 4) % 512];
+    wr32(e, (rd32(e) & 0xF0000000u) | (val & 0x0FFFFFFFu));
+    return FSC_MarkDirty(vol->fat_cache, lba);
+}
+
+static void bitmap_mark(FAT32_Volume *vol, uint32_t cl, boolean used)
+{
+    if (!vol->free_bitmap) return;
+    if (used) vol->free_bitmap[cl >> 5] |= 1u << (cl & 31);
+    else vol->free_bitmap[cl >> 5] &= ~(1u << (cl & 31));
+}
+
+// Build the free-cluster bitmap from the on-disk FAT; also yields an exact free count
+static void build_free_bitmap(FAT32_Volume *vol)
+{
+    if (vol->free_bitmap || vol->free_bitmap_tried) return;
+    vol->free_bitmap_tried = 1;
+    uint32_t end = vol->total_clusters + 2;
+    uint32_t words = (end + 31) / 32;
+    if (words * 4u > FAT32_FREE_BITMAP_MAX) return;
+    // Pending FAT updates must be on the card before it is scanned
+    if (vol->fat_cache && !FSC_Flush(vol->fat_cache)) return;
+    uint32_t *bm = malloc(words * 4u);
+    uint8_t *chunk = malloc(8 * 512);
+    if (!bm || !chunk) {
+        if (bm) free(bm);
+        if (chunk) free(chunk);
+        return;
+    }
+    memset(bm, 0xFF, words * 4u); // clusters 0/1 and the tail past 'end' stay marked used
+    uint32_t free_count = 0, cl = 0;
+    uint32_t sectors = (end * 4 + 511) / 512;
+    for (uint32_t s=0; s<sectors; s+=8) {
+        uint32_t n = (sectors - s < 8) ? sectors - s : 8;
+        if (!BDEV_Read(vol->dev, vol->fat_begin_lba + s, n, chunk)) { free(bm); free(chunk); return; }
+        for (uint32_t i=0; i<n*128 && cl<end; ++i, ++cl) {
+            if (cl >= 2 && (rd32(&chunk[i*4]) & 0x0FFFFFFFu) == 0) {
+                bm[cl >> 5] &= ~(1u << (cl & 31));
+                free_count++;
+            }
+        }
+    }
+    free(chunk);
+    vol->free_bitmap = bm;
+    if (vol->free_count != free_count) { vol->free_count = free_count; vol->fsinfo_dirty = 1; }
+}
+
+static boolean cluster_is_free(FAT32_Volume *vol, uint32_t cl, boolean *is_free)
+{
+    uint32_t v;
+    if (vol->free_bitmap) { *is_free = !(vol->free_bitmap[cl >> 5] & (1u << (cl & 31))); return true; }
+    if (!fat_next(vol, cl, &v)) return false;
+    *is_free = (v == 0);
+    return true;
+}
+
+// Next-fit search from 'hint' for a run of up to 'want' free clusters. The first run that
+// is long enough wins; otherwise the longest one seen. Returns 0 when the volume is full.
+static uint32_t find_free_run(FAT32_Volume *vol, uint32_t hint, uint32_t want, uint32_t *got)
+{
+    uint32_t end = vol->total_clusters + 2;
+    uint32_t best = 0, best_len = 0, scanned = 0;
+    uint32_t cl = (hint >= 2 && hint < end) ? hint : 2;
+    *got = 0;
+    while (scanned < end - 2) {
+        boolean f;
+        if (vol->free_bitmap && (cl & 31) == 0 && cl + 32 <= end && vol->free_bitmap[cl >> 5] == 0xFFFFFFFFu) {
+            cl += 32; scanned += 32; // whole word in use
+        } else {
+            if (!cluster_is_free(vol, cl, &f)) return 0;
+            if (f) {
+                uint32_t start = cl, len = 0;
+                while (f && len < want && cl < end) {
+                    len++; cl++;
+                    if (cl < end && !cluster_is_free(vol, cl, &f)) return 0;
+                }
+                scanned += len;
+                if (len >= want) { *got = len; return start; }
+                if (len > best_len) { best = start; best_len = len; }
+            } else {
+                cl++; scanned++;
+            }
+        }
+        if (cl >= end) cl = 2;
+    }
+    *got = best_len;
+    return best;
+}
+
+// Allocate one physical run of up to 'want' clusters, chained after 'tail' (0 = new chain).
+// Growing in place is preferred; otherwise the run starts in a free area of at least
+// FAT32_ALLOC_MIN_RUN clusters at the next-free hint, which then moves past that area so
+// files appended in turn do not take each other's next cluster.
+static boolean alloc_run(FAT32_Volume *vol, uint32_t tail, uint32_t want, uint32_t *first, uint32_t *got)
+{
+    uint32_t len = 0, start = 0, area = 0;
+    boolean f;
+    build_free_bitmap(vol);
+    if (tail && tail + 1 < vol->total_clusters + 2 && cluster_is_free(vol, tail + 1, &f) && f)
+        start = find_free_run(vol, tail + 1, want, &len);
+    if (!len) {
+        start = find_free_run(vol, vol->next_free, (want > FAT32_ALLOC_MIN_RUN) ? want : FAT32_ALLOC_MIN_RUN, &len);
+        area = len;
+        if (len > want) len = want;
+    }
+    if (!start || !len) return false;
+    for (uint32_t i=0; i<len; ++i) {
+        if (!fat_set(vol, start + i, (i + 1 < len) ? start + i + 1 : FAT32_EOC)) return false;
+        bitmap_mark(vol, start + i, true);
+    }
+    if (tail && !fat_set(vol, tail, start)) return false;
+    if (area) vol->next_free = start + area;
+    else if (start + len > vol->next_free) vol->next_free = start + len;
+    if (vol->free_count != 0xFFFFFFFFu) vol->free_count -= len;
+    vol->fsinfo_dirty = 1;
+    *first = start;
+    *got = len;
+    return true;
+}
+
+static boolean free_chain(FAT32_Volume *vol, uint32_t cl)
+{
+    while (cl >= 2 && cl < 0x0FFFFFF8) {
+        uint32_t next;
+        if (!fat_next(vol, cl, &next) || !fat_set(vol, cl, 0)) return false;
+        bitmap_mark(vol, cl, false);
+        if (vol->free_count != 0xFFFFFFFFu) vol->free_count++;
+        vol->fsinfo_dirty = 1;
+        cl = next;
+    }
+    return true;
+}
+
 static void format_name83(const uint8_t *dirent, char *out)
 {
     char name[12]; memcpy(name, dirent, 11); name[11]='\0';
@@ -76,7 +292,7 @@ boolean FAT32_ListDirectory(FAT32_Volume *vol, uint32_t startCluster, FAT32_List
     uint32_t cl = startCluster;
     while (cl >= 2 && cl < 0x0FFFFFF8) {
         for (uint8_t s=0; s<vol->sectors_per_cluster; ++s) {
-            if (!SDM_ReadBlock(lba_of_cluster(vol, cl) + s, g_sec)) return false;
+            if (!BDEV_Read(vol->dev, lba_of_cluster(vol, cl) + s, 1, g_sec)) return false;
             for (int off=0; off<512; off+=32) {
                 uint8_t first = g_sec[off];
                 if (first == 0x00) return true; // end of directory
@@ -93,10 +309,7 @@ boolean FAT32_ListDirectory(FAT32_Volume *vol, uint32_t startCluster, FAT32_List
             }
         }
         // follow FAT
-        uint32_t fat_sector = vol->fat_begin_lba + (cl * 4) / 512;
-        if (!SDM_ReadBlock(fat_sector, g_sec)) return false;
-        uint32_t entry = rd32(&g_sec[(cl * 4) % 512]) & 0x0FFFFFFF;
-        cl = entry;
+        if (!fat_next(vol, cl, &cl)) return false;
     }
     return true;
 }
@@ -106,101 +319,801 @@ boolean FAT32_ListRoot(FAT32_Volume *vol, FAT32_ListCallback cb, void *user)
     return FAT32_ListDirectory(vol, vol->root_dir_first_cluster, cb, user);
 }
 
-// Very simple 8.3 upper-case matcher
-static boolean match_name83(const uint8_t *dirent, const char *name83)
+// Convert one path component to the raw space padded 8.3 form used in directory entries
+static boolean name_to_raw83(const char *s, size_t len, uint8_t raw[11])
 {
-    char temp[12];
-    memcpy(temp, dirent, 11); temp[11] = '\0';
-    for (int i=0;i<11;i++) if (temp[i]==' ') temp[i]='\0';
-    // Build NAME[.EXT]
-    char fmt[14];
-    int n=0; for(int i=0;i<8 && temp[i];++i) fmt[n++]=temp[i];
-    if (temp[8]) { fmt[n++]='.'; for(int i=8;i<11 && temp[i];++i) fmt[n++]=temp[i]; }
-    fmt[n]='\0';
-    return strcmp(fmt, name83)==0;
+    memset(raw, ' ', 11);
+    if (len == 1 && s[0] == '.') { raw[0] = '.'; return true; }
+    if (len == 2 && s[0] == '.' && s[1] == '.') { raw[0] = raw[1] = '.'; return true; }
+    size_t n = 0, limit = 8;
+    for (size_t i=0; i<len; ++i) {
+        char c = s[i];
+        if (c == '.') {
+            if (limit == 3 || n == 0) return false; // second dot or empty base name
+            n = 8; limit = 11;
+            continue;
+        }
+        if (n >= limit) return false; // component longer than 8.3
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        raw[n++] = (uint8_t)c;
+    }
+    return raw[0] != ' ';
 }
 
-boolean FAT32_Open(FAT32_Volume *vol, const char *name83, FAT32_File *file)
+static uint32_t dentry_hash(uint32_t parent, const uint8_t raw[11])
 {
-    if (!vol || !file) return false;
-    memset(file,0,sizeof(*file));
-    uint32_t cl = vol->root_dir_first_cluster;
-    // Iterate clusters in root (no subdirs yet)
+    uint32_t h = 2166136261u ^ parent; // FNV-1a
+    for (int i=0; i<11; ++i) h = (h ^ raw[i]) * 16777619u;
+    return h;
+}
+
+// Find 'raw' in directory 'dir': dentry cache first, then a scan of the directory chain
+static boolean dir_lookup(FAT32_Volume *vol, uint32_t dir, const uint8_t raw[11], FAT32_Dentry *out)
+{
+    uint32_t h = dentry_hash(dir, raw);
+    FAT32_Dentry *slot = &vol->dentry_cache[h & (FAT32_DENTRY_CACHE_SIZE - 1)];
+    if (slot->parent_cluster == dir && slot->hash == h && !memcmp(slot->name, raw, 11)) {
+        vol->dentry_hits++;
+        *out = *slot;
+        return true;
+    }
+    vol->dentry_misses++;
+    uint32_t cl = dir;
     while (cl >= 2 && cl < 0x0FFFFFF8) {
         for (uint8_t s=0; s<vol->sectors_per_cluster; ++s) {
-            if (!SDM_ReadBlock(lba_of_cluster(vol, cl) + s, g_sec)) return false;
+            if (!BDEV_Read(vol->dev, lba_of_cluster(vol, cl) + s, 1, g_sec)) return false;
             for (int off=0; off<512; off+=32) {
                 uint8_t first = g_sec[off];
                 if (first == 0x00) return false; // end
                 if (first == 0xE5) continue; // deleted
-                if (g_sec[off + 11] & 0x08) continue; // volume label
-                if (g_sec[off + 11] & 0x10) continue; // skip subdirs for now
-                if (match_name83(&g_sec[off], name83)) {
-                    uint16_t cl_lo = rd16(&g_sec[off + 26]);
-                    uint16_t cl_hi = rd16(&g_sec[off + 20]);
-                    file->first_cluster = ((uint32_t)cl_hi << 16) | cl_lo;
-                    file->current_cluster = file->first_cluster;
-                    file->size_bytes = rd32(&g_sec[off + 28]);
-                    file->file_pos = 0;
-                    return true;
-                }
+                if (g_sec[off + 11] & 0x08) continue; // volume label / LFN
+                if (memcmp(&g_sec[off], raw, 11)) continue;
+                out->parent_cluster = dir;
+                out->hash = h;
+                out->first_cluster = ((uint32_t)rd16(&g_sec[off + 20]) << 16) | rd16(&g_sec[off + 26]);
+                out->size_bytes = rd32(&g_sec[off + 28]);
+                out->entry_lba = lba_of_cluster(vol, cl) + s;
+                out->entry_off = (uint16_t)off;
+                memcpy(out->name, raw, 11);
+                out->attr = g_sec[off + 11];
+                *slot = *out;
+                return true;
             }
         }
         // Follow FAT chain
-        uint32_t fat_sector = vol->fat_begin_lba + (cl * 4) / 512;
-        if (!SDM_ReadBlock(fat_sector, g_sec)) return false;
-        uint32_t entry = rd32(&g_sec[(cl * 4) % 512]) & 0x0FFFFFFF;
-        cl = entry;
+        if (!fat_next(vol, cl, &cl)) return false;
     }
     return false;
 }
 
+// Walk 'path' up to its last component: *dir receives the parent directory, raw the last name
+static boolean resolve_parent(FAT32_Volume *vol, const char *path, uint32_t *dir, uint8_t raw[11])
+{
+    uint32_t d = vol->root_dir_first_cluster;
+    for (;;) {
+        while (*path == '/' || *path == '\\') path++;
+        const char *end = path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        if (end == path) return false; // empty path or trailing separator
+        if (!name_to_raw83(path, (size_t)(end - path), raw)) return false;
+        path = end;
+        while (*path == '/' || *path == '\\') path++;
+        if (!*path) { *dir = d; return true; }
+        FAT32_Dentry de;
+        if (!dir_lookup(vol, d, raw, &de)) return false;
+        if (!(de.attr & 0x10)) return false; // not a directory
+        d = de.first_cluster ? de.first_cluster : vol->root_dir_first_cluster; // ".." to root is 0
+    }
+}
+
+static void dir_begin(FAT32_Dir *dir, FAT32_Volume *vol, uint32_t first_cluster)
+{
+    memset(dir, 0, offsetof(FAT32_Dir, sec_buf));
+    dir->vol = vol;
+    dir->first_cluster = first_cluster;
+    dir->pos.cluster = first_cluster;
+}
+
+boolean FAT32_OpenDir(FAT32_Volume *vol, const char *path, FAT32_Dir *dir)
+{
+    if (!vol || !dir) return false;
+    uint32_t cl = vol->root_dir_first_cluster;
+    while (path && (*path == '/' || *path == '\\')) path++;
+    if (path && *path) {
+        uint32_t parent;
+        uint8_t raw[11];
+        FAT32_Dentry de;
+        if (!resolve_parent(vol, path, &parent, raw) || !dir_lookup(vol, parent, raw, &de)) return false;
+        if (!(de.attr & 0x10)) return false;
+        if (de.first_cluster) cl = de.first_cluster; // ".." to root is 0
+    }
+    dir_begin(dir, vol, cl);
+    return true;
+}
+
+FAT32_DirPos FAT32_TellDir(const FAT32_Dir *dir)
+{
+    return dir->pos;
+}
+
+void FAT32_SeekDir(FAT32_Dir *dir, const FAT32_DirPos *pos)
+{
+    dir->pos = *pos;
+    dir->error = 0;
+}
+
+void FAT32_RewindDir(FAT32_Dir *dir)
+{
+    dir_begin(dir, dir->vol, dir->first_cluster);
+}
+
+// Slot at dir->pos in the handle's sector; NULL at the end of the chain or on error
+static const uint8_t *dir_slot(FAT32_Dir *dir)
+{
+    FAT32_Volume *vol = dir->vol;
+    if (dir->pos.cluster < 2 || dir->pos.cluster >= 0x0FFFFFF8) return NULL;
+    uint32_t lba = lba_of_cluster(vol, dir->pos.cluster) + dir->pos.sector;
+    if (dir->sec_lba != lba) {
+        dir->sec_lba = 0;
+        if (!BDEV_Read(vol->dev, lba, 1, (uint8_t*)dir->sec_buf)) { dir->error = 1; return NULL; }
+        dir->sec_lba = lba;
+    }
+    return (const uint8_t*)dir->sec_buf + dir->pos.offset;
+}
+
+// Step dir->pos to the next slot; the FAT is consulted only when leaving a cluster
+static void dir_advance(FAT32_Dir *dir)
+{
+    dir->pos.offset += 32;
+    if (dir->pos.offset < 512) return;
+    dir->pos.offset = 0;
+    if (++dir->pos.sector < dir->vol->sectors_per_cluster) return;
+    dir->pos.sector = 0;
+    if (!fat_next(dir->vol, dir->pos.cluster, &dir->pos.cluster)) { dir->error = 1; dir->pos.cluster = 0; }
+}
+
+#define LFN_COMPLETE 0xFF // every LFN slot seen, the short entry is next
+
+static uint8_t lfn_checksum(const uint8_t *raw)
+{
+    uint8_t sum = 0;
+    for (int i=0; i<11; ++i) sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + raw[i]);
+    return sum;
+}
+
+boolean FAT32_ReadDir(FAT32_Dir *dir, FAT32_DirEntry *entry)
+{
+    if (!dir || !entry || !dir->vol || dir->error) return false;
+    static const uint8_t lfn_off[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    uint8_t lfn_next = 0;     // sequence number expected next, 0 = no LFN run in progress
+    uint8_t lfn_sum = 0;
+    uint16_t lfn_len = 0;
+    const uint8_t *e;
+    while ((e = dir_slot(dir)) != NULL) {
+        FAT32_DirPos here = dir->pos;
+        uint8_t first = e[0];
+        uint8_t attr = e[11];
+        if (first == 0x00) { dir->pos.cluster = 0; return false; } // end of directory; stays at the end
+        dir_advance(dir);
+        if (first == 0xE5) { lfn_next = 0; continue; }
+        if (attr == 0x0F) {
+            uint8_t ord = first & 0x1F;
+            if (first & 0x40) {
+                // Last LFN slot comes first on disk; it starts a new run
+                if (!ord || ord * 13 > FAT32_LFN_MAX + 13) { lfn_next = 0; continue; }
+                entry->pos = here;
+                lfn_sum = e[13];
+                lfn_len = 0;
+                lfn_next = ord;
+                memset(entry->name, 0, sizeof(entry->name));
+            } else if (!lfn_next || ord != lfn_next || e[13] != lfn_sum) { lfn_next = 0; continue; }
+            for (int i=0; i<13; ++i) {
+                uint16_t c = rd16(&e[lfn_off[i]]);
+                uint16_t at = (uint16_t)((ord - 1) * 13 + i);
+                if (c == 0x0000 || c == 0xFFFF || at >= FAT32_LFN_MAX) break;
+                entry->name[at] = (c < 0x80) ? (char)c : '?';
+                if (at + 1 > lfn_len) lfn_len = (uint16_t)(at + 1);
+            }
+            lfn_next = (ord == 1) ? LFN_COMPLETE : (uint8_t)(ord - 1);
+            continue;
+        }
+        if (attr & 0x08) { lfn_next = 0; continue; } // volume label
+        format_name83(e, entry->name83);
+        entry->attr = attr;
+        entry->first_cluster = ((uint32_t)rd16(&e[20]) << 16) | rd16(&e[26]);
+        entry->size_bytes = rd32(&e[28]);
+        if (lfn_next == LFN_COMPLETE && lfn_sum == lfn_checksum(e) && lfn_len) entry->name[lfn_len] = '\0';
+        else {
+            // No (intact) long name: the short one is the name
+            entry->pos = here;
+            strcpy(entry->name, entry->name83);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void file_from_dentry(FAT32_File *file, const FAT32_Dentry *de)
+{
+    memset(file,0,sizeof(*file));
+    file->first_cluster = de->first_cluster;
+    file->current_cluster = file->first_cluster;
+    file->size_bytes = de->size_bytes;
+    file->dir_lba = de->entry_lba;
+    file->dir_off = de->entry_off;
+}
+
+boolean FAT32_Open(FAT32_Volume *vol, const char *path, FAT32_File *file)
+{
+    if (!vol || !file || !path) return false;
+    memset(file,0,sizeof(*file));
+    uint32_t dir;
+    uint8_t raw[11];
+    FAT32_Dentry de;
+    if (!resolve_parent(vol, path, &dir, raw) || !dir_lookup(vol, dir, raw, &de)) return false;
+    if (de.attr & 0x10) return false; // directories are not opened as files
+    file_from_dentry(file, &de);
+    return true;
+}
+
+// Walk the chain once and record contiguous cluster runs into file->extents
+static boolean build_extent_map(FAT32_Volume *vol, FAT32_File *file)
+{
+    uint32_t cl = file->first_cluster;
+    uint32_t idx = 0;
+    FAT32_Extent *run = NULL;
+    file->extent_count = 0;
+    while (cl >= 2 && cl < 0x0FFFFFF8) {
+        if (run && cl == run->start_cluster + run->length) {
+            run->length++;
+        } else {
+            if (file->extent_count == file->extent_max) return true; // partial map, rest walked on demand
+            run = &file->extents[file->extent_count++];
+            run->start_cluster = cl;
+            run->file_cluster = idx;
+            run->length = 1;
+        }
+        if (!fat_next(vol, cl, &cl)) return false;
+        idx++;
+    }
+    return true;
+}
+
+// Binary search the run map; returns cluster number for file cluster 'idx' or 0 if not mapped
+static uint32_t extent_lookup(const FAT32_File *file, uint32_t idx)
+{
+    uint32_t lo = 0, hi = file->extent_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        const FAT32_Extent *e = &file->extents[mid];
+        if (idx < e->file_cluster) hi = mid;
+        else if (idx >= e->file_cluster + e->length) lo = mid + 1;
+        else return e->start_cluster + (idx - e->file_cluster);
+    }
+    return 0;
+}
+
+boolean FAT32_OpenMapped(FAT32_Volume *vol, const char *path, FAT32_File *file, FAT32_Extent *extents, uint16_t max_extents)
+{
+    if (!FAT32_Open(vol, path, file)) return false;
+    if (!extents || !max_extents) return true;
+    file->extents = extents;
+    file->extent_max = max_extents;
+    if (!build_extent_map(vol, file)) {
+        file->extents = NULL;
+        file->extent_count = file->extent_max = 0;
+        return false;
+    }
+    return true;
+}
+
+// Cluster following 'cl' (file cluster index 'idx'): run map first, FAT otherwise. False at EOF.
+static boolean cluster_after(FAT32_Volume *vol, const FAT32_File *file, uint32_t cl, uint32_t idx, uint32_t *next)
+{
+    uint32_t entry = file->extents ? extent_lookup(file, idx + 1) : 0;
+    if (!entry) {
+        if (!fat_next(vol, cl, &entry)) return false;
+        if (entry < 2 || entry >= 0x0FFFFFF8) return false; // EOF
+    }
+    *next = entry;
+    return true;
+}
+
 static boolean advance_cluster(FAT32_Volume *vol, FAT32_File *file)
 {
-    uint32_t cl = file->current_cluster;
-    uint32_t fat_sector = vol->fat_begin_lba + (cl * 4) / 512;
-    if (!SDM_ReadBlock(fat_sector, g_sec)) return false;
-    uint32_t entry = rd32(&g_sec[(cl * 4) % 512]) & 0x0FFFFFFF;
-    if (entry >= 0x0FFFFFF8) return false; // EOF
+    uint32_t entry;
+    if (!cluster_after(vol, file, file->current_cluster, file->cluster_index, &entry)) return false;
     file->current_cluster = entry;
+    file->cluster_index++;
     return true;
 }
 
+// Sectors from 'sector_in_cluster' of the current cluster onwards that are physically contiguous,
+// at most 'want'; *last_cl / *last_idx receive the final cluster of the run
+static uint32_t contiguous_run(FAT32_Volume *vol, const FAT32_File *file, uint32_t sector_in_cluster, uint32_t want,
+                               uint32_t *last_cl, uint32_t *last_idx)
+{
+    uint32_t run = vol->sectors_per_cluster - sector_in_cluster;
+    *last_cl = file->current_cluster;
+    *last_idx = file->cluster_index;
+    if (run > want) run = want;
+    while (run < want) {
+        uint32_t next;
+        if (!cluster_after(vol, file, *last_cl, *last_idx, &next) || next != *last_cl + 1) break;
+        *last_cl = next; (*last_idx)++;
+        run += (want - run < vol->sectors_per_cluster) ? want - run : vol->sectors_per_cluster;
+    }
+    return run;
+}
+
+// Sector 'lba' in the handle's buffer, read from the card unless already held. With load == false
+// the sector is about to be written past the end of data and starts out zeroed instead.
+static uint8_t *file_sector(FAT32_Volume *vol, FAT32_File *file, uint32_t lba, boolean load)
+{
+    uint8_t *p = (uint8_t*)file->sec_buf;
+    if (load && file->sec_lba == lba) return p;
+    file->sec_lba = 0;
+    if (!load) memset(p, 0, 512);
+    else if (!BDEV_Read(vol->dev, lba, 1, p)) return NULL;
+    file->sec_lba = lba;
+    return p;
+}
+
 size_t FAT32_Read(FAT32_Volume *vol, FAT32_File *file, void *buf, size_t bytes)
 {
     if (!vol || !file || !buf) return 0;
     if (file->file_pos >= file->size_bytes) return 0;
     if (bytes > file->size_bytes - file->file_pos) bytes = file->size_bytes - file->file_pos;
     uint8_t *out = (uint8_t*)buf;
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
     while (bytes) {
-        uint32_t cluster_offset = file->file_pos % (vol->sectors_per_cluster * 512u);
-        uint32_t sector_in_cluster = cluster_offset / 512u;
-        uint32_t lba = lba_of_cluster(vol, file->current_cluster) + sector_in_cluster;
-        if (!SDM_ReadBlock(lba, g_sec)) break;
+        // Clusters are advanced lazily so a read ending on a cluster boundary costs no FAT lookup
+        if (file->cluster_index < file->file_pos / cluster_bytes && !advance_cluster(vol, file)) break;
+        uint32_t sector_in_cluster = (file->file_pos % cluster_bytes) / 512u;
         uint32_t within_sector = file->file_pos % 512u;
-        uint32_t copy = 512u - within_sector;
-        if (copy > bytes) copy = (uint32_t)bytes;
-        memcpy(out, &g_sec[within_sector], copy);
+        uint32_t lba = lba_of_cluster(vol, file->current_cluster) + sector_in_cluster;
+        uint32_t copy;
+        if (within_sector == 0 && bytes >= 512u && ((uintptr_t)out & 3u) == 0) {
+            // Whole sectors go straight into the caller's buffer, one multi-block
+            // transfer per physically contiguous run of clusters
+            uint32_t last_cl, last_idx;
+            uint32_t run = contiguous_run(vol, file, sector_in_cluster, (uint32_t)(bytes / 512u), &last_cl, &last_idx);
+            if (!BDEV_Read(vol->dev, lba, run, out)) break;
+            file->current_cluster = last_cl;
+            file->cluster_index = last_idx;
+            copy = run * 512u;
+        } else {
+            // Unaligned head/tail bytes (or unaligned destination) go through the handle's sector,
+            // so small sequential reads touch the card once per sector
+            const uint8_t *sec = file_sector(vol, file, lba, true);
+            if (!sec) break;
+            copy = 512u - within_sector;
+            if (copy > bytes) copy = (uint32_t)bytes;
+            memcpy(out, &sec[within_sector], copy);
+        }
         out += copy;
         file->file_pos += copy;
         bytes -= copy;
-        // Advance sector / cluster as needed
-        within_sector += copy;
-        if (within_sector == 512u) {
-            sector_in_cluster++;
-            if (sector_in_cluster == vol->sectors_per_cluster) {
-                if (!advance_cluster(vol, file)) break;
+    }
+    return (size_t)(out - (uint8_t*)buf);
+}
+
+boolean FAT32_Seek(FAT32_Volume *vol, FAT32_File *file, uint32_t pos)
+{
+    if (!vol || !file) return false;
+    if (pos > file->size_bytes) pos = file->size_bytes;
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    uint32_t idx = pos / cluster_bytes;
+    // At EOF on a cluster boundary stay on the last cluster (there is no next one)
+    if (idx && pos == file->size_bytes && (pos % cluster_bytes) == 0) idx--;
+    if (file->first_cluster < 2) { file->file_pos = pos; return true; } // empty file
+
+    uint32_t cl = file->extents ? extent_lookup(file, idx) : 0;
+    uint32_t cl_idx = idx;
+    if (!cl) {
+        // Not mapped: walk forward from the closest known cluster at or before idx
+        if (file->cluster_index <= idx) {
+            cl = file->current_cluster; cl_idx = file->cluster_index;
+        } else {
+            cl = file->first_cluster; cl_idx = 0;
+        }
+        if (file->extent_count) {
+            const FAT32_Extent *last = &file->extents[file->extent_count - 1];
+            uint32_t last_idx = last->file_cluster + last->length - 1;
+            if (last_idx <= idx && last_idx > cl_idx) {
+                cl = last->start_cluster + last->length - 1; cl_idx = last_idx;
             }
         }
+        while (cl_idx < idx) {
+            uint32_t next;
+            if (!fat_next(vol, cl, &next)) return false;
+            if (next < 2 || next >= 0x0FFFFFF8) return false; // chain shorter than size says
+            cl = next; cl_idx++;
+        }
     }
-    return (size_t)(out - (uint8_t*)buf);
+    file->current_cluster = cl;
+    file->cluster_index = idx;
+    file->file_pos = pos;
+    return true;
+}
+
+#define STREAM_IDLE 0xFF
+
+static void stream_fill(FAT32_Stream *s);
+
+static void stream_done(BDEV_Request *req, boolean ok)
+{
+    FAT32_Stream *s = (FAT32_Stream*)req->user;
+    uint8_t slot = s->loading;
+    s->loading = STREAM_IDLE;
+    if (!ok && !s->closing && s->retries < BDEV_ASYNC_RETRIES) {
+        // The backend may have stepped its link down (SD CRC back-off): same sectors again
+        s->retries++;
+        s->retry = slot;
+    } else {
+        s->slot_state[slot] = ok ? FAT32_SLOT_READY : FAT32_SLOT_ERROR;
+        s->retries = 0;
+    }
+    if (!s->closing && s->slot_state[slot] != FAT32_SLOT_ERROR) stream_fill(s); // keep the card busy while the consumer works
+}
+
+// Issue s->req for 'slot'; false if it failed for good
+static boolean stream_start(FAT32_Stream *s, uint8_t slot)
+{
+    const BDEV_Device *dev = s->vol->dev;
+    s->loading = slot;
+    if (BDEV_CanReadAsync(dev) && dev->ops->read_async(dev->ctx, &s->req)) return true;
+    // No asynchronous path (or the transfer failed to start): fall back to a blocking read,
+    // which does its own retries
+    s->loading = STREAM_IDLE;
+    s->retries = 0;
+    s->slot_state[slot] = BDEV_Read(dev, s->req.lba, s->req.count, s->req.buf) ? FAT32_SLOT_READY : FAT32_SLOT_ERROR;
+    return s->slot_state[slot] == FAT32_SLOT_READY;
+}
+
+// Start loading free slots in ring order; one transfer at a time, chained from stream_done
+static void stream_fill(FAT32_Stream *s)
+{
+    FAT32_Volume *vol = s->vol;
+    FAT32_File *f = s->file;
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    if (s->retry != STREAM_IDLE) {
+        // s->req still describes the failed transfer; it goes first, slots fill in ring order
+        uint8_t slot = s->retry;
+        if (s->loading != STREAM_IDLE || BDEV_Busy(vol->dev)) return;
+        s->retry = STREAM_IDLE;
+        if (!stream_start(s, slot)) return;
+    }
+    while (s->loading == STREAM_IDLE && s->slot_state[s->fill] == FAT32_SLOT_EMPTY) {
+        if (f->file_pos >= f->size_bytes || BDEV_Busy(vol->dev)) return; // all prefetched / device owned by someone else
+        if (f->cluster_index < f->file_pos / cluster_bytes && !advance_cluster(vol, f)) {
+            s->slot_state[s->fill] = FAT32_SLOT_ERROR; // chain shorter than the size says
+            return;
+        }
+        uint32_t sector_in_cluster = (f->file_pos % cluster_bytes) / 512u;
+        uint32_t left = f->size_bytes - f->file_pos;
+        uint32_t want = (left + 511u) / 512u;
+        uint32_t last_cl, last_idx, run, len;
+        uint8_t slot = s->fill;
+        if (want > s->slot_sectors) want = s->slot_sectors;
+        run = contiguous_run(vol, f, sector_in_cluster, want, &last_cl, &last_idx);
+        len = (run * 512u < left) ? run * 512u : left;
+        s->req.lba = lba_of_cluster(vol, f->current_cluster) + sector_in_cluster;
+        s->req.count = run;
+        s->req.buf = s->slot_buf[slot];
+        s->req.done = stream_done;
+        s->req.user = s;
+        s->slot_len[slot] = len;
+        s->slot_state[slot] = FAT32_SLOT_LOADING;
+        s->fill = (uint8_t)((slot + 1) % s->slots);
+        f->current_cluster = last_cl;
+        f->cluster_index = last_idx;
+        f->file_pos += len;
+        if (!stream_start(s, slot)) return;
+    }
+}
+
+boolean FAT32_StreamOpen(FAT32_Stream *s, FAT32_Volume *vol, FAT32_File *file, void *pool, uint8_t slots, uint16_t slot_sectors)
+{
+    if (!s || !vol || !file || !pool || ((uintptr_t)pool & 3u)) return false;
+    if (!slots || slots > FAT32_STREAM_MAX_SLOTS || !slot_sectors) return false;
+    memset(s, 0, sizeof(*s));
+    s->vol = vol;
+    s->file = file;
+    s->slots = slots;
+    s->slot_sectors = slot_sectors;
+    s->loading = STREAM_IDLE;
+    s->retry = STREAM_IDLE;
+    for (uint8_t i=0; i<slots; ++i) s->slot_buf[i] = (uint8_t*)pool + (uint32_t)i * slot_sectors * 512u;
+    s->pos = file->file_pos;
+    // Transfers are whole sectors; an unaligned start is skipped inside the first slot
+    if (s->pos < file->size_bytes) {
+        s->offset = s->pos % 512u;
+        if (!FAT32_Seek(vol, file, s->pos - s->offset)) return false;
+    }
+    stream_fill(s);
+    return true;
+}
+
+const void *FAT32_StreamPeek(FAT32_Stream *s, size_t *avail)
+{
+    if (avail) *avail = 0;
+    if (!s || !s->file) return NULL;
+    stream_fill(s);
+    if (s->slot_state[s->head] != FAT32_SLOT_READY) return NULL;
+    if (avail) *avail = s->slot_len[s->head] - s->offset;
+    return s->slot_buf[s->head] + s->offset;
+}
+
+void FAT32_StreamConsume(FAT32_Stream *s, size_t bytes)
+{
+    if (!s || !s->file || s->slot_state[s->head] != FAT32_SLOT_READY) return;
+    uint32_t avail = s->slot_len[s->head] - s->offset;
+    if (bytes > avail) bytes = avail;
+    s->offset += (uint32_t)bytes;
+    s->pos += (uint32_t)bytes;
+    if (s->offset == s->slot_len[s->head]) {
+        s->slot_state[s->head] = FAT32_SLOT_EMPTY;
+        s->head = (uint8_t)((s->head + 1) % s->slots);
+        s->offset = 0;
+        stream_fill(s);
+    }
+}
+
+boolean FAT32_StreamEOF(const FAT32_Stream *s)
+{
+    return !s || !s->file || s->pos >= s->file->size_bytes;
+}
+
+boolean FAT32_StreamError(const FAT32_Stream *s)
+{
+    return s && s->file && s->slot_state[s->head] == FAT32_SLOT_ERROR;
+}
+
+void FAT32_StreamClose(FAT32_Stream *s)
+{
+    if (!s || !s->file) return;
+    s->closing = 1;
+    if (s->loading != STREAM_IDLE) BDEV_Wait(s->vol->dev, &s->req); // only set on a device that can be waited on
+    // Hand the file back positioned where the consumer stopped
+    FAT32_Seek(s->vol, s->file, s->pos);
+    s->file = NULL;
+}
+
+// Refresh cached lookups that point at this file's directory entry
+static void dentry_update(FAT32_Volume *vol, const FAT32_File *file)
+{
+    for (int i=0; i<FAT32_DENTRY_CACHE_SIZE; ++i) {
+        FAT32_Dentry *d = &vol->dentry_cache[i];
+        if (d->parent_cluster && d->entry_lba == file->dir_lba && d->entry_off == file->dir_off) {
+            d->first_cluster = file->first_cluster;
+            d->size_bytes = file->size_bytes;
+        }
+    }
+}
+
+// Make sure clusters exist for file bytes [0, end); new clusters come as few physical runs as possible.
+// The file position is preserved. Returns how far the file is backed by clusters, capped at 'end';
+// less than 'end' if the volume filled up, 0 on an I/O error.
+static uint32_t reserve_clusters(FAT32_Volume *vol, FAT32_File *file, uint32_t end)
+{
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    uint32_t have = 0, tail = 0, pos = file->file_pos;
+    uint32_t need = (uint32_t)(((uint64_t)end + cluster_bytes - 1) / cluster_bytes);
+    if (file->first_cluster >= 2) {
+        have = (file->size_bytes + cluster_bytes - 1) / cluster_bytes;
+        if (!have) have = 1; // zero-length file that still owns its first cluster
+    }
+    if (need <= have) return end;
+    if (have) {
+        if (!FAT32_Seek(vol, file, (have - 1) * cluster_bytes)) return 0;
+        tail = file->current_cluster;
+        // The chain may already run past the size (clusters of a write that failed part-way): use them
+        while (have < need) {
+            uint32_t next;
+            if (!fat_next(vol, tail, &next)) return 0;
+            if (next < 2 || next >= 0x0FFFFFF8) break;
+            tail = next;
+            have++;
+        }
+    }
+    while (have < need) {
+        uint32_t first, got;
+        if (!alloc_run(vol, tail, need - have, &first, &got)) break;
+        if (!tail) {
+            file->first_cluster = file->current_cluster = first;
+            file->cluster_index = 0;
+            file->dirty = 1;
+        }
+        tail = first + got - 1;
+        have += got;
+    }
+    if (file->first_cluster >= 2 && !FAT32_Seek(vol, file, pos)) return 0;
+    return ((uint64_t)have * cluster_bytes < end) ? have * cluster_bytes : end;
+}
+
+// Cut the cluster chain after the first 'keep' clusters and drop run map entries past it
+static boolean cut_chain(FAT32_Volume *vol, FAT32_File *file, uint32_t keep)
+{
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    if (file->first_cluster >= 2) {
+        if (!keep) {
+            if (!free_chain(vol, file->first_cluster)) return false;
+            file->first_cluster = file->current_cluster = 0;
+            file->cluster_index = 0;
+            file->dirty = 1;
+        } else {
+            uint32_t next;
+            if (!FAT32_Seek(vol, file, (keep - 1) * cluster_bytes)) return false;
+            if (!fat_next(vol, file->current_cluster, &next)) return false;
+            if (next >= 2 && next < 0x0FFFFFF8) {
+                if (!fat_set(vol, file->current_cluster, FAT32_EOC)) return false;
+                if (!free_chain(vol, next)) return false;
+            }
+        }
+    }
+    // Run map entries past the new end describe freed clusters
+    while (file->extent_count && file->extents[file->extent_count - 1].file_cluster >= keep) file->extent_count--;
+    if (file->extent_count) {
+        FAT32_Extent *last = &file->extents[file->extent_count - 1];
+        if (last->file_cluster + last->length > keep) last->length = keep - last->file_cluster;
+    }
+    file->sec_lba = 0; // may belong to a freed cluster
+    return true;
 }
 
-void FAT32_Seek(FAT32_File *file, uint32_t pos)
+size_t FAT32_Write(FAT32_Volume *vol, FAT32_File *file, const void *buf, size_t bytes)
 {
-    // Simple: only support rewind to 0 right now; full seek would need chain traversal
-    if (pos == 0) {
-        file->file_pos = 0;
-        file->current_cluster = file->first_cluster;
+    if (!vol || !file || !buf || !file->dir_lba) return 0;
+    if (bytes > 0xFFFFFFFFu - file->file_pos) bytes = 0xFFFFFFFFu - file->file_pos; // FAT32 4 GiB limit
+    if (!bytes) return 0;
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    // Whole write reserved up front so an append gets one contiguous run instead of a cluster at a time;
+    // after a partial reservation only what was allocated is written
+    uint32_t backed = reserve_clusters(vol, file, file->file_pos + (uint32_t)bytes);
+    if (backed <= file->file_pos) return 0;
+    if (bytes > backed - file->file_pos) bytes = backed - file->file_pos;
+    const uint8_t *in = (const uint8_t*)buf;
+    while (bytes) {
+        if (file->current_cluster < 2) break; // empty file and nothing could be allocated
+        if (file->cluster_index < file->file_pos / cluster_bytes && !advance_cluster(vol, file)) break; // volume full
+        uint32_t sector_in_cluster = (file->file_pos % cluster_bytes) / 512u;
+        uint32_t within_sector = file->file_pos % 512u;
+        uint32_t lba = lba_of_cluster(vol, file->current_cluster) + sector_in_cluster;
+        uint32_t copy;
+        if (within_sector == 0 && bytes >= 512u && ((uintptr_t)in & 3u) == 0) {
+            uint32_t last_cl, last_idx;
+            uint32_t run = contiguous_run(vol, file, sector_in_cluster, (uint32_t)(bytes / 512u), &last_cl, &last_idx);
+            if (file->sec_lba >= lba && file->sec_lba < lba + run) file->sec_lba = 0; // overwritten
+            if (!BDEV_Write(vol->dev, lba, run, in)) break;
+            file->current_cluster = last_cl;
+            file->cluster_index = last_idx;
+            copy = run * 512u;
+        } else {
+            // Partial sector: read-modify-write, except past the end of data where the sector is fresh
+            uint8_t *sec = file_sector(vol, file, lba, file->file_pos - within_sector < file->size_bytes);
+            if (!sec) break;
+            copy = 512u - within_sector;
+            if (copy > bytes) copy = (uint32_t)bytes;
+            memcpy(&sec[within_sector], in, copy);
+            if (!BDEV_Write(vol->dev, lba, 1, sec)) { file->sec_lba = 0; break; }
+        }
+        in += copy;
+        file->file_pos += copy;
+        bytes -= copy;
+        if (file->file_pos > file->size_bytes) { file->size_bytes = file->file_pos; file->dirty = 1; }
+    }
+    if (bytes) {
+        // Stopped part-way: give back the clusters reserved past the data actually written
+        uint32_t pos = file->file_pos;
+        if (cut_chain(vol, file, (file->size_bytes + cluster_bytes - 1) / cluster_bytes)) FAT32_Seek(vol, file, pos);
+    }
+    return (size_t)(in - (const uint8_t*)buf);
+}
+
+boolean FAT32_Truncate(FAT32_Volume *vol, FAT32_File *file, uint32_t size)
+{
+    if (!vol || !file || !file->dir_lba) return false;
+    if (size >= file->size_bytes) return size == file->size_bytes; // growing is done by FAT32_Write
+    uint32_t cluster_bytes = vol->sectors_per_cluster * 512u;
+    uint32_t pos = (file->file_pos < size) ? file->file_pos : size;
+    if (!cut_chain(vol, file, (size + cluster_bytes - 1) / cluster_bytes)) return false;
+    file->size_bytes = size;
+    file->dirty = 1;
+    return FAT32_Seek(vol, file, pos);
+}
+
+boolean FAT32_Sync(FAT32_Volume *vol)
+{
+    if (!vol || !vol->dev) return false;
+    boolean ok = vol->fat_cache ? FSC_Flush(vol->fat_cache) : true;
+    if (vol->fsinfo_lba && vol->fsinfo_dirty) {
+        if (BDEV_Read(vol->dev, vol->fsinfo_lba, 1, g_sec) && rd32(&g_sec[0]) == FSINFO_LEAD_SIG) {
+            wr32(&g_sec[488], vol->free_count);
+            wr32(&g_sec[492], vol->next_free);
+            if (BDEV_Write(vol->dev, vol->fsinfo_lba, 1, g_sec)) vol->fsinfo_dirty = 0;
+            else ok = false;
+        } else ok = false;
+    }
+    return BDEV_Flush(vol->dev) && ok;
+}
+
+boolean FAT32_Flush(FAT32_Volume *vol, FAT32_File *file)
+{
+    if (!vol || !file || !file->dir_lba) return false;
+    if (file->dirty) {
+        if (!BDEV_Read(vol->dev, file->dir_lba, 1, g_sec)) return false;
+        uint8_t *e = &g_sec[file->dir_off];
+        wr16(&e[20], (uint16_t)(file->first_cluster >> 16));
+        wr16(&e[26], (uint16_t)file->first_cluster);
+        wr32(&e[28], file->size_bytes);
+        e[11] |= 0x20; // archive
+        if (!BDEV_Write(vol->dev, file->dir_lba, 1, g_sec)) return false;
+        dentry_update(vol, file);
+        file->dirty = 0;
+    }
+    return FAT32_Sync(vol);
+}
+
+// Find an unused entry in directory 'dir', growing the directory by one zeroed cluster when full
+static boolean dir_free_slot(FAT32_Volume *vol, uint32_t dir, uint32_t *lba, uint16_t *off)
+{
+    uint32_t cl = dir, last = dir;
+    while (cl >= 2 && cl < 0x0FFFFFF8) {
+        for (uint8_t s=0; s<vol->sectors_per_cluster; ++s) {
+            if (!BDEV_Read(vol->dev, lba_of_cluster(vol, cl) + s, 1, g_sec)) return false;
+            for (int o=0; o<512; o+=32) {
+                if (g_sec[o] == 0x00 || g_sec[o] == 0xE5) {
+                    *lba = lba_of_cluster(vol, cl) + s;
+                    *off = (uint16_t)o;
+                    return true;
+                }
+            }
+        }
+        last = cl;
+        if (!fat_next(vol, cl, &cl)) return false;
+    }
+    uint32_t ncl, got;
+    if (!alloc_run(vol, last, 1, &ncl, &got)) return false;
+    memset(g_sec, 0, 512);
+    for (uint8_t s=0; s<vol->sectors_per_cluster; ++s)
+        if (!BDEV_Write(vol->dev, lba_of_cluster(vol, ncl) + s, 1, g_sec)) return false;
+    *lba = lba_of_cluster(vol, ncl);
+    *off = 0;
+    return true;
+}
+
+boolean FAT32_Create(FAT32_Volume *vol, const char *path, FAT32_File *file)
+{
+    if (!vol || !file || !path) return false;
+    memset(file,0,sizeof(*file));
+    uint32_t dir;
+    uint8_t raw[11];
+    FAT32_Dentry de;
+    if (!resolve_parent(vol, path, &dir, raw) || raw[0] == '.') return false;
+    if (dir_lookup(vol, dir, raw, &de)) {
+        if (de.attr & 0x11) return false; // directory or read-only
+        file_from_dentry(file, &de);
+        return FAT32_Truncate(vol, file, 0) && FAT32_Flush(vol, file);
     }
+    uint32_t lba;
+    uint16_t off;
+    if (!dir_free_slot(vol, dir, &lba, &off)) return false;
+    if (!BDEV_Read(vol->dev, lba, 1, g_sec)) return false;
+    memset(&g_sec[off], 0, 32);
+    memcpy(&g_sec[off], raw, 11);
+    g_sec[off + 11] = 0x20; // archive
+    if (!BDEV_Write(vol->dev, lba, 1, g_sec)) return false;
+    // Seed the dentry cache so the first open after create needs no directory scan
+    de.parent_cluster = dir;
+    de.hash = dentry_hash(dir, raw);
+    de.first_cluster = 0;
+    de.size_bytes = 0;
+    de.entry_lba = lba;
+    de.entry_off = off;
+    memcpy(de.name, raw, 11);
+    de.attr = 0x20;
+    vol->dentry_cache[de.hash & (FAT32_DENTRY_CACHE_SIZE - 1)] = de;
+    file_from_dentry(file, &de);
+    return FAT32_Sync(vol);
 }
@@ -3,12 +3,48 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "systypes.h"
+#include "blockdev.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Number of FAT sectors kept in the per-volume LRU (128 cluster entries each)
+#ifndef FAT32_FAT_CACHE_SECTORS
+#define FAT32_FAT_CACHE_SECTORS 8
+#endif
+
+// Directory entries remembered per volume by (parent cluster, name hash); power of 2
+#ifndef FAT32_DENTRY_CACHE_SIZE
+#define FAT32_DENTRY_CACHE_SIZE 64
+#endif
+
+// Largest free-cluster bitmap kept in RAM (bytes); bigger volumes allocate by scanning the FAT
+#ifndef FAT32_FREE_BITMAP_MAX
+#define FAT32_FREE_BITMAP_MAX (256u * 1024u)
+#endif
+
+// Free-space run length looked for when a file chain starts or cannot grow in place
+#ifndef FAT32_ALLOC_MIN_RUN
+#define FAT32_ALLOC_MIN_RUN 16
+#endif
+
+struct tag_FCACHE;
+
+// Cached result of one directory lookup
+typedef struct {
+    uint32_t parent_cluster; // directory searched (0 = unused slot)
+    uint32_t hash;           // hash of parent_cluster + name
+    uint32_t first_cluster;
+    uint32_t size_bytes;
+    uint32_t entry_lba;      // sector holding the on-disk entry
+    uint16_t entry_off;      // byte offset of the entry in that sector
+    uint8_t  name[11];       // raw space padded 8.3 name as stored on disk
+    uint8_t  attr;
+} FAT32_Dentry;
+
 typedef struct {
+    const BDEV_Device *dev;       // backing block device
     uint32_t sectors_per_fat;
     uint32_t fat_begin_lba;
     uint32_t cluster_begin_lba;
@@ -18,24 +54,145 @@ typedef struct {
     uint32_t total_clusters;
     uint16_t bytes_per_sector;
     uint8_t  sectors_per_cluster;
+    uint8_t  num_fats;
+    uint32_t fsinfo_lba;          // 0 = no FSInfo sector
+    uint32_t free_count;          // free clusters, 0xFFFFFFFF = unknown
+    uint32_t next_free;           // allocation hint (FSInfo next free cluster)
+    uint8_t  fsinfo_dirty;
+    uint8_t  free_bitmap_tried;   // bitmap build attempted (it is not retried after failure)
+    uint32_t *free_bitmap;        // bit per cluster, set = in use; built on first allocation
+    struct tag_FCACHE *fat_cache; // FAT sector LRU, created on first mount and kept across remounts
+    uint32_t fat_cache_hits;      // FAT lookups served from fat_cache
+    uint32_t fat_cache_misses;    // FAT lookups that had to read the card
+    uint32_t dentry_hits;         // path components resolved from dentry_cache
+    uint32_t dentry_misses;       // path components that needed a directory scan
+    FAT32_Dentry dentry_cache[FAT32_DENTRY_CACHE_SIZE];
 } FAT32_Volume;
 
+// One contiguous run of clusters inside a file's chain
+typedef struct {
+    uint32_t start_cluster; // first cluster of the run
+    uint32_t file_cluster;  // index of start_cluster within the file (0 = first cluster)
+    uint32_t length;        // number of clusters in the run
+} FAT32_Extent;
+
 typedef struct {
     uint32_t first_cluster;
     uint32_t size_bytes;
     uint32_t current_cluster;
+    uint32_t cluster_index;   // index of current_cluster within the file
     uint32_t file_pos;
+    FAT32_Extent *extents;    // optional caller-owned run map (NULL = walk the FAT)
+    uint16_t extent_count;    // runs stored in extents[]
+    uint16_t extent_max;      // capacity of extents[]
+    uint32_t dir_lba;         // directory entry location (0 = not opened from a directory)
+    uint16_t dir_off;
+    uint8_t  dirty;           // size or first cluster changed since the last FAT32_Flush
+    // Partial-sector reads/writes go through this handle's own sector so interleaved handles keep
+    // their locality. Writes are write-through, but another handle on the same file is not refreshed.
+    uint32_t sec_lba;         // sector held in sec_buf (0 = none)
+    uint32_t sec_buf[128];    // word aligned for the MSDC FIFO
 } FAT32_File;
 
+// Read-ahead ring for FAT32_Stream*; each slot holds up to one multi-block transfer
+#ifndef FAT32_STREAM_MAX_SLOTS
+#define FAT32_STREAM_MAX_SLOTS 4
+#endif
+
+#define FAT32_SLOT_EMPTY    0
+#define FAT32_SLOT_LOADING  1
+#define FAT32_SLOT_READY    2
+#define FAT32_SLOT_ERROR    3
+
+typedef struct {
+    FAT32_Volume *vol;
+    FAT32_File *file;         // owned by the stream until FAT32_StreamClose (its position is the prefetch cursor)
+    BDEV_Request req;         // the one transfer in flight
+    uint8_t *slot_buf[FAT32_STREAM_MAX_SLOTS];
+    uint32_t slot_len[FAT32_STREAM_MAX_SLOTS];          // valid bytes in each slot
+    volatile uint8_t slot_state[FAT32_STREAM_MAX_SLOTS]; // FAT32_SLOT_*
+    uint16_t slot_sectors;    // capacity of a slot in sectors
+    uint8_t  slots;           // ring size
+    uint8_t  head;            // slot being consumed
+    uint8_t  fill;            // next slot to load
+    uint8_t  loading;         // slot with a transfer in flight, 0xFF = none
+    uint8_t  retry;           // slot whose failed transfer is to be issued again, 0xFF = none
+    uint8_t  retries;         // failed attempts of that transfer so far
+    uint8_t  closing;
+    uint32_t offset;          // bytes consumed from the head slot
+    uint32_t pos;             // consumer position in the file
+} FAT32_Stream;
+
+// Longest long file name kept by FAT32_ReadDir (LFN limit is 255 UTF-16 characters)
+#define FAT32_LFN_MAX 255
+
+// Location of a directory entry; FAT32_TellDir/FAT32_SeekDir resume listing there without rescanning
+typedef struct {
+    uint32_t cluster;         // directory cluster holding the entry (0 = end of directory)
+    uint8_t  sector;          // sector within that cluster
+    uint16_t offset;          // byte offset within the sector
+} FAT32_DirPos;
+
+typedef struct {
+    char     name[FAT32_LFN_MAX + 1]; // long name (non-ASCII shown as '?'), else the 8.3 name
+    char     name83[13];      // short name as "NAME.EXT"
+    uint8_t  attr;
+    uint32_t first_cluster;
+    uint32_t size_bytes;
+    FAT32_DirPos pos;         // first slot of the entry (its LFN part if any)
+} FAT32_DirEntry;
+
+typedef struct {
+    FAT32_Volume *vol;
+    uint32_t first_cluster;   // start of the directory chain
+    FAT32_DirPos pos;         // next slot to examine
+    uint8_t  error;           // a read failed; FAT32_ReadDir keeps returning false
+    uint32_t sec_lba;         // sector held in sec_buf (0 = none)
+    uint32_t sec_buf[128];    // private so listing does not disturb file handles or lookups
+} FAT32_Dir;
+
 typedef void (*FAT32_ListCallback)(const char *name83, uint8_t attr, uint32_t firstCluster, uint32_t sizeBytes, void *user);
 
 boolean FAT32_ListRoot(FAT32_Volume *vol, FAT32_ListCallback cb, void *user); // list root entries (files + dirs)
 boolean FAT32_ListDirectory(FAT32_Volume *vol, uint32_t startCluster, FAT32_ListCallback cb, void *user); // generic cluster chain dir
 
-boolean FAT32_Mount(FAT32_Volume *vol); // Mount first partition or raw volume
-boolean FAT32_Open(FAT32_Volume *vol, const char *name83, FAT32_File *file); // NAME.EXT (upper)
+// Resumable directory iteration. A page of a large directory costs only its own sectors when the
+// caller keeps the FAT32_TellDir position of each page start and FAT32_SeekDir's back to it.
+boolean FAT32_OpenDir(FAT32_Volume *vol, const char *path, FAT32_Dir *dir); // "" or "/" = root
+boolean FAT32_ReadDir(FAT32_Dir *dir, FAT32_DirEntry *entry); // next entry (LFN assembled), false at end/error
+FAT32_DirPos FAT32_TellDir(const FAT32_Dir *dir); // position of the entry the next FAT32_ReadDir returns
+void    FAT32_SeekDir(FAT32_Dir *dir, const FAT32_DirPos *pos); // position from FAT32_TellDir or FAT32_DirEntry.pos
+void    FAT32_RewindDir(FAT32_Dir *dir);
+
+boolean FAT32_Mount(FAT32_Volume *vol); // Mount first partition or raw volume of the SD card (vol must be zeroed or previously mounted)
+boolean FAT32_MountDevice(FAT32_Volume *vol, const BDEV_Device *dev); // same on any block device
+void    FAT32_Unmount(FAT32_Volume *vol); // write back pending FAT/FSInfo updates and release caches
+// "NAME.EXT" in the root or "/DIR/SUB/NAME.EXT"; 8.3 components, case-insensitive
+boolean FAT32_Open(FAT32_Volume *vol, const char *path, FAT32_File *file);
+// Open + build a run-length cluster map into caller storage so seeks need no FAT reads.
+// If the file has more runs than max_extents the map covers only the head of the file.
+boolean FAT32_OpenMapped(FAT32_Volume *vol, const char *path, FAT32_File *file, FAT32_Extent *extents, uint16_t max_extents);
 size_t  FAT32_Read(FAT32_Volume *vol, FAT32_File *file, void *buf, size_t bytes);
-void    FAT32_Seek(FAT32_File *file, uint32_t pos); // simple absolute seek within file
+boolean FAT32_Seek(FAT32_Volume *vol, FAT32_File *file, uint32_t pos); // absolute seek, clamped to file size
+
+// Streaming reads: the next sectors of the file are prefetched into a ring of caller buffers with
+// asynchronous SD transfers while the consumer works on the current slot. pool must be word aligned
+// and hold slots * slot_sectors * 512 bytes. Reading resumes at file->file_pos. Devices without
+// read_async are read synchronously slot by slot.
+boolean FAT32_StreamOpen(FAT32_Stream *s, FAT32_Volume *vol, FAT32_File *file, void *pool, uint8_t slots, uint16_t slot_sectors);
+const void *FAT32_StreamPeek(FAT32_Stream *s, size_t *avail); // data at the consumer position, NULL while loading
+void    FAT32_StreamConsume(FAT32_Stream *s, size_t bytes);   // release bytes returned by Peek
+boolean FAT32_StreamEOF(const FAT32_Stream *s);
+boolean FAT32_StreamError(const FAT32_Stream *s); // the head slot failed, BDEV_ASYNC_RETRIES re-issues included
+void    FAT32_StreamClose(FAT32_Stream *s); // finish the transfer in flight; file->file_pos = consumer position
+
+// Write support. FAT sectors are cached and written back on eviction or FAT32_Flush/FAT32_Sync;
+// a file's directory entry is updated by FAT32_Flush.
+boolean FAT32_Create(FAT32_Volume *vol, const char *path, FAT32_File *file); // new empty file (existing file is truncated)
+size_t  FAT32_Write(FAT32_Volume *vol, FAT32_File *file, const void *buf, size_t bytes); // at file_pos; seek to size to append
+boolean FAT32_Truncate(FAT32_Volume *vol, FAT32_File *file, uint32_t size); // shrink to size, freeing trailing clusters
+boolean FAT32_Flush(FAT32_Volume *vol, FAT32_File *file); // update directory entry + FAT32_Sync
+boolean FAT32_Sync(FAT32_Volume *vol); // write back dirty FAT sectors (all copies) and FSInfo
 
 #ifdef __cplusplus
 }
@@ -23,6 +23,8 @@
 #include "ili9341.h"
 #include "lcdif.h"
 
+static TSLAB SetWinCmdSlab = SLAB("ILI9341Win", ILI9341_SETWINCMDSIZE * sizeof(uint32_t), ILI9341_SETWINSLABBLOCKS);
+
 boolean ILI9341_Initialize(void)
 {
     LCDIF_WriteCommand(ILI9341_PCONTROL1);
@@ -130,7 +132,7 @@ uint32_t *ILI9341_SetOutputWindow(pRECT Rct, uint32_t *Count, uint32_t DataAttr,
     {
         uint32_t i = 0;
 
-        Data = malloc(ILI9341_SETWINCMDSIZE * sizeof(uint32_t));
+        Data = SLAB_Alloc(&SetWinCmdSlab);
         if (Data != NULL)
         {
             Data[i++] = LCDIF_COMM(ILI9341_CASET) | CmdAttr;
@@ -197,7 +199,6 @@ void ILI9341_FlushFrameBuffer(void)
         {
             // Send the command sequence to set output window
             LCDIF_AddCommandToQueue(cmd_data, cmd_count, &full_screen);
-            free(cmd_data);
 
             // Now force the framebuffer data to be sent
             LCDIF_UpdateRectangle(full_screen);
@@ -222,7 +223,6 @@ void ILI9341_UpdateRect(TRECT rect)
     if (cmd_data != NULL)
     {
         LCDIF_AddCommandToQueue(cmd_data, cmd_count, &rect);
-        free(cmd_data);
         LCDIF_UpdateRectangle(rect);
         //DebugPrint("ILI9341: Updated rect (%d,%d,%d,%d)\n", rect.l, rect.t, rect.r, rect.b);
     }
@@ -21,6 +21,7 @@
 
 #define ILI9341_ROWSHIFT            0x00
 #define ILI9341_SETWINCMDSIZE       11
+#define ILI9341_SETWINSLABBLOCKS    32                                                              // Command arrays served by the slab
 
 #define ILI9341_NOP                 0x00
 #define ILI9341_SWRESET             0x01
@@ -36,9 +36,24 @@
 #endif
 
 static int g_cardType = SDM_CARD_NONE; // internal card type
+static SDM_Request *volatile g_req = NULL; // in-flight asynchronous request
+static pTIMER g_reqTimer = NULL;         // request timeout (created on first async read)
+static uint8_t g_draining = 0;           // a blocking transfer is finishing the in-flight request
+static uint8_t g_irqRegistered = 0;      // bit per controller (bit0 MSDC0, bit1 MSDC2)
 static unsigned short g_rca = 0;
 static int g_activeController = -1; // 0 or 2
 static unsigned g_capacityMB = 0; // computed after CMD9
+static int g_lastController = -1;   // controller of the last successful init, tried first by SDM_Open
+static unsigned g_clockKHz = SDM_DEFAULT_CLOCK_KHZ; // transfer clock applied at the end of init
+static volatile uint32_t g_generation = 0; // bumped on every (re)init and detected card change
+static volatile uint8_t g_cardChanged = 0; // debounced card-detect change not yet handled by SDM_Open
+static uint8_t g_cdArmed = 0;            // PINIRQ enabled on the active controller
+static uint8_t g_cdPin = 0;              // PIN0 level when the session was armed / last change
+static pTIMER g_cdTimer = NULL;          // card-detect debounce
+static uint8_t g_busWidth = 1;           // 1 or 4 (ACMD6 + SDC_CFG.MDLEN)
+static unsigned g_clockCapKHz = 0;       // CRC back-off ceiling for this card, 0 = none
+static uint8_t g_dswFlipped = 0;         // data sample edge flipped at the current clock
+static uint8_t g_dataCrc = 0;            // last data phase reported a CRC error
 
 static void delay_ms_local(unsigned ms){ while(ms--) USC_Pause_us(1000); }
 
@@ -72,6 +87,10 @@ static void msdc_gpio_mux_ctrl(int ctrl_id)
         GPIO_Setup(31, GPMODE(GPIO31_MODE_MCCK));
         GPIO_Setup(32, GPMODE(GPIO32_MODE_MCCM0));
         GPIO_Setup(33, GPMODE(GPIO33_MODE_MCDA0));
+        // DAT1..3 for the 4-bit bus (only MSDC0 has them)
+        GPIO_Setup(34, GPMODE(GPIO34_MODE_MCDA1));
+        GPIO_Setup(35, GPMODE(GPIO35_MODE_MCDA2));
+        GPIO_Setup(36, GPMODE(GPIO36_MODE_MCDA3));
     }
 #endif
 }
@@ -229,6 +248,9 @@ static void msdc_dump_regs(uint32_t base, const char *tag)
         (unsigned long)*(volatile uint32_t*)(base + 0x0044));
 }
 
+static void setup_bus_base(uint32_t base, int ctrl_id);
+static void apply_transfer_clock_base(uint32_t base);
+
 static boolean try_init_base(uint32_t base, int ctrl_id)
 {
     g_cardType = SDM_CARD_NONE;
@@ -340,14 +362,16 @@ static boolean try_init_base(uint32_t base, int ctrl_id)
 
     if (send_cmd_base(base, SDM_CMD7_SELECT_CARD, g_rca << 16)) { g_failStage = "CMD7"; return false; }
 
-    // Switch to higher clock ~13 MHz
-    msdc_set_clock_khz_base(base, 13000);
+    // Widest bus / fastest mode both sides support, then the matching transfer clock
+    setup_bus_base(base, ctrl_id);
+    apply_transfer_clock_base(base);
 
     g_activeController = ctrl_id;
+    g_lastController = ctrl_id;
     return true;
 }
 
-boolean SDM_Init(void)
+static boolean probe_all(void)
 {
     g_activeController = -1;
     // Probe MSDC0 first
@@ -357,39 +381,508 @@ boolean SDM_Init(void)
     return false;
 }
 
+static void arm_card_detect(void);
+
+boolean SDM_Init(void)
+{
+    g_cdArmed = 0; // try_init_base rewrites MSDC_CFG
+    g_cardChanged = 0;
+    g_generation++;
+    if (!probe_all()) return false;
+    arm_card_detect();
+    return true;
+}
+
+boolean SDM_Open(void)
+{
+    // Session alive and no card change reported: no card traffic at all
+    if (g_cardType != SDM_CARD_NONE && !g_cardChanged) return true;
+    if (g_req) return false;
+    g_cdArmed = 0;
+    g_cardChanged = 0;
+    g_generation++;
+    // Re-init where the card was last time before probing both controllers
+    if (!(g_lastController >= 0 && try_init_base((g_lastController==0)?0xA0130000u:0xA0270000u, g_lastController)) &&
+        !probe_all()) return false;
+    arm_card_detect();
+    return true;
+}
+
+uint32_t SDM_GetGeneration(void)
+{
+    return g_generation;
+}
+
 boolean SDM_ReadBlock0(uint8_t *buf)
 {
     return SDM_ReadBlock(0, buf);
 }
 
-boolean SDM_ReadBlock(uint32_t lba, uint8_t *buf)
+// Drain 'words' 32-bit words from the data FIFO; returns number of words left unread (0 = ok)
+static unsigned read_fifo_words(uint32_t base, uint32_t *p, unsigned words)
+{
+    unsigned timeout = 2000000;
+    volatile uint32_t *sta = (uint32_t*)(base + 0x0004);
+    volatile uint32_t *dat = (uint32_t*)(base + 0x0010);
+    while (words && timeout--) {
+        if (*sta & SDM_MSDC_STA_DRQ) { *p++ = *dat; --words; }
+    }
+    return words;
+}
+
+static void finish_data_base(uint32_t base)
+{
+    volatile uint32_t *sta = (uint32_t*)(base + 0x0004);
+    *sta |= SDM_MSDC_STA_FIFOCLR;
+    msdc_reset_fifo_base(base);
+}
+
+// Sample SDC_DATSTA after a data phase (clears on read); remembers CRC errors for the back-off
+static unsigned data_status_base(uint32_t base)
+{
+    unsigned dsta = *(volatile uint32_t*)(base + 0x0044);
+    g_dataCrc = (dsta & SDM_SDC_DATCRCERR) ? 1 : 0;
+    return dsta;
+}
+
+static boolean recover_data_error(void);
+
+// Blocking transfers queue behind an in-flight asynchronous read instead of failing: it is polled
+// to completion first. Its callback sees the device busy, so nothing new is started meanwhile.
+static void drain_request(void)
+{
+    SDM_Request *req;
+    g_draining = 1;
+    while ((req = g_req) != NULL) SDM_WaitRequest(req);
+    g_draining = 0;
+}
+
+static boolean read_block_once(uint32_t lba, uint8_t *buf)
 {
     if (!buf) return false;
+    drain_request();
     if (g_cardType == SDM_CARD_NONE) return false;
     uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u;
     *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | 512u;
     unsigned arg = (g_cardType == SDM_CARD_SDHC) ? lba : (lba * 512u);
     if (send_cmd_base(base, SDM_CMD17_READ_SINGLE, arg)) return false;
+    unsigned words = read_fifo_words(base, (uint32_t*)buf, 512/4);
+    unsigned dsta = data_status_base(base);
+    if (words || g_dataCrc) {
+        SDM_LOG("READ fail LBA=%lu remain=%u STA=%08lX DATSTA=%08lX\n", (unsigned long)lba, words,
+            (unsigned long)*(volatile uint32_t*)(base + 0x0004), (unsigned long)dsta);
+    }
+    finish_data_base(base);
+    return words == 0 && !g_dataCrc;
+}
+
+boolean SDM_ReadBlock(uint32_t lba, uint8_t *buf)
+{
+    g_dataCrc = 0;
+    while (!read_block_once(lba, buf))
+        if (!g_dataCrc || !recover_data_error()) return false;
+    return true;
+}
+
+static boolean read_blocks_once(uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    if (!buf || !count) return false;
+    if (count == 1) return read_block_once(lba, buf);
+    drain_request();
+    if (g_cardType == SDM_CARD_NONE) return false;
+    uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u;
+    *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | 512u;
+    unsigned arg = (g_cardType == SDM_CARD_SDHC) ? lba : (lba * 512u);
+    if (send_cmd_base(base, SDM_CMD18_READ_MULTI, arg)) return false;
+    // One CMD18 streams blocks back to back; the per-block timeout restarts for every sector
     uint32_t *p = (uint32_t*)buf;
-    unsigned words = 512/4;
+    uint32_t blk;
+    unsigned words = 0;
+    for (blk = 0; blk < count; ++blk, p += 512/4) {
+        words = read_fifo_words(base, p, 512/4);
+        if (words) break;
+    }
+    unsigned dsta = data_status_base(base);
+    if (words || g_dataCrc) {
+        SDM_LOG("READM fail LBA=%lu blk=%lu/%lu remain=%u DATSTA=%08lX\n", (unsigned long)lba, (unsigned long)blk,
+            (unsigned long)count, words, (unsigned long)dsta);
+    }
+    // CMD12 ends the open-ended transfer even after a timeout so the card returns to transfer state
+    int stop = send_cmd_base(base, SDM_CMD12_STOP_TRAN, 0);
+    finish_data_base(base);
+    return (words == 0) && !g_dataCrc && (stop == 0);
+}
+
+boolean SDM_ReadBlocks(uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    g_dataCrc = 0;
+    while (!read_blocks_once(lba, count, buf))
+        if (!g_dataCrc || !recover_data_error()) return false; // each step of the back-off is tried once
+    return true;
+}
+
+// Feed 'words' 32-bit words into the data FIFO; returns number of words not written (0 = ok)
+static unsigned write_fifo_words(uint32_t base, const uint32_t *p, unsigned words)
+{
     unsigned timeout = 2000000;
     volatile uint32_t *sta = (uint32_t*)(base + 0x0004);
     volatile uint32_t *dat = (uint32_t*)(base + 0x0010);
     while (words && timeout--) {
-        if (*sta & SDM_MSDC_STA_DRQ) { *p++ = *dat; --words; }
+        if (!(*sta & SDM_MSDC_STA_BF)) { *dat = *p++; --words; }
+    }
+    return words;
+}
+
+// Wait for the card to release DAT0 after a write (SDC_STA busy clears once programming ends)
+static boolean wait_prog_done_base(uint32_t base, unsigned timeout_us)
+{
+    volatile uint32_t *sdcsta = (uint32_t*)(base + 0x002C);
+    while (timeout_us--) {
+        if (!(*sdcsta & SDM_SDC_STA_SDCBUSY)) return true;
+        USC_Pause_us(1);
+    }
+    return false;
+}
+
+// Poll CMD13 until the card is back in transfer state and ready for data; false on a status error
+static boolean wait_card_ready_base(uint32_t base, unsigned timeout_ms)
+{
+    while (timeout_ms--) {
+        if (send_cmd_base(base, SDM_CMD13_SEND_STATUS, g_rca << 16)) return false;
+        unsigned r1 = *(volatile uint32_t*)(base + 0x0030);
+        if (r1 & SDM_R1_ERRORS) { SDM_LOG("STATUS error R1=%08lX\n", (unsigned long)r1); return false; }
+        if ((r1 & SDM_R1_READY_FOR_DATA) && SDM_R1_STATE(r1) == SDM_R1_STATE_TRAN) return true;
+        delay_ms_local(1);
     }
-    if (words) {
-        SDM_LOG("READ timeout LBA=%lu remain=%u STA=%08lX DATSTA=%08lX\n", (unsigned long)lba, words,
-            (unsigned long)*sta, (unsigned long)*(volatile uint32_t*)(base + 0x0044));
-        msdc_reset_fifo_base(base);
-        *sta |= SDM_MSDC_STA_FIFOCLR;
+    return false;
+}
+
+static boolean write_block_once(uint32_t lba, const uint8_t *buf)
+{
+    if (!buf || ((uintptr_t)buf & 3u)) return false;
+    drain_request();
+    if (g_cardType == SDM_CARD_NONE) return false;
+    uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u;
+    *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | 512u;
+    unsigned arg = (g_cardType == SDM_CARD_SDHC) ? lba : (lba * 512u);
+    if (send_cmd_base(base, SDM_CMD24_WRITE_SINGLE, arg)) return false;
+    unsigned words = write_fifo_words(base, (const uint32_t*)buf, 512/4);
+    boolean prog = wait_prog_done_base(base, 250000); // SD spec write timeout is 250 ms
+    unsigned dsta = data_status_base(base); // CRC status token of the block
+    boolean ready = prog && wait_card_ready_base(base, 250);
+    if (words || g_dataCrc || !ready) {
+        SDM_LOG("WRITE fail LBA=%lu remain=%u prog=%d DATSTA=%08lX\n", (unsigned long)lba, words, prog, (unsigned long)dsta);
+    }
+    finish_data_base(base);
+    return (words == 0) && !g_dataCrc && ready;
+}
+
+boolean SDM_WriteBlock(uint32_t lba, const uint8_t *buf)
+{
+    g_dataCrc = 0;
+    while (!write_block_once(lba, buf))
+        if (!g_dataCrc || !recover_data_error()) return false;
+    return true;
+}
+
+static boolean write_blocks_once(uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    if (!buf || !count || ((uintptr_t)buf & 3u)) return false;
+    if (count == 1) return write_block_once(lba, buf);
+    drain_request();
+    if (g_cardType == SDM_CARD_NONE) return false;
+    uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u;
+    *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | 512u;
+    // Pre-erase hint so the card can erase the whole range up front; a card rejecting it is still written
+    if (send_cmd_base(base, SDM_CMD55_APP_CMD, g_rca << 16) || send_cmd_base(base, SDM_ACMD23_PRE_ERASE, count & 0x7FFFFFu))
+        SDM_LOG("ACMD23 rejected, writing without pre-erase\n");
+    unsigned arg = (g_cardType == SDM_CARD_SDHC) ? lba : (lba * 512u);
+    if (send_cmd_base(base, SDM_CMD25_WRITE_MULTI, arg)) return false;
+    // Blocks go back to back in one CMD25; the card programs while the next block is being sent
+    const uint32_t *p = (const uint32_t*)buf;
+    uint32_t blk;
+    unsigned words = 0;
+    for (blk = 0; blk < count; ++blk, p += 512/4) {
+        words = write_fifo_words(base, p, 512/4);
+        if (words) break;
+    }
+    // Let the last block leave the FIFO before CMD12; the stop's R1b busy then covers programming
+    boolean prog = wait_prog_done_base(base, 250000);
+    unsigned dsta = data_status_base(base);
+    int stop = send_cmd_base(base, SDM_CMD12_STOP_TRAN, 0);
+    prog = wait_prog_done_base(base, 250000) && prog;
+    boolean ready = wait_card_ready_base(base, 250);
+    if (words || g_dataCrc || !prog || stop || !ready) {
+        SDM_LOG("WRITEM fail LBA=%lu blk=%lu/%lu remain=%u prog=%d DATSTA=%08lX\n", (unsigned long)lba, (unsigned long)blk,
+            (unsigned long)count, words, prog, (unsigned long)dsta);
+    }
+    finish_data_base(base);
+    return (words == 0) && !g_dataCrc && prog && (stop == 0) && ready;
+}
+
+boolean SDM_WriteBlocks(uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    g_dataCrc = 0;
+    while (!write_blocks_once(lba, count, buf))
+        if (!g_dataCrc || !recover_data_error()) return false;
+    return true;
+}
+
+// Set SDC_CFG block length for the next data command
+static void set_blklen_base(uint32_t base, unsigned len)
+{
+    *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | len;
+}
+
+// ACMD51: 8-byte SCR, most significant byte first
+static boolean read_scr_base(uint32_t base, uint8_t scr[8])
+{
+    uint32_t w[2] = { 0 };
+    unsigned words = 2;
+    set_blklen_base(base, 8);
+    if (!send_cmd_base(base, SDM_CMD55_APP_CMD, g_rca << 16) && !send_cmd_base(base, SDM_ACMD51_SEND_SCR, 0))
+        words = read_fifo_words(base, w, 2);
+    finish_data_base(base);
+    set_blklen_base(base, 512);
+    memcpy(scr, w, 8);
+    return words == 0;
+}
+
+// Bus width after CMD7; a card or controller without 4-bit support stays at 1 bit. The card is left in
+// default speed: the divider in msdc_set_clock_khz_base tops out at half its 26 MHz reference, which
+// default speed (<= 25 MHz) already covers, so a CMD6 high-speed switch would gain nothing.
+static void setup_bus_base(uint32_t base, int ctrl_id)
+{
+    volatile uint32_t *sdccfg = (uint32_t*)(base + 0x0020);
+    volatile uint32_t *iocon = (uint32_t*)(base + 0x0014);
+    uint8_t scr[8];
+    g_busWidth = 1;
+    *sdccfg &= ~SDM_SDC_CFG_MDLEN;
+    *iocon &= ~(SDM_MSDC_IOCON_HSPEED | SDM_MSDC_IOCON_DSW);
+    if (!read_scr_base(base, scr)) { SDM_LOG("SCR read failed, 1-bit bus\n"); return; }
+    // SD_BUS_WIDTHS bit 2 = 4-bit; only MSDC0 has DAT1..3 wired
+    if ((scr[1] & 0x04) && MSDC_IsMultiLineSupported((ctrl_id == 0) ? MSDC_ITF0 : MSDC_ITF1) &&
+        !send_cmd_base(base, SDM_CMD55_APP_CMD, g_rca << 16) && !send_cmd_base(base, SDM_ACMD6_SET_BUS_WIDTH, 2)) {
+        *sdccfg |= SDM_SDC_CFG_MDLEN;
+        g_busWidth = 4;
+    }
+    if (g_dswFlipped) *iocon |= SDM_MSDC_IOCON_DSW;
+    SDM_LOG("Bus %u-bit\n", g_busWidth);
+}
+
+// Transfer clock limited by the CRC back-off ceiling
+static void apply_transfer_clock_base(uint32_t base)
+{
+    g_clockKHz = SDM_DEFAULT_CLOCK_KHZ;
+    if (g_clockCapKHz && g_clockKHz > g_clockCapKHz) g_clockKHz = g_clockCapKHz;
+    msdc_set_clock_khz_base(base, g_clockKHz);
+}
+
+// Data CRC error back-off, one step per call: flip the data sample edge, then halve the clock
+// (sample edge reset), then drop to the 1-bit bus. False once nothing is left to try.
+static boolean recover_data_error(void)
+{
+    uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u;
+    volatile uint32_t *iocon = (uint32_t*)(base + 0x0014);
+    g_dataCrc = 0;
+    if (!g_dswFlipped) {
+        g_dswFlipped = 1;
+        *iocon |= SDM_MSDC_IOCON_DSW;
+        SDM_LOG("CRC error: retune (data sample edge)\n");
+        return true;
+    }
+    if (g_clockKHz > SDM_MIN_CLOCK_KHZ) {
+        g_dswFlipped = 0;
+        *iocon &= ~SDM_MSDC_IOCON_DSW;
+        g_clockCapKHz = (g_clockKHz / 2 > SDM_MIN_CLOCK_KHZ) ? g_clockKHz / 2 : SDM_MIN_CLOCK_KHZ;
+        apply_transfer_clock_base(base);
+        SDM_LOG("CRC error: clock back-off to %u kHz\n", g_clockKHz);
+        return true;
+    }
+    if (g_busWidth == 4 && !send_cmd_base(base, SDM_CMD55_APP_CMD, g_rca << 16) &&
+        !send_cmd_base(base, SDM_ACMD6_SET_BUS_WIDTH, 0)) {
+        *(volatile uint32_t*)(base + 0x0020) &= ~SDM_SDC_CFG_MDLEN;
+        g_busWidth = 1;
+        SDM_LOG("CRC error: falling back to 1-bit bus\n");
+        return true;
+    }
+    return false;
+}
+
+static uint32_t active_base(void)
+{
+    return (g_activeController==0)?0xA0130000u:0xA0270000u;
+}
+
+// MSDC_CFG bits to clear when a data phase ends; INTEN stays on while card detect is armed
+static uint32_t data_irq_bits(void)
+{
+    return g_cdArmed ? SDM_MSDC_CFG_DIRQEN : (SDM_MSDC_CFG_DIRQEN | SDM_MSDC_CFG_INTEN);
+}
+
+// MSDC interrupt: card-detect pin changes start the debounce timer, data requests move whatever
+// the FIFO holds into the request buffer
+static void SDM_DataISR(void)
+{
+    uint32_t base = active_base();
+    volatile uint32_t *cfg = (uint32_t*)(base + 0x0000);
+    volatile uint32_t *sta = (uint32_t*)(base + 0x0004);
+    volatile uint32_t *dat = (uint32_t*)(base + 0x0010);
+    SDM_Request *req = g_req;
+
+    uint32_t ints = *(volatile uint32_t*)(base + 0x0008); // MSDC_INT clears on read
+    if (ints & SDM_MSDC_INT_PINIRQ) {
+        (void)*(volatile uint32_t*)(base + 0x000C); // reading MSDC_PS clears PINCHG
+        if (g_cdArmed) LRT_Start(g_cdTimer); // pin level is sampled once contacts settle
+    }
+    if (!req || req->state != SDM_REQ_BUSY) {
+        *cfg &= ~data_irq_bits();
+        return;
+    }
+    while (req->words_left && (*sta & SDM_MSDC_STA_DRQ)) {
+        *req->wp++ = *dat;
+        req->words_left--;
+    }
+    if (!req->words_left) {
+        *cfg &= ~data_irq_bits();
+        req->state = SDM_REQ_DONE;
+        // Finish in main loop context; if the event cannot be queued the timeout timer completes it
+        EM_PostEvent(ET_SDCOMPLETE, NULL, &req, sizeof(SDM_Request *));
+    }
+}
+
+// Fail a request whose data phase has not finished and stop its interrupt
+static void abort_if_busy(SDM_Request *req)
+{
+    uint32_t iflags = __disable_interrupts();
+    if (req->state == SDM_REQ_BUSY) {
+        *(volatile uint32_t*)(active_base() + 0x0000) &= ~data_irq_bits();
+        req->state = SDM_REQ_ERROR;
+        SDM_LOG("ASYNC timeout LBA=%lu remain=%lu\n", (unsigned long)req->lba, (unsigned long)req->words_left);
+    }
+    __restore_interrupts(iflags);
+}
+
+static void SDM_TimeoutHandler(pTIMER Timer)
+{
+    SDM_Request *req = g_req;
+    (void)Timer;
+    if (!req) return;
+    abort_if_busy(req);
+    SDM_CompleteRequest(req);
+}
+
+static boolean register_irq(void)
+{
+    int ctrl_bit = (g_activeController == 0) ? 1 : 2;
+    if (!(g_irqRegistered & ctrl_bit)) {
+        if (!NVIC_RegisterIRQ((g_activeController == 0) ? IRQ_MSDC_CODE : IRQ_MSDC2_CODE,
+                              SDM_DataISR, IRQ_SENS_LEVEL, true, true)) return false;
+        g_irqRegistered |= ctrl_bit;
+    }
+    return true;
+}
+
+// Debounced card-detect change (main loop): drop the session so the next SDM_Open re-initializes
+static void SDM_CardDetectHandler(pTIMER Timer)
+{
+    (void)Timer;
+    if (!g_cdArmed) return;
+    uint8_t pin = (*(volatile uint32_t*)(active_base() + 0x000C) & SDM_MSDC_PS_PIN0) ? 1 : 0;
+    if (pin == g_cdPin) return; // bounced back to where it was
+    g_cdPin = pin;
+    SDM_LOG("Card change (PIN0=%u)\n", pin);
+    SDM_Request *req = g_req;
+    if (req) {
+        abort_if_busy(req);
+        SDM_CompleteRequest(req);
+    }
+    g_cardType = SDM_CARD_NONE;
+    g_clockCapKHz = 0; // a new card gets the full speed again
+    g_dswFlipped = 0;
+    g_cardChanged = 1;
+    g_generation++;
+}
+
+static void arm_card_detect(void)
+{
+    uint32_t base = active_base();
+    if (!register_irq()) return;
+    if (!g_cdTimer) g_cdTimer = LRT_Create(SDM_CD_DEBOUNCE_MS, SDM_CardDetectHandler, TF_NONE);
+    if (!g_cdTimer) return;
+    g_cdPin = (*(volatile uint32_t*)(base + 0x000C) & SDM_MSDC_PS_PIN0) ? 1 : 0; // also clears a stale PINCHG
+    *(volatile uint32_t*)(base + 0x0000) |= SDM_MSDC_CFG_PINEN | SDM_MSDC_CFG_INTEN;
+    g_cdArmed = 1;
+}
+
+boolean SDM_ReadBlocksAsync(SDM_Request *req)
+{
+    if (!req || !req->buf || !req->count || ((uintptr_t)req->buf & 3u)) return false;
+    if (g_cardType == SDM_CARD_NONE || g_req || g_draining) return false;
+    uint32_t base = active_base();
+    volatile uint32_t *cfg = (uint32_t*)(base + 0x0000);
+
+    if (!register_irq()) return false;
+    if (!g_reqTimer) g_reqTimer = LRT_Create(SDM_ASYNC_TIMEOUT_MS, SDM_TimeoutHandler, TF_NONE);
+
+    req->wp = (volatile uint32_t*)req->buf;
+    req->words_left = req->count * (512/4);
+    req->state = SDM_REQ_BUSY;
+    g_req = req;
+
+    *(volatile uint32_t*)(base + 0x0020) = (*(volatile uint32_t*)(base + 0x0020) & 0xFFFF0000u) | 512u;
+    unsigned arg = (g_cardType == SDM_CARD_SDHC) ? req->lba : (req->lba * 512u);
+    if (send_cmd_base(base, (req->count > 1) ? SDM_CMD18_READ_MULTI : SDM_CMD17_READ_SINGLE, arg)) {
+        req->state = SDM_REQ_ERROR;
+        g_req = NULL;
+        finish_data_base(base);
         return false;
     }
-    *sta |= SDM_MSDC_STA_FIFOCLR;
-    msdc_reset_fifo_base(base);
+    // Data interrupt is armed only after the command phase so the ISR never races send_cmd_base
+    *cfg = (*cfg & ~SDM_MSDC_CFG_FIFOTHD(0xF)) | SDM_MSDC_CFG_FIFOTHD(SDM_ASYNC_FIFOTHD) |
+           SDM_MSDC_CFG_DIRQEN | SDM_MSDC_CFG_INTEN;
+    if (g_reqTimer) LRT_Start(g_reqTimer);
     return true;
 }
 
+void SDM_CompleteRequest(SDM_Request *req)
+{
+    uint32_t iflags = __disable_interrupts();
+    if (!req || g_req != req || req->state == SDM_REQ_BUSY) {
+        __restore_interrupts(iflags); // stale event or still transferring
+        return;
+    }
+    g_req = NULL;
+    __restore_interrupts(iflags);
+
+    uint32_t base = active_base();
+    volatile uint32_t *cfg = (uint32_t*)(base + 0x0000);
+    boolean ok = (req->state == SDM_REQ_DONE);
+    if (g_reqTimer) LRT_Stop(g_reqTimer);
+    data_status_base(base);
+    if (g_dataCrc) { ok = false; recover_data_error(); } // caller re-issues it at the backed-off setting (blockdev.h)
+    if (req->count > 1 && send_cmd_base(base, SDM_CMD12_STOP_TRAN, 0)) ok = false;
+    *cfg = (*cfg & ~SDM_MSDC_CFG_FIFOTHD(0xF)) | SDM_MSDC_CFG_FIFOTHD(1); // back to polled-mode threshold
+    finish_data_base(base);
+    req->state = ok ? SDM_REQ_DONE : SDM_REQ_ERROR;
+    if (req->done) req->done(req, ok);
+}
+
+boolean SDM_WaitRequest(SDM_Request *req)
+{
+    unsigned timeout_us = SDM_ASYNC_TIMEOUT_MS * 1000u;
+    if (!req) return false;
+    while (req->state == SDM_REQ_BUSY && timeout_us--) USC_Pause_us(1);
+    abort_if_busy(req);
+    SDM_CompleteRequest(req); // the queued ET_SDCOMPLETE event is ignored afterwards
+    return req->state == SDM_REQ_DONE;
+}
+
+boolean SDM_IsBusy(void)
+{
+    return g_req != NULL || g_draining;
+}
+
 int SDM_GetCardType(void)
 {
     return g_cardType;
@@ -409,9 +902,71 @@ unsigned SDM_GetCapacityMB(void)
     return g_capacityMB;
 }
 
+unsigned SDM_GetClockKHz(void)
+{
+    return g_clockKHz;
+}
+
+int SDM_GetBusWidth(void)
+{
+    return g_busWidth;
+}
+
 unsigned SDM_CardDetectRaw(void)
 {
     if (g_activeController < 0) return 0;
     uint32_t base = (g_activeController==0)?0xA0130000u:0xA0270000u; // same bases used earlier
     return *(volatile uint32_t*)(base + 0x000C);
 }
+
+// Block device backend over the active card
+static boolean sdm_bdev_read(void *ctx, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    (void)ctx;
+    return SDM_ReadBlocks(lba, count, buf);
+}
+
+static boolean sdm_bdev_write(void *ctx, uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    (void)ctx;
+    return SDM_WriteBlocks(lba, count, buf);
+}
+
+static boolean sdm_bdev_geometry(void *ctx, uint32_t *sector_size, uint32_t *sector_count)
+{
+    (void)ctx;
+    if (g_cardType == SDM_CARD_NONE) return false;
+    *sector_size = 512;
+    *sector_count = g_capacityMB * 2048u;
+    return true;
+}
+
+static boolean sdm_bdev_read_async(void *ctx, BDEV_Request *req)
+{
+    (void)ctx;
+    return SDM_ReadBlocksAsync(req);
+}
+
+static boolean sdm_bdev_busy(void *ctx)
+{
+    (void)ctx;
+    return SDM_IsBusy();
+}
+
+static boolean sdm_bdev_wait(void *ctx, BDEV_Request *req)
+{
+    (void)ctx;
+    return SDM_WaitRequest(req);
+}
+
+static const BDEV_Ops sdm_bdev_ops = {
+    sdm_bdev_read,
+    sdm_bdev_write,
+    NULL,                   // writes wait for programming, nothing is buffered
+    sdm_bdev_geometry,
+    sdm_bdev_read_async,
+    sdm_bdev_busy,
+    sdm_bdev_wait
+};
+
+const BDEV_Device SDM_BlockDevice = { &sdm_bdev_ops, NULL };
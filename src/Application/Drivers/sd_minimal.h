@@ -2,6 +2,7 @@
 #define SD_MINIMAL_H
 #include <stdint.h>
 #include "systypes.h" // for boolean typedef
+#include "blockdev.h"
 
 // Focus: very small subset needed for init + single block read on MT6261 MSDC2
 // Clean-room style minimal definitions (no direct large GPL text copying)
@@ -29,6 +30,11 @@
 
 // SDC_CFG bits (partial)
 #define SDM_SDC_CFG_INTEN    (1u<<0)
+#define SDM_SDC_CFG_MDLEN    (1u<<17) // 4-bit data bus
+
+// MSDC_IOCON bits (partial)
+#define SDM_MSDC_IOCON_HSPEED   (1u<<10) // high-speed output timing
+#define SDM_MSDC_IOCON_DSW      (1u<<16) // sample data on the other clock edge
 
 // MSDC_CFG bits
 #define SDM_MSDC_CFG_MSDC       (1u<<0)
@@ -45,6 +51,10 @@
 #define SDM_SDC_CMDTO           (1u<<1)
 #define SDM_SDC_RSPCRCERR       (1u<<2)
 
+// SDC_DATSTA bits
+#define SDM_SDC_DATTO           (1u<<1)
+#define SDM_SDC_DATCRCERR       (1u<<2)
+
 // SDC_STA busy bits
 #define SDM_SDC_STA_SDCBUSY     (1u<<0)
 
@@ -70,6 +80,10 @@
 #define SDM_MSDC_CFG_RST         (1u<<1)
 #define SDM_MSDC_CFG_MSDC        (1u<<0)
 
+// MSDC_INT bits (clear on read)
+#define SDM_MSDC_INT_DIRQ        (1u<<0)
+#define SDM_MSDC_INT_PINIRQ      (1u<<1)
+
 // MSDC_PS bits (card detect)
 #define SDM_MSDC_PS_PINCHG       (1u<<4)
 #define SDM_MSDC_PS_PIN0         (1u<<3)
@@ -90,30 +104,76 @@
 #define SDM_CMD7_SELECT_CARD    MSDC_CMD7
 #define SDM_CMD9_SEND_CSD       MSDC_CMD9
 #define SDM_CMD17_READ_SINGLE   MSDC_CMD17
+#define SDM_CMD18_READ_MULTI    MSDC_CMD18
 #define SDM_CMD12_STOP_TRAN     MSDC_CMD12
+#define SDM_CMD24_WRITE_SINGLE  MSDC_CMD24
+#define SDM_CMD25_WRITE_MULTI   MSDC_CMD25
+#define SDM_CMD13_SEND_STATUS   MSDC_CMD13
+#define SDM_ACMD23_PRE_ERASE    MSDC_ACMD23
+#define SDM_ACMD6_SET_BUS_WIDTH MSDC_ACMD6
+#define SDM_ACMD51_SEND_SCR     MSDC_ACMD51
 
 // Arguments
 #define CMD8_ARG_PATTERN    0x000001AAu
 #define ACMD41_ARG_HCS      0x40FF8000u  // High capacity + voltage range
 #define ACMD41_ARG_SDSC     0x00FF8000u
 
+// R1 card status (CMD13 response)
+#define SDM_R1_READY_FOR_DATA   (1u<<8)
+#define SDM_R1_STATE(r)         (((r)>>9)&0xFu)
+#define SDM_R1_STATE_TRAN       4
+#define SDM_R1_ERRORS           0xFDF80000u // out of range .. generic error, except CARD_IS_LOCKED
+
 // Card type flags
 #define SDM_CARD_NONE   0
 #define SDM_CARD_SDSC   1
 #define SDM_CARD_SDHC   2
 
+// Asynchronous read request. The data phase is drained from the MSDC FIFO-threshold
+// interrupt; completion (CMD12, FIFO reset, callback) runs from EM_ProcessEvents.
+// count 1 = CMD17, >1 = CMD18 + CMD12.
+typedef BDEV_Request SDM_Request;
+typedef BDEV_Callback SDM_Callback;
+
+#define SDM_REQ_IDLE    BDEV_REQ_IDLE
+#define SDM_REQ_BUSY    BDEV_REQ_BUSY
+#define SDM_REQ_DONE    BDEV_REQ_DONE
+#define SDM_REQ_ERROR   BDEV_REQ_ERROR
+
+#define SDM_ASYNC_TIMEOUT_MS    500   // whole request, checked by an LRT timer
+#define SDM_ASYNC_FIFOTHD       4     // FIFO words per data interrupt (divides 128)
+
+#define SDM_CD_DEBOUNCE_MS      150   // card-detect pin must be stable this long before a change counts
+#define SDM_DEFAULT_CLOCK_KHZ   13000 // transfer clock after identification (default speed, <= 25 MHz)
+#define SDM_MIN_CLOCK_KHZ       1000  // CRC error back-off stops halving the clock here
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 boolean SDM_Init(void);                 // probe MSDC0 then MSDC2; initialize first responding card
+// Managed session: the first call initializes the card and arms the card-detect interrupt; later calls
+// return at once until an insert/remove is seen, then re-init starts on the remembered controller.
+boolean SDM_Open(void);
+uint32_t SDM_GetGeneration(void);       // changes whenever the card may have changed; remount when it differs
 boolean SDM_ReadBlock0(uint8_t *buf);   // read LBA0 (512B)
 boolean SDM_ReadBlock(uint32_t lba, uint8_t *buf); // generic single block read
+boolean SDM_ReadBlocks(uint32_t lba, uint32_t count, uint8_t *buf); // CMD18 multi-block read + CMD12 (buf word aligned)
+boolean SDM_WriteBlock(uint32_t lba, const uint8_t *buf); // CMD24 single block write, waits for programming (buf word aligned)
+boolean SDM_WriteBlocks(uint32_t lba, uint32_t count, const uint8_t *buf); // ACMD23 pre-erase + CMD25 + CMD12, waits for programming (buf word aligned)
+boolean SDM_ReadBlocksAsync(SDM_Request *req); // start a read; false if busy, no card or command failed (re-issue a failed one, blockdev.h)
+boolean SDM_WaitRequest(SDM_Request *req); // poll a request to completion without the event loop (callback still runs)
+boolean SDM_IsBusy(void);               // true while an asynchronous request is in flight (blocking I/O waits for it)
+void SDM_CompleteRequest(SDM_Request *req); // ET_SDCOMPLETE handler (called by the event manager)
 int  SDM_GetCardType(void);          // return SDM_CARD_* value
 unsigned SDM_CardDetectRaw(void);  // Add prototype for SDM_CardDetectRaw
 const char *SDM_GetLastFailStage(void); // NULL if last init succeeded
 int SDM_GetActiveController(void);      // 0,2 or -1 if none
 unsigned SDM_GetCapacityMB(void);       // 0 if unknown/not init
+unsigned SDM_GetClockKHz(void);         // transfer clock requested for the card (after any CRC back-off)
+int SDM_GetBusWidth(void);              // 1 or 4
+
+extern const BDEV_Device SDM_BlockDevice; // active card as a block device (valid after SDM_Init)
 
 #ifdef __cplusplus
 }
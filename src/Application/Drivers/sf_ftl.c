@@ -0,0 +1,317 @@
+#include "systemconfig.h"
+#include "sf_ftl.h"
+#include <string.h>
+
+// Sector layout: [log header 16][7 tags x 12] in slot 0, data slots 1..7 of 512 bytes each.
+// A tag is programmed after its data, so a tag that reads back intact means the slot is
+// complete. The newest sequence of a block wins when the map is rebuilt at mount.
+
+#define FTL_MAGIC               0x314C5446u // "FTL1"
+#define FTL_SECTOR_SIZE         NORSECTORSIZE
+#define FTL_SLOT_SHIFT          3           // 8 slots per sector in map entries
+#define FTL_SECTOR_FULL         (FTL_SLOTS_PER_SECTOR + 1)
+
+typedef struct {
+    uint32_t block;
+    uint32_t sequence;
+    uint16_t crc;           // over block and sequence
+    uint16_t reserved;
+} ftl_tag;
+
+static uint32_t sector_addr(const FTL_Volume *vol, uint32_t s)
+{
+    return s * FTL_SECTOR_SIZE;     // region relative, the sector log adds its base
+}
+
+static uint32_t slot_addr(const FTL_Volume *vol, uint32_t p)
+{
+    return sector_addr(vol, p >> FTL_SLOT_SHIFT) + (p & ((1u << FTL_SLOT_SHIFT) - 1)) * FTL_BLOCK_SIZE;
+}
+
+static uint32_t tag_addr(const FTL_Volume *vol, uint32_t p)
+{
+    return sector_addr(vol, p >> FTL_SLOT_SHIFT) + SLOG_HEADERSIZE +
+           ((p & ((1u << FTL_SLOT_SHIFT) - 1)) - 1) * sizeof(ftl_tag);
+}
+
+static boolean flash_read(FTL_Volume *vol, uint32_t addr, void *data, size_t count)
+{
+    return SLOG_ReadAt(&vol->log, addr, data, count);
+}
+
+static boolean flash_program(FTL_Volume *vol, uint32_t addr, const void *data, size_t count)
+{
+    return SLOG_ProgramAt(&vol->log, addr, data, count);
+}
+
+static boolean tag_valid(const FTL_Volume *vol, ftl_tag *tag)
+{
+    return tag->crc == CalculateCRC16(tag, offsetof(ftl_tag, crc)) && tag->block < vol->block_count;
+}
+
+static boolean is_blank(const uint32_t *p, uint32_t words)
+{
+    while (words--) if (*p++ != 0xFFFFFFFFu) return false;
+    return true;
+}
+
+static boolean is_zero(const uint8_t *p, uint32_t bytes)
+{
+    while (bytes--) if (*p++) return false;
+    return true;
+}
+
+static void map_drop(FTL_Volume *vol, uint32_t block)
+{
+    uint16_t p = vol->map[block];
+    if (p != FTL_UNMAPPED) vol->log.Sectors[p >> FTL_SLOT_SHIFT].Live--;
+}
+
+static void map_set(FTL_Volume *vol, uint32_t block, uint32_t p)
+{
+    map_drop(vol, block);
+    vol->map[block] = (uint16_t)p;
+    vol->log.Sectors[p >> FTL_SLOT_SHIFT].Live++;
+}
+
+static boolean collect_step(void *owner)
+{
+    return FTL_Collect((FTL_Volume *)owner);
+}
+
+// Programs data + tag into the next free slot of the active sector
+static boolean write_slot(FTL_Volume *vol, uint32_t block, const void *data, uint32_t seq)
+{
+    ftl_tag tag;
+    uint32_t p;
+
+    // A reset during collection can leave the reserve in use: the room left in the active
+    // sector belongs to the collection that has to finish first
+    while (!SLOG_MayWrite(&vol->log)) {
+        if (!FTL_Collect(vol)) return false;
+        vol->stats.sync_gc++;
+    }
+    while (vol->log.ActiveSector == SLOG_NOSECTOR ||
+           vol->log.Sectors[vol->log.ActiveSector].Fill > FTL_SLOTS_PER_SECTOR) {
+        if (SLOG_OpenSector(&vol->log)) break;
+        if (vol->log.Reclaiming) return false;
+        // Background collection fell behind: reclaim a sector before this write
+        if (!FTL_Collect(vol)) return false;
+        vol->stats.sync_gc++;
+    }
+    p = (vol->log.ActiveSector << FTL_SLOT_SHIFT) | vol->log.Sectors[vol->log.ActiveSector].Fill++;
+
+    tag.block = block;
+    tag.sequence = seq;
+    tag.crc = CalculateCRC16(&tag, offsetof(ftl_tag, crc));
+    tag.reserved = 0xFFFF;
+    if (!flash_program(vol, slot_addr(vol, p), data, FTL_BLOCK_SIZE) ||
+        !flash_program(vol, tag_addr(vol, p), &tag, sizeof(tag)))
+        return false;   // the slot stays consumed, a rescan treats it as garbage
+
+    map_set(vol, block, p);
+    vol->stats.slot_programs++;
+    return true;
+}
+
+static void scan_sector(void *owner, uint32_t s)
+{
+    FTL_Volume *vol = (FTL_Volume *)owner;
+    ftl_tag tags[FTL_SLOTS_PER_SECTOR];
+    TSLOGSECTOR *sec = &vol->log.Sectors[s];
+    uint32_t k;
+
+    sec->Fill = FTL_SECTOR_FULL;
+    if (!flash_read(vol, sector_addr(vol, s) + SLOG_HEADERSIZE, tags, sizeof(tags))) return;
+    for (k = 1; k <= FTL_SLOTS_PER_SECTOR; k++) {
+        ftl_tag *tag = &tags[k - 1];
+        uint32_t p = (s << FTL_SLOT_SHIFT) | k;
+
+        if (is_blank((const uint32_t *)tag, sizeof(ftl_tag) / 4)) {
+            // No tag: either the end of the log or data torn by a reset
+            if (flash_read(vol, slot_addr(vol, p), vol->buf, FTL_BLOCK_SIZE) &&
+                is_blank(vol->buf, FTL_BLOCK_SIZE / 4)) {
+                sec->Fill = k;
+                break;
+            }
+            continue;
+        }
+        if (!tag_valid(vol, tag)) continue;
+        if ((int32_t)(tag->sequence - vol->next_seq) >= 0) vol->next_seq = tag->sequence + 1;
+        if (vol->map[tag->block] != FTL_UNMAPPED) {
+            ftl_tag cur;
+            if (!flash_read(vol, tag_addr(vol, vol->map[tag->block]), &cur, sizeof(cur)) ||
+                !SLOG_IsNewer(&vol->log, tag->sequence, s, cur.sequence, vol->map[tag->block] >> FTL_SLOT_SHIFT))
+                continue;
+        }
+        map_set(vol, tag->block, p);
+    }
+}
+
+boolean FTL_Mount(FTL_Volume *vol, const struct tag_NORFLASH *flash, uint32_t base, uint32_t sector_count)
+{
+    if (!vol || !flash || (base & BLOCK4K_MASK) || sector_count <= FTL_SPARE_SECTORS ||
+        sector_count > (FTL_UNMAPPED >> FTL_SLOT_SHIFT))
+        return false;
+    if (SLOG_Detach(&vol->log)) FTL_Unmount(vol);   // remount of a live volume
+    memset(vol, 0, sizeof(*vol));
+    vol->log.Flash = *flash;
+    vol->log.Base = base;
+    vol->log.SectorsCount = sector_count;
+    vol->log.Magic = FTL_MAGIC;
+    vol->log.FirstUnit = 1;
+    vol->log.EndUnit = FTL_SECTOR_FULL;
+    vol->log.MinReclaim = 1;                        // one stale slot pays for the erase
+    vol->log.ReserveSectors = FTL_RESERVE_SECTORS;
+    vol->log.FreeTarget = FTL_GC_TARGET;
+    vol->log.WearDelta = FTL_WEAR_DELTA;
+    vol->log.Reclaim = collect_step;
+    vol->log.Owner = vol;
+    vol->block_count = (sector_count - FTL_SPARE_SECTORS) * FTL_SLOTS_PER_SECTOR;
+    vol->log.Sectors = malloc(sector_count * sizeof(TSLOGSECTOR));
+    vol->map = malloc(vol->block_count * sizeof(uint16_t));
+    if (!vol->log.Sectors || !vol->map) {
+        FTL_Unmount(vol);
+        return false;
+    }
+    memset(vol->log.Sectors, 0, sector_count * sizeof(TSLOGSECTOR));
+    memset(vol->map, 0xFF, vol->block_count * sizeof(uint16_t));
+
+    if (!SLOG_Mount(&vol->log, scan_sector)) {
+        FTL_Unmount(vol);
+        return false;
+    }
+    SLOG_Attach(&vol->log, FTL_GC_DELAY_MS);
+    return true;
+}
+
+void FTL_Unmount(FTL_Volume *vol)
+{
+    if (!vol) return;
+    SLOG_Detach(&vol->log);
+    if (vol->log.Sectors) free(vol->log.Sectors);
+    if (vol->map) free(vol->map);
+    vol->log.Sectors = NULL;
+    vol->map = NULL;
+    vol->block_count = 0;
+}
+
+boolean FTL_Read(FTL_Volume *vol, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    if (!vol || !vol->map || lba + count > vol->block_count || lba + count < lba) return false;
+    for (; count; count--, lba++, buf += FTL_BLOCK_SIZE) {
+        uint16_t p = vol->map[lba];
+        if (p == FTL_UNMAPPED) memset(buf, 0, FTL_BLOCK_SIZE);
+        else if (!flash_read(vol, slot_addr(vol, p), buf, FTL_BLOCK_SIZE)) return false;
+    }
+    return true;
+}
+
+boolean FTL_Write(FTL_Volume *vol, uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    if (!vol || !vol->map || lba + count > vol->block_count || lba + count < lba) return false;
+    for (; count; count--, lba++, buf += FTL_BLOCK_SIZE) {
+        uint16_t p = vol->map[lba];
+
+        boolean same;
+
+        vol->stats.host_writes++;
+        // Filesystems rewrite FAT and directory sectors unchanged quite often
+        if (p != FTL_UNMAPPED)
+            same = flash_read(vol, slot_addr(vol, p), vol->buf, FTL_BLOCK_SIZE) &&
+                   !memcmp(vol->buf, buf, FTL_BLOCK_SIZE);
+        else
+            same = is_zero(buf, FTL_BLOCK_SIZE);
+        if (same) {
+            vol->stats.skipped_writes++;
+            continue;
+        }
+        if (!write_slot(vol, lba, buf, vol->next_seq++)) {
+            SLOG_Schedule(&vol->log);
+            return false;
+        }
+    }
+    SLOG_Schedule(&vol->log);
+    return true;
+}
+
+// Reclaims one sector, the victim is chosen by SLOG_SelectVictim
+boolean FTL_Collect(FTL_Volume *vol)
+{
+    uint32_t victim, k;
+
+    if (!vol || !vol->map || vol->log.Reclaiming) return false;
+    victim = SLOG_SelectVictim(&vol->log);
+    if (victim == SLOG_NOSECTOR) return false;
+
+    vol->log.Reclaiming = true;
+    for (k = 1; k <= FTL_SLOTS_PER_SECTOR && vol->log.Sectors[victim].Live; k++) {
+        uint32_t p = (victim << FTL_SLOT_SHIFT) | k;
+        ftl_tag tag;
+
+        if (!flash_read(vol, tag_addr(vol, p), &tag, sizeof(tag)) || !tag_valid(vol, &tag) ||
+            vol->map[tag.block] != p)
+            continue;
+        // The copy keeps its sequence, a duplicate left by a reset resolves either way
+        if (!flash_read(vol, slot_addr(vol, p), vol->buf, FTL_BLOCK_SIZE) ||
+            !write_slot(vol, tag.block, vol->buf, tag.sequence)) {
+            vol->log.Reclaiming = false;
+            return false;
+        }
+        vol->stats.gc_moves++;
+    }
+    vol->log.Reclaiming = false;
+
+    if (!SLOG_EraseSector(&vol->log, victim)) return false;
+    vol->stats.gc_runs++;
+    return true;
+}
+
+void FTL_GetStats(FTL_Volume *vol, FTL_Stats *stats)
+{
+    if (!vol || !stats) return;
+    *stats = vol->stats;
+    stats->erases = vol->log.Erases;
+    stats->min_erase = 0xFFFFFFFFu;
+    stats->max_erase = 0;
+    for (uint32_t s = 0; s < vol->log.SectorsCount; s++) {
+        const TSLOGSECTOR *sec = &vol->log.Sectors[s];
+        if (sec->EraseCount < stats->min_erase) stats->min_erase = sec->EraseCount;
+        if (sec->EraseCount > stats->max_erase) stats->max_erase = sec->EraseCount;
+    }
+}
+
+static boolean ftl_bdev_read(void *ctx, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    return FTL_Read((FTL_Volume *)ctx, lba, count, buf);
+}
+
+static boolean ftl_bdev_write(void *ctx, uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    return FTL_Write((FTL_Volume *)ctx, lba, count, buf);
+}
+
+static boolean ftl_bdev_geometry(void *ctx, uint32_t *sector_size, uint32_t *sector_count)
+{
+    FTL_Volume *vol = (FTL_Volume *)ctx;
+    if (!vol->map) return false;
+    *sector_size = FTL_BLOCK_SIZE;
+    *sector_count = vol->block_count;
+    return true;
+}
+
+static const BDEV_Ops ftl_bdev_ops = {
+    ftl_bdev_read,
+    ftl_bdev_write,
+    NULL,                   // slots are programmed before FTL_Write returns
+    ftl_bdev_geometry,
+    NULL,
+    NULL,
+    NULL
+};
+
+void FTL_GetBlockDevice(FTL_Volume *vol, BDEV_Device *dev)
+{
+    dev->ops = &ftl_bdev_ops;
+    dev->ctx = vol;
+}
@@ -0,0 +1,62 @@
+#ifndef SF_FTL_H
+#define SF_FTL_H
+#include <stdint.h>
+#include "systypes.h"
+#include "blockdev.h"
+#include "systemconfig.h"  // TSECTORLOG
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Flash translation layer: 512 byte logical blocks mapped onto 4 KiB NOR sectors with
+// out-of-place updates. The sectors form a sector log (sectorlog.h) whose units are slots:
+// the first slot of every sector holds the log header and one tag per data slot; a block
+// write programs a free data slot and then its tag, it never erases. Garbage collection
+// (copy live slots, erase the victim) runs from the sector log timer so that erased
+// sectors are ready before writes need them.
+
+#define FTL_BLOCK_SIZE          512
+#define FTL_SLOTS_PER_SECTOR    7   // data slots, slot 0 holds header and tags
+#define FTL_SPARE_SECTORS       4   // over-provisioning, not part of the exported capacity
+#define FTL_RESERVE_SECTORS     1   // erased sectors only garbage collection may open
+#define FTL_GC_TARGET           3   // background collection keeps this many sectors erased
+#define FTL_WEAR_DELTA          64  // erase count spread that moves cold sectors
+#define FTL_GC_DELAY_MS         20
+
+#define FTL_UNMAPPED            0xFFFFu
+
+typedef struct {
+    uint32_t host_writes;     // blocks written through FTL_Write
+    uint32_t skipped_writes;  // blocks whose content was already on flash
+    uint32_t slot_programs;   // data slots programmed, host writes and collection
+    uint32_t gc_runs;
+    uint32_t gc_moves;        // live slots copied by collection
+    uint32_t sync_gc;         // collections a write had to wait for
+    uint32_t erases;
+    uint32_t min_erase;
+    uint32_t max_erase;
+} FTL_Stats;
+
+typedef struct FTL_Volume FTL_Volume;
+struct FTL_Volume {
+    TSECTORLOG log;           // Fill is the first unwritten data slot, Live counts current ones
+    uint32_t block_count;     // exported logical blocks
+    uint32_t next_seq;
+    uint16_t *map;            // logical block -> sector * 8 + slot, FTL_UNMAPPED if never written
+    uint32_t buf[FTL_BLOCK_SIZE / 4];
+    FTL_Stats stats;
+};
+
+boolean FTL_Mount(FTL_Volume *vol, const struct tag_NORFLASH *flash, uint32_t base, uint32_t sector_count);
+void    FTL_Unmount(FTL_Volume *vol);
+boolean FTL_Read(FTL_Volume *vol, uint32_t lba, uint32_t count, uint8_t *buf);   // unwritten blocks read as zeros
+boolean FTL_Write(FTL_Volume *vol, uint32_t lba, uint32_t count, const uint8_t *buf);
+boolean FTL_Collect(FTL_Volume *vol); // one garbage collection step, false if nothing was reclaimed
+void    FTL_GetStats(FTL_Volume *vol, FTL_Stats *stats);
+void    FTL_GetBlockDevice(FTL_Volume *vol, BDEV_Device *dev);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
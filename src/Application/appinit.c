@@ -57,6 +57,7 @@ typedef signed int int32_t;
 #include "msdc.h"          // For minimal raw SD access
 #include "sdcmd.h"
 #include "Drivers/fs_fat32.h" // FAT32 minimal implementation
+#include "Drivers/fs_exfat.h"  // exFAT read-only fallback
 // Root clock (CONFIG_BASE) minimal defs
 #ifndef CONFIG_BASE
 #define CONFIG_BASE 0xA0010000u
@@ -74,18 +75,53 @@ static void msdc_root_clock_enable(int ctrl_index){
     USB_Print("SD(min): rootclk ctrl=%d bit=0x%lX %08lX->%08lX\r\n",ctrl_index,(unsigned long)bit,(unsigned long)before,(unsigned long)after);
 }
 
-// FAT32 directory listing callback (file-scope) used by 'p' key
-static void fat32_list_print_cb(const char *name83, uint8_t attr, uint32_t firstCluster, uint32_t sizeBytes, void *user)
+// exFAT directory listing callback used by 'p' key when the card is not FAT32
+static void exfat_list_print_cb(const char *name, uint16_t attr, uint64_t sizeBytes, void *user)
 {
     (void)user;
     char type = (attr & 0x10) ? 'D' : 'F';
-    USB_Printf(" %c %s %lu %08lX\r\n", type, name83, (unsigned long)sizeBytes, (unsigned long)firstCluster);
+    USB_Printf(" %c %s %lu\r\n", type, name, (unsigned long)sizeBytes);
 }
 // Watchdog handling: if project provides WDT APIs, define WDT_PET() macro accordingly.
 #ifndef WDT_PET
 #define WDT_PET() do { /* no-op */ } while(0)
 #endif
 
+// ---------------- Serial flash read benchmark ('Q' key) ----------------
+// Reads the same uncached flash range (resource partition) with the plain XIP memcpy and with
+// SF_Read, which switches to LDM/STM bursts for long reads. MB/s = bytes per microsecond.
+#define SF_BENCH_BYTES  (64u * 1024u)
+extern uintptr_t __ROMBase;
+static void RunFlashReadBenchmark(void)
+{
+    uint8_t *buf = malloc(SF_BENCH_BYTES);
+    if (!buf || FlashCapacity < KVSREGIONSIZE + RESREGIONSIZE + SF_BENCH_BYTES) {
+        USB_Print("SF-BENCH: no buffer or flash\r\n");
+        free(buf);
+        return;
+    }
+    uint32_t offset = FlashCapacity - KVSREGIONSIZE - RESREGIONSIZE;
+    const uint8_t *xip = (const uint8_t *)((uintptr_t)&__ROMBase + offset);
+
+    USC_StartCounter();
+    uint32_t t0 = USC_GetCurrentTicks();
+    memcpy(buf, xip, SF_BENCH_BYTES);
+    uint32_t t1 = USC_GetCurrentTicks();
+    SF_Read(SFI_CS0, (void *)offset, buf, SF_BENCH_BYTES);
+    uint32_t t2 = USC_GetCurrentTicks();
+    boolean same = memcmp(buf, xip, SF_BENCH_BYTES) == 0;
+
+    uint32_t us_copy = (t1 - t0) ? (t1 - t0) : 1u, us_bulk = (t2 - t1) ? (t2 - t1) : 1u;
+    USB_Print("SF-BENCH: %lu bytes memcpy %luus %lu.%02lu MB/s, bulk %luus %lu.%02lu MB/s%s\r\n",
+              (unsigned long)SF_BENCH_BYTES,
+              (unsigned long)us_copy, (unsigned long)(SF_BENCH_BYTES / us_copy),
+              (unsigned long)((SF_BENCH_BYTES * 100u / us_copy) % 100u),
+              (unsigned long)us_bulk, (unsigned long)(SF_BENCH_BYTES / us_bulk),
+              (unsigned long)((SF_BENCH_BYTES * 100u / us_bulk) % 100u),
+              same ? "" : " MISMATCH");
+    free(buf);
+}
+
 // ---------------- Integer Benchmark (triggered by 'W' key, key_id 19) ----------------
 static void RunIntBenchmark(void)
 {
@@ -220,6 +256,9 @@ static boolean SD_Minimal_InitAndReadLBA0(uint8_t *buf512)
 // Simple USB CDC support for key event transmission
 static TCDCEVENTER g_cdcEventer; // Persist for writes
 static volatile boolean g_cdcConnected = false;
+static volatile boolean g_heapReportPending = false; // 'H' received over CDC
+static volatile boolean g_heapTraceStart = false;    // 'R': start recording heap calls (MEMTRACE builds)
+static volatile boolean g_heapTraceDump = false;     // 'T': stop recording and dump the trace
 
 // --- Minimal inline GPIO monitor (GPIO0..11 excluding assigned 4,5,7,10,11) ---
 // --- Binary counter on GPIO0..GPIO10 (11 bits) updating every 200ms ---
@@ -255,7 +294,18 @@ static void CDC_StatusChangeHandler(TCDCSTATUS status)
 
 static void CDC_DataReceivedHandler(uint32_t received)
 {
-    (void)received; // Not used yet
+    // Called from the USB interrupt: only note the request, the snapshot is streamed from the main loop
+    uint8_t rx[16];
+    uint32_t n;
+
+    (void)received;
+    while ((n = USB_CDC_Read(&g_cdcEventer, rx, sizeof(rx))) != 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (rx[i] == 'H' || rx[i] == 'h') g_heapReportPending = true;
+            else if (rx[i] == 'R' || rx[i] == 'r') g_heapTraceStart = true;
+            else if (rx[i] == 'T' || rx[i] == 't') g_heapTraceDump = true;
+        }
+    }
 }
 
 static void CDC_DataTransmittedHandler(uint32_t transmitted)
@@ -428,6 +478,21 @@ void APP_ProcessEvents(void)
         map_inited = 1; // sentinel that array exists
     }
 
+    if (g_heapReportPending) {
+        // Heap telemetry snapshot, rendered on the host by tools/heapreport.py
+        g_heapReportPending = false;
+        MEM_ReportProfile(USB_Print);
+    }
+    if (g_heapTraceStart) {
+        g_heapTraceStart = false;
+        MEM_TraceStart();
+    }
+    if (g_heapTraceDump) {
+        // Replayed against tlsf.c on the host by tools/tlsfreplay.c
+        g_heapTraceDump = false;
+        MEM_DumpTrace(USB_Print);
+    }
+
     if (Keypad_GetKeyEvent(&event))
     {
         if (event.state == KEY_PRESSED)
@@ -466,9 +531,10 @@ void APP_ProcessEvents(void)
                     USB_Print("Key 1: Flash LED toggled\r\n");
 
                     break;
-                case 49: //Q key
+                case 49: //Q key -> serial flash read benchmark
                     //SingleLED_Toggle(LED_BLUE);
                     //SingleLED_Flash_Pattern();
+                    RunFlashReadBenchmark();
                     break;
                 case 38: // 'E' key
                     PCM_Player_PlaySample();
@@ -482,15 +548,35 @@ void APP_ProcessEvents(void)
                     Beep();
                     break;
                 case 9:{ //p key
-                    extern boolean SDM_Init(void);
-                    extern unsigned SDM_GetCapacityMB(void);
-                    extern boolean SDM_ReadBlock(uint32_t lba, uint8_t *buf);
+                    // Card and volume stay up between presses; only a card-detect change forces re-init + remount
                     static FAT32_Volume vol;
-                    if (!SDM_Init()) { USB_Print("SD init fail\r\n"); break; }
-                    USB_Printf("SD capacity ~%u MB\r\n", SDM_GetCapacityMB());
-                    if (!FAT32_Mount(&vol)) { USB_Print("FAT32 mount fail\r\n"); break; }
+                    static EXFAT_Volume xvol;
+                    static uint32_t mountedGen;
+                    static uint8_t mounted; // 0 = none, 1 = FAT32, 2 = exFAT
+                    uint32_t t0 = USC_GetCurrentTicks();
+                    if (!SDM_Open()) { USB_Print("SD init fail\r\n"); mounted = 0; break; }
+                    if (!mounted || mountedGen != SDM_GetGeneration()) {
+                        USB_Printf("SD capacity ~%u MB\r\n", SDM_GetCapacityMB());
+                        mountedGen = SDM_GetGeneration();
+                        mounted = FAT32_Mount(&vol) ? 1 : (EXFAT_Mount(&xvol, &SDM_BlockDevice) ? 2 : 0);
+                        if (!mounted) { USB_Print("FAT32/exFAT mount fail\r\n"); break; }
+                    }
+                    USB_Printf("SD session ready in %lu us\r\n", (unsigned long)(USC_GetCurrentTicks() - t0));
+                    if (mounted == 2) {
+                        uint32_t freeClusters;
+                        USB_Print("exFAT root dir listing:\r\n");
+                        EXFAT_ListDirectory(&xvol, "/", exfat_list_print_cb, NULL);
+                        if (EXFAT_GetFreeClusters(&xvol, &freeClusters))
+                            USB_Printf("exFAT free clusters=%lu\r\n", (unsigned long)freeClusters);
+                        break;
+                    }
+                    static FAT32_Dir dir;
+                    static FAT32_DirEntry de;
                     USB_Print("Root dir listing:\r\n");
-                    FAT32_ListRoot(&vol, fat32_list_print_cb, NULL);
+                    if (FAT32_OpenDir(&vol, "/", &dir))
+                        while (FAT32_ReadDir(&dir, &de))
+                            USB_Printf(" %c %s %lu\r\n", (de.attr & 0x10) ? 'D' : 'F', de.name, (unsigned long)de.size_bytes);
+                    USB_Printf("FAT cache hits=%lu misses=%lu\r\n", (unsigned long)vol.fat_cache_hits, (unsigned long)vol.fat_cache_misses);
                     break;
                 }
 
@@ -55,6 +55,8 @@ void AFE_SetOutputVolume(uint8_t left, uint8_t right) {
 #define DL_PATH 0
 #endif
 
+#define PCM_TONE_CHUNK  512   // samples generated per pass of the test tone
+
 // ----- Add a simple generated tone buffer to prove path first -----
 static void gen_sine16(int16_t *buf, uint32_t samples, uint32_t fs, uint32_t f)
 {
@@ -136,11 +138,12 @@ void PCM_Player_PlayBuffer(const int16_t *buf, uint32_t samples, uint32_t sample
 void PCM_Player_PlayTestTone(uint32_t freq_hz, uint32_t ms)
 {
     const uint32_t fs = 8000;
-    static int16_t tmp[1024];
+    int16_t *tmp = malloc_fast(PCM_TONE_CHUNK * sizeof(int16_t));   // TCM when it fits
     uint32_t total = (uint64_t)ms * fs / 1000;
+    if (!tmp) return;
     pcm_hw_enable(fs);
     while (total) {
-        uint32_t chunk = (total > 1024) ? 1024 : total;
+        uint32_t chunk = (total > PCM_TONE_CHUNK) ? PCM_TONE_CHUNK : total;
         gen_sine16(tmp, chunk, fs, freq_hz);
         for (uint32_t i=0; i<chunk; i++) {
             fifo_wait_space();
@@ -150,6 +153,7 @@ void PCM_Player_PlayTestTone(uint32_t freq_hz, uint32_t ms)
     }
     USC_Pause_us(2000);
     pcm_hw_disable();
+    free(tmp);
     USB_Print("PCM: test tone done\n");
 }
 
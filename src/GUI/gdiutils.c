@@ -125,9 +125,20 @@ boolean IsRectCollapsed(pRECT rct)
            (rct->l > rct->r) || (rct->t > rct->b);
 }
 
+/* Region lists, their rectangles and RLISTs live in the per event scratch arena. free()
+   of them is harmless, the arena is reset after the event has been dispatched. */
+pDLIST GDI_CreateRegion(void)
+{
+    pDLIST tmpRegion = SCRATCH_Alloc(sizeof(TDLIST));
+
+    if (tmpRegion != NULL) memset(tmpRegion, 0x00, sizeof(TDLIST));
+
+    return tmpRegion;
+}
+
 pRLIST GDI_CreateRList(void)
 {
-    pRLIST tmpRList = malloc(sizeof(TRLIST));
+    pRLIST tmpRList = SCRATCH_Alloc(sizeof(TRLIST));
 
     if (tmpRList != NULL)
         tmpRList->Count = 0;
@@ -270,11 +281,11 @@ pDLIST GDI_ADDRectangles(pRECT a, pRECT b)
     if ((a == NULL) || (b == NULL)) return NULL;
     if (!IsRectsOverlaps(a, b))
     {
-        ResRects = DL_Create();
+        ResRects = GDI_CreateRegion();
         if (ResRects != NULL)
         {
-            tmpRectA = malloc(sizeof(TRECTITEM));
-            tmpRectB = malloc(sizeof(TRECTITEM));
+            tmpRectA = SCRATCH_Alloc(sizeof(TRECTITEM));
+            tmpRectB = SCRATCH_Alloc(sizeof(TRECTITEM));
             if ((tmpRectA == NULL) || (tmpRectB == NULL))
             {
                 free(tmpRectA);
@@ -292,10 +303,10 @@ pDLIST GDI_ADDRectangles(pRECT a, pRECT b)
     {
         if (IsRectInRect(a, b))
         {
-            tmpRectA = malloc(sizeof(TRECTITEM));
+            tmpRectA = SCRATCH_Alloc(sizeof(TRECTITEM));
             if (tmpRectA != NULL)
             {
-                ResRects = DL_Create();
+                ResRects = GDI_CreateRegion();
                 tmpRectA->Rct = *a;
                 if (ResRects != NULL) DL_AddItemPtr(ResRects, &tmpRectA->ListHeader);
                 else
@@ -312,20 +323,20 @@ pDLIST GDI_ADDRectangles(pRECT a, pRECT b)
             if (tmpRList != NULL)
             {
                 if (tmpRList->Count &&
-                        ((ResRects = DL_Create()) != NULL))
+                        ((ResRects = GDI_CreateRegion()) != NULL))
                 {
                     uint32_t i;
 
                     for(i = 0; i < tmpRList->Count; i++)
                     {
-                        tmpRectB = malloc(sizeof(TRECTITEM));
+                        tmpRectB = SCRATCH_Alloc(sizeof(TRECTITEM));
                         if (tmpRectB != NULL)
                         {
                             tmpRectB->Rct = tmpRList->Item[i];
                             DL_AddItemPtr(ResRects, &tmpRectB->ListHeader);
                         }
                     }
-                    tmpRectB = malloc(sizeof(TRECTITEM));
+                    tmpRectB = SCRATCH_Alloc(sizeof(TRECTITEM));
                     if (tmpRectB != NULL)
                     {
                         tmpRectB->Rct = *b;
@@ -421,7 +432,7 @@ boolean GDI_ADDRectToRegion(pDLIST Region, pRECT Rct)
 
                         for(i = 1; i < tmpList->Count; i++)
                         {
-                            if ((tmpRectItem = malloc(sizeof(TRECTITEM))) != NULL)
+                            if ((tmpRectItem = SCRATCH_Alloc(sizeof(TRECTITEM))) != NULL)
                             {
                                 tmpRectItem->Rct = tmpList->Item[i];
                                 DL_InsertItemBeforePtr(Region, tmpItem, (pDLITEM)tmpRectItem);
@@ -444,7 +455,7 @@ boolean GDI_ADDRectToRegion(pDLIST Region, pRECT Rct)
             tmpItem = DL_GetNextItem(tmpItem);
         }
     }
-    tmpRectItem = malloc(sizeof(TRECTITEM));
+    tmpRectItem = SCRATCH_Alloc(sizeof(TRECTITEM));
     if (tmpRectItem != NULL)
     {
         tmpRectItem->Rct = *Rct;
@@ -482,7 +493,7 @@ boolean GDI_SUBRectFromRegion(pDLIST Region, pRECT Rct)
                         {
                             pRECTITEM tmpRectItem;
 
-                            if ((tmpRectItem = malloc(sizeof(TRECTITEM))) != NULL)
+                            if ((tmpRectItem = SCRATCH_Alloc(sizeof(TRECTITEM))) != NULL)
                             {
                                 tmpRectItem->Rct = tmpList->Item[i];
                                 DL_InsertItemBeforePtr(Region, tmpItem, (pDLITEM)tmpRectItem);
@@ -39,6 +39,7 @@ extern TSIZEXY SizeXY(uint16_t sx, uint16_t sy);
 extern boolean IsRectsOverlaps(pRECT a, pRECT b);
 extern boolean IsPointInRect(pPOINT Pt, pRECT Rct);
 extern boolean IsRectCollapsed(pRECT rct);
+extern pDLIST GDI_CreateRegion(void);
 extern pRLIST GDI_CreateRList(void);
 extern pRLIST GDI_DeleteRList(pRLIST RList);
 extern TPOINT GDI_LocalToGlobalPt(pPOINT pt, pPOINT Offset);
@@ -286,8 +286,8 @@ void GUI_OnPaintHandler(pPAINTEV Event)
         if ((GUILayer[Layer] != NULL) &&
                 GDI_ANDRectangles(&Event->UpdateRect, &LCDScreen.VLayer[Layer].LayerRgn))
         {
-            pDLIST    UpdateRgn = DL_Create();
-            pRECTITEM SeedRect = malloc(sizeof(TRECTITEM));
+            pDLIST    UpdateRgn = GDI_CreateRegion();
+            pRECTITEM SeedRect = SCRATCH_Alloc(sizeof(TRECTITEM));
 
             if ((UpdateRgn != NULL) && (SeedRect != NULL) &&
                     DL_AddItemPtr(UpdateRgn, &SeedRect->ListHeader))
@@ -28,5 +28,6 @@
 #include "gdi.h"
 #include "gui.h"
 #include "fontlib.h"
+#include "resource.h"
 
 #endif /* _GUILIB_H_ */
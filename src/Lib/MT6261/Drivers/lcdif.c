@@ -32,6 +32,8 @@ pLAYER LCDIF_LAYER[LCDIF_NUMLAYERS] = {(volatile pLAYER) &LCDIF_LAYER0BASE,
 TSCREEN LCDScreen;
 pDLIST  LCDIFQueue;
 
+static TSLAB LCDCmdSlab = SLAB("LCDCmd", sizeof(TLCDCMD), LCDIF_CMDSLABBLOCKS);
+
 void LCDIF_WriteCommand(uint8_t Cmd)
 {
     LCDIF_SCMD0 = Cmd;
@@ -122,7 +124,7 @@ boolean LCDIF_AddCommandToQueue(uint32_t *CmdArray, uint32_t CmdCount, pRECT Upd
 
     if (CmdCount && (CmdArray != NULL))
     {
-        CMD = malloc(sizeof(TLCDCMD));
+        CMD = SLAB_Alloc(&LCDCmdSlab);
         if (CMD != NULL)
         {
             CMD->CMDCount = CmdCount;
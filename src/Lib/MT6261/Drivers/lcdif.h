@@ -22,6 +22,7 @@
 #include "gditypes.h"
 
 #define MAX_LCDQUEUE_SIZE           128
+#define LCDIF_CMDSLABBLOCKS         32                                                              // Queue entries served by the slab
 
 #define LCDIF_STA                   (*(volatile uint16_t *)(LCDIF_BASE + 0x0000))
 #define LCDIF_RUNNING               (1 << 0)
@@ -25,6 +25,7 @@
 #define CMD2_ALL_SEND_CID           0x02                                                            // Asks any card to send the CID
 #define CMD3_SEND_RELATIVE_ADDR     0x03                                                            // Ask the card to publish a new relative address (RCA)
 #define CMD4_SET_DSR                0x04                                                            // Programs the DSR of all cards
+#define CMD6_SWITCH_FUNC            0x06                                                            // Checks switchable function (mode 0) or switches card function (mode 1)
 #define CMD7_SELECT_CARD            0x07
 #define CMD8_SEND_IF_COND           0x08                                                            // Sends SD Memory Card interface condition
 #define CMD9_SEND_CSD               0x09                                                            // Addressed card sends its card-specific data (CSD)
@@ -68,6 +69,7 @@
 #define MSDC_CMD2                   (SDC_RSPTYP(SDC_RSP_R2) | CMD2_ALL_SEND_CID)
 #define MSDC_CMD3                   (SDC_RSPTYP(SDC_RSP_R6) | CMD3_SEND_RELATIVE_ADDR)
 #define MSDC_CMD4                   (SDC_RSPTYP(SDC_NO_RSP) | CMD4_SET_DSR)
+#define MSDC_CMD6                   (SDC_DTYPE(SDC_DTYPE_SINGLE) | SDC_RSPTYP(SDC_RSP_R1) | CMD6_SWITCH_FUNC)
 #define MSDC_CMD7                   (SDC_RSPTYP(SDC_RSP_R1B) | CMD7_SELECT_CARD)
 #define MSDC_CMD8                   (SDC_RSPTYP(SDC_RSP_R1) | CMD8_SEND_IF_COND)
 #define MSDC_CMD9                   (SDC_RSPTYP(SDC_RSP_R2) | CMD9_SEND_CSD)
@@ -181,6 +181,19 @@ __loop_sec_memset:
 	bl      __restore_interrupts
 	ldmfd   sp!, {r0, r3, pc}
     .endfunc
+///////////////////////////////////////////////////////////////////////////////////////////////////
+    .globl  __copy_bursts
+    .type   __copy_bursts, %function
+    .func   __copy_bursts
+__copy_bursts:
+    stmfd   sp!, {r4-r10, lr}                                                                       // void __copy_bursts(void *Dst, const void *Src, size_t Count);
+__loop_copy_bursts:                                                                                 // Count of 32 byte blocks, word aligned Src and Dst
+    subs    r2, r2, #1
+    ldmge   r1!, {r3-r10}                                                                           // One 8 word burst
+    stmge   r0!, {r3-r10}
+    bgt     __loop_copy_bursts
+    ldmfd   sp!, {r4-r10, pc}
+    .endfunc
 ///////////////////////////////////////////////////////////////////////////////////////////////////
     .globl  __is_in_isr_mode
     .type   __is_in_isr_mode, %function
@@ -22,6 +22,7 @@
 #include "evmngr.h"
 
 static pDLIST EventsList;
+static TSLAB  EventsSlab = SLAB("Events", sizeof(TEVENT) + EM_SLABPARAMSIZE, EM_SLABBLOCKS);
 
 static pEVENT EM_GetTopEvent(void)
 {
@@ -44,7 +45,9 @@ boolean EM_PostEvent(TEVTYPE Type, void *Object, void *Param, uint32_t ParamSz)
 
     if (Param == NULL) ParamSz = 0;
 
-    tmpEvent = malloc(sizeof(TEVENT) + ParamSz);
+    /* Posted from ISRs too, the slab avoids a TLSF call with interrupts disabled */
+    if (ParamSz <= EM_SLABPARAMSIZE) tmpEvent = SLAB_Alloc(&EventsSlab);
+    else tmpEvent = malloc(sizeof(TEVENT) + ParamSz);
     if (tmpEvent != NULL)
     {
         tmpEvent->Event = Type;
@@ -97,9 +100,18 @@ void EM_ProcessEvents(void)
                 if (EvTimer->Handler != NULL) EvTimer->Handler(EvTimer);
             }
             break;
+        case ET_SDCOMPLETE:
+            if (tmpEvent->ParamSz == sizeof(SDM_Request *))
+                SDM_CompleteRequest(*(SDM_Request **)tmpEvent->Param);
+            break;
+        case ET_SFCOMPLETE:
+            if (tmpEvent->ParamSz == sizeof(pSFJOB))
+                SF_CompleteJob(*(pSFJOB *)tmpEvent->Param);
+            break;
         default:
             break;
         }
         free(tmpEvent);
+        SCRATCH_Reset();                                                                            // Regions of the handler are dead now
     }
 }
@@ -31,9 +31,15 @@ typedef enum tag_EVTYPE
     ET_GODESTROY,
     /* System events */
     ET_PWRKEY,
-    ET_ONTIMER
+    ET_ONTIMER,
+    /* Driver events */
+    ET_SDCOMPLETE,
+    ET_SFCOMPLETE
 } TEVTYPE;
 
+#define EM_SLABPARAMSIZE            16                                                              // Largest parameter served by the events slab
+#define EM_SLABBLOCKS               32
+
 typedef struct tag_EVENT
 {
     TDLITEM  ListHeader;
@@ -21,31 +21,181 @@
 #include "systemconfig.h"
 #include "fscache.h"
 
-static pFCBLOCK FSC_FindBlock(pFSCACHE Cache, uint32_t BlockIndex)
+#define FSC_ALIGN4(x)               (((x) + 3) & ~3UL)
+
+static uint32_t FSC_Hash(pFSCACHE Cache, uint32_t BlockIndex)
+{
+    /* Fibonacci hashing, top bits of the product select the slot */
+    return (uint32_t)(BlockIndex * 0x9E3779B1UL) >> Cache->HashShift;
+}
+
+static uint8_t *FSC_BlockData(pFSCACHE Cache, uint32_t Block)
+{
+    return &Cache->Data[Block * Cache->BlockSize];
+}
+
+/* Returns the hash slot holding BlockIndex, or the empty slot where it would be inserted */
+static uint32_t FSC_FindSlot(pFSCACHE Cache, uint32_t BlockIndex)
+{
+    uint32_t Slot = FSC_Hash(Cache, BlockIndex);
+
+    while(Cache->HashTable[Slot] != FSC_NOBLOCK)
+    {
+        if (Cache->Blocks[Cache->HashTable[Slot]].BlockIndex == BlockIndex) break;
+        Slot = (Slot + 1) & Cache->HashMask;
+    }
+    return Slot;
+}
+
+static uint32_t FSC_FindBlock(pFSCACHE Cache, uint32_t BlockIndex)
 {
-    pDLITEM tmpBlockItem = DL_GetFirstItem(&Cache->BlockList);
+    return Cache->HashTable[FSC_FindSlot(Cache, BlockIndex)];
+}
+
+/* Backward-shift deletion keeps linear probe chains intact without tombstones */
+static void FSC_HashRemove(pFSCACHE Cache, uint32_t BlockIndex)
+{
+    uint32_t Hole = FSC_FindSlot(Cache, BlockIndex);
+    uint32_t Slot = Hole;
 
-    while(tmpBlockItem != NULL)
+    if (Cache->HashTable[Hole] == FSC_NOBLOCK) return;
+    Cache->HashTable[Hole] = FSC_NOBLOCK;
+    while(1)
     {
-        if (((pFCBLOCK)tmpBlockItem)->BlockIndex == BlockIndex) break;
-        tmpBlockItem = DL_GetNextItem(tmpBlockItem);
+        uint32_t Home;
+
+        Slot = (Slot + 1) & Cache->HashMask;
+        if (Cache->HashTable[Slot] == FSC_NOBLOCK) break;
+        Home = FSC_Hash(Cache, Cache->Blocks[Cache->HashTable[Slot]].BlockIndex);
+        /* Move the entry back unless its home slot lies cyclically in (Hole, Slot] */
+        if (((Slot - Home) & Cache->HashMask) >= ((Slot - Hole) & Cache->HashMask))
+        {
+            Cache->HashTable[Hole] = Cache->HashTable[Slot];
+            Cache->HashTable[Slot] = FSC_NOBLOCK;
+            Hole = Slot;
+        }
     }
-    return (pFCBLOCK)tmpBlockItem;
+}
+
+static void FSC_LRUUnlink(pFSCACHE Cache, uint32_t Block)
+{
+    pFCBLOCK tmpBlock = &Cache->Blocks[Block];
+
+    if (tmpBlock->Prev != FSC_NOBLOCK) Cache->Blocks[tmpBlock->Prev].Next = tmpBlock->Next;
+    else Cache->Head = tmpBlock->Next;
+    if (tmpBlock->Next != FSC_NOBLOCK) Cache->Blocks[tmpBlock->Next].Prev = tmpBlock->Prev;
+    else Cache->Tail = tmpBlock->Prev;
+    tmpBlock->Prev = tmpBlock->Next = FSC_NOBLOCK;
+}
+
+static void FSC_LRUPushFront(pFSCACHE Cache, uint32_t Block)
+{
+    pFCBLOCK tmpBlock = &Cache->Blocks[Block];
+
+    tmpBlock->Prev = FSC_NOBLOCK;
+    tmpBlock->Next = Cache->Head;
+    if (Cache->Head != FSC_NOBLOCK) Cache->Blocks[Cache->Head].Prev = Block;
+    else Cache->Tail = Block;
+    Cache->Head = Block;
+}
+
+static boolean FSC_WriteBackBlock(pFSCACHE Cache, uint32_t Block)
+{
+    pFCBLOCK tmpBlock = &Cache->Blocks[Block];
+
+    if (!(tmpBlock->Flags & FCBF_DIRTY)) return true;
+    if ((Cache->WriteBack == NULL) ||
+            !Cache->WriteBack(Cache->WriteBackContext, tmpBlock->BlockIndex, FSC_BlockData(Cache, Block)))
+        return false;
+    tmpBlock->Flags &= ~FCBF_DIRTY;
+    Cache->Stats.WriteBacks++;
+    return true;
+}
+
+/* Drops a block without writing it back and returns it to the free list */
+static void FSC_ReleaseBlock(pFSCACHE Cache, uint32_t Block)
+{
+    pFCBLOCK tmpBlock = &Cache->Blocks[Block];
+
+    FSC_HashRemove(Cache, tmpBlock->BlockIndex);
+    FSC_LRUUnlink(Cache, Block);
+    tmpBlock->Flags = FCBF_NONE;
+    tmpBlock->Next = Cache->FreeList;
+    Cache->FreeList = Block;
+    Cache->BlocksCount--;
+}
+
+static uint32_t FSC_AllocateBlock(pFSCACHE Cache)
+{
+    uint32_t Block = Cache->FreeList;
+
+    if (Block == FSC_NOBLOCK)
+    {
+        /* Evict the least recently used block, a dirty one must reach the backing store first */
+        Block = Cache->Tail;
+        if ((Block == FSC_NOBLOCK) || !FSC_WriteBackBlock(Cache, Block)) return FSC_NOBLOCK;
+        FSC_ReleaseBlock(Cache, Block);
+        Cache->Stats.Evictions++;
+    }
+    Cache->FreeList = Cache->Blocks[Block].Next;
+    return Block;
+}
+
+static uint32_t FSC_PutDataBlock(pFSCACHE Cache, uint32_t BlockIndex, void *Data)
+{
+    uint32_t Block = FSC_FindBlock(Cache, BlockIndex);
+
+    if (Block != FSC_NOBLOCK) FSC_LRUUnlink(Cache, Block);
+    else
+    {
+        Block = FSC_AllocateBlock(Cache);
+        if (Block == FSC_NOBLOCK) return FSC_NOBLOCK;
+
+        Cache->Blocks[Block].BlockIndex = BlockIndex;
+        Cache->Blocks[Block].Flags = FCBF_VALID;
+        Cache->HashTable[FSC_FindSlot(Cache, BlockIndex)] = Block;
+        Cache->BlocksCount++;
+    }
+    memcpy(FSC_BlockData(Cache, Block), Data, Cache->BlockSize);
+    FSC_LRUPushFront(Cache, Block);
+    return Block;
 }
 
 pFSCACHE FSC_Create(uint32_t BlockSize, uint32_t MaxBlocksCount)
 {
     pFSCACHE NewFSCache = NULL;
 
-    if (BlockSize)
+    MaxBlocksCount = min(FSCACHEMAXBLOCKS, MaxBlocksCount);
+    if (BlockSize && MaxBlocksCount)
     {
-        NewFSCache = malloc(sizeof(TFSCACHE));
+        uint32_t HashSize = 2, HashBits = 1;
+        uint32_t BlocksOffset, HashOffset, DataOffset;
+
+        /* Load factor stays at or below 1/2 so probe chains remain short */
+        while(HashSize < 2 * MaxBlocksCount)
+        {
+            HashSize <<= 1;
+            HashBits++;
+        }
+        BlocksOffset = FSC_ALIGN4(sizeof(TFSCACHE));
+        HashOffset = FSC_ALIGN4(BlocksOffset + MaxBlocksCount * sizeof(TFCBLOCK));
+        DataOffset = FSC_ALIGN4(HashOffset + HashSize * sizeof(uint16_t));
+
+        /* Header, block descriptors, hash index and data share a single allocation */
+        NewFSCache = malloc(DataOffset + MaxBlocksCount * BlockSize);
         if (NewFSCache != NULL)
         {
             memset(NewFSCache, 0x00, sizeof(TFSCACHE));
 
             NewFSCache->BlockSize = BlockSize;
-            NewFSCache->MaxBlocksCount = min(FSCACHEMAXBLOCKS, MaxBlocksCount);
+            NewFSCache->MaxBlocksCount = MaxBlocksCount;
+            NewFSCache->HashMask = HashSize - 1;
+            NewFSCache->HashShift = 32 - HashBits;
+            NewFSCache->Blocks = (pFCBLOCK)((uint8_t *)NewFSCache + BlocksOffset);
+            NewFSCache->HashTable = (uint16_t *)((uint8_t *)NewFSCache + HashOffset);
+            NewFSCache->Data = (uint8_t *)NewFSCache + DataOffset;
+            memset(NewFSCache->HashTable, 0xFF, HashSize * sizeof(uint16_t));
+            FSC_Invalidate(NewFSCache, FSC_INVALIDATEALL, 0);
         }
     }
     return NewFSCache;
@@ -55,13 +205,13 @@ pFSCACHE FSC_Destroy(pFSCACHE Cache)
 {
     if (Cache != NULL)
     {
-        if (DL_GetItemsCount(&Cache->BlockList))
-            DL_Delete(&Cache->BlockList, false);
+        FSC_Flush(Cache);
         if (IsDynamicMemory(Cache)) free(Cache);
     }
     return NULL;
 }
 
+/* Invalidation discards cached data, dirty blocks included; call FSC_Flush() first to keep them */
 boolean FSC_Invalidate(pFSCACHE Cache, TFSCCMD Command, uint32_t BlockIndex)
 {
     boolean Result = false;
@@ -71,18 +221,30 @@ boolean FSC_Invalidate(pFSCACHE Cache, TFSCCMD Command, uint32_t BlockIndex)
         switch (Command)
         {
         case FSC_INVALIDATEALL:
-            while(DL_GetItemsCount(&Cache->BlockList))
-                DL_DeleteFirstItem(&Cache->BlockList);
+        {
+            uint32_t i;
+
+            for(i = 0; i < Cache->MaxBlocksCount; i++)
+            {
+                Cache->Blocks[i].Flags = FCBF_NONE;
+                Cache->Blocks[i].Prev = FSC_NOBLOCK;
+                Cache->Blocks[i].Next = (i + 1 < Cache->MaxBlocksCount) ? i + 1 : FSC_NOBLOCK;
+            }
+            memset(Cache->HashTable, 0xFF, (Cache->HashMask + 1) * sizeof(uint16_t));
+            Cache->Head = Cache->Tail = FSC_NOBLOCK;
+            Cache->FreeList = 0;
+            Cache->BlocksCount = 0;
             Result = true;
-            break;
+        }
+        break;
         case FSC_INVALIDATEBLOCK:
         {
-            pFCBLOCK tmpBlock = FSC_FindBlock(Cache, BlockIndex);
+            uint32_t Block = FSC_FindBlock(Cache, BlockIndex);
 
-            if (tmpBlock != NULL)
+            if (Block != FSC_NOBLOCK)
             {
-                Result = DL_ExcludeItem(&Cache->BlockList, &tmpBlock->ListHeader);
-                free(tmpBlock);
+                FSC_ReleaseBlock(Cache, Block);
+                Result = true;
             }
         }
         break;
@@ -93,44 +255,96 @@ boolean FSC_Invalidate(pFSCACHE Cache, TFSCCMD Command, uint32_t BlockIndex)
 
 boolean FSC_StoreDataBlock(pFSCACHE Cache, uint32_t BlockIndex, void *Data)
 {
-    boolean Result = false;
+    if ((Cache != NULL) && (Data != NULL))
+        return (FSC_PutDataBlock(Cache, BlockIndex, Data) != FSC_NOBLOCK);
+    else return false;
+}
+
+void *FSC_GetDataBlock(pFSCACHE Cache, uint32_t BlockIndex)
+{
+    if (Cache != NULL)
+    {
+        uint32_t Block = FSC_FindBlock(Cache, BlockIndex);
 
+        if (Block != FSC_NOBLOCK)
+        {
+            /* Keep the list in LRU order: a hit becomes the most recently used block */
+            FSC_LRUUnlink(Cache, Block);
+            FSC_LRUPushFront(Cache, Block);
+            Cache->Stats.Hits++;
+            return FSC_BlockData(Cache, Block);
+        }
+        Cache->Stats.Misses++;
+    }
+    return NULL;
+}
+
+void FSC_SetWriteBack(pFSCACHE Cache, TFSCWRITEBACK Handler, void *Context)
+{
+    if (Cache != NULL)
+    {
+        Cache->WriteBack = Handler;
+        Cache->WriteBackContext = Context;
+    }
+}
+
+/* Stores Data and marks the block dirty; it reaches the backing store on eviction or FSC_Flush() */
+boolean FSC_WriteDataBlock(pFSCACHE Cache, uint32_t BlockIndex, void *Data)
+{
     if ((Cache != NULL) && (Data != NULL))
     {
-        pFCBLOCK DataBlock = FSC_FindBlock(Cache, BlockIndex);
+        uint32_t Block = FSC_PutDataBlock(Cache, BlockIndex, Data);
 
-        if (DataBlock != NULL)
+        if (Block != FSC_NOBLOCK)
         {
-            memcpy(DataBlock->BlockData, Data, Cache->BlockSize);
-            Result = DL_MoveItemToIndex(&Cache->BlockList, 0, &DataBlock->ListHeader);
+            Cache->Blocks[Block].Flags |= FCBF_DIRTY;
+            return true;
         }
-        else
+    }
+    return false;
+}
+
+/* For blocks modified in place through the pointer returned by FSC_GetDataBlock() */
+boolean FSC_MarkDirty(pFSCACHE Cache, uint32_t BlockIndex)
+{
+    if (Cache != NULL)
+    {
+        uint32_t Block = FSC_FindBlock(Cache, BlockIndex);
+
+        if (Block != FSC_NOBLOCK)
         {
-            DataBlock = malloc(sizeof(TFCBLOCK) + Cache->BlockSize);
-            if (DataBlock != NULL)
-            {
-                while(DL_GetItemsCount(&Cache->BlockList) >= Cache->MaxBlocksCount)
-                {
-                    pDLITEM tmpItem = DL_GetLastItem(&Cache->BlockList);
-
-                    if (tmpItem == NULL) break;
-                    DL_DeleteItem(&Cache->BlockList, tmpItem);
-                }
-                memcpy(DataBlock->BlockData, Data, Cache->BlockSize);
-                DataBlock->BlockIndex = BlockIndex;
-                Result = DL_AddItemAtIndexPtr(&Cache->BlockList, 0, &DataBlock->ListHeader);
-            }
+            Cache->Blocks[Block].Flags |= FCBF_DIRTY;
+            return true;
+        }
+    }
+    return false;
+}
+
+boolean FSC_Flush(pFSCACHE Cache)
+{
+    boolean Result = false;
+
+    if (Cache != NULL)
+    {
+        uint32_t Block = Cache->Tail;
+
+        /* Oldest first */
+        Result = true;
+        while(Block != FSC_NOBLOCK)
+        {
+            if (!FSC_WriteBackBlock(Cache, Block)) Result = false;
+            Block = Cache->Blocks[Block].Prev;
         }
     }
     return Result;
 }
 
-void *FSC_GetDataBlock(pFSCACHE Cache, uint32_t BlockIndex)
+void FSC_GetStats(pFSCACHE Cache, pFCSTATS Stats)
 {
-    pFCBLOCK DataBlock;
+    if ((Cache != NULL) && (Stats != NULL)) *Stats = Cache->Stats;
+}
 
-    if ((Cache != NULL) &&
-            ((DataBlock = FSC_FindBlock(Cache, BlockIndex)) != NULL))
-        return DataBlock->BlockData;
-    else return NULL;
+void FSC_ResetStats(pFSCACHE Cache)
+{
+    if (Cache != NULL) memset(&Cache->Stats, 0x00, sizeof(TFCSTATS));
 }
@@ -20,6 +20,7 @@
 #define _FSCACHE_H_
 
 #define FSCACHEMAXBLOCKS            128
+#define FSC_NOBLOCK                 0xFFFF
 
 typedef enum tag_FSCCMD
 {
@@ -27,24 +28,60 @@ typedef enum tag_FSCCMD
     FSC_INVALIDATEBLOCK
 } TFSCCMD;
 
-typedef struct tag_FCACHE
+typedef enum tag_FCBFLAGS
 {
-    uint32_t BlockSize;
-    uint32_t MaxBlocksCount;
-    TDLIST   BlockList;
-} TFSCACHE, *pFSCACHE;
+    FCBF_NONE  = 0,
+    FCBF_VALID = (1 << 0),
+    FCBF_DIRTY = (1 << 1)
+} TFCBFLAGS;
+
+/* Write-back handler for dirty blocks: returns true when Data reached the backing store */
+typedef boolean (*TFSCWRITEBACK)(void *Context, uint32_t BlockIndex, void *Data);
 
 typedef struct tag_FCBLOCK
 {
-    TDLITEM  ListHeader;
     uint32_t BlockIndex;
-    uint8_t  BlockData[];
+    uint16_t Prev;                                      // LRU neighbour towards the head (more recent)
+    uint16_t Next;                                      // LRU neighbour towards the tail, or free list link
+    uint8_t  Flags;                                     // TFCBFLAGS
 } TFCBLOCK, *pFCBLOCK;
 
+typedef struct tag_FCSTATS
+{
+    uint32_t Hits;
+    uint32_t Misses;
+    uint32_t Evictions;
+    uint32_t WriteBacks;
+} TFCSTATS, *pFCSTATS;
+
+typedef struct tag_FCACHE
+{
+    uint32_t      BlockSize;
+    uint32_t      MaxBlocksCount;
+    uint32_t      BlocksCount;                          // Valid blocks
+    uint32_t      HashMask;                             // Hash table size - 1 (power of 2, >= 2 * MaxBlocksCount)
+    uint32_t      HashShift;
+    uint16_t      Head;                                 // Most recently used block
+    uint16_t      Tail;                                 // Least recently used block
+    uint16_t      FreeList;
+    uint16_t     *HashTable;                            // Block number per slot, FSC_NOBLOCK if empty
+    pFCBLOCK      Blocks;                               // Block headers, MaxBlocksCount entries
+    uint8_t      *Data;                                 // Block data slab, MaxBlocksCount * BlockSize
+    TFSCWRITEBACK WriteBack;
+    void         *WriteBackContext;
+    TFCSTATS      Stats;
+} TFSCACHE, *pFSCACHE;
+
 extern pFSCACHE FSC_Create(uint32_t BlockSize, uint32_t MaxBlocksCount);
 extern pFSCACHE FSC_Destroy(pFSCACHE Cache);
 extern boolean FSC_Invalidate(pFSCACHE Cache, TFSCCMD Command, uint32_t Block);
 extern boolean FSC_StoreDataBlock(pFSCACHE Cache, uint32_t BlockIndex, void *Data);
 extern void *FSC_GetDataBlock(pFSCACHE Cache, uint32_t BlockIndex);
+extern void FSC_SetWriteBack(pFSCACHE Cache, TFSCWRITEBACK Handler, void *Context);
+extern boolean FSC_WriteDataBlock(pFSCACHE Cache, uint32_t BlockIndex, void *Data);
+extern boolean FSC_MarkDirty(pFSCACHE Cache, uint32_t BlockIndex);
+extern boolean FSC_Flush(pFSCACHE Cache);
+extern void FSC_GetStats(pFSCACHE Cache, pFCSTATS Stats);
+extern void FSC_ResetStats(pFSCACHE Cache);
 
 #endif /* _FSCACHE_H_ */
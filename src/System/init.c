@@ -59,6 +59,12 @@ void Init(void)
     DebugPrint("Initialize low resolution timers pool...");
     DebugPrint((LRT_Initialize()) ? "Complete.\r\n" : "Failed\r\n");
 
+    DebugPrint("Initialize key/value store...");
+    DebugPrint((KVS_Initialize() != NULL) ? "Complete.\r\n" : "Failed\r\n");
+
+    DebugPrint("Initialize resource archive...");
+    DebugPrint((RES_Initialize()) ? "Complete.\r\n" : "Not found\r\n");
+
     DebugPrint("Power management initialization");
     PMU_Initialize();
 
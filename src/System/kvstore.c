@@ -0,0 +1,511 @@
+/*
+* This file is part of the DZ09 project.
+*
+* Copyright (C) 2022 AJScorp
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+#include "systemconfig.h"
+#include "kvstore.h"
+
+/*
+ * Log-structured key/value store on a sector log (sectorlog.c). Records are appended behind
+ * the sector header and never rewritten: an update or delete appends a newer record and
+ * the old one becomes garbage. The RAM index is rebuilt from a scan at creation, the
+ * highest record sequence wins. Compaction copies the current records of a victim sector
+ * to the log head and erases it; it runs from the sector log timer so KVS_Set only
+ * programs already erased space.
+ */
+
+#define KVS_MAGIC                   0x3153564B                                                      // "KVS1"
+#define KVS_ALIGN4(x)               (((x) + 3) & ~3UL)
+
+#define KVRT_DATA                   0xA5
+#define KVRT_DELETED                0x5A
+
+typedef struct tag_KVSRECORD
+{
+    uint8_t  KeyLen;                                                                                // 0xFF marks the end of the log in a sector
+    uint8_t  Type;                                                                                  // KVRT_DATA / KVRT_DELETED
+    uint16_t ValueSize;
+    uint32_t Sequence;
+    uint16_t Reserved;
+    uint16_t CRC;                                                                                   // Over the whole image with CRC = 0xFFFF
+} TKVSRECORD;                                                                                       // Followed by key and value
+
+#define KVS_DATAOFFSET              SLOG_HEADERSIZE
+#define KVS_RECORDSIZE(k, v)        (sizeof(TKVSRECORD) + (k) + (v))
+
+extern uintptr_t __ROMBase, __ROMImageLimit;
+
+pKVSTORE SystemKVStore;
+
+static uint32_t KVS_KeyHash(const char *Key, uint32_t KeyLen)
+{
+    uint32_t Hash = 0x811C9DC5;                                                                     // FNV-1a
+
+    while(KeyLen--)
+    {
+        Hash ^= (uint8_t)*Key++;
+        Hash *= 0x01000193;
+    }
+    return Hash;
+}
+
+static uint32_t KVS_HomeSlot(pKVSTORE Store, uint32_t Hash)
+{
+    return (uint32_t)(Hash * 0x9E3779B1UL) >> Store->HashShift;
+}
+
+static uint32_t KVS_Footprint(pKVSINDEX Entry)
+{
+    return KVS_ALIGN4(KVS_RECORDSIZE(Entry->KeyLen, Entry->ValueSize));
+}
+
+/* Returns the index slot holding Key, or the empty slot where it would be inserted */
+static uint32_t KVS_FindSlot(pKVSTORE Store, uint32_t Hash, const char *Key, uint32_t KeyLen)
+{
+    uint32_t Slot = KVS_HomeSlot(Store, Hash);
+    char     tmpKey[KVS_MAXKEYLEN];
+
+    while(Store->Index[Slot].Location != KVS_NOLOCATION)
+    {
+        pKVSINDEX Entry = &Store->Index[Slot];
+
+        if ((Entry->Hash == Hash) && (Entry->KeyLen == KeyLen) &&
+                SLOG_ReadAt(&Store->Log, Entry->Location + sizeof(TKVSRECORD), tmpKey, KeyLen) &&
+                !memcmp(tmpKey, Key, KeyLen))
+            break;
+        Slot = (Slot + 1) & Store->HashMask;
+    }
+    return Slot;
+}
+
+/* Backward-shift deletion, the same scheme as the fscache hash */
+static void KVS_IndexRemove(pKVSTORE Store, uint32_t Hole)
+{
+    uint32_t Slot = Hole;
+
+    Store->Index[Hole].Location = KVS_NOLOCATION;
+    Store->EntriesCount--;
+    while(1)
+    {
+        uint32_t Home;
+
+        Slot = (Slot + 1) & Store->HashMask;
+        if (Store->Index[Slot].Location == KVS_NOLOCATION) break;
+        Home = KVS_HomeSlot(Store, Store->Index[Slot].Hash);
+        if (((Slot - Home) & Store->HashMask) >= ((Slot - Hole) & Store->HashMask))
+        {
+            Store->Index[Hole] = Store->Index[Slot];
+            Store->Index[Slot].Location = KVS_NOLOCATION;
+            Hole = Slot;
+        }
+    }
+}
+
+static void KVS_Supersede(pKVSTORE Store, pKVSINDEX Entry)
+{
+    Store->Log.Sectors[Entry->Location / KVS_SECTORSIZE].Live -= KVS_Footprint(Entry);
+}
+
+static uint16_t KVS_RecordCRC(uint8_t *Image, uint32_t Size)
+{
+    TKVSRECORD *Record = (TKVSRECORD *)Image;
+    uint16_t   StoredCRC = Record->CRC, CRC;
+
+    Record->CRC = 0xFFFF;
+    CRC = CalculateCRC16(Image, Size);
+    Record->CRC = StoredCRC;
+
+    return CRC;
+}
+
+static uint32_t KVS_BuildRecord(pKVSTORE Store, uint8_t Type, const char *Key, uint32_t KeyLen,
+                                const void *Value, uint32_t ValueSize)
+{
+    TKVSRECORD *Record = (TKVSRECORD *)Store->Buffer;
+    uint32_t   Size = KVS_RECORDSIZE(KeyLen, ValueSize);
+
+    Record->KeyLen = KeyLen;
+    Record->Type = Type;
+    Record->ValueSize = ValueSize;
+    Record->Sequence = Store->NextSequence++;
+    Record->Reserved = 0xFFFF;
+    memcpy(&Store->Buffer[sizeof(TKVSRECORD)], Key, KeyLen);
+    if (ValueSize) memcpy(&Store->Buffer[sizeof(TKVSRECORD) + KeyLen], Value, ValueSize);
+    Record->CRC = KVS_RecordCRC(Store->Buffer, Size);
+
+    return Size;
+}
+
+/* Loads the record at Offset of Sector into Buffer. Returns its aligned size, 0 at the end
+   of the log, or the distance to the sector end when the header is unusable. Valid is set
+   when the image passed the CRC check. */
+static uint32_t KVS_LoadRecord(pKVSTORE Store, uint32_t Sector, uint32_t Offset, boolean *Valid)
+{
+    TKVSRECORD *Record = (TKVSRECORD *)Store->Buffer;
+    uint32_t   Location = Sector * KVS_SECTORSIZE + Offset, Size;
+
+    *Valid = false;
+    if ((Offset + sizeof(TKVSRECORD) > KVS_SECTORSIZE) ||
+            !SLOG_ReadAt(&Store->Log, Location, Record, sizeof(TKVSRECORD)))
+        return KVS_SECTORSIZE - Offset;
+    if ((Record->KeyLen == 0xFF) && (Record->Type == 0xFF)) return 0;
+
+    Size = KVS_RECORDSIZE(Record->KeyLen, Record->ValueSize);
+    if (!Record->KeyLen || (Record->KeyLen > KVS_MAXKEYLEN) || (Offset + Size > KVS_SECTORSIZE))
+        return KVS_SECTORSIZE - Offset;
+
+    if (SLOG_ReadAt(&Store->Log, Location + sizeof(TKVSRECORD), &Store->Buffer[sizeof(TKVSRECORD)],
+                   Size - sizeof(TKVSRECORD)))
+        *Valid = ((Record->Type == KVRT_DATA) || (Record->Type == KVRT_DELETED)) &&
+                 (KVS_RecordCRC(Store->Buffer, Size) == Record->CRC);
+
+    return KVS_ALIGN4(Size);
+}
+
+/* Programs the record image held in Buffer at the log head */
+static uint32_t KVS_Append(pKVSTORE Store, uint32_t Size)
+{
+    uint32_t    Footprint = KVS_ALIGN4(Size), Location;
+    pSLOGSECTOR Sector;
+
+    if ((Store->Log.ActiveSector == SLOG_NOSECTOR) ||
+            (Store->Log.Sectors[Store->Log.ActiveSector].Fill + Footprint > KVS_SECTORSIZE))
+    {
+        if (!SLOG_OpenSector(&Store->Log)) return KVS_NOLOCATION;
+    }
+    Sector = &Store->Log.Sectors[Store->Log.ActiveSector];
+    Location = Store->Log.ActiveSector * KVS_SECTORSIZE + Sector->Fill;
+
+    if (!SLOG_ProgramAt(&Store->Log, Location, Store->Buffer, Size))
+    {
+        /* Whatever was programmed is garbage now, close the sector */
+        Sector->Fill = KVS_SECTORSIZE;
+        return KVS_NOLOCATION;
+    }
+    Sector->Fill += Footprint;
+    Sector->Live += Footprint;
+
+    return Location;
+}
+
+static boolean KVS_Reclaim(void *Owner)
+{
+    return KVS_Compact((pKVSTORE)Owner);
+}
+
+static void KVS_ScanSector(void *Owner, uint32_t Sector)
+{
+    pKVSTORE   Store = (pKVSTORE)Owner;
+    TKVSRECORD *Record = (TKVSRECORD *)Store->Buffer;
+    uint32_t   Offset = KVS_DATAOFFSET, Size;
+    boolean    Valid;
+
+    while((Size = KVS_LoadRecord(Store, Sector, Offset, &Valid)) != 0)
+    {
+        if (Valid)
+        {
+            const char *Key = (const char *)&Store->Buffer[sizeof(TKVSRECORD)];
+            uint32_t   Hash = KVS_KeyHash(Key, Record->KeyLen);
+            uint32_t   Slot = KVS_FindSlot(Store, Hash, Key, Record->KeyLen);
+            pKVSINDEX  Entry = &Store->Index[Slot];
+            boolean    Newer = true;
+
+            if ((int32_t)(Record->Sequence - Store->NextSequence) >= 0)
+                Store->NextSequence = Record->Sequence + 1;
+            if (Entry->Location != KVS_NOLOCATION)
+            {
+                TKVSRECORD Current;
+
+                Newer = SLOG_ReadAt(&Store->Log, Entry->Location, &Current, sizeof(TKVSRECORD)) &&
+                        SLOG_IsNewer(&Store->Log, Record->Sequence, Sector,
+                                     Current.Sequence, Entry->Location / KVS_SECTORSIZE);
+                if (Newer) KVS_Supersede(Store, Entry);
+            }
+            else if (Store->EntriesCount < KVS_MAXKEYS) Store->EntriesCount++;
+            else Newer = false;
+
+            if (Newer)
+            {
+                Entry->Hash = Hash;
+                Entry->Location = Sector * KVS_SECTORSIZE + Offset;
+                Entry->ValueSize = Record->ValueSize;
+                Entry->KeyLen = Record->KeyLen;
+                Entry->Deleted = (Record->Type == KVRT_DELETED);
+                Store->Log.Sectors[Sector].Live += Size;
+            }
+        }
+        Offset += Size;
+    }
+    Store->Log.Sectors[Sector].Fill = Offset;
+}
+
+pKVSTORE KVS_Create(const TNORFLASH *Flash, uint32_t Base, uint32_t SectorsCount)
+{
+    pKVSTORE NewStore = NULL;
+
+    if ((Flash != NULL) && (Flash->Read != NULL) && (Flash->Program != NULL) && (Flash->Erase != NULL) &&
+            !(Base & BLOCK4K_MASK) && (SectorsCount >= KVS_RESERVESECTORS + 2))
+    {
+        uint32_t HashSize = 2, HashBits = 1;
+        uint32_t SectorsOffset, IndexOffset, BufferOffset;
+
+        while(HashSize < 2 * KVS_MAXKEYS)
+        {
+            HashSize <<= 1;
+            HashBits++;
+        }
+        SectorsOffset = KVS_ALIGN4(sizeof(TKVSTORE));
+        IndexOffset = KVS_ALIGN4(SectorsOffset + SectorsCount * sizeof(TSLOGSECTOR));
+        BufferOffset = KVS_ALIGN4(IndexOffset + HashSize * sizeof(TKVSINDEX));
+
+        NewStore = malloc(BufferOffset + KVS_SECTORSIZE);
+        if (NewStore != NULL)
+        {
+            uint32_t i;
+
+            memset(NewStore, 0x00, IndexOffset);
+
+            NewStore->Log.Flash = *Flash;
+            NewStore->Log.Base = Base;
+            NewStore->Log.SectorsCount = SectorsCount;
+            NewStore->Log.Magic = KVS_MAGIC;
+            NewStore->Log.FirstUnit = KVS_DATAOFFSET;
+            NewStore->Log.EndUnit = KVS_SECTORSIZE;
+            NewStore->Log.MinReclaim = KVS_MINRECLAIM;
+            NewStore->Log.ReserveSectors = KVS_RESERVESECTORS;
+            NewStore->Log.FreeTarget = KVS_FREESECTORS;
+            NewStore->Log.WearDelta = KVS_WEARDELTA;
+            NewStore->Log.Reclaim = KVS_Reclaim;
+            NewStore->Log.Owner = NewStore;
+            NewStore->HashMask = HashSize - 1;
+            NewStore->HashShift = 32 - HashBits;
+            NewStore->Log.Sectors = (pSLOGSECTOR)((uint8_t *)NewStore + SectorsOffset);
+            NewStore->Index = (pKVSINDEX)((uint8_t *)NewStore + IndexOffset);
+            NewStore->Buffer = (uint8_t *)NewStore + BufferOffset;
+            for(i = 0; i < HashSize; i++) NewStore->Index[i].Location = KVS_NOLOCATION;
+
+            if (SLOG_Mount(&NewStore->Log, KVS_ScanSector)) SLOG_Attach(&NewStore->Log, KVS_COMPACTDELAY);
+            else
+            {
+                free(NewStore);
+                NewStore = NULL;
+            }
+        }
+    }
+    return NewStore;
+}
+
+pKVSTORE KVS_Destroy(pKVSTORE Store)
+{
+    if (Store != NULL)
+    {
+        SLOG_Detach(&Store->Log);
+        if (SystemKVStore == Store) SystemKVStore = NULL;
+        free(Store);
+    }
+    return NULL;
+}
+
+static boolean KVS_Put(pKVSTORE Store, uint8_t Type, const char *Key, const void *Value, size_t Size)
+{
+    uint32_t  KeyLen, Hash, Slot, Location;
+    pKVSINDEX Entry;
+
+    if ((Store == NULL) || (Key == NULL) || ((Value == NULL) && Size)) return false;
+    KeyLen = strlen(Key);
+    if (!KeyLen || (KeyLen > KVS_MAXKEYLEN) ||
+            (KVS_DATAOFFSET + KVS_RECORDSIZE(KeyLen, Size) > KVS_SECTORSIZE))
+        return false;
+
+    Hash = KVS_KeyHash(Key, KeyLen);
+    Slot = KVS_FindSlot(Store, Hash, Key, KeyLen);
+    Entry = &Store->Index[Slot];
+
+    if (Entry->Location == KVS_NOLOCATION)
+    {
+        if ((Type == KVRT_DELETED) || (Store->EntriesCount >= KVS_MAXKEYS)) return false;
+    }
+    else if (Type == KVRT_DELETED)
+    {
+        if (Entry->Deleted) return false;
+    }
+    else if (!Entry->Deleted && (Entry->ValueSize == Size))
+    {
+        /* Rewriting the same value costs flash space for nothing */
+        uint32_t ValueLocation = Entry->Location + sizeof(TKVSRECORD) + KeyLen, Offset;
+        uint8_t  tmpData[32];
+
+        for(Offset = 0; Offset < Size; Offset += sizeof(tmpData))
+        {
+            uint32_t nBytes = min(sizeof(tmpData), Size - Offset);
+
+            if (!SLOG_ReadAt(&Store->Log, ValueLocation + Offset, tmpData, nBytes) ||
+                    memcmp(tmpData, (const uint8_t *)Value + Offset, nBytes))
+                break;
+        }
+        if (Offset >= Size) return true;
+    }
+
+    if (!SLOG_MayWrite(&Store->Log))
+    {
+        SLOG_Schedule(&Store->Log);
+        return false;
+    }
+    Location = KVS_Append(Store, KVS_BuildRecord(Store, Type, Key, KeyLen, Value, Size));
+    if (Location == KVS_NOLOCATION)
+    {
+        Store->NextSequence--;
+        SLOG_Schedule(&Store->Log);
+        return false;
+    }
+
+    if (Entry->Location != KVS_NOLOCATION) KVS_Supersede(Store, Entry);
+    else Store->EntriesCount++;
+    Entry->Hash = Hash;
+    Entry->Location = Location;
+    Entry->ValueSize = Size;
+    Entry->KeyLen = KeyLen;
+    Entry->Deleted = (Type == KVRT_DELETED);
+    Store->Stats.Writes++;
+
+    SLOG_Schedule(&Store->Log);
+
+    return true;
+}
+
+boolean KVS_Set(pKVSTORE Store, const char *Key, const void *Value, size_t Size)
+{
+    return KVS_Put(Store, KVRT_DATA, Key, Value, Size);
+}
+
+boolean KVS_Delete(pKVSTORE Store, const char *Key)
+{
+    return KVS_Put(Store, KVRT_DELETED, Key, NULL, 0);
+}
+
+/* Size holds the buffer size on entry and the stored value size on return */
+boolean KVS_Get(pKVSTORE Store, const char *Key, void *Value, size_t *Size)
+{
+    uint32_t  KeyLen;
+    pKVSINDEX Entry;
+
+    if ((Store == NULL) || (Key == NULL) || (Size == NULL)) return false;
+    KeyLen = strlen(Key);
+    if (!KeyLen || (KeyLen > KVS_MAXKEYLEN)) return false;
+
+    Entry = &Store->Index[KVS_FindSlot(Store, KVS_KeyHash(Key, KeyLen), Key, KeyLen)];
+    if ((Entry->Location == KVS_NOLOCATION) || Entry->Deleted) return false;
+
+    if ((Value != NULL) && *Size &&
+            !SLOG_ReadAt(&Store->Log, Entry->Location + sizeof(TKVSRECORD) + KeyLen, Value,
+                        min(*Size, Entry->ValueSize)))
+        return false;
+    *Size = Entry->ValueSize;
+
+    return true;
+}
+
+/* Reclaims one sector, the victim is chosen by SLOG_SelectVictim */
+boolean KVS_Compact(pKVSTORE Store)
+{
+    uint32_t Victim, Offset, Size;
+    boolean  DropTombstones, Valid;
+
+    if (Store == NULL) return false;
+    Victim = SLOG_SelectVictim(&Store->Log);
+    if (Victim == SLOG_NOSECTOR) return false;
+
+    /* A tombstone may only go once no older sector can hold a version it hides */
+    DropTombstones = (SLOG_OldestSector(&Store->Log) == Victim);
+
+    Store->Log.Reclaiming = true;
+    for(Offset = KVS_DATAOFFSET;
+            (Offset < Store->Log.Sectors[Victim].Fill) && ((Size = KVS_LoadRecord(Store, Victim, Offset, &Valid)) != 0);
+            Offset += Size)
+    {
+        TKVSRECORD *Record = (TKVSRECORD *)Store->Buffer;
+        const char *Key;
+        uint32_t   Slot, Location;
+
+        if (!Valid) continue;
+        Key = (const char *)&Store->Buffer[sizeof(TKVSRECORD)];
+        Slot = KVS_FindSlot(Store, KVS_KeyHash(Key, Record->KeyLen), Key, Record->KeyLen);
+        if (Store->Index[Slot].Location != Victim * KVS_SECTORSIZE + Offset) continue;
+
+        if (Store->Index[Slot].Deleted && DropTombstones)
+        {
+            KVS_Supersede(Store, &Store->Index[Slot]);
+            KVS_IndexRemove(Store, Slot);
+            continue;
+        }
+        /* The image keeps its sequence and CRC, a copy left behind by a reset is harmless */
+        Location = KVS_Append(Store, KVS_RECORDSIZE(Record->KeyLen, Record->ValueSize));
+        if (Location == KVS_NOLOCATION)
+        {
+            Store->Log.Reclaiming = false;
+            return false;
+        }
+        KVS_Supersede(Store, &Store->Index[Slot]);
+        Store->Index[Slot].Location = Location;
+        Store->Stats.RecordsMoved++;
+    }
+    Store->Log.Reclaiming = false;
+
+    if (!SLOG_EraseSector(&Store->Log, Victim)) return false;
+    Store->Stats.Compactions++;
+
+    return true;
+}
+
+void KVS_GetStats(pKVSTORE Store, pKVSSTATS Stats)
+{
+    if ((Store != NULL) && (Stats != NULL))
+    {
+        uint32_t i;
+
+        *Stats = Store->Stats;
+        Stats->KeysCount = 0;
+        Stats->Erases = Store->Log.Erases;
+        Stats->FreeSectors = Store->Log.FreeSectors;
+        Stats->MinEraseCount = 0xFFFFFFFF;
+        Stats->MaxEraseCount = 0;
+        for(i = 0; i <= Store->HashMask; i++)
+            if ((Store->Index[i].Location != KVS_NOLOCATION) && !Store->Index[i].Deleted)
+                Stats->KeysCount++;
+        for(i = 0; i < Store->Log.SectorsCount; i++)
+        {
+            Stats->MinEraseCount = min(Stats->MinEraseCount, Store->Log.Sectors[i].EraseCount);
+            Stats->MaxEraseCount = max(Stats->MaxEraseCount, Store->Log.Sectors[i].EraseCount);
+        }
+    }
+}
+
+/* System store in the top KVSREGIONSIZE bytes of the boot serial flash */
+pKVSTORE KVS_Initialize(void)
+{
+    if ((SystemKVStore == NULL) && (FlashConfig != NULL) && (FlashConfig->EraseSupport & BR_4K) &&
+            (FlashCapacity >= KVSREGIONSIZE))
+    {
+        uint32_t Base = FlashCapacity - KVSREGIONSIZE;
+
+        /* Never overlap the firmware image */
+        if (Base < (uintptr_t)&__ROMImageLimit - (uintptr_t)&__ROMBase) return NULL;
+
+        SystemKVStore = KVS_Create(&SFNorFlash, Base, KVSREGIONSIZE / KVS_SECTORSIZE);
+    }
+    return SystemKVStore;
+}
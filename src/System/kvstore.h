@@ -0,0 +1,77 @@
+/*
+* This file is part of the DZ09 project.
+*
+* Copyright (C) 2022 AJScorp
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+#ifndef _KVSTORE_H_
+#define _KVSTORE_H_
+
+#define KVS_SECTORSIZE              NORSECTORSIZE                                                   // Erase unit
+#define KVS_MAXKEYLEN               32
+#define KVS_MAXKEYS                 128                                                             // Index capacity, deleted keys included
+#define KVS_RESERVESECTORS          1                                                               // Kept erased for compaction only
+#define KVS_FREESECTORS             3                                                               // Background compaction target
+#define KVS_MINRECLAIM              (KVS_SECTORSIZE / 8)                                            // Least garbage worth an erase
+#define KVS_WEARDELTA               64                                                              // Erase count spread that moves cold sectors
+#define KVS_COMPACTDELAY            100                                                             // ms
+#define KVS_NOLOCATION              0xFFFFFFFF
+
+typedef struct tag_KVSINDEX
+{
+    uint32_t Hash;
+    uint32_t Location;                                                                              // Record offset in region, KVS_NOLOCATION if empty
+    uint16_t ValueSize;
+    uint8_t  KeyLen;
+    uint8_t  Deleted;                                                                               // Tombstone still needed on flash
+} TKVSINDEX, *pKVSINDEX;
+
+typedef struct tag_KVSSTATS
+{
+    uint32_t Writes;
+    uint32_t Compactions;
+    uint32_t RecordsMoved;
+    uint32_t Erases;
+    uint32_t KeysCount;
+    uint32_t FreeSectors;
+    uint32_t MinEraseCount;
+    uint32_t MaxEraseCount;
+} TKVSSTATS, *pKVSSTATS;
+
+typedef struct tag_KVSTORE *pKVSTORE;
+typedef struct tag_KVSTORE
+{
+    TSECTORLOG Log;                                                                                 // Sectors in bytes, Live counts current records
+    uint32_t   NextSequence;
+    uint32_t   EntriesCount;
+    uint32_t   HashMask;
+    uint32_t   HashShift;
+    pKVSINDEX  Index;
+    uint8_t    *Buffer;                                                                             // One record image, KVS_SECTORSIZE bytes
+    TKVSSTATS  Stats;
+} TKVSTORE;
+
+extern pKVSTORE SystemKVStore;
+
+extern pKVSTORE KVS_Create(const TNORFLASH *Flash, uint32_t Base, uint32_t SectorsCount);
+extern pKVSTORE KVS_Destroy(pKVSTORE Store);
+extern boolean KVS_Set(pKVSTORE Store, const char *Key, const void *Value, size_t Size);
+extern boolean KVS_Get(pKVSTORE Store, const char *Key, void *Value, size_t *Size);
+extern boolean KVS_Delete(pKVSTORE Store, const char *Key);
+extern boolean KVS_Compact(pKVSTORE Store);
+extern void KVS_GetStats(pKVSTORE Store, pKVSSTATS Stats);
+extern pKVSTORE KVS_Initialize(void);
+
+#endif /* _KVSTORE_H_ */
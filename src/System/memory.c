@@ -23,6 +23,126 @@
 #include "memory.h"
 
 static uint8_t MemoryPool[SYSMEMSIZE] __attribute__ ((aligned (8), section (".noinit")));
+static uint8_t TCMPool[FASTMEMSIZE] __attribute__ ((aligned (8), section (".tcmheap")));        // Placed by the linker script
+static uint8_t *FastMemoryPool;                                                                     // TCMPool, NULL if it is unusable
+static pSLAB   SlabsList;
+static uint8_t *ScratchStart, *ScratchTop;
+static uint32_t ScratchPeak, ScratchFallbacks;
+
+#if MEMPROFILE
+/* Prepended to every TLSF block, keeps the 8 byte alignment */
+typedef struct tag_MEMTAG
+{
+    void     *Caller;
+    uint32_t Size;
+} TMEMTAG, *pMEMTAG;
+
+#define MEM_TAGSIZE                 sizeof(TMEMTAG)
+
+static TMEMPROFILE MemProfile;
+static TMEMSITE    MemSites[MEMPROF_SITES];
+
+/* Called with interrupts disabled */
+static pMEMSITE MEM_GetSite(void *Caller)
+{
+    uint32_t i = ((uint32_t)(uintptr_t)Caller * 0x9E3779B1) >> (32 - MEMPROF_SITESHIFT);
+    uint32_t n;
+
+    for(n = 0; n < MEMPROF_SITES; n++, i = (i + 1) & (MEMPROF_SITES - 1))
+    {
+        if (MemSites[i].Caller == Caller) return &MemSites[i];
+        if (MemSites[i].Caller == NULL)
+        {
+            MemSites[i].Caller = Caller;
+            return &MemSites[i];
+        }
+    }
+    return NULL;
+}
+
+/* Called with interrupts disabled, returns the user pointer */
+static void *MEM_TagAlloc(void *Block, void *Caller, size_t Size)
+{
+    pMEMTAG  Tag = Block;
+    pMEMSITE Site = MEM_GetSite(Caller);
+    uint32_t Class = (Size > 16) ? 28 - __clz(Size - 1) : 0;
+
+    Tag->Caller = Caller;
+    Tag->Size = Size;
+
+    MemProfile.Allocs++;
+    MemProfile.ClassAllocs[min(Class, MEMPROF_CLASSES - 1)]++;
+    MemProfile.LiveBytes += Size;
+    if (MemProfile.LiveBytes > MemProfile.PeakBytes) MemProfile.PeakBytes = MemProfile.LiveBytes;
+
+    if (Site != NULL)
+    {
+        Site->Allocs++;
+        Site->LiveCount++;
+        Site->LiveBytes += Size;
+        if (Site->LiveBytes > Site->PeakBytes) Site->PeakBytes = Site->LiveBytes;
+    }
+    else MemProfile.LostAllocs++;
+
+    return &Tag[1];
+}
+
+/* Called with interrupts disabled, returns the TLSF block. The tag is left intact. */
+static void *MEM_TagFree(void *ptr)
+{
+    pMEMTAG  Tag;
+    pMEMSITE Site;
+
+    if (ptr == NULL) return NULL;
+
+    Tag = (pMEMTAG)ptr - 1;
+    Site = MEM_GetSite(Tag->Caller);
+
+    MemProfile.Frees++;
+    MemProfile.LiveBytes -= Tag->Size;
+    if (Site != NULL)
+    {
+        Site->LiveCount--;
+        Site->LiveBytes -= Tag->Size;
+    }
+    return Tag;
+}
+
+#define MEM_Retag(Block)            MEM_TagAlloc(Block, ((pMEMTAG)(Block))->Caller, ((pMEMTAG)(Block))->Size)
+#else
+#define MEM_TAGSIZE                 0
+#define MEM_TagAlloc(Block, c, s)   (Block)
+#define MEM_TagFree(ptr)            (ptr)
+#define MEM_Retag(Block)            ((void)(Block))
+#endif /* MEMPROFILE */
+
+#if MEMTRACE
+static TMEMTRACEREC MemTrace[MEMTRACE_RECORDS] __attribute__ ((section (".noinit")));
+static uint32_t     MemTraceCount, MemTraceLost;
+static boolean      MemTraceEnabled;
+
+/* Called with interrupts disabled. A full buffer stops recording, the rest is counted as lost. */
+static void MEM_TraceOp(TMEMTRACEOP Op, void *Pool, void *Ptr, void *OldPtr, size_t Size)
+{
+    pMEMTRACEREC Rec;
+
+    if (!MemTraceEnabled) return;
+    if (MemTraceCount >= MEMTRACE_RECORDS)
+    {
+        MemTraceLost++;
+        return;
+    }
+    Rec = &MemTrace[MemTraceCount++];
+    Rec->Time = USC_GetCurrentTicks();
+    Rec->Ptr = (uint32_t)(uintptr_t)Ptr;
+    Rec->OldPtr = (uint32_t)(uintptr_t)OldPtr;
+    Rec->Size = min(Size, 0x00FFFFFF);
+    Rec->Op = Op;
+    Rec->Fast = (Pool != MemoryPool) ? 1 : 0;
+}
+#else
+#define MEM_TraceOp(Op, Pool, Ptr, OldPtr, Size)
+#endif /* MEMTRACE */
 
 extern uintptr_t __stack_top, __stack_limit;
 extern uintptr_t __int_stack_top, __int_stack_limit;
@@ -32,29 +152,122 @@ size_t InitializeMemoryPool(void)
     uint32_t iflags = __disable_interrupts();
     size_t   Result;
 
+    FastMemoryPool = TCMPool;
+    destroy_memory_pool(FastMemoryPool);
     destroy_memory_pool(MemoryPool);
+    SlabsList = NULL;
+    ScratchStart = ScratchTop = NULL;
 
+    if (init_memory_pool(FASTMEMSIZE, FastMemoryPool) == (size_t)-1) FastMemoryPool = NULL;
     Result = init_memory_pool(SYSMEMSIZE, MemoryPool);
     __restore_interrupts(iflags);
 
     return Result;
 }
 
-void *malloc(size_t size)
+static void *MEM_Alloc(size_t size, void *Pool, void *Caller)
 {
     uint32_t iflags = __disable_interrupts();
-    void     *Result = tlsf_malloc(size);
+    void     *Result = (size <= SIZE_MAX - MEM_TAGSIZE) ? malloc_ex(size + MEM_TAGSIZE, Pool) : NULL;
 
+    if (Result != NULL) Result = MEM_TagAlloc(Result, Caller, size);
+    MEM_TraceOp(MTO_MALLOC, Pool, Result, NULL, size);
     __restore_interrupts(iflags);
 
     return Result;
 }
 
+void *malloc(size_t size)
+{
+    return MEM_Alloc(size, MemoryPool, __builtin_return_address(0));
+}
+
+/* Zero wait state TCM for latency critical buffers, the pool is small */
+void *malloc_hint(size_t size, TMEMHINT Hint)
+{
+    void *Result = NULL;
+
+    if ((Hint != MH_ANY) && (FastMemoryPool != NULL))
+        Result = MEM_Alloc(size, FastMemoryPool, __builtin_return_address(0));
+    if ((Result == NULL) && (Hint != MH_FASTONLY))
+        Result = MEM_Alloc(size, MemoryPool, __builtin_return_address(0));
+
+    return Result;
+}
+
+void *malloc_fast(size_t size)
+{
+    void *Result = (FastMemoryPool != NULL) ?
+                   MEM_Alloc(size, FastMemoryPool, __builtin_return_address(0)) : NULL;
+
+    return (Result != NULL) ? Result : MEM_Alloc(size, MemoryPool, __builtin_return_address(0));
+}
+
+/* Called with interrupts disabled */
+static pSLAB SLAB_Find(void *ptr)
+{
+    pSLAB Slab = SlabsList;
+
+    while((Slab != NULL) && (((uint8_t *)ptr < Slab->Start) || ((uint8_t *)ptr >= Slab->End)))
+        Slab = Slab->Next;
+
+    return Slab;
+}
+
+/* Called with interrupts disabled */
+static boolean SLAB_Create(pSLAB Slab)
+{
+    uint32_t BlockSize = (max(Slab->BlockSize, sizeof(void *)) + 7) & ~7;
+    uint8_t  *Storage;
+    uint32_t i;
+
+    if (!Slab->BlocksCount || ((Storage = malloc_ex(BlockSize * Slab->BlocksCount, MemoryPool)) == NULL))
+        return false;
+
+    Slab->BlockSize = BlockSize;
+    Slab->Start = Storage;
+    Slab->End = Storage + BlockSize * Slab->BlocksCount;
+    Slab->FreeList = NULL;
+    for(i = Slab->BlocksCount; i; i--)
+    {
+        void **Block = (void **)(Storage + (i - 1) * BlockSize);
+
+        *Block = Slab->FreeList;
+        Slab->FreeList = Block;
+    }
+    Slab->Next = SlabsList;
+    SlabsList = Slab;
+
+    return true;
+}
+
+static boolean IsScratchMemory(void *ptr)
+{
+    return ((ScratchStart != NULL) && ((uint8_t *)ptr >= ScratchStart) &&
+            ((uint8_t *)ptr < ScratchStart + SCRATCHSIZE)) ? true : false;
+}
+
 void free(void *ptr)
 {
     uint32_t iflags = __disable_interrupts();
+    pSLAB    Slab = SLAB_Find(ptr);
 
-    tlsf_free(ptr);
+    if (Slab != NULL)
+    {
+        *(void **)ptr = Slab->FreeList;
+        Slab->FreeList = ptr;
+        Slab->Used--;
+    }
+    else if (IsFastMemory(ptr))
+    {
+        MEM_TraceOp(MTO_FREE, FastMemoryPool, ptr, NULL, 0);
+        free_ex(MEM_TagFree(ptr), FastMemoryPool);
+    }
+    else if ((ptr != NULL) && !IsScratchMemory(ptr))                                                // Scratch waits for SCRATCH_Reset()
+    {
+        MEM_TraceOp(MTO_FREE, MemoryPool, ptr, NULL, 0);
+        free_ex(MEM_TagFree(ptr), MemoryPool);
+    }
 
     __restore_interrupts(iflags);
 }
@@ -62,19 +275,56 @@ void free(void *ptr)
 void *realloc(void *ptr, size_t size)
 {
     uint32_t iflags = __disable_interrupts();
-    void     *Result = tlsf_realloc(ptr, size);
+    pSLAB    Slab = SLAB_Find(ptr);
+    void     *Result, *Block, *Pool;
+
+    __restore_interrupts(iflags);
+
+    if ((ptr == NULL) || (Slab != NULL) || IsScratchMemory(ptr))
+    {
+        if ((Result = MEM_Alloc(size, MemoryPool, __builtin_return_address(0))) != NULL)
+        {
+            if (ptr != NULL)
+                memcpy(Result, ptr, min(size, (Slab != NULL) ? Slab->BlockSize :
+                                        (size_t)(ScratchTop - (uint8_t *)ptr)));                    // A scratch block ends at the top at most
+            free(ptr);
+        }
+        return Result;
+    }
+    if (!size)
+    {
+        free(ptr);
+        return NULL;
+    }
 
+    iflags = __disable_interrupts();
+    Pool = IsFastMemory(ptr) ? FastMemoryPool : MemoryPool;
+    Block = MEM_TagFree(ptr);
+    if (size > SIZE_MAX - MEM_TAGSIZE) Result = NULL;
+    else Result = realloc_ex(Block, size + MEM_TAGSIZE, Pool);
+    if (Result != NULL) Result = MEM_TagAlloc(Result, __builtin_return_address(0), size);
+    else MEM_Retag(Block);                                                                          // The old block is kept
+    MEM_TraceOp(MTO_REALLOC, Pool, Result, ptr, size);
     __restore_interrupts(iflags);
 
+    /* A block the TCM pool cannot grow moves to the external RAM pool */
+    if ((Result == NULL) && (Pool != MemoryPool) &&
+            ((Result = MEM_Alloc(size, MemoryPool, __builtin_return_address(0))) != NULL))
+    {
+        memcpy(Result, ptr, min(size, get_block_size(Block) - MEM_TAGSIZE));
+        free(ptr);
+    }
     return Result;
 }
 
 void *calloc(size_t nelem, size_t elem_size)
 {
-    uint32_t iflags = __disable_interrupts();
-    void     *Result = tlsf_calloc(nelem, elem_size);
+    void *Result;
 
-    __restore_interrupts(iflags);
+    if (elem_size && (nelem > SIZE_MAX / elem_size)) return NULL;
+
+    Result = MEM_Alloc(nelem * elem_size, MemoryPool, __builtin_return_address(0));
+    if (Result != NULL) memset(Result, 0, nelem * elem_size);
 
     return Result;
 }
@@ -86,8 +336,15 @@ uint32_t GetSysMemoryAddress(void)
 
 boolean IsDynamicMemory(void *Memory)
 {
-    return (((uintptr_t)Memory >= (uintptr_t)&MemoryPool[0]) &&
-            ((uintptr_t)Memory <= (uintptr_t)&MemoryPool[SYSMEMSIZE - 1])) ? true : false;
+    return ((((uintptr_t)Memory >= (uintptr_t)&MemoryPool[0]) &&
+             ((uintptr_t)Memory <= (uintptr_t)&MemoryPool[SYSMEMSIZE - 1])) ||
+            IsFastMemory(Memory)) ? true : false;
+}
+
+boolean IsFastMemory(void *Memory)
+{
+    return ((FastMemoryPool != NULL) && ((uintptr_t)Memory >= (uintptr_t)FastMemoryPool) &&
+            ((uintptr_t)Memory < (uintptr_t)FastMemoryPool + FASTMEMSIZE)) ? true : false;
 }
 
 boolean IsStackMemory(void *Memory)
@@ -102,3 +359,236 @@ size_t GetTotalUsedMemory(void)
 {
     return get_used_size(MemoryPool);
 }
+
+size_t GetTotalUsedFastMemory(void)
+{
+    return (FastMemoryPool != NULL) ? get_used_size(FastMemoryPool) : 0;
+}
+
+/* Takes a block in a few instructions, safe from ISR context. The slab is created on its
+   first use, an exhausted or uncreated slab falls back to malloc(). */
+void *SLAB_Alloc(pSLAB Slab)
+{
+    uint32_t iflags = __disable_interrupts();
+    void     **Block = NULL;
+
+    if ((Slab->Start != NULL) || SLAB_Create(Slab))
+    {
+        if ((Block = Slab->FreeList) != NULL)
+        {
+            Slab->FreeList = *Block;
+            if (++Slab->Used > Slab->Peak) Slab->Peak = Slab->Used;
+        }
+    }
+    if (Block == NULL) Slab->Fallbacks++;
+
+    __restore_interrupts(iflags);
+
+    return (Block != NULL) ? Block : MEM_Alloc(Slab->BlockSize, MemoryPool, __builtin_return_address(0));
+}
+
+/* Created slabs, starts with Slab = NULL */
+pSLAB SLAB_GetNext(pSLAB Slab)
+{
+    return (Slab == NULL) ? SlabsList : Slab->Next;
+}
+
+void SLAB_GetStats(pSLAB Slab, pSLABSTATS Stats)
+{
+    if ((Slab != NULL) && (Stats != NULL))
+    {
+        uint32_t iflags = __disable_interrupts();
+
+        Stats->BlockSize = Slab->BlockSize;
+        Stats->BlocksCount = Slab->BlocksCount;
+        Stats->Used = Slab->Used;
+        Stats->Peak = Slab->Peak;
+        Stats->Fallbacks = Slab->Fallbacks;
+        __restore_interrupts(iflags);
+    }
+}
+
+void SLAB_ReportStats(void)
+{
+    pSLAB      Slab = NULL;
+    TSLABSTATS Stats;
+
+    while((Slab = SLAB_GetNext(Slab)) != NULL)
+    {
+        SLAB_GetStats(Slab, &Stats);
+        DebugPrint("Slab %s: %u x %u bytes, used %u, peak %u, fallbacks %u\r\n", Slab->Name,
+                   Stats.BlocksCount, Stats.BlockSize, Stats.Used, Stats.Peak, Stats.Fallbacks);
+    }
+}
+
+/* Bump allocation for data that does not outlive the current event, main loop only.
+   free() of a scratch block does nothing, EM_ProcessEvents() resets the arena after each
+   dispatch. The arena is carved from the memory pool on first use, a request that does
+   not fit falls back to malloc(). */
+void *SCRATCH_Alloc(size_t size)
+{
+    uint32_t iflags = __disable_interrupts();
+    void     *Result = NULL;
+
+    if ((size <= SCRATCHSIZE) &&
+            ((ScratchStart != NULL) ||
+             ((ScratchStart = ScratchTop = malloc_ex(SCRATCHSIZE, MemoryPool)) != NULL)))
+    {
+        size_t Size = (max(size, 1) + 7) & ~7;
+
+        if (Size <= (size_t)(ScratchStart + SCRATCHSIZE - ScratchTop))
+        {
+            Result = ScratchTop;
+            ScratchTop += Size;
+            if ((uint32_t)(ScratchTop - ScratchStart) > ScratchPeak) ScratchPeak = ScratchTop - ScratchStart;
+        }
+    }
+    if (Result == NULL) ScratchFallbacks++;
+
+    __restore_interrupts(iflags);
+
+    return (Result != NULL) ? Result : MEM_Alloc(size, MemoryPool, __builtin_return_address(0));
+}
+
+void SCRATCH_Reset(void)
+{
+    ScratchTop = ScratchStart;
+}
+
+void SCRATCH_GetStats(pSCRATCHSTATS Stats)
+{
+    if (Stats != NULL)
+    {
+        uint32_t iflags = __disable_interrupts();
+
+        Stats->Size = (ScratchStart != NULL) ? SCRATCHSIZE : 0;
+        Stats->Used = ScratchTop - ScratchStart;
+        Stats->Peak = ScratchPeak;
+        Stats->Fallbacks = ScratchFallbacks;
+        __restore_interrupts(iflags);
+    }
+}
+
+/* Heap snapshot for telemetry. Print is called with interrupts enabled, line by line:
+   HEAP, FAST (TCM pool), PROF, CLASS and SITE lines (profiling builds only), SCRATCH, SLAB
+   lines, then END. */
+void MEM_ReportProfile(void (*Print)(const char *fmt, ...))
+{
+    static uint32_t PrevTicks, PrevAllocs;
+    uint32_t      iflags, Ticks;
+    size_t        Used, Peak, Free, Largest;
+    size_t        FastUsed = 0, FastPeak = 0, FastFree = 0, FastLargest = 0;
+    pSLAB         Slab = NULL;
+    TSLABSTATS    SlabStats;
+    TSCRATCHSTATS ScratchStats;
+#if MEMPROFILE
+    static TMEMSITE Sites[MEMPROF_SITES];
+    TMEMPROFILE     Profile;
+    uint32_t        i, Rate;
+#endif
+
+    if (Print == NULL) return;
+
+    iflags = __disable_interrupts();
+    Ticks = USC_GetCurrentTicks();
+    Used = get_used_size(MemoryPool);
+    Peak = get_max_size(MemoryPool);                                                                // Peak of Used
+    Free = get_free_size(MemoryPool, &Largest);
+    if (FastMemoryPool != NULL)
+    {
+        FastUsed = get_used_size(FastMemoryPool);
+        FastPeak = get_max_size(FastMemoryPool);
+        FastFree = get_free_size(FastMemoryPool, &FastLargest);
+    }
+#if MEMPROFILE
+    Profile = MemProfile;
+    memcpy(Sites, MemSites, sizeof(Sites));
+#endif
+    __restore_interrupts(iflags);
+
+    /* Fragmentation: share of free memory not in the largest block, per mille */
+    Print("HEAP t=%lu used=%lu peak=%lu free=%lu largest=%lu frag=%lu\r\n", Ticks, (uint32_t)Used,
+          (uint32_t)Peak, (uint32_t)Free, (uint32_t)Largest,
+          (Free) ? 1000 - (uint32_t)((uint64_t)Largest * 1000 / Free) : 0);
+    Print("FAST used=%lu peak=%lu free=%lu largest=%lu\r\n", (uint32_t)FastUsed, (uint32_t)FastPeak,
+          (uint32_t)FastFree, (uint32_t)FastLargest);
+#if MEMPROFILE
+    Rate = (PrevTicks && (Ticks != PrevTicks)) ?
+           (uint32_t)((uint64_t)(Profile.Allocs - PrevAllocs) * 1000000 / (Ticks - PrevTicks)) : 0;
+    PrevTicks = Ticks;
+    PrevAllocs = Profile.Allocs;
+
+    Print("PROF live=%lu peak=%lu allocs=%lu frees=%lu rate=%lu lost=%lu\r\n", Profile.LiveBytes,
+          Profile.PeakBytes, Profile.Allocs, Profile.Frees, Rate, Profile.LostAllocs);
+    Print("CLASS");
+    for(i = 0; i < MEMPROF_CLASSES; i++) Print(" %lu", Profile.ClassAllocs[i]);
+    Print("\r\n");
+    for(i = 0; i < MEMPROF_SITES; i++)
+    {
+        if (Sites[i].Caller != NULL)
+            Print("SITE %08lX allocs=%lu count=%lu live=%lu peak=%lu\r\n", (uint32_t)Sites[i].Caller,
+                  Sites[i].Allocs, Sites[i].LiveCount, Sites[i].LiveBytes, Sites[i].PeakBytes);
+    }
+#else
+    (void)PrevTicks;
+    (void)PrevAllocs;
+#endif
+    SCRATCH_GetStats(&ScratchStats);
+    Print("SCRATCH size=%lu used=%lu peak=%lu fallbacks=%lu\r\n", ScratchStats.Size,
+          ScratchStats.Used, ScratchStats.Peak, ScratchStats.Fallbacks);
+    while((Slab = SLAB_GetNext(Slab)) != NULL)
+    {
+        SLAB_GetStats(Slab, &SlabStats);
+        Print("SLAB %s size=%lu count=%lu used=%lu peak=%lu fallbacks=%lu\r\n", Slab->Name,
+              SlabStats.BlockSize, SlabStats.BlocksCount, SlabStats.Used, SlabStats.Peak, SlabStats.Fallbacks);
+    }
+    Print("END\r\n");
+}
+
+/* Starts a new trace, MEMTRACE builds only */
+void MEM_TraceStart(void)
+{
+#if MEMTRACE
+    uint32_t iflags = __disable_interrupts();
+
+    MemTraceCount = MemTraceLost = 0;
+    MemTraceEnabled = true;
+    __restore_interrupts(iflags);
+#endif
+}
+
+void MEM_TraceStop(void)
+{
+#if MEMTRACE
+    MemTraceEnabled = false;
+#endif
+}
+
+/* Stops recording and prints the trace for tools/tlsfreplay.c: a TRACE line, one line per
+   call "<op> <time> <ptr> <oldptr> <size>" with op M, F or R (lower case for the TCM pool),
+   then END. Print is called with interrupts enabled. */
+void MEM_DumpTrace(void (*Print)(const char *fmt, ...))
+{
+#if MEMTRACE
+    static const char OpChars[] = "MFRmfr";
+    uint32_t i;
+#endif
+
+    if (Print == NULL) return;
+
+    MEM_TraceStop();
+#if MEMTRACE
+    Print("TRACE records=%lu lost=%lu pool=%lu fast=%lu\r\n", MemTraceCount, MemTraceLost,
+          (uint32_t)SYSMEMSIZE, (uint32_t)FASTMEMSIZE);
+    for(i = 0; i < MemTraceCount; i++)
+    {
+        pMEMTRACEREC Rec = &MemTrace[i];
+
+        Print("%c %lu %lX %lX %lu\r\n", OpChars[Rec->Op + Rec->Fast * 3], Rec->Time,
+              Rec->Ptr, Rec->OldPtr, (uint32_t)Rec->Size);
+    }
+#else
+    Print("TRACE records=0 lost=0 pool=%lu fast=%lu\r\n", (uint32_t)SYSMEMSIZE, (uint32_t)FASTMEMSIZE);
+#endif
+    Print("END\r\n");
+}
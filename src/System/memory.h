@@ -19,14 +19,116 @@
 #ifndef _MEMORY_H_
 #define _MEMORY_H_
 
+#define MEMPROF_SITESHIFT           6
+#define MEMPROF_SITES               (1 << MEMPROF_SITESHIFT)                                        // Call sites tracked by the profiler
+#define MEMPROF_CLASSES             16                                                              // Size classes: <= 16, <= 32, ... bytes
+#define MEMTRACE_RECORDS            4096                                                            // Trace buffer, MEMTRACE builds only
+#define SLAB(Name, Size, Count)     { Name, Size, Count }                                          // Static slab descriptor
+
+/* Placement hints for malloc_hint() */
+typedef enum tag_MEMHINT
+{
+    MH_ANY = 0,                                                                                     // External RAM pool
+    MH_FAST,                                                                                        // TCM pool, external RAM when it is exhausted
+    MH_FASTONLY                                                                                     // TCM pool or NULL
+} TMEMHINT;
+
+/* Fixed size blocks carved from the memory pool on first use. free() returns slab blocks
+   to their free list, a request the slab cannot serve is passed to TLSF. */
+typedef struct tag_SLAB *pSLAB;
+typedef struct tag_SLAB
+{
+    const char *Name;
+    uint32_t   BlockSize;                                                                           // Rounded up to 8 bytes on creation
+    uint32_t   BlocksCount;
+    pSLAB      Next;                                                                                // Created slabs, searched by free()
+    uint8_t    *Start;
+    uint8_t    *End;
+    void       *FreeList;
+    uint32_t   Used;
+    uint32_t   Peak;
+    uint32_t   Fallbacks;                                                                           // Requests passed to TLSF
+} TSLAB;
+
+typedef struct tag_SCRATCHSTATS
+{
+    uint32_t Size;
+    uint32_t Used;
+    uint32_t Peak;
+    uint32_t Fallbacks;                                                                             // Requests passed to TLSF
+} TSCRATCHSTATS, *pSCRATCHSTATS;
+
+typedef struct tag_SLABSTATS
+{
+    uint32_t BlockSize;
+    uint32_t BlocksCount;
+    uint32_t Used;
+    uint32_t Peak;
+    uint32_t Fallbacks;
+} TSLABSTATS, *pSLABSTATS;
+
+/* Allocation profiler, MEMPROFILE builds only */
+typedef struct tag_MEMSITE
+{
+    void     *Caller;                                                                               // Return address of the allocating call
+    uint32_t Allocs;
+    uint32_t LiveCount;
+    uint32_t LiveBytes;
+    uint32_t PeakBytes;
+} TMEMSITE, *pMEMSITE;
+
+/* Heap call trace, MEMTRACE builds only. Sizes are the requested ones. */
+typedef enum tag_MEMTRACEOP
+{
+    MTO_MALLOC = 0,
+    MTO_FREE,
+    MTO_REALLOC
+} TMEMTRACEOP;
+
+typedef struct tag_MEMTRACEREC
+{
+    uint32_t Time;                                                                                  // USC ticks, us
+    uint32_t Ptr;                                                                                   // Block returned or freed, 0 if the call failed
+    uint32_t OldPtr;                                                                                // Source block of realloc
+    uint32_t Size    : 24;
+    uint32_t Op      : 4;                                                                           // TMEMTRACEOP
+    uint32_t Fast    : 1;                                                                           // TCM pool
+    uint32_t         : 3;
+} TMEMTRACEREC, *pMEMTRACEREC;
+
+typedef struct tag_MEMPROFILE
+{
+    uint32_t LiveBytes;                                                                             // Requested sizes, no TLSF overhead
+    uint32_t PeakBytes;
+    uint32_t Allocs;
+    uint32_t Frees;
+    uint32_t LostAllocs;                                                                            // Call site table was full
+    uint32_t ClassAllocs[MEMPROF_CLASSES];
+} TMEMPROFILE, *pMEMPROFILE;
+
 extern size_t InitializeMemoryPool(void);
 extern void *malloc(size_t size);
 extern void free(void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc(size_t nelem, size_t elem_size);
+extern void *malloc_hint(size_t size, TMEMHINT Hint);
+extern void *malloc_fast(size_t size);
 extern uint32_t GetSysMemoryAddress(void);
 extern boolean IsDynamicMemory(void *Memory);
+extern boolean IsFastMemory(void *Memory);
 extern boolean IsStackMemory(void *Memory);
 extern size_t GetTotalUsedMemory(void);
+extern size_t GetTotalUsedFastMemory(void);
+extern void *SLAB_Alloc(pSLAB Slab);
+extern pSLAB SLAB_GetNext(pSLAB Slab);
+extern void SLAB_GetStats(pSLAB Slab, pSLABSTATS Stats);
+extern void SLAB_ReportStats(void);
+extern void *SCRATCH_Alloc(size_t size);
+extern void SCRATCH_Reset(void);
+extern void SCRATCH_GetStats(pSCRATCHSTATS Stats);
+extern void MEM_ReportProfile(void (*Print)(const char *fmt, ...));
+extern void MEM_TraceStart(void);
+extern void MEM_TraceStop(void);
+extern void MEM_DumpTrace(void (*Print)(const char *fmt, ...));
 
 #endif /* _MEMORY_H_ */
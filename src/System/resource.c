@@ -21,3 +21,118 @@
 #include "systemconfig.h"
 #include "resource.h"
 
+
+extern uintptr_t __ROMBase, __ROMImageLimit;
+
+static const TRESHEADER *ResArchive;                                                               // XIP mapped, NULL if missing
+
+static const TRESENTRY *RES_GetEntries(void)
+{
+    return (const TRESENTRY *)&ResArchive[1];
+}
+
+static const char *RES_GetName(const TRESENTRY *Entry)
+{
+    return (const char *)ResArchive + Entry->NameOffset;
+}
+
+/* Binary search over the sorted index, the archive is read in place */
+const TRESENTRY *RES_Find(const char *Name)
+{
+    if ((ResArchive != NULL) && (Name != NULL))
+    {
+        const TRESENTRY *Entries = RES_GetEntries();
+        uint32_t Low = 0, High = ResArchive->EntriesCount;
+
+        while(Low < High)
+        {
+            uint32_t Middle = Low + (High - Low) / 2;
+            int32_t  Result = strcmp(Name, RES_GetName(&Entries[Middle]));
+
+            if (!Result) return &Entries[Middle];
+            if (Result < 0) High = Middle;
+            else Low = Middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Returns a pointer into the memory mapped flash, valid until the archive is rewritten */
+const void *RES_GetEx(const char *Name, TRESTYPE *Type, size_t *Size)
+{
+    const TRESENTRY *Entry = RES_Find(Name);
+
+    if (Entry == NULL) return NULL;
+    if (Type != NULL) *Type = (TRESTYPE)Entry->Type;
+    if (Size != NULL) *Size = Entry->Size;
+
+    return (const uint8_t *)ResArchive + Entry->DataOffset;
+}
+
+const void *RES_Get(const char *Name)
+{
+    return RES_GetEx(Name, NULL, NULL);
+}
+
+/* Data CRCs are not checked at lookup, this is for update checks */
+boolean RES_Verify(const char *Name)
+{
+    const TRESENTRY *Entry = RES_Find(Name);
+
+    return (Entry != NULL) &&
+           (CalculateCRC16((uint8_t *)ResArchive + Entry->DataOffset, Entry->Size) == Entry->DataCRC);
+}
+
+uint32_t RES_GetCount(void)
+{
+    return (ResArchive != NULL) ? ResArchive->EntriesCount : 0;
+}
+
+static boolean RES_CheckArchive(const TRESHEADER *Header, size_t RegionSize)
+{
+    const TRESENTRY *Entries = (const TRESENTRY *)&Header[1];
+    size_t          IndexSize;
+    uint32_t        i;
+
+    if ((Header->Magic != RES_MAGIC) || (Header->Version != RES_VERSION) ||
+            (Header->TotalSize > RegionSize) || (Header->DataOffset < sizeof(TRESHEADER)) ||
+            (Header->DataOffset > Header->TotalSize) ||
+            (Header->EntriesCount > (Header->DataOffset - sizeof(TRESHEADER)) / sizeof(TRESENTRY)))
+        return false;
+
+    IndexSize = Header->DataOffset - sizeof(TRESHEADER);
+    if (CalculateCRC16((void *)Entries, IndexSize) != Header->IndexCRC) return false;
+
+    /* Names must end inside the index, data inside the archive */
+    for(i = 0; i < Header->EntriesCount; i++)
+    {
+        const TRESENTRY *Entry = &Entries[i];
+
+        if ((Entry->NameOffset < sizeof(TRESHEADER) + Header->EntriesCount * sizeof(TRESENTRY)) ||
+                (Entry->NameOffset >= Header->DataOffset) ||
+                (memchr((const char *)Header + Entry->NameOffset, '\0',
+                        Header->DataOffset - Entry->NameOffset) == NULL) ||
+                (Entry->DataOffset < Header->DataOffset) || (Entry->DataOffset & (RES_ALIGNMENT - 1)) ||
+                (Entry->DataOffset > Header->TotalSize) ||
+                (Entry->Size > Header->TotalSize - Entry->DataOffset))
+            return false;
+    }
+    return true;
+}
+
+/* Archive partition right below the key/value store */
+boolean RES_Initialize(void)
+{
+    ResArchive = NULL;
+    if ((FlashConfig != NULL) && (FlashCapacity >= KVSREGIONSIZE + RESREGIONSIZE))
+    {
+        uint32_t Base = FlashCapacity - KVSREGIONSIZE - RESREGIONSIZE;
+        const TRESHEADER *Header = (const TRESHEADER *)(Base + (uintptr_t)&__ROMBase);
+
+        /* Never overlap the firmware image */
+        if (Base < (uintptr_t)&__ROMImageLimit - (uintptr_t)&__ROMBase) return false;
+
+        if (RES_CheckArchive(Header, RESREGIONSIZE)) ResArchive = Header;
+    }
+    return ResArchive != NULL;
+}
@@ -19,6 +19,11 @@
 #ifndef _RESOURCE_H_
 #define _RESOURCE_H_
 
+#define RES_MAGIC                   0x31534552                                                      // "RES1"
+#define RES_VERSION                 1
+#define RES_ALIGNMENT               4                                                               // Data offsets alignment
+#define RES_MAXNAMELEN              63
+
 typedef enum tag_RESTYPE
 {
     RT_UNKNOWN,
@@ -40,4 +45,32 @@ typedef struct tag_RESFONT
     BFC_FONT *Font;
 } TRESFONT, *pRESFONT;
 
+/* Archive layout: header, entries sorted by name (strcmp order), zero terminated names,
+   data. All offsets are from the archive start, all fields are little endian. */
+typedef struct tag_RESHEADER
+{
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t IndexCRC;                                                                              // CRC16 of entries and names
+    uint32_t EntriesCount;
+    uint32_t DataOffset;                                                                            // End of the names
+    uint32_t TotalSize;
+} TRESHEADER, *pRESHEADER;
+
+typedef struct tag_RESENTRY
+{
+    uint32_t NameOffset;
+    uint32_t DataOffset;
+    uint32_t Size;
+    uint16_t Type;                                                                                  // TRESTYPE
+    uint16_t DataCRC;
+} TRESENTRY, *pRESENTRY;
+
+extern const TRESENTRY *RES_Find(const char *Name);
+extern const void *RES_Get(const char *Name);
+extern const void *RES_GetEx(const char *Name, TRESTYPE *Type, size_t *Size);
+extern boolean RES_Verify(const char *Name);
+extern uint32_t RES_GetCount(void);
+extern boolean RES_Initialize(void);
+
 #endif /* _RESOURCE_H_ */
@@ -0,0 +1,302 @@
+/*
+* This file is part of the DZ09 project.
+*
+* Copyright (C) 2022 AJScorp
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+#include "systemconfig.h"
+#include "sectorlog.h"
+
+/*
+ * Sector bookkeeping shared by the flash logs (kvstore.c, sf_ftl.c). Every sector starts with
+ * a TSLOGHEADER; the owner appends its data behind it and never rewrites it. Sectors are
+ * opened in sequence, the least erased free one first, and reclaimed by the owner: it moves
+ * the current data of a victim sector to the log head and erases it. Reclaiming runs from a
+ * low resolution timer so writes only program already erased space.
+ */
+
+typedef struct tag_SLOGHEADER
+{
+    uint32_t Magic;
+    uint32_t EraseCount;
+    uint16_t CRC;                                                                                   // Over Magic and EraseCount
+    uint16_t Reserved;
+    uint32_t Sequence;                                                                              // Programmed when opened, 0xFFFFFFFF while free
+} TSLOGHEADER;
+
+static pSECTORLOG SLOGList;
+static pTIMER     SLOGTimer;
+static uint32_t   SLOGDelay;                                                                        // ms, shortest asked for
+
+boolean SLOG_ReadAt(pSECTORLOG Log, uint32_t Location, void *Data, size_t Count)
+{
+    return Log->Flash.Read(Log->Flash.Context, Log->Base + Location, Data, Count);
+}
+
+boolean SLOG_ProgramAt(pSECTORLOG Log, uint32_t Location, const void *Data, size_t Count)
+{
+    return Log->Flash.Program(Log->Flash.Context, Log->Base + Location, (void *)Data, Count);
+}
+
+static boolean SLOG_WriteHeader(pSECTORLOG Log, uint32_t Sector)
+{
+    TSLOGHEADER Header;
+
+    Header.Magic = Log->Magic;
+    Header.EraseCount = Log->Sectors[Sector].EraseCount;
+    Header.CRC = CalculateCRC16(&Header, offsetof(TSLOGHEADER, CRC));
+    Header.Reserved = 0xFFFF;
+
+    if (!SLOG_ProgramAt(Log, Sector * SLOG_SECTORSIZE, &Header, offsetof(TSLOGHEADER, Sequence)))
+        return false;
+    Log->Sectors[Sector].State = SLS_FREE;
+    Log->Sectors[Sector].Fill = Log->FirstUnit;
+    Log->Sectors[Sector].Live = 0;
+    Log->FreeSectors++;
+
+    return true;
+}
+
+/* An interrupted erase leaves any mix of old and erased words, the header may even survive
+   with its Sequence erased. Clearing the magic first makes the mount erase such a sector again
+   instead of taking it for a free one or scanning what is left of its data. */
+boolean SLOG_EraseSector(pSECTORLOG Log, uint32_t Sector)
+{
+    uint32_t Magic = 0;
+
+    if (!SLOG_ProgramAt(Log, Sector * SLOG_SECTORSIZE, &Magic, sizeof(Magic)) ||
+            !Log->Flash.Erase(Log->Flash.Context, Log->Base + Sector * SLOG_SECTORSIZE))
+        return false;
+    Log->Sectors[Sector].EraseCount++;
+    Log->Erases++;
+
+    return SLOG_WriteHeader(Log, Sector);
+}
+
+static boolean SLOG_IsBlank(pSECTORLOG Log, uint32_t Sector)
+{
+    uint32_t Offset, i, tmpData[16];
+
+    for(Offset = 0; Offset < SLOG_SECTORSIZE; Offset += sizeof(tmpData))
+    {
+        if (!SLOG_ReadAt(Log, Sector * SLOG_SECTORSIZE + Offset, tmpData, sizeof(tmpData))) return false;
+        for(i = 0; i < sizeof(tmpData) / sizeof(uint32_t); i++)
+            if (tmpData[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+/* Rebuilds the sector table from the headers. Scan gets every sector in use and sets its
+   Fill and Live, the active sector is the newest one with room left. */
+boolean SLOG_Mount(pSECTORLOG Log, void (*Scan)(void *Owner, uint32_t Sector))
+{
+    uint32_t i, MaxEraseCount = 0, Newest = SLOG_NOSECTOR;
+
+    Log->ActiveSector = SLOG_NOSECTOR;
+    Log->FreeSectors = 0;
+    Log->NextSequence = 0;
+    Log->Erases = 0;
+    Log->Reclaiming = false;
+
+    for(i = 0; i < Log->SectorsCount; i++)
+    {
+        TSLOGHEADER Header;
+        pSLOGSECTOR Sector = &Log->Sectors[i];
+
+        Sector->Fill = Log->FirstUnit;
+        Sector->Live = 0;
+        if (SLOG_ReadAt(Log, i * SLOG_SECTORSIZE, &Header, sizeof(TSLOGHEADER)) &&
+                (Header.Magic == Log->Magic) &&
+                (Header.CRC == CalculateCRC16(&Header, offsetof(TSLOGHEADER, CRC))))
+        {
+            Sector->EraseCount = Header.EraseCount;
+            MaxEraseCount = max(MaxEraseCount, Header.EraseCount);
+            if (Header.Sequence == 0xFFFFFFFF)
+            {
+                Sector->State = SLS_FREE;
+                Log->FreeSectors++;
+            }
+            else
+            {
+                Sector->State = SLS_USED;
+                Sector->Sequence = Header.Sequence;
+                if ((Newest == SLOG_NOSECTOR) || ((int32_t)(Header.Sequence - Log->Sectors[Newest].Sequence) > 0))
+                    Newest = i;
+                if ((int32_t)(Header.Sequence - Log->NextSequence) >= 0)
+                    Log->NextSequence = Header.Sequence + 1;
+                Scan(Log->Owner, i);
+            }
+        }
+        else Sector->State = SLS_UNFORMATTED;
+    }
+
+    /* Erase counts of unformatted sectors are lost, assume the worst known one. An
+       interrupted erase or a foreign region is cleaned here, before any write can wait on it. */
+    for(i = 0; i < Log->SectorsCount; i++)
+        if (Log->Sectors[i].State == SLS_UNFORMATTED)
+        {
+            Log->Sectors[i].EraseCount = MaxEraseCount;
+            if (!(SLOG_IsBlank(Log, i) ? SLOG_WriteHeader(Log, i) : SLOG_EraseSector(Log, i)))
+                return false;
+        }
+
+    if ((Newest != SLOG_NOSECTOR) && (Log->Sectors[Newest].Fill < Log->EndUnit))
+        Log->ActiveSector = Newest;
+
+    return true;
+}
+
+/* Wear levelling: the least erased free sector becomes the new log head */
+boolean SLOG_OpenSector(pSECTORLOG Log)
+{
+    uint32_t i, Sector = SLOG_NOSECTOR;
+
+    if (!Log->Reclaiming && (Log->FreeSectors <= Log->ReserveSectors)) return false;
+
+    for(i = 0; i < Log->SectorsCount; i++)
+        if ((Log->Sectors[i].State == SLS_FREE) &&
+                ((Sector == SLOG_NOSECTOR) || (Log->Sectors[i].EraseCount < Log->Sectors[Sector].EraseCount)))
+            Sector = i;
+    if (Sector == SLOG_NOSECTOR) return false;
+
+    Log->Sectors[Sector].Sequence = Log->NextSequence++;
+    Log->Sectors[Sector].State = SLS_USED;
+    Log->FreeSectors--;
+    Log->ActiveSector = Sector;
+
+    if (!SLOG_ProgramAt(Log, Sector * SLOG_SECTORSIZE + offsetof(TSLOGHEADER, Sequence),
+                        &Log->Sectors[Sector].Sequence, sizeof(uint32_t)))
+    {
+        Log->Sectors[Sector].Fill = Log->EndUnit;
+        return false;
+    }
+    return true;
+}
+
+/* A reset while reclaiming can leave the reserve in use: the room left at the log head
+   belongs to the reclaiming that has to finish first */
+boolean SLOG_MayWrite(pSECTORLOG Log)
+{
+    return Log->Reclaiming || (Log->FreeSectors >= Log->ReserveSectors);
+}
+
+/* The sector with the least current data, or the least erased one once the erase count
+   spread exceeds WearDelta so that cold data moves as well. SLOG_NOSECTOR if no sector is
+   worth an erase or the log has no room for the data to move. */
+uint32_t SLOG_SelectVictim(pSECTORLOG Log)
+{
+    uint32_t i, Victim = SLOG_NOSECTOR, Coldest = SLOG_NOSECTOR, MaxEraseCount = 0, Room;
+
+    for(i = 0; i < Log->SectorsCount; i++)
+    {
+        pSLOGSECTOR Sector = &Log->Sectors[i];
+
+        MaxEraseCount = max(MaxEraseCount, Sector->EraseCount);
+        if ((Sector->State != SLS_USED) || (i == Log->ActiveSector)) continue;
+        if ((Victim == SLOG_NOSECTOR) || (Sector->Live < Log->Sectors[Victim].Live))
+            Victim = i;
+        if ((Coldest == SLOG_NOSECTOR) || (Sector->EraseCount < Log->Sectors[Coldest].EraseCount))
+            Coldest = i;
+    }
+    if (Victim == SLOG_NOSECTOR) return SLOG_NOSECTOR;
+
+    if ((MaxEraseCount - Log->Sectors[Coldest].EraseCount > Log->WearDelta) &&
+            (Log->FreeSectors > Log->ReserveSectors))
+        Victim = Coldest;
+    else if (Log->Sectors[Victim].Live + Log->MinReclaim > Log->EndUnit - Log->FirstUnit)
+        return SLOG_NOSECTOR;                                                                       // Not worth an erase cycle
+
+    Room = Log->FreeSectors * (Log->EndUnit - Log->FirstUnit);
+    if (Log->ActiveSector != SLOG_NOSECTOR)
+        Room += Log->EndUnit - Log->Sectors[Log->ActiveSector].Fill;
+
+    return (Room < Log->Sectors[Victim].Live) ? SLOG_NOSECTOR : Victim;
+}
+
+uint32_t SLOG_OldestSector(pSECTORLOG Log)
+{
+    uint32_t i, Sector = SLOG_NOSECTOR;
+
+    for(i = 0; i < Log->SectorsCount; i++)
+        if ((Log->Sectors[i].State == SLS_USED) &&
+                ((Sector == SLOG_NOSECTOR) || ((int32_t)(Log->Sectors[i].Sequence - Log->Sectors[Sector].Sequence) < 0)))
+            Sector = i;
+    return Sector;
+}
+
+/* Decides between two versions of an item while mounting. Equal sequences are copies left by
+   an interrupted reclaim: the copy, in the later opened sector, wins. The victim then only
+   counts what is still to be moved and the reclaim can resume within the room it had. */
+boolean SLOG_IsNewer(pSECTORLOG Log, uint32_t Sequence, uint32_t Sector, uint32_t OldSequence, uint32_t OldSector)
+{
+    int32_t Order = (int32_t)(Sequence - OldSequence);
+
+    if (!Order) Order = (int32_t)(Log->Sectors[Sector].Sequence - Log->Sectors[OldSector].Sequence);
+
+    return Order > 0;
+}
+
+static boolean SLOG_NeedsReclaim(pSECTORLOG Log)
+{
+    return Log->FreeSectors < Log->FreeTarget;
+}
+
+/* Runs from the main loop: one sector per tick keeps event latency bounded */
+static void SLOG_TimerHandler(pTIMER Timer)
+{
+    pSECTORLOG tmpLog;
+    boolean    Pending = false;
+
+    for(tmpLog = SLOGList; tmpLog != NULL; tmpLog = tmpLog->Next)
+        if (SLOG_NeedsReclaim(tmpLog) && tmpLog->Reclaim(tmpLog->Owner) && SLOG_NeedsReclaim(tmpLog))
+            Pending = true;
+    if (Pending) LRT_Start(Timer);
+}
+
+/* Hands the log to the background reclaimer, which ticks at the shortest Delay asked for */
+void SLOG_Attach(pSECTORLOG Log, uint32_t Delay)
+{
+    SLOG_Detach(Log);
+    Log->Next = SLOGList;
+    SLOGList = Log;
+    if (SLOGTimer == NULL)
+    {
+        SLOGTimer = LRT_Create(Delay, SLOG_TimerHandler, TF_NONE);
+        SLOGDelay = Delay;
+    }
+    else if (Delay < SLOGDelay)
+    {
+        LRT_SetInterval(SLOGTimer, Delay);
+        SLOGDelay = Delay;
+    }
+    SLOG_Schedule(Log);
+}
+
+/* Returns false if the log was not attached */
+boolean SLOG_Detach(pSECTORLOG Log)
+{
+    pSECTORLOG *pLink = &SLOGList;
+
+    while((*pLink != NULL) && (*pLink != Log)) pLink = &(*pLink)->Next;
+    if (*pLink == NULL) return false;
+    *pLink = Log->Next;
+
+    return true;
+}
+
+void SLOG_Schedule(pSECTORLOG Log)
+{
+    if ((SLOGTimer != NULL) && SLOG_NeedsReclaim(Log)) LRT_Start(SLOGTimer);
+}
@@ -0,0 +1,81 @@
+/*
+* This file is part of the DZ09 project.
+*
+* Copyright (C) 2022 AJScorp
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+#ifndef _SECTORLOG_H_
+#define _SECTORLOG_H_
+
+#define SLOG_SECTORSIZE             NORSECTORSIZE                                                   // Erase unit
+#define SLOG_HEADERSIZE             16                                                              // Sector header, the owner's data follows
+#define SLOG_NOSECTOR               0xFFFFFFFF
+
+typedef enum tag_SLOGSTATE
+{
+    SLS_FREE,                                                                                       // Erased, header written
+    SLS_USED,                                                                                       // Sequence assigned, holds data
+    SLS_UNFORMATTED                                                                                 // No valid header, while mounting only
+} TSLOGSTATE;
+
+typedef struct tag_SLOGSECTOR
+{
+    uint32_t EraseCount;
+    uint32_t Sequence;                                                                              // Order in which sectors were opened
+    uint16_t Fill;                                                                                  // First unwritten unit
+    uint16_t Live;                                                                                  // Units holding current data
+    uint8_t  State;                                                                                 // TSLOGSTATE
+} TSLOGSECTOR, *pSLOGSECTOR;
+
+/* Units are the owner's choice (bytes, slots): Fill runs from FirstUnit to EndUnit */
+typedef struct tag_SECTORLOG *pSECTORLOG;
+typedef struct tag_SECTORLOG
+{
+    pSECTORLOG  Next;                                                                               // Logs serviced by the background reclaimer
+    TNORFLASH   Flash;
+    uint32_t    Base;
+    uint32_t    SectorsCount;
+    uint32_t    Magic;                                                                              // Owner's sector header magic
+    uint16_t    FirstUnit;
+    uint16_t    EndUnit;
+    uint16_t    MinReclaim;                                                                         // Least garbage worth an erase
+    uint16_t    ReserveSectors;                                                                     // Kept erased for reclaiming only
+    uint16_t    FreeTarget;                                                                         // Background reclaiming target
+    uint16_t    WearDelta;                                                                          // Erase count spread that moves cold sectors
+    boolean     (*Reclaim)(void *Owner);                                                            // One reclaiming step
+    void        *Owner;
+    pSLOGSECTOR Sectors;
+    uint32_t    ActiveSector;                                                                       // Sector taking writes, SLOG_NOSECTOR if none
+    uint32_t    FreeSectors;
+    uint32_t    NextSequence;                                                                       // Of the next sector opened
+    uint32_t    Erases;
+    boolean     Reclaiming;                                                                         // Reserve sectors may be opened
+} TSECTORLOG;
+
+extern boolean SLOG_ReadAt(pSECTORLOG Log, uint32_t Location, void *Data, size_t Count);
+extern boolean SLOG_ProgramAt(pSECTORLOG Log, uint32_t Location, const void *Data, size_t Count);
+extern boolean SLOG_Mount(pSECTORLOG Log, void (*Scan)(void *Owner, uint32_t Sector));
+extern boolean SLOG_OpenSector(pSECTORLOG Log);
+extern boolean SLOG_EraseSector(pSECTORLOG Log, uint32_t Sector);
+extern boolean SLOG_MayWrite(pSECTORLOG Log);
+extern uint32_t SLOG_SelectVictim(pSECTORLOG Log);
+extern uint32_t SLOG_OldestSector(pSECTORLOG Log);
+extern boolean SLOG_IsNewer(pSECTORLOG Log, uint32_t Sequence, uint32_t Sector,
+                            uint32_t OldSequence, uint32_t OldSector);
+extern void SLOG_Attach(pSECTORLOG Log, uint32_t Delay);
+extern boolean SLOG_Detach(pSECTORLOG Log);
+extern void SLOG_Schedule(pSECTORLOG Log);
+
+#endif /* _SECTORLOG_H_ */
@@ -27,6 +27,10 @@ pDFCONFIG FlashConfig;
 size_t    FlashCapacity;
 boolean   (*SFI_DeviceCmdAddrWrite)(TSFI_CS, uint8_t, uint32_t, uint8_t*, size_t);
 
+static pDLIST          SFJobsList;
+static pTIMER          SFJobTimer;
+static pSFJOB volatile SFActiveJob;                                                                 // Job that may hold a suspended erase
+
 static void __ramfunc SF_DevWaitReady(TSFI_CS CS)
 {
     uint8_t tmpSR;
@@ -38,6 +42,22 @@ static void __ramfunc SF_DevWaitReady(TSFI_CS CS)
     while(tmpSR & DF_BUSY);
 }
 
+/* Returns false if the device is still busy after Timeout us */
+static boolean __ramfunc SF_DevWaitReadyFor(TSFI_CS CS, uint32_t Timeout)
+{
+    uint32_t StartTicks = USCNTI_VAL;
+    uint8_t  tmpSR;
+
+    do
+    {
+        SFI_DeviceCommandRead(CS, DF_CMD_READ_SR, &tmpSR, 1);
+        if (!(tmpSR & DF_BUSY)) return true;
+    }
+    while(USCNTI_VAL - StartTicks < Timeout);
+
+    return false;
+}
+
 static boolean __ramfunc SF_BlankCheck(void *Address, size_t Count)
 {
     uint8_t *pData = (uint8_t *)((uintptr_t)Address + (uintptr_t)&__ROMBase);
@@ -99,6 +119,108 @@ static void __ramfunc SF_WriteBlock(TSFI_CS CS, void *Address, uint8_t *Data, si
     __restore_interrupts(intflags);
 }
 
+/* Runs the erase to its end before other device commands, a suspended erase only allows reads */
+static void __ramfunc SF_FinishSuspended(void)
+{
+    pSFJOB Job = SFActiveJob;
+
+    if ((Job != NULL) && Job->Suspended)
+    {
+        uint32_t intflags = __disable_interrupts();
+
+        SFI_DeviceCommandWrite(Job->CS, DF_CMD_RESUME, NULL, 0);
+        SF_DevWaitReady(Job->CS);
+        Job->Suspended = false;
+        Job->Address += Job->BlockSize;
+        Job->BlockSize = 0;
+        __restore_interrupts(intflags);
+    }
+}
+
+/* One job step. Code and data keep executing from the flash between steps, so an erase
+   that outlasts SFJ_SLICETIME is suspended before interrupts are enabled again. */
+static void __ramfunc SF_JobStep(pSFJOB Job)
+{
+    if (Job->Type == SFJ_ERASE)
+    {
+        uint32_t intflags;
+        boolean  Done;
+
+        if (!Job->BlockSize)
+        {
+            uintptr_t Remain = Job->EndAddress - Job->Address;
+            uint8_t   Command;
+
+            if ((FlashConfig->EraseSupport & BR_64K) && !(Job->Address & BLOCK64K_MASK) && (Remain > BLOCK64K_MASK))
+            {
+                Job->BlockSize = BLOCK64K_MASK + 1;
+                Command = DF_CMD_ERASE_BLOCK64;
+            }
+            else if ((FlashConfig->EraseSupport & BR_32K) && !(Job->Address & BLOCK32K_MASK) && (Remain > BLOCK32K_MASK))
+            {
+                Job->BlockSize = BLOCK32K_MASK + 1;
+                Command = DF_CMD_ERASE_BLOCK32;
+            }
+            else
+            {
+                Job->BlockSize = BLOCK4K_MASK + 1;
+                Command = DF_CMD_ERASE_SECTOR;
+            }
+            if (SF_BlankCheck((void *)Job->Address, Job->BlockSize))
+            {
+                Job->Address += Job->BlockSize;
+                Job->BlockSize = 0;
+                return;
+            }
+            intflags = __disable_interrupts();
+            SFI_DeviceCommandWrite(Job->CS, DF_CMD_WREN, NULL, 0);
+            SFI_DeviceCmdAddrWrite(Job->CS, Command, Job->Address, NULL, 0);
+        }
+        else
+        {
+            intflags = __disable_interrupts();
+            if (Job->Suspended) SFI_DeviceCommandWrite(Job->CS, DF_CMD_RESUME, NULL, 0);
+            Job->Suspended = false;
+        }
+
+        Done = SF_DevWaitReadyFor(Job->CS, SFJ_SLICETIME);
+        if (!Done)
+        {
+            uint8_t tmpSR2;
+
+            /* A device without suspend support simply completes the erase here */
+            SFI_DeviceCommandWrite(Job->CS, DF_CMD_SUSPEND, NULL, 0);
+            SF_DevWaitReady(Job->CS);
+            SFI_DeviceCommandRead(Job->CS, DF_CMD_READ_SR2, &tmpSR2, 1);
+            Job->Suspended = (tmpSR2 & DF_SUS1) != 0;
+            Done = !Job->Suspended;
+        }
+        __restore_interrupts(intflags);
+
+        if (Done)
+        {
+            Job->Address += Job->BlockSize;
+            Job->BlockSize = 0;
+        }
+    }
+    else
+    {
+        uint32_t StartTicks = USCNTI_VAL;
+
+        /* Page programs are short, interrupts are served between them */
+        do
+        {
+            uint32_t nBytes = FlashConfig->PageSize - (Job->Address & (FlashConfig->PageSize - 1));
+
+            nBytes = min(min(nBytes, Job->EndAddress - Job->Address), SFI_MAXDATALOAD);
+            SF_WriteBlock(Job->CS, (void *)Job->Address, Job->Data, nBytes);
+            Job->Address += nBytes;
+            Job->Data += nBytes;
+        }
+        while((Job->Address < Job->EndAddress) && (USCNTI_VAL - StartTicks < SFJ_SLICETIME));
+    }
+}
+
 uint32_t __ramfunc SF_DevReadID(TSFI_CS CS)
 {
     uint32_t tmpDevixeID = 0, intflags = __disable_interrupts();
@@ -131,7 +253,20 @@ size_t __ramfunc SF_Read(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count)
         uint8_t *pReadData = (uint8_t *)((uintptr_t)&__ROMBase + (uintptr_t)Address);
 
         Count = min(Count, FlashCapacity - (uintptr_t)Address);
-        memcpy(Data, pReadData, Count);
+
+        /* Outside the firmware image the flash is not cached, every load is a separate
+           SFI transaction. Long reads go in 8 word LDM/STM bursts instead. */
+        if ((Count >= SF_BULKREADMIN) && !(((uintptr_t)pReadData ^ (uintptr_t)Data) & 0x03))
+        {
+            size_t nHead = -(uintptr_t)Data & 0x03;
+            size_t nBursts = (Count - nHead) / SF_BURSTSIZE;
+
+            memcpy(Data, pReadData, nHead);
+            __copy_bursts(Data + nHead, pReadData + nHead, nBursts);
+            nHead += nBursts * SF_BURSTSIZE;
+            memcpy(Data + nHead, pReadData + nHead, Count - nHead);
+        }
+        else memcpy(Data, pReadData, Count);
     }
     else Count = 0;
 
@@ -140,28 +275,30 @@ size_t __ramfunc SF_Read(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count)
 
 size_t __ramfunc SF_Write(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count)
 {
+    size_t Written = 0;
+
     if ((CS < SFI_CSNUM) && (Data != NULL) && ((uintptr_t)Address < FlashCapacity))
     {
         uint8_t *bAddress = Address;
 
+        SF_FinishSuspended();
+
         Count = min(Count, FlashCapacity - (uintptr_t)bAddress);
 
-        while(Count)
+        while(Written < Count)
         {
             uint32_t nBytes = FlashConfig->PageSize - ((uintptr_t)bAddress & (FlashConfig->PageSize - 1));
 
-            nBytes = min(min(nBytes, Count), SFI_MAXDATALOAD);
+            nBytes = min(min(nBytes, Count - Written), SFI_MAXDATALOAD);
 
             SF_WriteBlock(CS, bAddress, Data, nBytes);
 
             bAddress += nBytes;
             Data += nBytes;
-            Count -= nBytes;
+            Written += nBytes;
         }
     }
-    else Count = 0;
-
-    return Count;
+    return Written;
 }
 
 boolean __ramfunc SF_Erase(TSFI_CS CS, void *Address, size_t Count)
@@ -191,6 +328,8 @@ boolean __ramfunc SF_Erase(TSFI_CS CS, void *Address, size_t Count)
 
             nBlocks *= blockGranularity;
 
+            SF_FinishSuspended();
+
             if (nStart && !SF_BlankCheck(bAddress, nStart) &&
                     ((pStart = malloc(nStart)) != NULL))
                 SF_Read(CS, bAddress, pStart, nStart);
@@ -245,6 +384,127 @@ boolean __ramfunc SF_Erase(TSFI_CS CS, void *Address, size_t Count)
     return Result;
 }
 
+static boolean SF_NorRead(void *Context, uint32_t Address, void *Data, size_t Count)
+{
+    return SF_Read((TSFI_CS)(uintptr_t)Context, (void *)Address, Data, Count) == Count;
+}
+
+static boolean SF_NorProgram(void *Context, uint32_t Address, void *Data, size_t Count)
+{
+    return SF_Write((TSFI_CS)(uintptr_t)Context, (void *)Address, Data, Count) == Count;
+}
+
+static boolean SF_NorErase(void *Context, uint32_t Address)
+{
+    /* Aligned whole sector, SF_Erase has nothing to preserve around it */
+    return ((FlashConfig != NULL) && (FlashConfig->EraseSupport & BR_4K) && !(Address & BLOCK4K_MASK)) ?
+           SF_Erase((TSFI_CS)(uintptr_t)Context, (void *)Address, NORSECTORSIZE) : false;
+}
+
+const TNORFLASH SFNorFlash = { SF_NorRead, SF_NorProgram, SF_NorErase, (void *)SFI_CS0 };
+
+static void SF_JobTimerHandler(pTIMER Timer)
+{
+    pDLITEM tmpItem = DL_GetFirstItem(SFJobsList);
+    pSFJOB  Job;
+
+    if (tmpItem == NULL)
+    {
+        LRT_Stop(Timer);
+        return;
+    }
+    Job = tmpItem->Data;
+    Job->State = SFJS_RUNNING;
+    SFActiveJob = Job;
+    if ((Job->Address < Job->EndAddress) || Job->BlockSize) SF_JobStep(Job);
+
+    if ((Job->Address >= Job->EndAddress) && !Job->BlockSize)
+    {
+        SFActiveJob = NULL;
+        DL_ExcludeItem(SFJobsList, &Job->ListHeader);
+        Job->State = SFJS_DONE;
+        if (!DL_GetItemsCount(SFJobsList)) LRT_Stop(Timer);
+        if (!EM_PostEvent(ET_SFCOMPLETE, NULL, &Job, sizeof(pSFJOB))) SF_CompleteJob(Job);
+    }
+}
+
+static pSFJOB SF_QueueJob(TSFJTYPE Type, TSFI_CS CS, uintptr_t Address, uint8_t *Data, size_t Count,
+                          void (*Handler)(pSFJOB), void *Object)
+{
+    pSFJOB Job;
+
+    if (SFJobsList == NULL) SFJobsList = DL_Create();
+    if (SFJobTimer == NULL) SFJobTimer = LRT_Create(SFJ_POLLINTERVAL, SF_JobTimerHandler, TF_AUTOREPEAT);
+    if ((SFJobsList == NULL) || (SFJobTimer == NULL)) return NULL;
+
+    Job = malloc(sizeof(TSFJOB));
+    if (Job != NULL)
+    {
+        Job->Type = Type;
+        Job->State = SFJS_QUEUED;
+        Job->CS = CS;
+        Job->Address = Address;
+        Job->EndAddress = Address + min(Count, FlashCapacity - Address);
+        Job->Data = Data;
+        Job->BlockSize = 0;
+        Job->Suspended = false;
+        Job->Handler = Handler;
+        Job->Object = Object;
+        if (DL_AddItemPtr(SFJobsList, &Job->ListHeader))
+        {
+            if (DL_GetItemsCount(SFJobsList) == 1) LRT_Start(SFJobTimer);
+        }
+        else
+        {
+            free(Job);
+            Job = NULL;
+        }
+    }
+    return Job;
+}
+
+/* Address and Count must be aligned to the smallest supported erase block, nothing
+   around the range is preserved */
+pSFJOB SF_EraseAsync(TSFI_CS CS, void *Address, size_t Count, void (*Handler)(pSFJOB), void *Object)
+{
+    if ((CS < SFI_CSNUM) && (FlashConfig != NULL) && FlashConfig->EraseSupport &&
+            ((uintptr_t)Address < FlashCapacity) && Count)
+    {
+        uint32_t AlignMask = (FlashConfig->EraseSupport & BR_4K) ? BLOCK4K_MASK :
+                             (FlashConfig->EraseSupport & BR_32K) ? BLOCK32K_MASK : BLOCK64K_MASK;
+
+        if (!((uintptr_t)Address & AlignMask) && !(Count & AlignMask))
+            return SF_QueueJob(SFJ_ERASE, CS, (uintptr_t)Address, NULL, Count, Handler, Object);
+    }
+    return NULL;
+}
+
+/* Data must stay valid until the job completes */
+pSFJOB SF_WriteAsync(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count,
+                     void (*Handler)(pSFJOB), void *Object)
+{
+    if ((CS < SFI_CSNUM) && (FlashConfig != NULL) && (Data != NULL) &&
+            ((uintptr_t)Address < FlashCapacity) && Count)
+        return SF_QueueJob(SFJ_PROGRAM, CS, (uintptr_t)Address, Data, Count, Handler, Object);
+
+    return NULL;
+}
+
+uint32_t SF_GetPendingJobs(void)
+{
+    return (SFJobsList != NULL) ? DL_GetItemsCount(SFJobsList) : 0;
+}
+
+/* ET_SFCOMPLETE handler */
+void SF_CompleteJob(pSFJOB Job)
+{
+    if (Job != NULL)
+    {
+        if (Job->Handler != NULL) Job->Handler(Job);
+        free(Job);
+    }
+}
+
 boolean SF_Initialize(void)
 {
     boolean Result = false;
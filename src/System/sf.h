@@ -28,6 +28,7 @@
 #define DF_WEL                      (1 << 1)
 /* DF STATUS2 bits */
 #define DF_QE                       (1 << 1)
+#define DF_SUS1                     (1 << 7)                                                        // Erase suspended
 
 /* Generic DF commands */
 #define DF_CMD_WRITE_SR             0X01
@@ -46,12 +47,73 @@
 #define DF_CMD_READ_ID              0X9F
 #define DF_CMD_ENTER_DPD            0XB9
 #define DF_CMD_LEAVE_DPD            0XAB
+#define DF_CMD_READ_SR2             0X35
+#define DF_CMD_SUSPEND              0X75
+#define DF_CMD_RESUME               0X7A
+
+/* Bulk reads */
+#define SF_BURSTSIZE                32                                                              // Bytes per LDM/STM burst
+#define SF_BULKREADMIN              256                                                             // Shorter reads are a plain memcpy
+
+/* Asynchronous jobs */
+#define SFJ_SLICETIME               2000                                                            // us of device work per step, interrupts off
+#define SFJ_POLLINTERVAL            10                                                              // ms between steps
+
+typedef enum tag_SFJTYPE
+{
+    SFJ_ERASE,
+    SFJ_PROGRAM
+} TSFJTYPE;
+
+typedef enum tag_SFJSTATE
+{
+    SFJS_QUEUED,
+    SFJS_RUNNING,
+    SFJS_DONE
+} TSFJSTATE;
+
+typedef struct tag_SFJOB *pSFJOB;
+typedef struct tag_SFJOB
+{
+    TDLITEM            ListHeader;
+    TSFJTYPE           Type;
+    volatile TSFJSTATE State;
+    TSFI_CS            CS;
+    uintptr_t          Address;                                                                     // Next byte to erase or program
+    uintptr_t          EndAddress;
+    uint8_t            *Data;                                                                       // Program source, kept by the caller until completion
+    uint32_t           BlockSize;                                                                   // Erase in progress at Address, 0 if none
+    boolean            Suspended;                                                                   // That erase is suspended
+    void               (*Handler)(pSFJOB Job);                                                      // Runs from EM_ProcessEvents, the job is freed afterwards
+    void               *Object;
+} TSFJOB;
+
+#define NORSECTORSIZE               (BLOCK4K_MASK + 1)
+
+/* Sector level access for flash users that manage erasing themselves: addresses are
+   flash offsets, Erase sets one NORSECTORSIZE sector to 0xFF, Program only clears bits */
+typedef struct tag_NORFLASH
+{
+    boolean (*Read)(void *Context, uint32_t Address, void *Data, size_t Count);
+    boolean (*Program)(void *Context, uint32_t Address, void *Data, size_t Count);
+    boolean (*Erase)(void *Context, uint32_t Address);
+    void    *Context;
+} TNORFLASH, *pNORFLASH;
+
+extern const TNORFLASH SFNorFlash;
+extern pDFCONFIG FlashConfig;
+extern size_t    FlashCapacity;
 
 extern uint32_t SF_DevReadID(TSFI_CS CS);
 extern boolean SF_WriteStatus(TSFI_CS CS, uint8_t *Data, uint32_t Count);
 extern size_t SF_Read(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count);
 extern size_t SF_Write(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count);
 extern boolean SF_Erase(TSFI_CS CS, void *Address, size_t Count);
+extern pSFJOB SF_EraseAsync(TSFI_CS CS, void *Address, size_t Count, void (*Handler)(pSFJOB), void *Object);
+extern pSFJOB SF_WriteAsync(TSFI_CS CS, void *Address, uint8_t *Data, size_t Count,
+                            void (*Handler)(pSFJOB), void *Object);
+extern uint32_t SF_GetPendingJobs(void);
+extern void SF_CompleteJob(pSFJOB Job);
 extern boolean SF_Initialize(void);
 
 #endif /* _SF_H_ */
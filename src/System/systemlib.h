@@ -33,5 +33,7 @@
 #include "crc.h"
 #include "fscache.h"
 #include "sf.h"
+#include "sectorlog.h"
+#include "kvstore.h"
 
 #endif /* _SYSTEMLIB_H_ */
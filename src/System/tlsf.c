@@ -609,6 +609,42 @@ size_t get_max_size(void *mem_pool)
 #endif
 }
 
+/******************************************************************/
+size_t get_free_size(void *mem_pool, size_t *largest)
+{
+/******************************************************************/
+    /* Walks every free list: total free bytes, and the largest free block in *largest */
+    tlsf_t *tlsf = (tlsf_t *) mem_pool;
+    size_t total = 0, max_block = 0;
+    int fl, sl;
+    bhdr_t *b;
+
+    for (fl = 0; fl < REAL_FLI; fl++) {
+        if (!(tlsf->fl_bitmap & (1 << fl)))
+            continue;
+        for (sl = 0; sl < MAX_SLI; sl++) {
+            for (b = tlsf->matrix[fl][sl]; b; b = b->ptr.free_ptr.next) {
+                total += b->size & BLOCK_SIZE;
+                if ((b->size & BLOCK_SIZE) > max_block)
+                    max_block = b->size & BLOCK_SIZE;
+            }
+        }
+    }
+    if (largest)
+        *largest = max_block;
+    return total;
+}
+
+/******************************************************************/
+size_t get_block_size(void *ptr)
+{
+/******************************************************************/
+    /* Usable size of an allocated block, may exceed the requested size */
+    bhdr_t *b = (bhdr_t *) ((char *) ptr - BHDR_OVERHEAD);
+
+    return b->size & BLOCK_SIZE;
+}
+
 /******************************************************************/
 void destroy_memory_pool(void *mem_pool)
 {
@@ -29,6 +29,8 @@ extern "C"
 extern size_t init_memory_pool(size_t, void *);
 extern size_t get_used_size(void *);
 extern size_t get_max_size(void *);
+extern size_t get_free_size(void *, size_t *);
+extern size_t get_block_size(void *);
 extern void destroy_memory_pool(void *);
 extern size_t add_new_area(void *, size_t, void *);
 extern void *malloc_ex(size_t, void *);
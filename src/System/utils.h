@@ -45,6 +45,7 @@ extern uint32_t __clz(uint32_t Value);
 extern uint32_t __get_cpu_freq_ticks(void);                                                         // from asmutils.s
 extern void *__secure_memset(void *memptr, int val, size_t num);                                    // from asmutils.s
 extern boolean __is_in_isr_mode(void);                                                              // from asmutils.s
+extern void __copy_bursts(void *Dst, const void *Src, size_t Count);                                // from asmutils.s
 extern uint32_t GetCPUFrequency(void);
 
 #endif /* _UTILS_H_ */
@@ -39,9 +39,19 @@
 #define VIBRVOLTAGE         VIBR_VO18V
 
 #define SYSMEMSIZE          (3 * 1024 * 1024)
+#ifndef MEMPROFILE
+#define MEMPROFILE          (0)                                                                      // Tag heap blocks with caller and size
+#endif
+#ifndef MEMTRACE
+#define MEMTRACE            (0)                                                                      // Record heap calls for host replay
+#endif
+#define FASTMEMSIZE         (4 * 1024)                                                               // TCM pool below the interrupt stacks
+#define SCRATCHSIZE         (8 * 1024)                                                               // Per event arena for GUI region lists
 #define SYSCACHESIZE        CACHE_32kB
 #define LRTMRHWTIMER        GP_TIMER1
 #define LRTMR_FREQUENCY     100
+#define KVSREGIONSIZE       (64 * 1024)                                                              // Key/value store at the top of serial flash
+#define RESREGIONSIZE       (1024 * 1024)                                                            // Resource archive below the key/value store
 #include "systemlib.h"
 #include "guilib.h"
 
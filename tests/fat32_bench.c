@@ -0,0 +1,314 @@
+// FAT32 benchmark on a disk image: the same fs_fat32.c/fscache.c as the payload, mounted
+// through a file-backed block device.
+//
+// Usage: fat32_bench [--quick] [image]
+//
+// Write cases also print how many extents the file ended up in. Every case reports host time per operation and what the card would have seen: transfers,
+// sectors and the card time of the filebdev.h model, so runs are comparable across commits
+// and hosts. The image is formatted on every run.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "systemconfig.h"
+#include "fs_fat32.h"
+#include "filebdev.h"
+#include "mkfat32.h"
+#include "hoststubs.h"
+
+#define IMAGE_SECTORS   (128u * 2048u) // 128 MiB
+
+static FBD_Image g_img;
+static BDEV_Device g_dev;
+static FAT32_Volume g_vol;
+static uint8_t g_buf[64 * 1024] __attribute__((aligned(4)));
+static uint32_t g_bigBytes = 16u << 20, g_smallFiles = 256, g_repeats = 2000;
+
+typedef struct {
+    struct timespec start;
+    FBD_Stats before;
+    uint64_t op_start_us;     // card time when the current operation began
+    uint64_t worst_us;        // slowest operation in card time
+    uint32_t ops;
+} bench;
+
+static void bench_start(bench *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->before = g_img.stats;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void op_start(bench *b)
+{
+    b->op_start_us = g_img.stats.card_us;
+}
+
+static void op_end(bench *b)
+{
+    uint64_t us = g_img.stats.card_us - b->op_start_us;
+    if (us > b->worst_us) b->worst_us = us;
+    b->ops++;
+}
+
+static void bench_end(bench *b, const char *name, uint64_t bytes)
+{
+    struct timespec end;
+    const FBD_Stats *s = &g_img.stats;
+    uint64_t card_us = s->card_us - b->before.card_us;
+    uint32_t xfers = (s->read_calls - b->before.read_calls) + (s->write_calls - b->before.write_calls) +
+                     (s->async_reads - b->before.async_reads);
+    uint32_t sectors = (s->sectors_read - b->before.sectors_read) + (s->sectors_written - b->before.sectors_written);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double host_us = (end.tv_sec - b->start.tv_sec) * 1e6 + (end.tv_nsec - b->start.tv_nsec) / 1e3;
+    if (!b->ops) b->ops = 1;
+    printf("%-22s %7u %9.2f %9u %9u %10.3f %9.3f %8.2f\n", name, b->ops, host_us / b->ops, xfers, sectors,
+           card_us / 1000.0 / b->ops, b->worst_us / 1000.0, (bytes && card_us) ? bytes / (double)card_us : 0.0);
+}
+
+static void remount(void)
+{
+    CHECK(FAT32_MountDevice(&g_vol, &g_dev));
+}
+
+static void fill_pattern(uint8_t *p, uint32_t offset, uint32_t count)
+{
+    for (uint32_t i=0; i<count; ++i) p[i] = (uint8_t)((offset + i) * 2654435761u >> 24);
+}
+
+static void populate(void)
+{
+    static FAT32_File f;
+    char name[16];
+    CHECK(FAT32_Create(&g_vol, "BIG.BIN", &f));
+    for (uint32_t pos = 0; pos < g_bigBytes; pos += sizeof(g_buf)) {
+        fill_pattern(g_buf, pos, sizeof(g_buf));
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, sizeof(g_buf)) == sizeof(g_buf));
+    }
+    CHECK(FAT32_Flush(&g_vol, &f));
+    for (uint32_t i=0; i<g_smallFiles; ++i) {
+        snprintf(name, sizeof(name), "F%05u.DAT", i);
+        CHECK(FAT32_Create(&g_vol, name, &f));
+        fill_pattern(g_buf, i, 700);
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, 700) == 700);
+        CHECK(FAT32_Flush(&g_vol, &f));
+    }
+}
+
+static void bench_sequential_read(uint32_t chunk)
+{
+    static FAT32_File f;
+    bench b;
+    char name[32];
+    remount();
+    CHECK(FAT32_Open(&g_vol, "BIG.BIN", &f));
+    bench_start(&b);
+    for (uint32_t pos = 0; pos < g_bigBytes; pos += chunk) {
+        op_start(&b);
+        CHECK(FAT32_Read(&g_vol, &f, g_buf, chunk) == chunk);
+        op_end(&b);
+    }
+    snprintf(name, sizeof(name), "seq read %u", chunk);
+    bench_end(&b, name, g_bigBytes);
+}
+
+static void bench_random_read(boolean mapped)
+{
+    static FAT32_File f;
+    static FAT32_Extent extents[64];
+    bench b;
+    uint32_t seed = 1;
+    remount();
+    if (mapped) CHECK(FAT32_OpenMapped(&g_vol, "BIG.BIN", &f, extents, 64));
+    else CHECK(FAT32_Open(&g_vol, "BIG.BIN", &f));
+    bench_start(&b);
+    for (uint32_t i=0; i<g_repeats; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        op_start(&b);
+        CHECK(FAT32_Seek(&g_vol, &f, (seed >> 8) % (g_bigBytes - 512)));
+        CHECK(FAT32_Read(&g_vol, &f, g_buf, 512) == 512);
+        op_end(&b);
+    }
+    bench_end(&b, mapped ? "random 512 mapped" : "random 512", (uint64_t)g_repeats * 512);
+}
+
+static void bench_stream(void)
+{
+    static FAT32_File f;
+    static FAT32_Stream s;
+    static uint32_t pool[4 * 16 * 128];
+    uint64_t bytes = 0;
+    bench b;
+    remount();
+    CHECK(FAT32_Open(&g_vol, "BIG.BIN", &f));
+    bench_start(&b);
+    CHECK(FAT32_StreamOpen(&s, &g_vol, &f, pool, 4, 16));
+    while (!FAT32_StreamEOF(&s)) {
+        size_t avail;
+        op_start(&b);
+        while (!FAT32_StreamPeek(&s, &avail)) {
+            CHECK(!FAT32_StreamError(&s));
+            CHECK(FBD_Poll(&g_img)); // the completion event
+        }
+        FAT32_StreamConsume(&s, avail);
+        bytes += avail;
+        op_end(&b);
+    }
+    FAT32_StreamClose(&s);
+    CHECK(bytes == g_bigBytes);
+    bench_end(&b, "stream 4x8K", bytes);
+}
+
+static void bench_open_by_name(boolean cold)
+{
+    static FAT32_File f;
+    bench b;
+    char name[16];
+    remount();
+    bench_start(&b);
+    for (uint32_t i=0; i<g_smallFiles; ++i) {
+        if (cold) remount(); // dentry and FAT caches empty
+        snprintf(name, sizeof(name), "F%05u.DAT", (i * 37) % g_smallFiles);
+        op_start(&b);
+        CHECK(FAT32_Open(&g_vol, name, &f));
+        op_end(&b);
+    }
+    bench_end(&b, cold ? "open by name (cold)" : "open by name", 0);
+    if (!cold) printf("%-22s dentry cache %u hits / %u misses, FAT cache %u hits / %u misses\n", "",
+                      g_vol.dentry_hits, g_vol.dentry_misses, g_vol.fat_cache_hits, g_vol.fat_cache_misses);
+}
+
+static void bench_listing(void)
+{
+    static FAT32_Dir d;
+    static FAT32_DirEntry e;
+    uint32_t count;
+    bench b;
+    remount();
+    bench_start(&b);
+    for (int r=0; r<10; ++r) {
+        op_start(&b);
+        CHECK(FAT32_OpenDir(&g_vol, "/", &d));
+        for (count = 0; FAT32_ReadDir(&d, &e); ++count);
+        CHECK(count >= g_smallFiles);
+        op_end(&b);
+    }
+    bench_end(&b, "list root", 0);
+}
+
+// Runs the file occupies on the volume, printed under each write case to show fragmentation
+static void print_extents(const char *a, const char *b)
+{
+    static FAT32_File f;
+    static FAT32_Extent extents[1024];
+    CHECK(FAT32_OpenMapped(&g_vol, a, &f, extents, 1024));
+    printf("%-22s %u extents", "", f.extent_count);
+    if (b) {
+        CHECK(FAT32_OpenMapped(&g_vol, b, &f, extents, 1024));
+        printf(" / %u extents", f.extent_count);
+    }
+    printf("\n");
+}
+
+static void bench_sequential_write(uint32_t chunk)
+{
+    static FAT32_File f;
+    bench b;
+    char name[32];
+    remount();
+    fill_pattern(g_buf, 0, sizeof(g_buf));
+    bench_start(&b);
+    CHECK(FAT32_Create(&g_vol, "W.BIN", &f));
+    for (uint32_t pos = 0; pos < g_bigBytes; pos += chunk) {
+        op_start(&b);
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, chunk) == chunk);
+        op_end(&b);
+    }
+    CHECK(FAT32_Flush(&g_vol, &f));
+    snprintf(name, sizeof(name), "seq write %u", chunk);
+    bench_end(&b, name, g_bigBytes);
+    print_extents("W.BIN", NULL);
+}
+
+// Data logger pattern: short record appended and made durable each time
+static void bench_append_flush(void)
+{
+    static FAT32_File f;
+    bench b;
+    remount();
+    fill_pattern(g_buf, 0, 100);
+    CHECK(FAT32_Create(&g_vol, "LOG.TXT", &f));
+    bench_start(&b);
+    for (uint32_t i=0; i<g_repeats; ++i) {
+        op_start(&b);
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, 100) == 100);
+        CHECK(FAT32_Flush(&g_vol, &f));
+        op_end(&b);
+    }
+    bench_end(&b, "append 100 + flush", (uint64_t)g_repeats * 100);
+}
+
+// Two files growing in turn, 1000 bytes at a time
+static void bench_interleaved_append(void)
+{
+    static FAT32_File a, c;
+    uint32_t size = g_bigBytes / 8;
+    bench b;
+    remount();
+    fill_pattern(g_buf, 0, 1000);
+    CHECK(FAT32_Create(&g_vol, "A.LOG", &a));
+    CHECK(FAT32_Create(&g_vol, "B.LOG", &c));
+    bench_start(&b);
+    for (uint32_t pos = 0; pos < size; pos += 1000) {
+        op_start(&b);
+        CHECK(FAT32_Write(&g_vol, &a, g_buf, 1000) == 1000);
+        CHECK(FAT32_Write(&g_vol, &c, g_buf, 1000) == 1000);
+        op_end(&b);
+    }
+    CHECK(FAT32_Flush(&g_vol, &a));
+    CHECK(FAT32_Flush(&g_vol, &c));
+    bench_end(&b, "2 files append 1000", (uint64_t)size * 2);
+    print_extents("A.LOG", "B.LOG");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = "fat32_bench.img";
+    for (int a=1; a<argc; ++a) {
+        if (!strcmp(argv[a], "--quick")) {
+            g_bigBytes = 2u << 20;
+            g_smallFiles = 64;
+            g_repeats = 200;
+        } else {
+            path = argv[a];
+        }
+    }
+    CHECK(FBD_Open(&g_img, path, IMAGE_SECTORS));
+    g_img.async = true;
+    FBD_GetBlockDevice(&g_img, &g_dev);
+    CHECK(MKFAT32_Format(&g_dev, IMAGE_SECTORS, 0, 8));
+    remount();
+    populate();
+    FAT32_Unmount(&g_vol);
+
+    printf("%s: %u MiB volume, 4 KiB clusters, %u KiB file, %u small files\n", path, IMAGE_SECTORS / 2048,
+           g_bigBytes >> 10, g_smallFiles);
+    printf("%-22s %7s %9s %9s %9s %10s %9s %8s\n", "case", "ops", "host us", "xfers", "sectors",
+           "card ms/op", "worst ms", "MB/s");
+    bench_sequential_read(512);
+    bench_sequential_read(4096);
+    bench_sequential_read(32768);
+    bench_stream();
+    bench_random_read(false);
+    bench_random_read(true);
+    bench_open_by_name(false);
+    bench_open_by_name(true);
+    bench_listing();
+    bench_sequential_write(4096);
+    bench_sequential_write(65536);
+    bench_append_flush();
+    bench_interleaved_append();
+
+    FAT32_Unmount(&g_vol);
+    FBD_Close(&g_img);
+    return 0;
+}
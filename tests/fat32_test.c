@@ -0,0 +1,444 @@
+// FAT32 driver tests on a disk image mounted through the file-backed block device
+#include <stdio.h>
+#include <string.h>
+#include "systemconfig.h"
+#include "fs_fat32.h"
+#include "filebdev.h"
+#include "mkfat32.h"
+#include "hoststubs.h"
+
+#define IMAGE_PATH      "fat32_test.img"
+#define IMAGE_SECTORS   (64u * 2048u) // 64 MiB
+#define SMALL_SECTORS   (4u * 2048u)  // 4 MiB, for filling the volume
+
+static FBD_Image g_img;
+static BDEV_Device g_dev;
+static FAT32_Volume g_vol;
+static uint8_t g_buf[128 * 1024] __attribute__((aligned(4)));
+static uint8_t g_chk[128 * 1024] __attribute__((aligned(4)));
+
+static void fill_pattern(uint8_t *p, uint32_t offset, uint32_t count, uint32_t seed)
+{
+    for (uint32_t i=0; i<count; ++i) p[i] = (uint8_t)(((offset + i) ^ seed) * 2654435761u >> 24);
+}
+
+// Fresh image of 'sectors', formatted and mounted
+static void setup_image(uint32_t sectors, uint32_t part_lba, uint8_t spc, boolean async)
+{
+    if (g_img.file) {
+        FAT32_Unmount(&g_vol);
+        FBD_Close(&g_img);
+    }
+    remove(IMAGE_PATH);
+    CHECK(FBD_Open(&g_img, IMAGE_PATH, sectors));
+    g_img.async = async;
+    FBD_GetBlockDevice(&g_img, &g_dev);
+    CHECK(MKFAT32_Format(&g_dev, sectors, part_lba, spc));
+    CHECK(FAT32_MountDevice(&g_vol, &g_dev));
+}
+
+static void setup(uint32_t part_lba, uint8_t spc, boolean async)
+{
+    setup_image(IMAGE_SECTORS, part_lba, spc, async);
+}
+
+static void remount(void)
+{
+    FAT32_Unmount(&g_vol);
+    CHECK(FAT32_MountDevice(&g_vol, &g_dev));
+}
+
+static void write_file(const char *path, uint32_t size, uint32_t seed, uint32_t chunk)
+{
+    static FAT32_File f;
+    CHECK(FAT32_Create(&g_vol, path, &f));
+    for (uint32_t pos = 0; pos < size; pos += chunk) {
+        uint32_t n = (size - pos < chunk) ? size - pos : chunk;
+        fill_pattern(g_buf, pos, n, seed);
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, n) == n);
+    }
+    CHECK(FAT32_Flush(&g_vol, &f));
+}
+
+static void verify_range(FAT32_File *f, uint32_t pos, uint32_t size, uint32_t seed)
+{
+    CHECK(FAT32_Seek(&g_vol, f, pos));
+    while (size) {
+        uint32_t n = (size < sizeof(g_buf)) ? size : sizeof(g_buf);
+        fill_pattern(g_chk, pos, n, seed);
+        CHECK(FAT32_Read(&g_vol, f, g_buf, n) == n);
+        CHECK(!memcmp(g_buf, g_chk, n));
+        pos += n;
+        size -= n;
+    }
+}
+
+static void verify_file(const char *path, uint32_t size, uint32_t seed)
+{
+    static FAT32_File f;
+    CHECK(FAT32_Open(&g_vol, path, &f));
+    CHECK(f.size_bytes == size);
+    for (uint32_t pos = 0; pos < size; pos += sizeof(g_buf)) {
+        uint32_t n = (size - pos < sizeof(g_buf)) ? size - pos : sizeof(g_buf);
+        fill_pattern(g_chk, pos, n, seed);
+        CHECK(FAT32_Read(&g_vol, &f, g_buf, n) == n);
+        CHECK(!memcmp(g_buf, g_chk, n));
+    }
+    CHECK(FAT32_Read(&g_vol, &f, g_buf, 1) == 0);
+}
+
+// Offline check of the written image, like fsck: every root file owns exactly the clusters
+// its size needs, no cluster is shared or lost, and FSInfo holds the true free count.
+// Returns the number of free clusters.
+static uint32_t check_volume(void)
+{
+    static FAT32_Dir d;
+    static FAT32_DirEntry e;
+    static uint32_t fat[SMALL_SECTORS * 128], owner[SMALL_SECTORS * 128];
+    uint32_t end = g_vol.total_clusters + 2, cluster_bytes = g_vol.sectors_per_cluster * 512u;
+    uint32_t used = 0, owned = 0, free_count = 0, file = 1;
+    CHECK(end <= sizeof(fat) / 4);
+    CHECK(FAT32_Sync(&g_vol));
+    for (uint32_t s=0; s<(end * 4 + 511) / 512; ++s)
+        CHECK(BDEV_Read(&g_dev, g_vol.fat_begin_lba + s, 1, (uint8_t*)&fat[s * 128]));
+    for (uint32_t cl=2; cl<end; ++cl) {
+        fat[cl] &= 0x0FFFFFFFu;
+        if (fat[cl]) used++;
+        else free_count++;
+    }
+    memset(owner, 0, end * 4);
+    // Root directory chain, then each file
+    for (uint32_t cl = g_vol.root_dir_first_cluster; cl >= 2 && cl < 0x0FFFFFF8; cl = fat[cl]) {
+        CHECK(cl < end && !owner[cl]);
+        owner[cl] = file;
+        owned++;
+    }
+    CHECK(FAT32_OpenDir(&g_vol, "/", &d));
+    while (FAT32_ReadDir(&d, &e)) {
+        uint32_t length = 0;
+        file++;
+        for (uint32_t cl = e.first_cluster; cl >= 2 && cl < 0x0FFFFFF8; cl = fat[cl]) {
+            CHECK(cl < end && !owner[cl]); // cross-linked or looping chain
+            owner[cl] = file;
+            length++;
+        }
+        // A cleared file may keep its first cluster, nothing beyond what the size needs
+        if (e.size_bytes) CHECK(length == (e.size_bytes + cluster_bytes - 1) / cluster_bytes);
+        else CHECK(length <= 1);
+        owned += length;
+    }
+    CHECK(owned == used); // clusters marked in use that no file owns are leaked
+    CHECK(BDEV_Read(&g_dev, g_vol.fsinfo_lba, 1, (uint8_t*)fat));
+    CHECK(fat[488 / 4] == free_count);
+    CHECK(g_vol.free_count == free_count);
+    return free_count;
+}
+
+// The same volume layout is found raw and behind an MBR partition
+static void test_mount_raw_and_partitioned(void)
+{
+    static const uint32_t part[2] = { 0, 2048 };
+    for (int i=0; i<2; ++i) {
+        setup(part[i], 8, false);
+        CHECK(g_vol.sectors_per_cluster == 8);
+        CHECK(g_vol.fat_begin_lba == part[i] + 32);
+        CHECK(g_vol.root_dir_first_cluster == 2);
+        write_file("HELLO.TXT", 10000, 7, 10000);
+        remount();
+        verify_file("HELLO.TXT", 10000, 7);
+        verify_file("/hello.txt", 10000, 7); // case-insensitive 8.3 lookup
+    }
+}
+
+// Reads of every size and alignment land on the right bytes
+static void test_read_sizes(void)
+{
+    static FAT32_File f;
+    static const uint32_t sizes[] = { 1, 3, 511, 512, 513, 4095, 4096, 4097, 12288, 65537 };
+    setup(0, 4, false);
+    write_file("DATA.BIN", 300000, 3, 7000);
+    remount();
+    CHECK(FAT32_Open(&g_vol, "DATA.BIN", &f));
+    for (uint32_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i) {
+        uint32_t pos = (i * 40961u) % 200000u + i;
+        CHECK(FAT32_Seek(&g_vol, &f, pos));
+        CHECK(FAT32_Read(&g_vol, &f, g_buf, sizes[i]) == sizes[i]);
+        fill_pattern(g_chk, pos, sizes[i], 3);
+        CHECK(!memcmp(g_buf, g_chk, sizes[i]));
+    }
+    CHECK(FAT32_Seek(&g_vol, &f, 299990));
+    CHECK(FAT32_Read(&g_vol, &f, g_buf, 100) == 10); // clamped at the end of the file
+}
+
+// A device whose reads complete asynchronously serves the blocking API the same way
+static void test_async_device(void)
+{
+    setup(0, 8, true);
+    write_file("ASYNC.BIN", 100000, 9, 4096);
+    remount();
+    verify_file("ASYNC.BIN", 100000, 9);
+    CHECK(g_img.pending == NULL);
+}
+
+// Overwrite, append and truncate through one handle, checked on the image after each step
+static void test_write_append_truncate(void)
+{
+    static FAT32_File f;
+    uint32_t free_before;
+    setup(0, 8, false);
+    free_before = check_volume();
+    write_file("LOG.TXT", 10000, 5, 777);
+    CHECK(check_volume() == free_before - 3);
+    // Append in pieces that straddle sector and cluster boundaries
+    CHECK(FAT32_Open(&g_vol, "LOG.TXT", &f));
+    CHECK(FAT32_Seek(&g_vol, &f, f.size_bytes));
+    for (uint32_t pos = 10000; pos < 30000; pos += 1234) {
+        uint32_t n = (30000 - pos < 1234) ? 30000 - pos : 1234;
+        fill_pattern(g_buf, pos, n, 5);
+        CHECK(FAT32_Write(&g_vol, &f, g_buf, n) == n);
+    }
+    // Overwrite in the middle keeps the size
+    CHECK(FAT32_Seek(&g_vol, &f, 4000));
+    fill_pattern(g_buf, 4000, 9000, 5);
+    CHECK(FAT32_Write(&g_vol, &f, g_buf, 9000) == 9000);
+    CHECK(f.size_bytes == 30000);
+    CHECK(FAT32_Flush(&g_vol, &f));
+    CHECK(check_volume() == free_before - 8);
+    remount();
+    verify_file("LOG.TXT", 30000, 5);
+    // Shrink, then grow again over the freed clusters
+    CHECK(FAT32_Open(&g_vol, "LOG.TXT", &f));
+    CHECK(FAT32_Truncate(&g_vol, &f, 5000));
+    CHECK(FAT32_Flush(&g_vol, &f));
+    CHECK(check_volume() == free_before - 2);
+    CHECK(FAT32_Seek(&g_vol, &f, 5000));
+    fill_pattern(g_buf, 5000, 20000, 5);
+    CHECK(FAT32_Write(&g_vol, &f, g_buf, 20000) == 20000);
+    CHECK(FAT32_Flush(&g_vol, &f));
+    CHECK(check_volume() == free_before - 7);
+    remount();
+    verify_file("LOG.TXT", 25000, 5);
+    // Create over an existing file empties it
+    write_file("LOG.TXT", 0, 0, 1);
+    CHECK(check_volume() >= free_before - 1);
+    verify_file("LOG.TXT", 0, 0);
+}
+
+// Writing past the free space returns a short count and leaves a consistent volume
+static void test_volume_full(void)
+{
+    static FAT32_File f;
+    uint32_t free_before, total = 0, cluster_bytes;
+    size_t n;
+    setup_image(SMALL_SECTORS, 0, 1, false);
+    cluster_bytes = g_vol.sectors_per_cluster * 512u;
+    free_before = check_volume();
+    CHECK(FAT32_Create(&g_vol, "FILL.BIN", &f));
+    do {
+        fill_pattern(g_buf, total, sizeof(g_buf), 11);
+        n = FAT32_Write(&g_vol, &f, g_buf, sizeof(g_buf));
+        total += (uint32_t)n;
+    } while (n == sizeof(g_buf));
+    CHECK(total == free_before * cluster_bytes);
+    CHECK(f.size_bytes == total);
+    CHECK(FAT32_Write(&g_vol, &f, g_buf, 1) == 0);
+    CHECK(FAT32_Flush(&g_vol, &f));
+    CHECK(check_volume() == 0);
+    // One more file fits once space is given back, and the full one reads back intact
+    CHECK(FAT32_Truncate(&g_vol, &f, total / 2));
+    CHECK(FAT32_Flush(&g_vol, &f));
+    write_file("MORE.BIN", 50000, 12, 50000);
+    check_volume();
+    remount();
+    verify_file("MORE.BIN", 50000, 12);
+    CHECK(FAT32_Open(&g_vol, "FILL.BIN", &f));
+    CHECK(f.size_bytes == total / 2);
+    verify_range(&f, 0, total / 2, 11);
+}
+
+// A write that fails part-way keeps the data written so far and gives the clusters
+// reserved for the rest back; a retry continues from there
+static void test_failed_write(void)
+{
+    static FAT32_File f;
+    static const int32_t budgets[] = { 0, 1, 7, 40 };
+    uint32_t free_before;
+    setup(0, 8, false);
+    free_before = check_volume();
+    for (uint32_t i=0; i<sizeof(budgets)/sizeof(budgets[0]); ++i) {
+        uint32_t start = 3000 + i * 1000, want = 100000;
+        size_t n;
+        write_file("FAIL.BIN", start, 21, 4096);
+        CHECK(FAT32_Open(&g_vol, "FAIL.BIN", &f));
+        CHECK(FAT32_Seek(&g_vol, &f, start));
+        fill_pattern(g_buf, start, want, 21);
+        g_img.write_budget = budgets[i];
+        n = FAT32_Write(&g_vol, &f, g_buf, want);
+        g_img.write_budget = -1;
+        CHECK(n < want);
+        CHECK(f.size_bytes == start + n);
+        CHECK(FAT32_Flush(&g_vol, &f));
+        check_volume();
+        // Retry the rest
+        CHECK(FAT32_Write(&g_vol, &f, g_buf + n, want - n) == want - n);
+        CHECK(FAT32_Flush(&g_vol, &f));
+        CHECK(check_volume() == free_before - (start + want + 4095) / 4096);
+        remount();
+        verify_file("FAIL.BIN", start + want, 21);
+    }
+}
+
+// Files appended in turn in small pieces still get long runs
+static void test_interleaved_appends(void)
+{
+    static FAT32_File a, b;
+    static FAT32_Extent extents[64];
+    uint32_t size = 0, max_extents;
+    setup(0, 8, false);
+    CHECK(FAT32_Create(&g_vol, "A.LOG", &a));
+    CHECK(FAT32_Create(&g_vol, "B.LOG", &b));
+    while (size < 400000) {
+        fill_pattern(g_buf, size, 1000, 31);
+        CHECK(FAT32_Write(&g_vol, &a, g_buf, 1000) == 1000);
+        fill_pattern(g_buf, size, 1000, 32);
+        CHECK(FAT32_Write(&g_vol, &b, g_buf, 1000) == 1000);
+        size += 1000;
+    }
+    CHECK(FAT32_Flush(&g_vol, &a));
+    CHECK(FAT32_Flush(&g_vol, &b));
+    check_volume();
+    remount();
+    // One extent per FAT32_ALLOC_MIN_RUN clusters at most, plus the first partial area
+    max_extents = (size / 4096 + FAT32_ALLOC_MIN_RUN - 1) / FAT32_ALLOC_MIN_RUN + 1;
+    CHECK(FAT32_OpenMapped(&g_vol, "A.LOG", &a, extents, 64));
+    CHECK(a.extent_count <= max_extents);
+    verify_range(&a, 0, size, 31);
+    CHECK(FAT32_OpenMapped(&g_vol, "B.LOG", &b, extents, 64));
+    CHECK(b.extent_count <= max_extents);
+    verify_range(&b, 0, size, 32);
+}
+
+// Read the whole file through a stream; with 'other' set, a second handle reads OTHER.BIN
+// while each prefetch is in flight. 'stop' closes the stream early at that position.
+static void stream_file(uint32_t size, uint32_t seed, boolean other, uint32_t stop)
+{
+    static FAT32_File f, g;
+    static FAT32_Stream st;
+    static uint32_t pool[3 * 8 * 128];
+    uint32_t pos = 0;
+    CHECK(FAT32_Open(&g_vol, "STREAM.BIN", &f));
+    CHECK(FAT32_StreamOpen(&st, &g_vol, &f, pool, 3, 8));
+    while (!FAT32_StreamEOF(&st) && pos < stop) {
+        size_t avail;
+        const uint8_t *p = FAT32_StreamPeek(&st, &avail);
+        CHECK(!FAT32_StreamError(&st));
+        if (!p) {
+            if (other) {
+                // Blocking reads on another handle finish the transfer in flight first
+                uint32_t at = (pos * 7) % 60000;
+                CHECK(FAT32_Open(&g_vol, "OTHER.BIN", &g));
+                CHECK(FAT32_Seek(&g_vol, &g, at));
+                CHECK(FAT32_Read(&g_vol, &g, g_buf, 5000) == 5000);
+                fill_pattern(g_chk, at, 5000, 42);
+                CHECK(!memcmp(g_buf, g_chk, 5000));
+            } else {
+                CHECK(FBD_Poll(&g_img));
+            }
+            continue;
+        }
+        if (avail > stop - pos) avail = stop - pos;
+        fill_pattern(g_chk, pos, (uint32_t)avail, seed);
+        CHECK(!memcmp(p, g_chk, avail));
+        FAT32_StreamConsume(&st, avail);
+        pos += (uint32_t)avail;
+    }
+    FAT32_StreamClose(&st);
+    CHECK(pos == ((stop < size) ? stop : size));
+    CHECK(f.file_pos == pos);
+    CHECK(g_img.pending == NULL);
+}
+
+// Streaming on a synchronous and an asynchronous device, mixed with blocking reads and
+// closed with a transfer still in flight
+static void test_stream(void)
+{
+    for (int async=0; async<2; ++async) {
+        setup(0, 8, async);
+        write_file("STREAM.BIN", 200000, 41, 65536);
+        write_file("OTHER.BIN", 65536, 42, 65536);
+        remount();
+        stream_file(200000, 41, false, 0xFFFFFFFFu);
+        stream_file(200000, 41, true, 0xFFFFFFFFu);
+        stream_file(200000, 41, false, 5000);
+    }
+}
+
+// Failed asynchronous reads are issued again (blockdev.h), also when a blocking read on another
+// handle finishes them; a transfer that fails past BDEV_ASYNC_RETRIES is a stream error
+static void test_stream_faults(void)
+{
+    static FAT32_File f, g;
+    static FAT32_Stream st;
+    static uint32_t pool[3 * 8 * 128];
+    uint32_t pos = 0, waits = 0;
+    setup(0, 8, true);
+    write_file("STREAM.BIN", 200000, 41, 65536);
+    write_file("OTHER.BIN", 65536, 42, 65536);
+    remount();
+    FBD_ResetStats(&g_img);
+    CHECK(FAT32_Open(&g_vol, "STREAM.BIN", &f));
+    CHECK(FAT32_StreamOpen(&st, &g_vol, &f, pool, 3, 8));
+    while (!FAT32_StreamEOF(&st)) {
+        size_t avail;
+        const uint8_t *p = FAT32_StreamPeek(&st, &avail);
+        CHECK(!FAT32_StreamError(&st));
+        if (!p) {
+            // A fresh transfer fails 0..BDEV_ASYNC_RETRIES times in turn
+            if (!g_img.async_faults && !st.retries) g_img.async_faults = waits % (BDEV_ASYNC_RETRIES + 1);
+            if (waits++ & 1) {
+                CHECK(FAT32_Open(&g_vol, "OTHER.BIN", &g));
+                CHECK(FAT32_Read(&g_vol, &g, g_buf, 5000) == 5000);
+            } else {
+                CHECK(FBD_Poll(&g_img));
+            }
+            continue;
+        }
+        fill_pattern(g_chk, pos, (uint32_t)avail, 41);
+        CHECK(!memcmp(p, g_chk, avail));
+        FAT32_StreamConsume(&st, avail);
+        pos += (uint32_t)avail;
+    }
+    FAT32_StreamClose(&st);
+    CHECK(pos == 200000);
+    CHECK(g_img.stats.async_reads > (200000 / 4096) * 3 / 2);
+
+    // One more failure than the retries: the error reaches the consumer and stays at the head
+    CHECK(FAT32_Open(&g_vol, "STREAM.BIN", &f));
+    CHECK(FAT32_StreamOpen(&st, &g_vol, &f, pool, 3, 8));
+    g_img.async_faults = BDEV_ASYNC_RETRIES + 1;
+    for (uint32_t i=0; i<=BDEV_ASYNC_RETRIES; ++i) {
+        CHECK(!FAT32_StreamPeek(&st, NULL) && !FAT32_StreamError(&st));
+        CHECK(FBD_Poll(&g_img));
+    }
+    CHECK(!FAT32_StreamPeek(&st, NULL) && FAT32_StreamError(&st));
+    FAT32_StreamClose(&st);
+    CHECK(f.file_pos == 0);
+}
+
+int main(void)
+{
+    test_mount_raw_and_partitioned();
+    test_read_sizes();
+    test_async_device();
+    test_stream();
+    test_stream_faults();
+    test_write_append_truncate();
+    test_volume_full();
+    test_failed_write();
+    test_interleaved_appends();
+    FAT32_Unmount(&g_vol);
+    FBD_Close(&g_img);
+    remove(IMAGE_PATH);
+    printf("fat32_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Flash translation layer geometry benchmark: sf_ftl.c on the NOR flash model sized like the
+// boot flash (8 MiB GD25LQ64), with a 1 MiB region at 6 MiB.
+//
+// Usage: ftl_bench [--quick]
+//
+// The region is filled to 75% of its capacity, then single block writes follow: 80% of them
+// to 32 hot blocks (FAT and directory sectors) or spread evenly. Background collection runs
+// every other write. Reported per case:
+//   WA          data slots programmed per host write (collection copies included)
+//   page WA     256-byte pages programmed per 512 bytes written (tags and headers included)
+//   erase/wr    sector erases per host write
+//   ms/wr       modelled chip time per write (normodel.h), against a read-modify-write of
+//               the whole sector through SF_Erase: one erase and 16 page programs
+#include <stdio.h>
+#include <string.h>
+#include "systemconfig.h"
+#include "sf_ftl.h"
+#include "normodel.h"
+#include "hoststubs.h"
+
+#define CHIP_SIZE       (8u << 20)
+#define REGION_BASE     (6u << 20)
+#define REGION_SECTORS  256
+#define HOT_BLOCKS      32
+#define RMW_US          (NORM_ERASE_US + (NORSECTORSIZE / NORM_PAGE_SIZE) * NORM_PAGE_US)
+
+static NORM_Flash g_nor;
+static TNORFLASH g_flash;
+static FTL_Volume g_vol;
+static uint8_t g_buf[FTL_BLOCK_SIZE];
+static uint32_t g_seed = 1, g_writes = 200000;
+
+static uint32_t next_random(void)
+{
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+static void write_random(uint32_t lba)
+{
+    for (uint32_t i=0; i<FTL_BLOCK_SIZE; ++i) g_buf[i] = (uint8_t)next_random();
+    CHECK(FTL_Write(&g_vol, lba, 1, g_buf));
+}
+
+static void bench_case(const char *name, uint32_t hot_percent)
+{
+    uint32_t used;
+    NORM_Stats before;
+    FTL_Stats st;
+
+    NORM_Destroy(&g_nor);
+    CHECK(NORM_Create(&g_nor, CHIP_SIZE, 0xFF));
+    NORM_GetFlash(&g_nor, &g_flash);
+    CHECK(FTL_Mount(&g_vol, &g_flash, REGION_BASE, REGION_SECTORS));
+    used = g_vol.block_count * 3 / 4;
+    for (uint32_t b=0; b<used; ++b) {
+        write_random(b);
+        HOST_RunTimers();
+    }
+
+    memset(&g_vol.stats, 0, sizeof(g_vol.stats));
+    before = g_nor.stats;
+    for (uint32_t i=0; i<g_writes; ++i) {
+        write_random((next_random() % 100 < hot_percent) ? next_random() % HOT_BLOCKS : next_random() % used);
+        if (i & 1) HOST_RunTimers();
+    }
+    FTL_GetStats(&g_vol, &st);
+    uint64_t pages = g_nor.stats.pages_programmed - before.pages_programmed;
+    uint64_t erases = g_nor.stats.erases - before.erases;
+    uint64_t busy_us = g_nor.stats.busy_us - before.busy_us;
+    printf("%-14s %7u %6.3f %8.3f %9.4f %7u %5u..%-5u %7.2f %7.2f\n", name, st.host_writes,
+           (double)st.slot_programs / (st.host_writes - st.skipped_writes), pages / (2.0 * st.host_writes),
+           (double)erases / st.host_writes, st.sync_gc, st.min_erase, st.max_erase,
+           busy_us / 1000.0 / st.host_writes, RMW_US / 1000.0);
+    FTL_Unmount(&g_vol);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "--quick")) g_writes = 20000;
+
+    printf("%u KiB region, %u sectors, %u KiB exported, filled to 75%%\n", REGION_SECTORS * 4, REGION_SECTORS,
+           (REGION_SECTORS - FTL_SPARE_SECTORS) * FTL_SLOTS_PER_SECTOR / 2);
+    printf("%-14s %7s %6s %8s %9s %7s %12s %7s %7s\n", "case", "writes", "WA", "page WA", "erase/wr",
+           "sync gc", "erase count", "ms/wr", "RMW ms");
+    bench_case("80% to 32 hot", 80);
+    bench_case("uniform", 0);
+
+    NORM_Destroy(&g_nor);
+    return 0;
+}
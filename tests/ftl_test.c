@@ -0,0 +1,276 @@
+// Flash translation layer tests on the NOR flash model: the block map and garbage collection
+// bookkeeping checked against the flash after every step, and recovery after power cuts
+#include <stdio.h>
+#include <string.h>
+#include "systemconfig.h"
+#include "sf_ftl.h"
+#include "normodel.h"
+#include "hoststubs.h"
+
+#define SECTORS         32
+#define CHIP_SECTORS    (SECTORS + 4)
+#define BASE            (2 * NORSECTORSIZE)    // region inside the chip
+#define MAX_BLOCKS      ((SECTORS - FTL_SPARE_SECTORS) * FTL_SLOTS_PER_SECTOR)
+#define TAGS_OFFSET     16                     // header, then one tag per data slot
+#define TAG_SIZE        12
+
+static FTL_Volume g_vol;
+static uint8_t g_ref[MAX_BLOCKS][FTL_BLOCK_SIZE];
+static uint8_t g_buf[8 * FTL_BLOCK_SIZE];
+static uint32_t g_seed = 1;
+
+static uint32_t next_random(void)
+{
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+static void random_block(uint8_t *p)
+{
+    for (uint32_t i=0; i<FTL_BLOCK_SIZE; ++i) p[i] = (uint8_t)next_random();
+}
+
+static boolean mount_volume(void *ctx);
+static void unmount_volume(void *ctx);
+
+static NORM_Fixture g_chip = {
+    .size = CHIP_SECTORS * NORSECTORSIZE,
+    .mount = mount_volume,
+    .unmount = unmount_volume
+};
+
+static boolean mount_volume(void *ctx)
+{
+    return FTL_Mount(&g_vol, &g_chip.flash, BASE, SECTORS);
+}
+
+static void unmount_volume(void *ctx)
+{
+    FTL_Unmount(&g_vol);
+}
+
+static void mount(void)
+{
+    CHECK(mount_volume(NULL));
+}
+
+// Fresh chip holding 'fill' everywhere and an empty volume
+static void new_chip(uint8_t fill)
+{
+    NORM_NewChip(&g_chip, fill);
+    memset(g_ref, 0, sizeof(g_ref));
+}
+
+static boolean blank(const uint8_t *p, uint32_t count)
+{
+    while (count--) if (*p++ != 0xFF) return false;
+    return true;
+}
+
+static const uint8_t *slot_data(uint32_t s, uint32_t k)
+{
+    return &g_chip.nor.mem[BASE + s * NORSECTORSIZE + k * FTL_BLOCK_SIZE];
+}
+
+static const uint8_t *slot_tag(uint32_t s, uint32_t k)
+{
+    return &g_chip.nor.mem[BASE + s * NORSECTORSIZE + TAGS_OFFSET + (k - 1) * TAG_SIZE];
+}
+
+// Map entries point at distinct programmed slots of used sectors, the per-sector live counts
+// and the free sector count agree with them, free space is erased, and every block reads back
+// its reference content
+static void check_volume(void)
+{
+    static uint8_t owner[SECTORS * 8];
+    uint32_t valid[SECTORS] = {0}, free_sectors = 0;
+
+    CHECK(g_vol.block_count == MAX_BLOCKS);
+    memset(owner, 0, sizeof(owner));
+    for (uint32_t b=0; b<g_vol.block_count; ++b) {
+        uint32_t p = g_vol.map[b], s = p / 8, k = p % 8;
+        if (p == FTL_UNMAPPED) continue;
+        CHECK(s < SECTORS && k >= 1);
+        CHECK(!owner[p]);
+        owner[p] = 1;
+        CHECK(g_vol.log.Sectors[s].State == SLS_USED);
+        CHECK(k < g_vol.log.Sectors[s].Fill);
+        CHECK(!blank(slot_tag(s, k), TAG_SIZE));
+        valid[s]++;
+    }
+    for (uint32_t s=0; s<SECTORS; ++s) {
+        const TSLOGSECTOR *sec = &g_vol.log.Sectors[s];
+        CHECK(sec->Live == valid[s]);
+        if (sec->State == SLS_FREE) {
+            free_sectors++;
+            CHECK(sec->Fill == 1);
+            CHECK(blank(slot_data(s, 0) + 12, NORSECTORSIZE - 12)); // past magic, erase count and CRC
+        } else if (s == g_vol.log.ActiveSector) {
+            for (uint32_t k=sec->Fill; k<=FTL_SLOTS_PER_SECTOR; ++k)
+                CHECK(blank(slot_tag(s, k), TAG_SIZE) && blank(slot_data(s, k), FTL_BLOCK_SIZE));
+        }
+    }
+    CHECK(g_vol.log.FreeSectors == free_sectors);
+    CHECK(g_vol.log.ActiveSector == SLOG_NOSECTOR || g_vol.log.Sectors[g_vol.log.ActiveSector].State == SLS_USED);
+    for (uint32_t b=0; b<g_vol.block_count; ++b) {
+        CHECK(FTL_Read(&g_vol, b, 1, g_buf));
+        CHECK(!memcmp(g_buf, g_ref[b], FTL_BLOCK_SIZE));
+    }
+}
+
+static void write_block(uint32_t b)
+{
+    random_block(g_buf);
+    CHECK(FTL_Write(&g_vol, b, 1, g_buf));
+    memcpy(g_ref[b], g_buf, FTL_BLOCK_SIZE);
+}
+
+// The first write after a restart runs with the supply on. A collection cut short may have
+// left the reserve in use; the write has to finish it, within the room it had.
+static void settle(void)
+{
+    write_block(next_random() % MAX_BLOCKS);
+    CHECK(g_vol.log.FreeSectors >= FTL_RESERVE_SECTORS);
+    check_volume();
+}
+
+static void test_basic(void)
+{
+    FTL_Stats st;
+    BDEV_Device dev;
+    uint32_t size, count;
+
+    // Whatever the region held is erased, the rest of the chip is not touched
+    new_chip(0x5A);
+    for (uint32_t s=0; s<CHIP_SECTORS; ++s)
+        CHECK(g_chip.nor.erase_count[s] == (s >= BASE / NORSECTORSIZE && s < BASE / NORSECTORSIZE + SECTORS));
+    CHECK(g_chip.nor.mem[0] == 0x5A && g_chip.nor.mem[BASE - 1] == 0x5A && g_chip.nor.mem[BASE + SECTORS * NORSECTORSIZE] == 0x5A);
+    CHECK(g_vol.log.FreeSectors == SECTORS);
+    check_volume();
+
+    FTL_GetBlockDevice(&g_vol, &dev);
+    CHECK(dev.ops->geometry(dev.ctx, &size, &count) && size == FTL_BLOCK_SIZE && count == MAX_BLOCKS);
+
+    // Multi-block transfers, bounds, and writes that change nothing
+    for (uint32_t i=0; i<8; ++i) random_block(g_ref[10 + i]);
+    CHECK(FTL_Write(&g_vol, 10, 8, g_ref[10]));
+    CHECK(FTL_Read(&g_vol, 10, 8, g_buf) && !memcmp(g_buf, g_ref[10], sizeof(g_buf)));
+    CHECK(!FTL_Write(&g_vol, MAX_BLOCKS - 1, 2, g_buf));
+    CHECK(!FTL_Read(&g_vol, MAX_BLOCKS, 1, g_buf));
+    FTL_GetStats(&g_vol, &st);
+    CHECK(st.host_writes == 8 && st.slot_programs == 8);
+    CHECK(FTL_Write(&g_vol, 10, 8, g_ref[10]));
+    memset(g_buf, 0, FTL_BLOCK_SIZE);
+    CHECK(FTL_Write(&g_vol, 0, 1, g_buf));
+    FTL_GetStats(&g_vol, &st);
+    CHECK(st.host_writes == 17 && st.skipped_writes == 9 && st.slot_programs == 8);
+    check_volume();
+
+    mount();
+    check_volume();
+}
+
+// Random writes with background collection and remounts
+static void test_random(void)
+{
+    FTL_Stats st;
+
+    new_chip(0xFF);
+    for (uint32_t i=1; i<=30000; ++i) {
+        uint32_t b = (next_random() % 10 < 8) ? next_random() % 16 : next_random() % MAX_BLOCKS;
+        write_block(b);
+        if (next_random() % 4 == 0) {
+            HOST_RunTimers();
+            CHECK(g_vol.log.FreeSectors >= FTL_GC_TARGET);
+        }
+        if (i % 5000 == 0) mount();
+        if (i % 500 == 0) check_volume();
+    }
+    FTL_GetStats(&g_vol, &st);
+    CHECK(g_chip.nor.stats.erases > 20 * SECTORS); // the log went round
+    CHECK(st.max_erase - st.min_erase <= 2 * FTL_WEAR_DELTA);
+
+    // Full capacity: writes still succeed, collecting synchronously when they must
+    for (uint32_t b=0; b<MAX_BLOCKS; ++b) write_block(b);
+    for (uint32_t i=0; i<5000; ++i) write_block(next_random() % MAX_BLOCKS);
+    check_volume();
+    mount();
+    check_volume();
+}
+
+static void run_timers(void *ctx)
+{
+    HOST_RunTimers();
+}
+
+static void collect(void *ctx)
+{
+    FTL_Collect(&g_vol);
+}
+
+// Cuts inside writes (a block reads back old or new), inside collection and its erase, and
+// inside the mount that cleans up after them; everything else stays intact
+static void test_power_cut(void)
+{
+    uint32_t write_cuts = 0, collect_cuts = 0;
+
+    new_chip(0xFF);
+    for (uint32_t b=0; b<MAX_BLOCKS * 3 / 4; ++b) write_block(b);
+    HOST_RunTimers();
+
+    for (uint32_t i=0; i<3000; ++i) {
+        uint32_t b = next_random() % MAX_BLOCKS;
+        boolean done, background;
+        int32_t cost;
+
+        random_block(g_buf);
+        g_chip.nor.budget = next_random() % (FTL_BLOCK_SIZE + 64);
+        done = FTL_Write(&g_vol, b, 1, g_buf);
+        if (g_chip.nor.off) {
+            CHECK(!done);
+            write_cuts++;
+            NORM_PowerCycle(&g_chip, (next_random() & 1) ? (int32_t)(next_random() % (2 * NORM_ERASE_COST)) : -1);
+            CHECK(FTL_Read(&g_vol, b, 1, &g_buf[FTL_BLOCK_SIZE]));
+            if (memcmp(&g_buf[FTL_BLOCK_SIZE], g_ref[b], FTL_BLOCK_SIZE)) {
+                CHECK(!memcmp(&g_buf[FTL_BLOCK_SIZE], g_buf, FTL_BLOCK_SIZE));
+                memcpy(g_ref[b], g_buf, FTL_BLOCK_SIZE);
+            }
+            settle();
+        } else {
+            NORM_PowerOn(&g_chip.nor);
+            CHECK(done);
+            memcpy(g_ref[b], g_buf, FTL_BLOCK_SIZE);
+        }
+        check_volume();
+        if (i % 4) continue;
+
+        // Collection only runs in the background once the volume is short of erased sectors
+        background = next_random() & 1;
+        for (uint32_t j = next_random() % 40; j; j--) write_block(next_random() % MAX_BLOCKS);
+        if (!background) HOST_RunTimers();
+        mount();
+        cost = NORM_StepCost(&g_chip, background ? run_timers : collect);
+        if (!cost) continue;
+        g_chip.nor.budget = next_random() % cost;
+        if (background) HOST_RunTimers();
+        else FTL_Collect(&g_vol);
+        CHECK(g_chip.nor.off);
+        collect_cuts++;
+        NORM_PowerCycle(&g_chip, (next_random() & 1) ? (int32_t)(next_random() % (2 * NORM_ERASE_COST)) : -1);
+        check_volume();
+        settle();
+    }
+    CHECK(write_cuts > 1000 && collect_cuts > 300);
+}
+
+int main(void)
+{
+    test_basic();
+    test_random();
+    test_power_cut();
+
+    FTL_Unmount(&g_vol);
+    NORM_Destroy(&g_chip.nor);
+    printf("ftl_test: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "filebdev.h"
+#include <string.h>
+#include <unistd.h>
+
+static void account(FBD_Image *img, uint32_t lba, uint32_t count, boolean write)
+{
+    if (lba != img->next_lba) img->stats.short_jumps++;
+    img->next_lba = lba + count;
+    img->stats.card_us += FBD_COMMAND_US + (uint64_t)count * FBD_SECTOR_US + (write ? FBD_PROGRAM_US : 0);
+}
+
+static boolean image_read(FBD_Image *img, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    if (!buf || !count || lba >= img->sector_count || count > img->sector_count - lba) return false;
+    if (fseek(img->file, (long)lba * 512, SEEK_SET)) return false;
+    if (fread(buf, 512, count, img->file) != count) return false;
+    img->stats.sectors_read += count;
+    account(img, lba, count, false);
+    return true;
+}
+
+static void complete_pending(FBD_Image *img)
+{
+    BDEV_Request *req = img->pending;
+    boolean ok;
+    img->pending = NULL;
+    if (img->async_faults) {
+        img->async_faults--;
+        ok = false;
+    } else {
+        ok = image_read(img, req->lba, req->count, req->buf);
+    }
+    req->state = ok ? BDEV_REQ_DONE : BDEV_REQ_ERROR;
+    if (req->done) req->done(req, ok);
+}
+
+// Blocking transfers queue behind the request in flight; its callback sees the device busy
+static void drain(FBD_Image *img)
+{
+    img->draining = true;
+    while (img->pending) complete_pending(img);
+    img->draining = false;
+}
+
+static boolean fbd_read(void *ctx, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    drain(img);
+    img->stats.read_calls++;
+    return image_read(img, lba, count, buf);
+}
+
+static boolean fbd_write(void *ctx, uint32_t lba, uint32_t count, const uint8_t *buf)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    uint32_t n = count;
+    drain(img);
+    if (!buf || !count || lba >= img->sector_count || count > img->sector_count - lba) return false;
+    img->stats.write_calls++;
+    if (img->write_budget >= 0 && (uint32_t)img->write_budget < n) n = (uint32_t)img->write_budget;
+    if (n) {
+        if (fseek(img->file, (long)lba * 512, SEEK_SET) || fwrite(buf, 512, n, img->file) != n) return false;
+        img->stats.sectors_written += n;
+        account(img, lba, n, true);
+    }
+    if (img->write_budget >= 0) img->write_budget -= (int32_t)n;
+    return n == count;
+}
+
+static boolean fbd_flush(void *ctx)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    return fflush(img->file) == 0;
+}
+
+static boolean fbd_geometry(void *ctx, uint32_t *sector_size, uint32_t *sector_count)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    *sector_size = 512;
+    *sector_count = img->sector_count;
+    return true;
+}
+
+static boolean fbd_read_async(void *ctx, BDEV_Request *req)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    if (img->pending || img->draining || !req->buf || !req->count) return false;
+    if (req->lba >= img->sector_count || req->count > img->sector_count - req->lba) return false;
+    req->state = BDEV_REQ_BUSY;
+    img->pending = req;
+    img->stats.async_reads++;
+    return true;
+}
+
+static boolean fbd_busy(void *ctx)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    return img->pending != NULL || img->draining;
+}
+
+static boolean fbd_wait(void *ctx, BDEV_Request *req)
+{
+    FBD_Image *img = (FBD_Image*)ctx;
+    if (img->pending == req) complete_pending(img);
+    return req->state == BDEV_REQ_DONE;
+}
+
+static const BDEV_Ops fbd_sync_ops = {
+    fbd_read, fbd_write, fbd_flush, fbd_geometry, NULL, NULL, NULL
+};
+
+static const BDEV_Ops fbd_async_ops = {
+    fbd_read, fbd_write, fbd_flush, fbd_geometry, fbd_read_async, fbd_busy, fbd_wait
+};
+
+boolean FBD_Open(FBD_Image *img, const char *path, uint32_t sector_count)
+{
+    memset(img, 0, sizeof(*img));
+    img->file = fopen(path, "r+b");
+    if (!img->file) img->file = fopen(path, "w+b");
+    if (!img->file) return false;
+    if (ftruncate(fileno(img->file), (off_t)sector_count * 512)) {
+        fclose(img->file);
+        img->file = NULL;
+        return false;
+    }
+    img->sector_count = sector_count;
+    img->write_budget = -1;
+    return true;
+}
+
+void FBD_Close(FBD_Image *img)
+{
+    if (img->pending) complete_pending(img);
+    if (img->file) fclose(img->file);
+    img->file = NULL;
+}
+
+void FBD_GetBlockDevice(FBD_Image *img, BDEV_Device *dev)
+{
+    dev->ops = img->async ? &fbd_async_ops : &fbd_sync_ops;
+    dev->ctx = img;
+}
+
+boolean FBD_Poll(FBD_Image *img)
+{
+    if (!img->pending) return false;
+    complete_pending(img);
+    return true;
+}
+
+void FBD_ResetStats(FBD_Image *img)
+{
+    memset(&img->stats, 0, sizeof(img->stats));
+}
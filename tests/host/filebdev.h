@@ -0,0 +1,45 @@
+#ifndef FILEBDEV_H
+#define FILEBDEV_H
+#include <stdio.h>
+#include <stdint.h>
+#include "systypes.h"
+#include "blockdev.h"
+
+// Block device over a disk image file, for running the filesystem code on the host.
+// Optionally offers read_async: the request stays in flight until FBD_Poll (the host's
+// stand-in for the SD completion event) or a blocking transfer finishes it.
+
+// Card time model used by the benchmarks: 4-bit bus at the 13 MHz transfer clock
+#define FBD_COMMAND_US      40      // command, response and turnaround per transfer
+#define FBD_SECTOR_US       80      // 512 bytes on the data lines
+#define FBD_PROGRAM_US      1500    // busy after a write transfer (typical class 4 card)
+
+typedef struct {
+    uint32_t read_calls;      // blocking read transfers
+    uint32_t write_calls;
+    uint32_t async_reads;
+    uint32_t sectors_read;    // blocking and asynchronous
+    uint32_t sectors_written;
+    uint32_t short_jumps;     // transfers not starting where the previous one ended
+    uint64_t card_us;         // modelled card time of all transfers
+} FBD_Stats;
+
+typedef struct {
+    FILE *file;
+    uint32_t sector_count;
+    boolean async;            // offer read_async/busy/wait
+    boolean draining;         // a blocking transfer is finishing the pending request
+    BDEV_Request *pending;    // asynchronous read in flight
+    int32_t write_budget;     // sectors that can still be written, -1 = unlimited (failure injection)
+    uint32_t async_faults;    // asynchronous reads still to fail, as a CRC error would (failure injection)
+    uint32_t next_lba;        // sector after the previous transfer
+    FBD_Stats stats;
+} FBD_Image;
+
+boolean FBD_Open(FBD_Image *img, const char *path, uint32_t sector_count); // create or resize the image
+void    FBD_Close(FBD_Image *img);
+void    FBD_GetBlockDevice(FBD_Image *img, BDEV_Device *dev);
+boolean FBD_Poll(FBD_Image *img);         // complete the asynchronous read in flight, false if none
+void    FBD_ResetStats(FBD_Image *img);
+
+#endif // FILEBDEV_H
@@ -0,0 +1,214 @@
+/*
+* System services the modules under test link against: low resolution timers and an event
+* queue that run when the test says so (standing in for the main loop), interrupt lines that
+* device models raise and that are served from USC_Pause_us, interrupt masking and the flash
+* globals referenced by KVS_Initialize.
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include "systemconfig.h"
+#include "hoststubs.h"
+
+#define HOST_MAXTIMERS      16
+#define HOST_MAXIRQS        64
+#define HOST_MAXEVENTS      32
+
+typedef struct
+{
+    TEVTYPE  Event;
+    uint32_t ParamSz;
+    uint8_t  Param[EM_SLABPARAMSIZE];
+} THOSTEVENT;
+
+static TTIMER     Timers[HOST_MAXTIMERS];
+static uint32_t   TimersCount;
+static void       (*IRQHandlers[HOST_MAXIRQS])(void);
+static boolean    IRQLines[HOST_MAXIRQS];
+static uint32_t   IRQsDisabled;
+static THOSTEVENT Events[HOST_MAXEVENTS];
+static uint32_t   EventsHead, EventsCount;
+static uint64_t   Microseconds;
+
+const TNORFLASH SFNorFlash;
+pDFCONFIG       FlashConfig;
+size_t          FlashCapacity;
+uintptr_t       __ROMBase, __ROMImageLimit;
+
+pTIMER LRT_Create(uint32_t Interval, void (*Handler)(pTIMER), TMRFLAGS Flags)
+{
+    pTIMER Timer;
+
+    if (TimersCount == HOST_MAXTIMERS) return NULL;
+    Timer = &Timers[TimersCount++];
+    memset(Timer, 0, sizeof(TTIMER));
+    Timer->Interval = Interval;
+    Timer->Handler = Handler;
+    Timer->Flags = Flags & ~TF_ENABLED;
+
+    return Timer;
+}
+
+boolean LRT_Start(pTIMER Timer)
+{
+    if (Timer == NULL) return false;
+    Timer->Flags |= TF_ENABLED;
+
+    return true;
+}
+
+boolean LRT_Stop(pTIMER Timer)
+{
+    if (Timer == NULL) return false;
+    Timer->Flags &= ~TF_ENABLED;
+
+    return true;
+}
+
+boolean LRT_SetInterval(pTIMER Timer, uint32_t Interval)
+{
+    if (Timer == NULL) return false;
+    Timer->Interval = Interval;
+
+    return true;
+}
+
+uint32_t HOST_RunTimers(void)
+{
+    uint32_t i, Fired = 0;
+    boolean  Pending;
+
+    do
+    {
+        Pending = false;
+        for(i = 0; i < TimersCount; i++)
+        {
+            pTIMER Timer = &Timers[i];
+
+            if (!(Timer->Flags & TF_ENABLED)) continue;
+            if (!(Timer->Flags & TF_AUTOREPEAT)) Timer->Flags &= ~TF_ENABLED;
+            Timer->Handler(Timer);
+            Pending |= (Timer->Flags & TF_ENABLED) != 0;
+            Fired++;
+        }
+    } while(Pending && (Fired < 100000));
+
+    return Fired;
+}
+
+boolean HOST_TimerPending(void (*Handler)(pTIMER))
+{
+    uint32_t i;
+
+    for(i = 0; i < TimersCount; i++)
+        if ((Timers[i].Flags & TF_ENABLED) && ((Handler == NULL) || (Timers[i].Handler == Handler))) return true;
+
+    return false;
+}
+
+boolean NVIC_RegisterIRQ(uint32_t SourceIdx, void (*Handler)(void), uint8_t Sense, boolean ModeIRQ, boolean Enable)
+{
+    if ((SourceIdx >= HOST_MAXIRQS) || (Handler == NULL)) return false;
+    IRQHandlers[SourceIdx] = Enable ? Handler : NULL;
+
+    return true;
+}
+
+void HOST_SetIRQ(uint32_t SourceIdx, boolean Active)
+{
+    if (SourceIdx < HOST_MAXIRQS) IRQLines[SourceIdx] = Active;
+}
+
+uint32_t HOST_ServiceIRQs(void)
+{
+    uint32_t i, Calls = 0;
+    boolean  Served;
+
+    if (IRQsDisabled) return 0;
+    IRQsDisabled = 1;                                                                               // Handlers run with interrupts off, as on the CPU
+    do
+    {
+        Served = false;
+        for(i = 0; i < HOST_MAXIRQS; i++)
+        {
+            if (!IRQLines[i] || (IRQHandlers[i] == NULL)) continue;
+            IRQHandlers[i]();
+            Served = true;
+            Calls++;
+        }
+    } while(Served && (Calls < 100000));
+    IRQsDisabled = 0;
+
+    return Calls;
+}
+
+uint32_t __disable_interrupts(void)
+{
+    uint32_t Flags = IRQsDisabled;
+
+    IRQsDisabled = 1;
+
+    return Flags;
+}
+
+void __restore_interrupts(uint32_t flags)
+{
+    IRQsDisabled = flags;
+}
+
+void USC_Pause_us(uint32_t us)
+{
+    Microseconds += us;
+    HOST_ServiceIRQs();
+}
+
+uint64_t HOST_GetMicroseconds(void)
+{
+    return Microseconds;
+}
+
+boolean EM_PostEvent(TEVTYPE Type, void *Object, void *Param, uint32_t ParamSz)
+{
+    THOSTEVENT *Event;
+
+    if (Param == NULL) ParamSz = 0;
+    if ((EventsCount == HOST_MAXEVENTS) || (ParamSz > EM_SLABPARAMSIZE)) return false;
+    Event = &Events[(EventsHead + EventsCount++) % HOST_MAXEVENTS];
+    Event->Event = Type;
+    Event->ParamSz = ParamSz;
+    if (ParamSz) memcpy(Event->Param, Param, ParamSz);
+
+    return true;
+}
+
+boolean HOST_GetEvent(TEVTYPE *Type, void *Param, uint32_t ParamSz)
+{
+    THOSTEVENT *Event;
+
+    if (!EventsCount) return false;
+    Event = &Events[EventsHead];
+    EventsHead = (EventsHead + 1) % HOST_MAXEVENTS;
+    EventsCount--;
+    *Type = Event->Event;
+    if (Param != NULL) memcpy(Param, Event->Param, (ParamSz < Event->ParamSz) ? ParamSz : Event->ParamSz);
+
+    return true;
+}
+
+void GPIO_Setup(uint32_t Pin, uint32_t Flags)
+{
+}
+
+boolean IsDynamicMemory(void *Memory)
+{
+    return Memory != NULL;
+}
+
+void USB_Print(const char *fmt, ...)
+{
+    va_list args;
+
+    if (getenv("HOST_VERBOSE") == NULL) return;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
@@ -0,0 +1,25 @@
+#ifndef _HOSTSTUBS_H_
+#define _HOSTSTUBS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Runs every started timer handler, again while handlers restart timers (the main loop's view
+// of a quiet system); returns the number of handler calls
+extern uint32_t HOST_RunTimers(void);
+// True if a timer with this handler (any handler for NULL) is started
+extern boolean HOST_TimerPending(void (*Handler)(pTIMER));
+
+// Interrupt line of a device model; active lines are served by USC_Pause_us and
+// HOST_ServiceIRQs unless interrupts are disabled. Returns the number of handler calls.
+extern void HOST_SetIRQ(uint32_t SourceIdx, boolean Active);
+extern uint32_t HOST_ServiceIRQs(void);
+// Time consumed by USC_Pause_us so far
+extern uint64_t HOST_GetMicroseconds(void);
+// Oldest event posted with EM_PostEvent (its parameter copied to Param), false if none
+extern boolean HOST_GetEvent(TEVTYPE *Type, void *Param, uint32_t ParamSz);
+
+// Test assertions: report the failing expression and stop the program
+#define CHECK(x)    do { if (!(x)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); exit(1); } } while(0)
+
+#endif /* _HOSTSTUBS_H_ */
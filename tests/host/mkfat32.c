@@ -0,0 +1,82 @@
+#include "mkfat32.h"
+#include <string.h>
+
+#define RESERVED_SECTORS    32
+
+static void wr16(uint8_t *p, uint16_t v){ p[0]=(uint8_t)v; p[1]=(uint8_t)(v>>8); }
+static void wr32(uint8_t *p, uint32_t v){ p[0]=(uint8_t)v; p[1]=(uint8_t)(v>>8); p[2]=(uint8_t)(v>>16); p[3]=(uint8_t)(v>>24); }
+
+static boolean zero_sectors(const BDEV_Device *dev, uint32_t lba, uint32_t count)
+{
+    static uint8_t zero[64 * 512];
+    while (count) {
+        uint32_t n = (count > 64) ? 64 : count;
+        if (!BDEV_Write(dev, lba, n, zero)) return false;
+        lba += n;
+        count -= n;
+    }
+    return true;
+}
+
+boolean MKFAT32_Format(const BDEV_Device *dev, uint32_t sector_count, uint32_t part_lba, uint8_t sectors_per_cluster)
+{
+    static uint8_t sec[512] __attribute__((aligned(4)));
+    uint32_t total = sector_count - part_lba;
+    uint32_t fat_sectors = 1, clusters;
+    if (!sectors_per_cluster || part_lba >= sector_count) return false;
+    // FAT size and cluster count depend on each other; grow the FAT until it maps every cluster
+    for (;;) {
+        clusters = (total - RESERVED_SECTORS - 2 * fat_sectors) / sectors_per_cluster;
+        uint32_t need = (clusters + 2 + 127) / 128;
+        if (need <= fat_sectors) break;
+        fat_sectors = need;
+    }
+    if (part_lba) {
+        memset(sec, 0, sizeof(sec));
+        sec[0x1BE + 4] = 0x0C;
+        wr32(&sec[0x1BE + 8], part_lba);
+        wr32(&sec[0x1BE + 12], total);
+        wr16(&sec[510], 0xAA55);
+        if (!BDEV_Write(dev, 0, 1, sec)) return false;
+    }
+    if (!zero_sectors(dev, part_lba, RESERVED_SECTORS + 2 * fat_sectors + sectors_per_cluster)) return false;
+
+    memset(sec, 0, sizeof(sec));
+    sec[0] = 0xEB; sec[1] = 0x58; sec[2] = 0x90;
+    memcpy(&sec[3], "MSWIN4.1", 8);
+    wr16(&sec[11], 512);
+    sec[13] = sectors_per_cluster;
+    wr16(&sec[14], RESERVED_SECTORS);
+    sec[16] = 2;                    // FAT copies
+    sec[21] = 0xF8;                 // media
+    wr32(&sec[28], part_lba);       // hidden sectors
+    wr32(&sec[32], total);
+    wr32(&sec[36], fat_sectors);
+    wr32(&sec[44], 2);              // root directory cluster
+    wr16(&sec[48], 1);              // FSInfo
+    wr16(&sec[50], 6);              // backup boot sector
+    sec[64] = 0x80;
+    sec[66] = 0x29;
+    wr32(&sec[67], 0x12345678);
+    memcpy(&sec[71], "NO NAME    ", 11);
+    memcpy(&sec[82], "FAT32   ", 8);
+    wr16(&sec[510], 0xAA55);
+    if (!BDEV_Write(dev, part_lba, 1, sec) || !BDEV_Write(dev, part_lba + 6, 1, sec)) return false;
+
+    memset(sec, 0, sizeof(sec));
+    wr32(&sec[0], 0x41615252u);
+    wr32(&sec[484], 0x61417272u);
+    wr32(&sec[488], clusters - 1);  // root directory holds one cluster
+    wr32(&sec[492], 3);
+    wr16(&sec[510], 0xAA55);
+    if (!BDEV_Write(dev, part_lba + 1, 1, sec) || !BDEV_Write(dev, part_lba + 7, 1, sec)) return false;
+
+    // Media entry, clean shutdown entry and the root directory's end of chain, in both FATs
+    memset(sec, 0, sizeof(sec));
+    wr32(&sec[0], 0x0FFFFFF8u);
+    wr32(&sec[4], 0x0FFFFFFFu);
+    wr32(&sec[8], 0x0FFFFFFFu);
+    if (!BDEV_Write(dev, part_lba + RESERVED_SECTORS, 1, sec) ||
+        !BDEV_Write(dev, part_lba + RESERVED_SECTORS + fat_sectors, 1, sec)) return false;
+    return BDEV_Flush(dev);
+}
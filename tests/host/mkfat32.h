@@ -0,0 +1,12 @@
+#ifndef MKFAT32_H
+#define MKFAT32_H
+#include <stdint.h>
+#include "systypes.h"
+#include "blockdev.h"
+
+// Minimal FAT32 formatter for test images: 32 reserved sectors, FSInfo at 1, backup boot sector
+// at 6, two FATs, empty root directory in cluster 2. part_lba > 0 adds an MBR with one type 0x0C
+// partition starting there; 0 formats the device as a raw volume.
+boolean MKFAT32_Format(const BDEV_Device *dev, uint32_t sector_count, uint32_t part_lba, uint8_t sectors_per_cluster);
+
+#endif // MKFAT32_H
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+#include "msdcmodel.h"
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include "systemconfig.h"
+#include "sd_minimal.h"
+#include "hoststubs.h"
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "msdcmodel.c single-steps register accesses with the x86-64 trap flag on Linux"
+#endif
+
+#define PAGE_SIZE       4096u
+#define EFLAGS_TF       0x100
+#define PF_WRITE        2           // page fault error code: the access was a write
+#define CARD_RCA        0x4D2A
+
+// SD card states (R1 CURRENT_STATE)
+enum { ST_IDLE, ST_READY, ST_IDENT, ST_STBY, ST_TRAN, ST_DATA, ST_RCV };
+
+typedef struct {
+    uint32_t base;
+    uint32_t irq;
+    uint32_t cfg, ps, iocon, iocon1, sdc_cfg, arg, cmdsta, datsta;
+    uint32_t res[4];
+    boolean  pin_irq;           // pin change not yet seen through MSDC_INT
+    unsigned sdc_busy;          // SDC_STA reads left with the card holding DAT0 busy
+    // Data phase
+    uint8_t  dir;               // 0 none, 1 card to FIFO, 2 FIFO to card
+    boolean  bad_crc;           // this data phase fails its CRC check
+    uint32_t addr;              // next card sector
+    uint32_t blocks_left;
+    uint32_t fifo[128];         // one block in flight
+    unsigned fifo_len, fifo_pos;
+} ctrl_model;
+
+static ctrl_model g_ctrl[2] = {
+    { .base = 0xA0130000u, .irq = IRQ_MSDC_CODE },
+    { .base = 0xA0270000u, .irq = IRQ_MSDC2_CODE },
+};
+static MSDCM_Card *g_card;
+static int g_state;
+static boolean g_app;           // CMD55 seen, the next command is an ACMD
+static unsigned g_polls;        // ACMD41 calls since CMD0
+
+static struct {
+    ctrl_model *c;
+    uint32_t off;
+    boolean write;
+} g_access;                     // register access being single-stepped
+
+static ctrl_model *card_ctrl(void)
+{
+    return g_card ? &g_ctrl[g_card->ctrl == 0 ? 0 : 1] : NULL;
+}
+
+static uint32_t card_status(void)
+{
+    return ((uint32_t)g_state << 9) | ((g_state == ST_TRAN) ? SDM_R1_READY_FOR_DATA : 0) | (g_app ? (1u << 5) : 0);
+}
+
+// Load the next block of a read into the FIFO once the previous one is consumed
+static boolean fifo_ready(ctrl_model *c)
+{
+    if (c->fifo_pos < c->fifo_len) return true;
+    if (c->dir != 1 || !c->blocks_left || c->addr >= g_card->sectors) return false;
+    memcpy(c->fifo, g_card->data + (size_t)c->addr * 512u, 512);
+    c->addr++;
+    c->blocks_left--;
+    c->fifo_len = 128;
+    c->fifo_pos = 0;
+    g_card->blocks_read++;
+    return true;
+}
+
+static void update_irq(ctrl_model *c)
+{
+    boolean data = (c->cfg & SDM_MSDC_CFG_DIRQEN) && c->dir == 1 && g_card && c == card_ctrl() && fifo_ready(c);
+    boolean pin = (c->cfg & SDM_MSDC_CFG_PINEN) && c->pin_irq;
+    HOST_SetIRQ(c->irq, (c->cfg & SDM_MSDC_CFG_INTEN) && (data || pin));
+}
+
+static void stop_data(ctrl_model *c)
+{
+    c->dir = 0;
+    c->fifo_len = c->fifo_pos = 0;
+    c->blocks_left = 0;
+}
+
+// Start a block transfer; the CRC faults of the card decide how its data phase ends
+static boolean start_data(ctrl_model *c, uint8_t dir, uint32_t blocks)
+{
+    unsigned width = (c->sdc_cfg & SDM_SDC_CFG_MDLEN) ? 4 : 1;
+    c->addr = g_card->sdhc ? c->arg : c->arg / 512u;
+    if (c->addr >= g_card->sectors) return false;
+    stop_data(c);
+    c->dir = dir;
+    c->blocks_left = blocks ? blocks : g_card->sectors - c->addr;
+    c->datsta = 0;
+    c->bad_crc = width != g_card->bus_width || (g_card->crc_on_4bit && width == 4) ||
+                 (g_card->crc_above_khz && g_card->clock_khz > g_card->crc_above_khz) ||
+                 (g_card->crc_until_dsw && !(c->iocon & SDM_MSDC_IOCON_DSW));
+    if (c->bad_crc) {
+        c->datsta |= SDM_SDC_DATCRCERR;
+        g_card->crc_errors++;
+    }
+    if (g_card->clock_khz > g_card->max_data_khz) g_card->max_data_khz = g_card->clock_khz;
+    return true;
+}
+
+// Command written to SDC_CMD: response registers and SDC_CMDSTA as the card answers
+static void command(ctrl_model *c, uint32_t cmd)
+{
+    unsigned idx = cmd & 0x3F;
+    boolean app = g_app, ok = true;
+    if (!g_card || c != card_ctrl()) {
+        c->cmdsta = idx ? SDM_SDC_CMDTO : SDM_SDC_CMDRDY; // CMD0 expects no response
+        return;
+    }
+    g_app = false;
+    if (app) g_card->acmd_count[idx]++;
+    else g_card->cmd_count[idx]++;
+    memset(c->res, 0, sizeof(c->res));
+    if (app) {
+        switch (idx) {
+        case 41:
+            if (g_state != ST_IDLE && g_state != ST_READY) { ok = false; break; }
+            c->res[0] = 0x00FF8000u;
+            if (++g_polls >= 2) {
+                c->res[0] |= 0x80000000u | ((g_card->sdhc && (c->arg & 0x40000000u)) ? 0x40000000u : 0);
+                g_state = ST_READY;
+            }
+            break;
+        case 6:
+            if (g_state != ST_TRAN) { ok = false; break; }
+            g_card->bus_width = ((c->arg & 3) == 2) ? 4 : 1;
+            c->res[0] = card_status();
+            break;
+        case 23:
+            ok = g_state == ST_TRAN;
+            c->res[0] = card_status();
+            break;
+        case 51:
+            if (g_state != ST_TRAN) { ok = false; break; }
+            c->res[0] = card_status();
+            stop_data(c);
+            c->dir = 1;
+            c->fifo[0] = 0x02u | ((g_card->wide ? 0x05u : 0x01u) << 8); // SCR bytes 0..3, then 4..7
+            c->fifo[1] = 0;
+            c->fifo_len = 2;
+            break;
+        default:
+            ok = false;
+        }
+    } else {
+        switch (idx) {
+        case 0:
+            g_state = ST_IDLE;
+            g_polls = 0;
+            g_card->bus_width = 1;
+            stop_data(c);
+            break;
+        case 8:
+            if (g_state != ST_IDLE) { ok = false; break; }
+            c->res[0] = c->arg & 0xFFF;
+            break;
+        case 55:
+            g_app = true;
+            c->res[0] = card_status();
+            break;
+        case 2:
+            if (g_state != ST_READY) { ok = false; break; }
+            g_state = ST_IDENT;
+            c->res[3] = 0x03534453u; // MID 0x03, "SD"
+            break;
+        case 3:
+            if (g_state != ST_IDENT && g_state != ST_STBY) { ok = false; break; }
+            g_state = ST_STBY;
+            c->res[0] = ((uint32_t)CARD_RCA << 16) | 0x0500;
+            break;
+        case 9:
+            if (g_state != ST_STBY || (c->arg >> 16) != CARD_RCA) { ok = false; break; }
+            if (g_card->sdhc) {
+                uint32_t c_size = g_card->sectors / 1024u - 1;
+                c->res[3] = 0x40000000u;
+                c->res[2] = (c_size >> 16) & 0x3F;
+                c->res[1] = (c_size & 0xFFFF) << 16;
+            } else {
+                uint32_t c_size = g_card->sectors / 512u - 1; // READ_BL_LEN 9, C_SIZE_MULT 7
+                c->res[2] = (9u << 16) | ((c_size >> 2) & 0x3FF);
+                c->res[1] = ((c_size & 3) << 30) | (7u << 15);
+            }
+            break;
+        case 7:
+            if ((c->arg >> 16) != CARD_RCA) { ok = false; break; }
+            g_state = ST_TRAN;
+            c->res[0] = card_status();
+            break;
+        case 13:
+            c->res[0] = card_status();
+            break;
+        case 12:
+            if (g_state == ST_DATA || g_state == ST_RCV) g_state = ST_TRAN;
+            stop_data(c);
+            c->res[0] = card_status();
+            c->sdc_busy = 2;
+            break;
+        case 17:
+        case 18:
+        case 24:
+        case 25:
+            if (g_state != ST_TRAN || !start_data(c, (idx < 24) ? 1 : 2, (idx == 17 || idx == 24) ? 1 : 0)) {
+                ok = false;
+                break;
+            }
+            c->res[0] = card_status();
+            if (idx == 18) g_state = ST_DATA;
+            if (idx == 25) g_state = ST_RCV;
+            break;
+        default:
+            ok = false;
+        }
+    }
+    c->cmdsta = ok ? SDM_SDC_CMDRDY : SDM_SDC_CMDTO;
+}
+
+// Word written to the FIFO; a full block is programmed unless its CRC check fails
+static void fifo_write(ctrl_model *c, uint32_t v)
+{
+    if (c->dir != 2 || !g_card) return;
+    c->fifo[c->fifo_len++] = v;
+    if (c->fifo_len < 128) return;
+    c->fifo_len = 0;
+    if (!c->bad_crc && c->addr < g_card->sectors) {
+        memcpy(g_card->data + (size_t)c->addr * 512u, c->fifo, 512);
+        g_card->blocks_written++;
+    }
+    c->addr++;
+    c->sdc_busy = 3;
+    if (--c->blocks_left == 0) c->dir = 0;
+}
+
+static uint32_t reg_value(ctrl_model *c, uint32_t off, boolean consume)
+{
+    uint32_t v;
+    switch (off) {
+    case 0x00: return c->cfg;
+    case 0x04:
+        v = SDM_MSDC_STA_BUSY; // set = controller idle, as wait_cmd_done_base reads it
+        if (c->dir == 1 && g_card && c == card_ctrl() && fifo_ready(c)) v |= SDM_MSDC_STA_DRQ;
+        if (c->fifo_pos >= c->fifo_len) v |= SDM_MSDC_STA_BE;
+        return v;
+    case 0x08:
+        v = ((c->cfg & SDM_MSDC_CFG_DIRQEN) && c->dir == 1 && g_card && fifo_ready(c)) ? SDM_MSDC_INT_DIRQ : 0;
+        if (c->pin_irq) v |= SDM_MSDC_INT_PINIRQ;
+        if (consume) c->pin_irq = false;
+        return v;
+    case 0x0C:
+        v = c->ps;
+        if (consume) c->ps &= ~SDM_MSDC_PS_PINCHG;
+        return v;
+    case 0x10:
+        if (!consume || c->dir != 1 || !fifo_ready(c)) return 0;
+        return c->fifo[c->fifo_pos++];
+    case 0x14: return c->iocon;
+    case 0x18: return c->iocon1;
+    case 0x20: return c->sdc_cfg;
+    case 0x28: return c->arg;
+    case 0x2C:
+        v = c->sdc_busy ? SDM_SDC_STA_SDCBUSY : 0;
+        if (consume && c->sdc_busy) c->sdc_busy--;
+        return v;
+    case 0x30: case 0x34: case 0x38: case 0x3C:
+        return c->res[(off - 0x30) / 4];
+    case 0x40:
+        v = c->cmdsta;
+        if (consume) c->cmdsta = 0;
+        return v;
+    case 0x44:
+        v = c->datsta;
+        if (consume) c->datsta = 0;
+        return v;
+    default:
+        return 0;
+    }
+}
+
+static void reg_write(ctrl_model *c, uint32_t off, uint32_t v)
+{
+    switch (off) {
+    case 0x00:
+        if (v & SDM_MSDC_CFG_RST) {
+            stop_data(c);
+            v &= ~SDM_MSDC_CFG_RST; // reset completes at once
+        }
+        c->cfg = v;
+        if (c == card_ctrl()) {
+            uint32_t sclkf = (v & SDM_MSDC_CFG_SCLKF_Msk) >> SDM_MSDC_CFG_SCLKF_Pos;
+            g_card->clock_khz = sclkf ? 26000u / (4u * sclkf) : 13000u; // 26 MHz reference, /2 when 0
+        }
+        break;
+    case 0x04:
+        if (v & SDM_MSDC_STA_FIFOCLR) c->fifo_len = c->fifo_pos = 0;
+        break;
+    case 0x0C:
+        c->ps = (c->ps & (SDM_MSDC_PS_PIN0 | SDM_MSDC_PS_PINCHG)) | (v & ~(SDM_MSDC_PS_PIN0 | SDM_MSDC_PS_PINCHG));
+        break;
+    case 0x10: fifo_write(c, v); break;
+    case 0x14:
+        c->iocon = v;
+        if ((v & SDM_MSDC_IOCON_HSPEED) && g_card) g_card->hspeed_seen = true;
+        break;
+    case 0x18: c->iocon1 = v; break;
+    case 0x20: c->sdc_cfg = v; break;
+    case 0x24: command(c, v); break;
+    case 0x28: c->arg = v; break;
+    default: break;
+    }
+}
+
+static ctrl_model *ctrl_at(uintptr_t addr)
+{
+    for (int i=0; i<2; ++i)
+        if (addr >= g_ctrl[i].base && addr < g_ctrl[i].base + PAGE_SIZE) return &g_ctrl[i];
+    return NULL;
+}
+
+// Access to a register page: put the register value in place, open the page for one instruction
+static void on_fault(int sig, siginfo_t *si, void *context)
+{
+    ucontext_t *uc = (ucontext_t*)context;
+    ctrl_model *c = ctrl_at((uintptr_t)si->si_addr);
+    volatile uint32_t *page;
+    if (!c) {
+        signal(SIGSEGV, SIG_DFL); // a real crash: fault again without the handler
+        return;
+    }
+    page = (volatile uint32_t*)(uintptr_t)c->base;
+    g_access.c = c;
+    g_access.off = (uint32_t)((uintptr_t)si->si_addr - c->base) & ~3u;
+    g_access.write = (uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+    mprotect((void*)page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+    // A store may be a read-modify-write, so it sees the value too, without read side effects
+    page[g_access.off / 4] = reg_value(c, g_access.off, !g_access.write);
+    uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+// The instruction has run: apply a store and close the page again
+static void on_step(int sig, siginfo_t *si, void *context)
+{
+    ucontext_t *uc = (ucontext_t*)context;
+    ctrl_model *c = g_access.c;
+    volatile uint32_t *page;
+    uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+    if (!c) return;
+    page = (volatile uint32_t*)(uintptr_t)c->base;
+    if (g_access.write) reg_write(c, g_access.off, page[g_access.off / 4]);
+    mprotect((void*)page, PAGE_SIZE, PROT_NONE);
+    g_access.c = NULL;
+    update_irq(c);
+}
+
+static boolean map_page(uint32_t base, int prot)
+{
+    void *p = mmap((void*)(uintptr_t)base, PAGE_SIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    return p == (void*)(uintptr_t)base;
+}
+
+boolean MSDCM_Attach(void)
+{
+    struct sigaction sa;
+    // Clock, power-down and LDO registers written during init are plain memory
+    if (!map_page(CONFIG_BASE, PROT_READ | PROT_WRITE) || !map_page(ANA_CFGSYS_BASE, PROT_READ | PROT_WRITE) ||
+        !map_page(PMU_BASE, PROT_READ | PROT_WRITE)) return false;
+    for (int i=0; i<2; ++i)
+        if (!map_page(g_ctrl[i].base, PROT_NONE)) return false;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = on_fault;
+    if (sigaction(SIGSEGV, &sa, NULL)) return false;
+    sa.sa_sigaction = on_step;
+    return sigaction(SIGTRAP, &sa, NULL) == 0;
+}
+
+// Card-detect pin of the card's controller moves; an armed controller interrupts
+static void pin_change(ctrl_model *c, boolean present)
+{
+    if (present) c->ps |= SDM_MSDC_PS_PIN0;
+    else c->ps &= ~SDM_MSDC_PS_PIN0;
+    c->ps |= SDM_MSDC_PS_PINCHG;
+    c->pin_irq = true;
+    update_irq(c);
+}
+
+void MSDCM_Insert(MSDCM_Card *card)
+{
+    g_card = card;
+    g_state = ST_IDLE;
+    g_app = false;
+    g_polls = 0;
+    card->bus_width = 1;
+    pin_change(card_ctrl(), true);
+}
+
+void MSDCM_Remove(void)
+{
+    ctrl_model *c = card_ctrl();
+    if (!c) return;
+    stop_data(c);
+    g_card = NULL;
+    pin_change(c, false);
+}
+
+// Only MSDC0 has DAT1..3 wired
+boolean MSDC_IsMultiLineSupported(TMSDC Index)
+{
+    return Index == MSDC_ITF0;
+}
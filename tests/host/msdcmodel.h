@@ -0,0 +1,39 @@
+#ifndef MSDCMODEL_H
+#define MSDCMODEL_H
+#include <stdint.h>
+#include "systypes.h"
+
+// Register level model of the MT6261 MSDC controllers with an SD card behind one of them, so
+// sd_minimal.c runs unchanged on the host. Its register pages (MSDC0 at 0xA0130000, MSDC2 at
+// 0xA0270000) are mapped without access: every load or store faults, is served by the model
+// and single-stepped (x86-64 Linux only). The clock and power registers it also touches are
+// plain memory. Data interrupts raise the controller's line in hoststubs.c.
+
+typedef struct {
+    // Card, set before MSDCM_Insert
+    int      ctrl;                // controller the card sits on: 0 (MSDC0) or 2 (MSDC2)
+    boolean  sdhc;                // block addressed (CCS); otherwise byte addressed SDSC
+    boolean  wide;                // SCR offers the 4-bit bus
+    uint32_t sectors;             // capacity, a multiple of 2048 (1 MiB)
+    uint8_t  *data;               // card contents, sectors * 512 bytes
+    // Data CRC errors (also whenever controller and card disagree on the bus width)
+    unsigned crc_above_khz;       // on transfers clocked above this, 0 = never
+    boolean  crc_on_4bit;         // on the 4-bit bus
+    boolean  crc_until_dsw;       // until the controller samples on the other edge (IOCON.DSW)
+    // Observed
+    unsigned clock_khz;           // card clock from MSDC_CFG.SCLKF
+    unsigned max_data_khz;        // fastest clock a data transfer ran at
+    uint8_t  bus_width;           // set by ACMD6
+    boolean  hspeed_seen;         // IOCON.HSPEED was ever set
+    uint32_t cmd_count[64];       // commands by index
+    uint32_t acmd_count[64];      // application commands (after CMD55) by index
+    uint32_t crc_errors;          // data phases that reported a CRC error
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+} MSDCM_Card;
+
+boolean MSDCM_Attach(void);              // map the register pages and install the fault handlers
+void    MSDCM_Insert(MSDCM_Card *card);  // card in its slot, idle (pin change on an armed controller)
+void    MSDCM_Remove(void);
+
+#endif // MSDCMODEL_H
@@ -0,0 +1,153 @@
+#include "normodel.h"
+#include "hoststubs.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t next_random(NORM_Flash *nor)
+{
+    nor->seed = nor->seed * 1103515245u + 12345u;
+    return nor->seed >> 8;
+}
+
+static boolean in_range(NORM_Flash *nor, uint32_t address, size_t count)
+{
+    return !nor->off && address < nor->size && count <= nor->size - address;
+}
+
+static boolean norm_read(void *ctx, uint32_t address, void *data, size_t count)
+{
+    NORM_Flash *nor = (NORM_Flash*)ctx;
+    if (!data || !in_range(nor, address, count)) return false;
+    memcpy(data, &nor->mem[address], count);
+    nor->stats.reads++;
+    nor->stats.bytes_read += count;
+    return true;
+}
+
+static boolean norm_program(void *ctx, uint32_t address, void *data, size_t count)
+{
+    NORM_Flash *nor = (NORM_Flash*)ctx;
+    const uint8_t *src = (const uint8_t*)data;
+    uint64_t pages;
+    if (!data || !in_range(nor, address, count)) return false;
+    if (!count) return true;
+    pages = (address + count - 1) / NORM_PAGE_SIZE - address / NORM_PAGE_SIZE + 1;
+    nor->stats.programs++;
+    nor->stats.pages_programmed += pages;
+    nor->stats.busy_us += pages * NORM_PAGE_US;
+    for (size_t i=0; i<count; ++i) {
+        if (nor->budget == 0) {
+            nor->mem[address + i] &= src[i] | (uint8_t)next_random(nor);
+            nor->off = true;
+            return false;
+        }
+        if (nor->budget > 0) nor->budget--;
+        nor->mem[address + i] &= src[i];
+        nor->stats.bytes_programmed++;
+    }
+    return true;
+}
+
+static boolean norm_erase(void *ctx, uint32_t address)
+{
+    NORM_Flash *nor = (NORM_Flash*)ctx;
+    uint8_t *sector = &nor->mem[address & ~(NORSECTORSIZE - 1)];
+    if (!in_range(nor, address, 1)) return false;
+    nor->stats.erases++;
+    nor->stats.busy_us += NORM_ERASE_US;
+    if (nor->budget >= 0 && nor->budget < NORM_ERASE_COST) {
+        // Each word made it with the odds of the erase progress at the cut
+        for (uint32_t i=0; i<NORSECTORSIZE; i+=4)
+            if (next_random(nor) % NORM_ERASE_COST < (uint32_t)nor->budget) memset(&sector[i], 0xFF, 4);
+        nor->budget = 0;
+        nor->off = true;
+        return false;
+    }
+    if (nor->budget > 0) nor->budget -= NORM_ERASE_COST;
+    memset(sector, 0xFF, NORSECTORSIZE);
+    nor->erase_count[address / NORSECTORSIZE]++;
+    return true;
+}
+
+boolean NORM_Create(NORM_Flash *nor, uint32_t size, uint8_t fill)
+{
+    memset(nor, 0, sizeof(*nor));
+    if (!size || size % NORSECTORSIZE) return false;
+    nor->mem = malloc(size);
+    nor->erase_count = calloc(size / NORSECTORSIZE, sizeof(uint32_t));
+    if (!nor->mem || !nor->erase_count) {
+        NORM_Destroy(nor);
+        return false;
+    }
+    memset(nor->mem, fill, size);
+    nor->size = size;
+    nor->budget = -1;
+    nor->seed = 1;
+    return true;
+}
+
+void NORM_Destroy(NORM_Flash *nor)
+{
+    free(nor->mem);
+    free(nor->erase_count);
+    memset(nor, 0, sizeof(*nor));
+}
+
+void NORM_GetFlash(NORM_Flash *nor, TNORFLASH *flash)
+{
+    flash->Read = norm_read;
+    flash->Program = norm_program;
+    flash->Erase = norm_erase;
+    flash->Context = nor;
+}
+
+void NORM_PowerOn(NORM_Flash *nor)
+{
+    nor->budget = -1;
+    nor->off = false;
+}
+
+static void fixture_mount(NORM_Fixture *fx)
+{
+    fx->unmount(fx->ctx);
+    CHECK(fx->mount(fx->ctx));
+}
+
+void NORM_NewChip(NORM_Fixture *fx, uint8_t fill)
+{
+    fx->unmount(fx->ctx);
+    NORM_Destroy(&fx->nor);
+    CHECK(NORM_Create(&fx->nor, fx->size, fill));
+    NORM_GetFlash(&fx->nor, &fx->flash);
+    fixture_mount(fx);
+}
+
+void NORM_PowerCycle(NORM_Fixture *fx, int32_t mount_budget)
+{
+    fx->unmount(fx->ctx);
+    NORM_PowerOn(&fx->nor);
+    fx->nor.budget = mount_budget;
+    if (!fx->mount(fx->ctx)) {
+        CHECK(fx->nor.off);
+        NORM_PowerOn(&fx->nor);
+        fixture_mount(fx);
+    }
+    NORM_PowerOn(&fx->nor);
+}
+
+int32_t NORM_StepCost(NORM_Fixture *fx, void (*step)(void *ctx))
+{
+    NORM_Stats before = fx->nor.stats;
+    uint8_t *image = malloc(fx->nor.size);
+    int32_t cost;
+
+    CHECK(image);
+    memcpy(image, fx->nor.mem, fx->nor.size);
+    step(fx->ctx);
+    cost = (int32_t)(fx->nor.stats.bytes_programmed - before.bytes_programmed) +
+           (int32_t)(fx->nor.stats.erases - before.erases) * NORM_ERASE_COST;
+    memcpy(fx->nor.mem, image, fx->nor.size);
+    free(image);
+    fixture_mount(fx);
+    return cost;
+}
@@ -0,0 +1,67 @@
+#ifndef NORMODEL_H
+#define NORMODEL_H
+#include <stdint.h>
+#include "systemconfig.h"
+
+// Serial NOR flash in RAM behind a TNORFLASH (sf.h), for the storage code that runs on the
+// boot flash. As on the chip, Erase sets one NORSECTORSIZE sector to 0xFF and Program only
+// clears bits, so a program over data that is not erased ANDs into it.
+//
+// Power loss: 'budget' counts the bytes that can still be programmed; an erase costs
+// NORM_ERASE_COST of them. When it runs out part way through an operation the supply is cut:
+// the bytes before the cut are programmed, the byte under it gets a random part of its zero
+// bits, a cut erase leaves a random part of the sector's words erased, and every later
+// operation fails until NORM_PowerOn.
+
+#define NORM_ERASE_COST     64
+
+// Chip time model used by the benchmarks: typical GD25LQ64 (the boot flash) figures
+#define NORM_PAGE_SIZE      256     // one program command stays within a page
+#define NORM_PAGE_US        400     // program a page
+#define NORM_ERASE_US       50000   // erase a sector
+
+typedef struct {
+    uint32_t reads;
+    uint32_t programs;
+    uint32_t erases;
+    uint64_t bytes_read;
+    uint64_t bytes_programmed;
+    uint64_t pages_programmed; // pages each program touched
+    uint64_t busy_us;          // modelled program and erase time
+} NORM_Stats;
+
+typedef struct {
+    uint8_t  *mem;
+    uint32_t size;            // bytes, whole sectors
+    uint32_t *erase_count;    // per sector
+    int32_t  budget;          // bytes that can still be programmed, -1 = unlimited (failure injection)
+    boolean  off;             // the budget ran out
+    uint32_t seed;            // what a cut leaves behind
+    NORM_Stats stats;
+} NORM_Flash;
+
+boolean NORM_Create(NORM_Flash *nor, uint32_t size, uint8_t fill); // contents set to fill (0xFF: erased)
+void    NORM_Destroy(NORM_Flash *nor);
+void    NORM_GetFlash(NORM_Flash *nor, TNORFLASH *flash);
+void    NORM_PowerOn(NORM_Flash *nor);  // supply back, unlimited budget
+
+// Power-cut fixture shared by the storage tests: a chip of 'size' bytes and the code under test,
+// which 'mount' brings up on 'flash' (false if the chip cut the supply) and 'unmount' drops.
+typedef struct {
+    NORM_Flash nor;
+    TNORFLASH  flash;
+    uint32_t   size;
+    boolean  (*mount)(void *ctx);
+    void     (*unmount)(void *ctx);
+    void      *ctx;
+} NORM_Fixture;
+
+void    NORM_NewChip(NORM_Fixture *fx, uint8_t fill);  // fresh chip holding fill everywhere, mounted
+// Restart after a cut; the mount may be cut as well when it has sectors to clean up
+// (mount_budget, -1 for none). Returns with the supply on.
+void    NORM_PowerCycle(NORM_Fixture *fx, int32_t mount_budget);
+// Budget that 'step' uses up, measured on a copy of the chip: bytes programmed plus
+// NORM_ERASE_COST per erase. The chip is restored and remounted afterwards.
+int32_t NORM_StepCost(NORM_Fixture *fx, void (*step)(void *ctx));
+
+#endif // NORMODEL_H
@@ -0,0 +1,12 @@
+// FAT32_Mount's default device for host programs that do not link sd_minimal.c: no card
+#include "sd_minimal.h"
+
+static boolean nocard_read(void *ctx, uint32_t lba, uint32_t count, uint8_t *buf)
+{
+    (void)ctx; (void)lba; (void)count; (void)buf;
+    return false;
+}
+
+static const BDEV_Ops nocard_ops = { nocard_read, NULL, NULL, NULL, NULL, NULL, NULL };
+
+const BDEV_Device SDM_BlockDevice = { &nocard_ops, NULL };
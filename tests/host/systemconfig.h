@@ -0,0 +1,46 @@
+/*
+* Host build replacement for src/systemconfig.h: the driver and system modules under test see
+* their usual headers, while the hardware pieces they call are provided by hoststubs.c and the
+* device models in this directory.
+*/
+#ifndef _SYSTEMCONFIG_H_
+#define _SYSTEMCONFIG_H_
+
+#include <stddef.h>
+#include "systypes.h"
+
+// Peripheral bases the driver headers expand to (mt6261.h is not usable off target)
+#define CONFIG_BASE                 0xA0010000
+#define GPIO_BASE                   0xA0020000
+#define CIRQ_BASE                   0xA0060000
+#define MSDC0_BASE                  0xA0130000
+#define SFI_BASE                    0xA0140000
+#define MIXED_BASE                  0xA0170000
+#define PLL_BASE                    MIXED_BASE
+#define MSDC1_BASE                  0xA0270000
+#define PMU_BASE                    0xA0700000
+#define ANA_CFGSYS_BASE             0xA0730000
+
+#include "dlist.h"
+#include "utils.h"
+#include "nvic.h"
+#include "gpio.h"
+#include "pctl.h"
+#include "pmu.h"
+#include "pll.h"
+#include "ustimer.h"
+#include "sfi.h"
+#include "msdc.h"
+#include "evmngr.h"
+#include "lrtimer.h"
+#include "crc.h"
+#include "fscache.h"
+#include "sf.h"
+#include "sectorlog.h"
+
+#define KVSREGIONSIZE               (64 * 1024)
+#include "kvstore.h"
+
+extern boolean IsDynamicMemory(void *Memory);
+
+#endif /* _SYSTEMCONFIG_H_ */
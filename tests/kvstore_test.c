@@ -0,0 +1,421 @@
+/*
+* kvstore.c on the NOR flash model: the store against a reference copy of its keys, and
+* recovery after the supply is cut part way through log appends, compaction and erases.
+*/
+#include <string.h>
+#include "systemconfig.h"
+#include "normodel.h"
+#include "hoststubs.h"
+
+#define KVT_SECTORS                 16
+#define KVT_CHIPSECTORS             (KVT_SECTORS + 4)
+#define KVT_BASE                    (2 * KVS_SECTORSIZE)                                            // Region inside the chip
+#define KVT_KEYS                    40
+#define KVT_MAXVALUE                1500
+
+typedef struct
+{
+    boolean  Present;
+    uint32_t Size;
+    uint8_t  Value[KVT_MAXVALUE];
+} TKVTKEY;
+
+static pKVSTORE     Store;
+static TKVTKEY      Reference[KVT_KEYS];
+static uint32_t     Seed = 1;
+static uint32_t     ValueLimit = 60;                                                                // Sizes RandomValue picks from
+
+static boolean CreateStore(void *Context);
+static void DestroyStore(void *Context);
+
+static NORM_Fixture Chip =
+{
+    .size = KVT_CHIPSECTORS * KVS_SECTORSIZE,
+    .mount = CreateStore,
+    .unmount = DestroyStore
+};
+
+static uint32_t Random(void)
+{
+    Seed = Seed * 1103515245 + 12345;
+    return Seed >> 8;
+}
+
+static const char *KeyName(uint32_t Key)
+{
+    static char Name[16];
+
+    sprintf(Name, "key%u", Key);
+    return Name;
+}
+
+static boolean CreateStore(void *Context)
+{
+    Store = KVS_Create(&Chip.flash, KVT_BASE, KVT_SECTORS);
+    return Store != NULL;
+}
+
+static void DestroyStore(void *Context)
+{
+    Store = KVS_Destroy(Store);
+}
+
+static void Mount(void)
+{
+    DestroyStore(NULL);
+    CHECK(CreateStore(NULL));
+}
+
+/* Fresh chip holding Fill everywhere and an empty store */
+static void NewChip(uint8_t Fill)
+{
+    NORM_NewChip(&Chip, Fill);
+    memset(Reference, 0, sizeof(Reference));
+}
+
+/* Restart after a cut. The main loop then runs with the supply on, so a compaction cut short
+   is finished before the next cut. */
+static void PowerCycle(int32_t MountBudget)
+{
+    NORM_PowerCycle(&Chip, MountBudget);
+    HOST_RunTimers();
+    CHECK(Store->Log.FreeSectors >= KVS_RESERVESECTORS);
+}
+
+static boolean Matches(uint32_t Key, const TKVTKEY *Expected)
+{
+    uint8_t Value[KVT_MAXVALUE + 1];
+    size_t  Size = sizeof(Value);
+
+    if (!KVS_Get(Store, KeyName(Key), Value, &Size)) return !Expected->Present;
+    return Expected->Present && (Size == Expected->Size) && !memcmp(Value, Expected->Value, Size);
+}
+
+static void CheckAll(void)
+{
+    TKVSSTATS Stats;
+    uint32_t  i, Present = 0;
+
+    for(i = 0; i < KVT_KEYS; i++)
+    {
+        CHECK(Matches(i, &Reference[i]));
+        Present += Reference[i].Present;
+    }
+    KVS_GetStats(Store, &Stats);
+    CHECK(Stats.KeysCount == Present);
+}
+
+static void RandomValue(TKVTKEY *Key)
+{
+    uint32_t i;
+
+    Key->Present = true;
+    Key->Size = Random() % ValueLimit;
+    for(i = 0; i < Key->Size; i++) Key->Value[i] = Random();
+}
+
+static boolean Put(uint32_t Key, const TKVTKEY *New)
+{
+    if (New->Present) return KVS_Set(Store, KeyName(Key), New->Value, New->Size);
+    return KVS_Delete(Store, KeyName(Key));
+}
+
+/* One random update, retried once after a background compaction when the log is full */
+static void Update(uint32_t Key)
+{
+    TKVTKEY New;
+
+    if (Random() % 8 == 0) New.Present = false;
+    else RandomValue(&New);
+    if (!New.Present && !Reference[Key].Present)
+    {
+        CHECK(!Put(Key, &New));
+        return;
+    }
+    if (!Put(Key, &New))
+    {
+        CHECK(HOST_RunTimers());
+        CHECK(Put(Key, &New));
+    }
+    Reference[Key] = New;
+}
+
+/* Updates without background compaction until the log refuses one: the next compaction
+   starts with nothing but the reserve sector erased */
+static void FillLog(void)
+{
+    for(;;)
+    {
+        uint32_t Key = Random() % KVT_KEYS;
+        TKVTKEY  New;
+
+        RandomValue(&New);
+        if (!Put(Key, &New)) break;
+        Reference[Key] = New;
+    }
+}
+
+static void TestBasic(void)
+{
+    static const char LongKey[] = "0123456789abcdef0123456789abcdef";
+    static uint8_t    Big[KVS_SECTORSIZE];
+    TKVSSTATS         Stats;
+    uint8_t           Value[16];
+    size_t            Size;
+    uint32_t          i, Writes;
+
+    /* Whatever the region held is erased, the rest of the chip is not touched */
+    NewChip(0x5A);
+    KVS_GetStats(Store, &Stats);
+    CHECK(Stats.FreeSectors == KVT_SECTORS);
+    CHECK(Stats.KeysCount == 0);
+    for(i = 0; i < KVT_CHIPSECTORS; i++)
+        CHECK(Chip.nor.erase_count[i] == ((i * KVS_SECTORSIZE >= KVT_BASE) && (i < KVT_BASE / KVS_SECTORSIZE + KVT_SECTORS)));
+    for(i = 0; i < KVT_BASE; i++) CHECK(Chip.nor.mem[i] == 0x5A);
+    for(i = KVT_BASE + KVT_SECTORS * KVS_SECTORSIZE; i < Chip.nor.size; i++) CHECK(Chip.nor.mem[i] == 0x5A);
+
+    CHECK(KVS_Set(Store, "a", "0123456789", 10));
+    Size = 4;
+    CHECK(KVS_Get(Store, "a", Value, &Size) && (Size == 10) && !memcmp(Value, "0123", 4));
+    Size = 0;
+    CHECK(KVS_Get(Store, "a", NULL, &Size) && (Size == 10));
+
+    /* The same value again is not written */
+    KVS_GetStats(Store, &Stats);
+    Writes = Stats.Writes;
+    CHECK(KVS_Set(Store, "a", "0123456789", 10));
+    KVS_GetStats(Store, &Stats);
+    CHECK(Stats.Writes == Writes);
+
+    CHECK(KVS_Set(Store, "empty", NULL, 0));
+    Size = sizeof(Value);
+    CHECK(KVS_Get(Store, "empty", Value, &Size) && (Size == 0));
+    CHECK(KVS_Set(Store, LongKey, "x", 1));
+    CHECK(KVS_Set(Store, "gone", "x", 1));
+    CHECK(KVS_Delete(Store, "gone"));
+    CHECK(!KVS_Delete(Store, "gone"));
+    CHECK(!KVS_Delete(Store, "missing"));
+    Size = sizeof(Value);
+    CHECK(!KVS_Get(Store, "gone", Value, &Size));
+
+    /* Keys out of range and values that do not fit a sector */
+    CHECK(!KVS_Set(Store, "", "x", 1));
+    CHECK(!KVS_Set(Store, "0123456789abcdef0123456789abcdefX", "x", 1));
+    CHECK(!KVS_Set(Store, "big", Big, sizeof(Big)));
+    CHECK(!KVS_Set(Store, NULL, "x", 1));
+    CHECK(!KVS_Set(Store, "a", NULL, 1));
+
+    Mount();
+    Size = sizeof(Value);
+    CHECK(KVS_Get(Store, "a", Value, &Size) && (Size == 10) && !memcmp(Value, "0123456789", 10));
+    Size = sizeof(Value);
+    CHECK(KVS_Get(Store, "empty", Value, &Size) && (Size == 0));
+    Size = sizeof(Value);
+    CHECK(KVS_Get(Store, LongKey, Value, &Size) && (Size == 1));
+    Size = sizeof(Value);
+    CHECK(!KVS_Get(Store, "gone", Value, &Size));
+    KVS_GetStats(Store, &Stats);
+    CHECK(Stats.KeysCount == 3);
+
+    /* The index holds KVS_MAXKEYS keys, also after a mount */
+    NewChip(0xFF);
+    for(i = 0; i < KVS_MAXKEYS; i++) CHECK(KVS_Set(Store, KeyName(i), &i, sizeof(i)));
+    CHECK(!KVS_Set(Store, KeyName(i), &i, sizeof(i)));
+    Mount();
+    for(i = 0; i < KVS_MAXKEYS; i++)
+    {
+        uint32_t Stored;
+
+        Size = sizeof(Stored);
+        CHECK(KVS_Get(Store, KeyName(i), &Stored, &Size) && (Size == sizeof(Stored)) && (Stored == i));
+    }
+    CHECK(!KVS_Set(Store, KeyName(i), &i, sizeof(i)));
+}
+
+/* Random updates with background compaction and mounts against the reference */
+static void TestReference(void)
+{
+    TKVSSTATS Stats;
+    uint32_t  i;
+
+    NewChip(0xFF);
+    for(i = 1; i <= 100000; i++)
+    {
+        Update(Random() % KVT_KEYS);
+        if (Random() % 4 == 0) HOST_RunTimers();
+        if (i % 5000 == 0) Mount();
+        if (i % 1000 == 0) CheckAll();
+    }
+    HOST_RunTimers();
+    KVS_GetStats(Store, &Stats);
+    CHECK(Chip.nor.stats.erases > 50 * KVT_SECTORS);                                                // The log went round
+    CHECK(Stats.FreeSectors >= KVS_FREESECTORS);
+    CHECK(!HOST_TimerPending(NULL));
+}
+
+/* Cuts inside appends: after the restart the key holds its old or its new value */
+static void TestPowerCutLog(void)
+{
+    uint32_t i, Cuts = 0;
+
+    NewChip(0xFF);
+    for(i = 0; i < 20000; i++)
+    {
+        uint32_t Key = Random() % KVT_KEYS;
+        TKVTKEY  New;
+        boolean  Done;
+
+        if (Random() % 8 == 0)
+        {
+            New.Present = false;
+            Chip.nor.budget = Random() % 32;
+            Done = KVS_Delete(Store, KeyName(Key));
+        }
+        else
+        {
+            RandomValue(&New);
+            Chip.nor.budget = Random() % 96;
+            Done = KVS_Set(Store, KeyName(Key), New.Value, New.Size);
+        }
+
+        if (Chip.nor.off)
+        {
+            CHECK(!Done);
+            Cuts++;
+            PowerCycle(-1);
+            CHECK(Matches(Key, &Reference[Key]) || Matches(Key, &New));
+        }
+        else
+        {
+            NORM_PowerOn(&Chip.nor);
+            CHECK(Matches(Key, Done ? &New : &Reference[Key]));
+        }
+        if (Matches(Key, &New)) Reference[Key] = New;
+        CheckAll();
+        HOST_RunTimers();
+    }
+    CHECK(Cuts > 5000);
+}
+
+static void RunTimers(void *Context)
+{
+    HOST_RunTimers();
+}
+
+static void Compact(void *Context)
+{
+    KVS_Compact(Store);
+}
+
+/* Cuts inside compaction, its erase and the mount that cleans up after it */
+static void TestPowerCutCompaction(uint32_t Limit)
+{
+    uint32_t i, j, Cuts = 0;
+
+    ValueLimit = Limit;
+    NewChip(0xFF);
+    for(i = 0; i < 3000; i++)
+    {
+        boolean Background = Random() & 1;
+        int32_t Cost;
+
+        /* Background compaction only runs once the log is short of free sectors */
+        if (Background && (Random() & 1)) FillLog();
+        else for(j = Random() % 100; j; j--) Update(Random() % KVT_KEYS);
+        if (!Background) HOST_RunTimers();
+        Mount();
+        Cost = NORM_StepCost(&Chip, Background ? RunTimers : Compact);
+        if (!Cost) continue;
+
+        Chip.nor.budget = Random() % Cost;
+        if (Background) HOST_RunTimers();
+        else KVS_Compact(Store);
+        CHECK(Chip.nor.off);
+        Cuts++;
+        PowerCycle((Random() & 1) ? (int32_t)(Random() % (2 * NORM_ERASE_COST)) : -1);
+        CheckAll();
+    }
+    CHECK(Cuts > 1000);
+}
+
+/* A compaction cut after some copies: the copies, in the later opened sector, win over the
+   originals with the same sequence, so the victim only counts what is still to be moved */
+static void TestInterruptedCopy(void)
+{
+    uint32_t i, Victim, Live;
+    int32_t  Cost;
+
+    ValueLimit = 1;
+    NewChip(0xFF);
+    for(i = 0; i < 10; i++)
+    {
+        Reference[i].Present = true;
+        Reference[i].Size = 500;
+        memset(Reference[i].Value, i, 500);
+        CHECK(Put(i, &Reference[i]));
+    }
+    for(i = 0; i < 4; i++) Update(i);                                                               // Garbage in sector 0
+    Victim = SLOG_SelectVictim(&Store->Log);
+    CHECK(Victim == 0);
+    Live = Store->Log.Sectors[Victim].Live;
+
+    Cost = NORM_StepCost(&Chip, Compact);
+    Chip.nor.budget = Cost / 2;
+    CHECK(!KVS_Compact(Store) && Chip.nor.off);
+    NORM_PowerCycle(&Chip, -1);
+    CHECK(Store->Log.Sectors[Victim].State == SLS_USED);
+    CHECK(Store->Log.Sectors[Victim].Live < Live);
+    CheckAll();
+    CHECK(KVS_Compact(Store));
+    CheckAll();
+}
+
+/* A hot key rewritten over cold ones: the cold sectors move once erase counts drift apart */
+static void TestWear(void)
+{
+    static uint8_t Cold[1000];
+    TKVSSTATS      Stats;
+    uint32_t       i;
+    size_t         Size;
+
+    NewChip(0xFF);
+    for(i = 0; i < 24; i++)
+    {
+        memset(Cold, i, sizeof(Cold));
+        CHECK(KVS_Set(Store, KeyName(i), Cold, sizeof(Cold)));
+        HOST_RunTimers();
+    }
+    for(i = 0; i < 200000; i++)
+    {
+        if (!KVS_Set(Store, "hot", &i, sizeof(i)))
+        {
+            CHECK(HOST_RunTimers());
+            CHECK(KVS_Set(Store, "hot", &i, sizeof(i)));
+        }
+        if (i % 8 == 0) HOST_RunTimers();
+    }
+    KVS_GetStats(Store, &Stats);
+    CHECK(Stats.MaxEraseCount - Stats.MinEraseCount <= 2 * KVS_WEARDELTA);
+    for(i = 0; i < 24; i++)
+    {
+        Size = sizeof(Cold);
+        CHECK(KVS_Get(Store, KeyName(i), Cold, &Size) && (Size == sizeof(Cold)) && (Cold[0] == i) && (Cold[999] == i));
+    }
+}
+
+int main(void)
+{
+    TestBasic();
+    TestReference();
+    TestPowerCutLog();
+    TestPowerCutCompaction(60);
+    TestPowerCutCompaction(KVT_MAXVALUE);
+    TestInterruptedCopy();
+    TestWear();
+
+    Store = KVS_Destroy(Store);
+    NORM_Destroy(&Chip.nor);
+    printf("kvstore_test: all tests passed\n");
+
+    return 0;
+}
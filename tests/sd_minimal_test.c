@@ -0,0 +1,318 @@
+// sd_minimal.c against the MSDC register model: card init on either controller, block transfers,
+// the interrupt driven read path and blocking transfers queueing behind it, card change, bus
+// width, transfer clock and the data CRC back-off
+#include <stdio.h>
+#include <string.h>
+#include "systemconfig.h"
+#include "sd_minimal.h"
+#include "msdcmodel.h"
+#include "hoststubs.h"
+
+#define CARD_SECTORS    (8u * 2048u) // 8 MiB
+
+static uint8_t g_data[CARD_SECTORS * 512];
+static MSDCM_Card g_card;
+static boolean g_inserted;
+static uint32_t g_buf[16 * 128], g_buf2[16 * 128];
+
+typedef struct {
+    uint32_t calls;
+    boolean ok;
+    boolean busy_seen;        // SDM_IsBusy in the callback
+    boolean restart_refused;  // a new request from the callback was refused
+} completion;
+
+static uint32_t pattern(uint32_t lba, uint32_t word)
+{
+    return (lba * 2654435761u) ^ (word * 40503u) ^ 0x5D000000u;
+}
+
+static void fill_card(void)
+{
+    uint32_t *p = (uint32_t*)g_data;
+    for (uint32_t lba=0; lba<CARD_SECTORS; ++lba)
+        for (uint32_t w=0; w<128; ++w) *p++ = pattern(lba, w);
+}
+
+static boolean matches_card(const uint32_t *buf, uint32_t lba, uint32_t count)
+{
+    return !memcmp(buf, g_data + (size_t)lba * 512u, count * 512u);
+}
+
+// Settle the card-detect debounce the way the main loop would
+static void main_loop(void)
+{
+    HOST_ServiceIRQs();
+    HOST_RunTimers();
+}
+
+// Fresh card in the slot of controller 'ctrl' and an open session on it
+static void new_card(int ctrl, boolean sdhc, boolean wide)
+{
+    if (g_inserted) {
+        MSDCM_Remove();
+        main_loop();
+    }
+    memset(&g_card, 0, sizeof(g_card));
+    g_card.ctrl = ctrl;
+    g_card.sdhc = sdhc;
+    g_card.wide = wide;
+    g_card.sectors = CARD_SECTORS;
+    g_card.data = g_data;
+    fill_card();
+    MSDCM_Insert(&g_card);
+    g_inserted = true;
+    main_loop();
+    CHECK(SDM_Open());
+}
+
+static void on_done(SDM_Request *req, boolean ok)
+{
+    completion *c = (completion*)req->user;
+    static SDM_Request other;
+    c->calls++;
+    c->ok = ok;
+    c->busy_seen = SDM_IsBusy();
+    other.lba = 0;
+    other.count = 1;
+    other.buf = (uint8_t*)g_buf2;
+    c->restart_refused = !SDM_ReadBlocksAsync(&other);
+}
+
+static void start_async(SDM_Request *req, completion *c, uint32_t lba, uint32_t count, uint32_t *buf)
+{
+    memset(req, 0, sizeof(*req));
+    memset(c, 0, sizeof(*c));
+    req->lba = lba;
+    req->count = count;
+    req->buf = (uint8_t*)buf;
+    req->done = on_done;
+    req->user = c;
+    CHECK(SDM_ReadBlocksAsync(req));
+    CHECK(req->state == SDM_REQ_BUSY && SDM_IsBusy());
+}
+
+// ET_SDCOMPLETE handling of EM_ProcessEvents; returns the number of events
+static uint32_t process_events(void)
+{
+    TEVTYPE type;
+    SDM_Request *req;
+    uint32_t n = 0;
+    while (HOST_GetEvent(&type, &req, sizeof(req))) {
+        CHECK(type == ET_SDCOMPLETE);
+        SDM_CompleteRequest(req);
+        n++;
+    }
+    return n;
+}
+
+// SDHC card on MSDC0: 4-bit bus, default speed clock, capacity from CSD v2
+static void test_init(void)
+{
+    new_card(0, true, true);
+    CHECK(SDM_GetCardType() == SDM_CARD_SDHC);
+    CHECK(SDM_GetActiveController() == 0);
+    CHECK(SDM_GetCapacityMB() == CARD_SECTORS / 2048);
+    CHECK(SDM_GetBusWidth() == 4 && g_card.bus_width == 4);
+    CHECK(SDM_GetClockKHz() == SDM_DEFAULT_CLOCK_KHZ && g_card.clock_khz == SDM_DEFAULT_CLOCK_KHZ);
+    CHECK(g_card.acmd_count[51] == 1 && g_card.acmd_count[6] == 1);
+    CHECK(SDM_Open()); // session alive: no card traffic
+    CHECK(g_card.cmd_count[0] == 2);
+}
+
+// Byte addressed SDSC card behind MSDC2, which has only DAT0
+static void test_sdsc_on_msdc2(void)
+{
+    new_card(2, false, true);
+    CHECK(SDM_GetCardType() == SDM_CARD_SDSC);
+    CHECK(SDM_GetActiveController() == 2);
+    CHECK(SDM_GetCapacityMB() == CARD_SECTORS / 2048);
+    CHECK(SDM_GetBusWidth() == 1 && g_card.acmd_count[6] == 0);
+    CHECK(SDM_ReadBlock(1000, (uint8_t*)g_buf) && matches_card(g_buf, 1000, 1));
+    CHECK(SDM_ReadBlocks(4000, 3, (uint8_t*)g_buf) && matches_card(g_buf, 4000, 3));
+}
+
+static void test_read_write(void)
+{
+    new_card(0, true, true);
+    CHECK(SDM_ReadBlock(7, (uint8_t*)g_buf) && matches_card(g_buf, 7, 1));
+    CHECK(SDM_ReadBlocks(100, 16, (uint8_t*)g_buf) && matches_card(g_buf, 100, 16));
+    CHECK(g_card.cmd_count[18] == 1 && g_card.cmd_count[12] == 1);
+    for (uint32_t i=0; i<16 * 128; ++i) g_buf[i] = ~pattern(i / 128, i);
+    CHECK(SDM_WriteBlock(3, (uint8_t*)g_buf));
+    CHECK(matches_card(g_buf, 3, 1));
+    CHECK(SDM_WriteBlocks(500, 16, (uint8_t*)g_buf));
+    CHECK(matches_card(g_buf, 500, 16));
+    CHECK(g_card.acmd_count[23] == 1 && g_card.cmd_count[25] == 1 && g_card.cmd_count[12] == 2);
+    CHECK(SDM_ReadBlocks(499, 3, (uint8_t*)g_buf2) && matches_card(g_buf2, 499, 3));
+    CHECK(!SDM_ReadBlock(CARD_SECTORS, (uint8_t*)g_buf)); // past the end: command refused
+    CHECK(SDM_ReadBlock(CARD_SECTORS - 1, (uint8_t*)g_buf) && matches_card(g_buf, CARD_SECTORS - 1, 1));
+}
+
+// The FIFO interrupt moves the data, the posted event completes the request
+static void test_async_read(void)
+{
+    static const uint32_t counts[2] = { 1, 8 };
+    SDM_Request req;
+    completion c;
+    new_card(0, true, true);
+    for (int i=0; i<2; ++i) {
+        uint32_t stops = g_card.cmd_count[12];
+        memset(g_buf, 0, sizeof(g_buf));
+        start_async(&req, &c, 2000 + i, counts[i], g_buf);
+        CHECK(!SDM_ReadBlocksAsync(&req)); // one request at a time
+        CHECK(HOST_ServiceIRQs() > 0);
+        CHECK(req.state == SDM_REQ_DONE && c.calls == 0); // data in, completion still queued
+        CHECK(process_events() == 1);
+        CHECK(c.calls == 1 && c.ok && !c.busy_seen && !c.restart_refused);
+        CHECK(matches_card(g_buf, 2000 + i, counts[i]));
+        CHECK(g_card.cmd_count[12] == stops + (counts[i] > 1));
+        // The request started from the callback finishes too
+        CHECK(SDM_IsBusy());
+        HOST_ServiceIRQs();
+        CHECK(process_events() == 1 && !SDM_IsBusy());
+        CHECK(matches_card(g_buf2, 0, 1));
+    }
+}
+
+// Blocking reads and writes issued while a read is in flight finish it first; its callback
+// sees the driver busy, so it cannot start another transfer in between
+static void test_blocking_drains_async(void)
+{
+    SDM_Request req;
+    completion c;
+    uint32_t sector[128];
+    new_card(0, true, true);
+    start_async(&req, &c, 300, 4, g_buf);
+    CHECK(SDM_ReadBlocks(40, 2, (uint8_t*)g_buf2));
+    CHECK(c.calls == 1 && c.ok && c.busy_seen && c.restart_refused);
+    CHECK(matches_card(g_buf, 300, 4) && matches_card(g_buf2, 40, 2));
+    CHECK(process_events() == 1 && c.calls == 1); // the stale event is ignored
+    CHECK(!SDM_IsBusy());
+
+    start_async(&req, &c, 301, 1, g_buf);
+    for (uint32_t i=0; i<128; ++i) sector[i] = i;
+    CHECK(SDM_WriteBlock(9, (uint8_t*)sector) && matches_card(sector, 9, 1));
+    CHECK(c.calls == 1 && c.ok && matches_card(g_buf, 301, 1));
+    process_events();
+
+    // The same through the block device: BDEV_Read does not fail on a busy card
+    start_async(&req, &c, 302, 2, g_buf);
+    CHECK(BDEV_Read(&SDM_BlockDevice, 50, 1, (uint8_t*)g_buf2));
+    CHECK(c.calls == 1 && c.ok && matches_card(g_buf, 302, 2) && matches_card(g_buf2, 50, 1));
+    process_events();
+    CHECK(!SDM_IsBusy());
+}
+
+// Removing the card fails the request in flight and ends the session; a new card is set up on open
+static void test_card_change(void)
+{
+    SDM_Request req;
+    completion c;
+    uint32_t generation;
+    new_card(0, true, true);
+    generation = SDM_GetGeneration();
+    start_async(&req, &c, 10, 2, g_buf);
+    MSDCM_Remove();
+    g_inserted = false;
+    main_loop();
+    CHECK(c.calls == 1 && !c.ok);
+    CHECK(SDM_GetGeneration() != generation);
+    CHECK(!SDM_Open());
+    new_card(0, true, true);
+    CHECK(SDM_GetCardType() == SDM_CARD_SDHC);
+    CHECK(SDM_ReadBlock(10, (uint8_t*)g_buf) && matches_card(g_buf, 10, 1));
+    process_events();
+}
+
+// Default speed only: data never clocked above 13 MHz, no CMD6 switch, no high-speed timing
+static void test_default_speed(void)
+{
+    new_card(0, true, true);
+    CHECK(SDM_ReadBlocks(0, 16, (uint8_t*)g_buf) && matches_card(g_buf, 0, 16));
+    CHECK(SDM_WriteBlocks(16, 16, (uint8_t*)g_buf) && matches_card(g_buf, 16, 16));
+    CHECK(g_card.max_data_khz == SDM_DEFAULT_CLOCK_KHZ && SDM_DEFAULT_CLOCK_KHZ <= 13000);
+    CHECK(g_card.cmd_count[6] == 0 && !g_card.hspeed_seen);
+}
+
+// 4-bit bus only when the SCR offers it; controller (SDC_CFG.MDLEN) and card (ACMD6) agree,
+// otherwise the model fails every data phase with a CRC error
+static void test_bus_width(void)
+{
+    new_card(0, true, false);
+    CHECK(SDM_GetBusWidth() == 1 && g_card.bus_width == 1 && g_card.acmd_count[6] == 0);
+    CHECK(SDM_ReadBlocks(10, 4, (uint8_t*)g_buf) && matches_card(g_buf, 10, 4));
+    new_card(0, true, true);
+    CHECK(SDM_GetBusWidth() == 4 && g_card.bus_width == 4);
+    CHECK(SDM_ReadBlocks(10, 4, (uint8_t*)g_buf) && matches_card(g_buf, 10, 4));
+    CHECK(g_card.crc_errors == 0);
+}
+
+// CRC back-off order: sample edge, then clock halving (edge reset), then the 1-bit bus;
+// a new card starts from the top again
+static void test_crc_backoff(void)
+{
+    SDM_Request req;
+    completion c;
+
+    new_card(0, true, true);
+    g_card.crc_until_dsw = true;
+    CHECK(SDM_ReadBlock(20, (uint8_t*)g_buf) && matches_card(g_buf, 20, 1));
+    CHECK(g_card.crc_errors == 1 && SDM_GetClockKHz() == SDM_DEFAULT_CLOCK_KHZ && SDM_GetBusWidth() == 4);
+    CHECK(SDM_WriteBlock(21, (uint8_t*)g_buf) && matches_card(g_buf, 21, 1) && g_card.crc_errors == 1);
+
+    new_card(0, true, true);
+    g_card.crc_until_dsw = true;
+    for (uint32_t i=0; i<128; ++i) g_buf[i] = i * 3;
+    CHECK(SDM_WriteBlock(22, (uint8_t*)g_buf) && matches_card(g_buf, 22, 1));
+    CHECK(g_card.crc_errors == 1 && g_card.blocks_written == 1);
+
+    new_card(0, true, true);
+    g_card.crc_above_khz = 7000;
+    CHECK(SDM_ReadBlocks(30, 8, (uint8_t*)g_buf) && matches_card(g_buf, 30, 8));
+    CHECK(g_card.crc_errors == 2); // 13 MHz on both edges
+    CHECK(SDM_GetClockKHz() == SDM_DEFAULT_CLOCK_KHZ / 2 && g_card.clock_khz == SDM_DEFAULT_CLOCK_KHZ / 2);
+    CHECK(SDM_ReadBlocks(40, 8, (uint8_t*)g_buf) && g_card.crc_errors == 2); // the ceiling holds
+
+    new_card(0, true, true);
+    g_card.crc_on_4bit = true;
+    CHECK(SDM_ReadBlocks(50, 2, (uint8_t*)g_buf) && matches_card(g_buf, 50, 2));
+    CHECK(g_card.crc_errors == 10); // both edges at 13000, 6500, 3250, 1625 and 1000 kHz
+    CHECK(SDM_GetBusWidth() == 1 && g_card.bus_width == 1 && g_card.acmd_count[6] == 2);
+    CHECK(SDM_GetClockKHz() == SDM_MIN_CLOCK_KHZ);
+
+    new_card(0, true, true);
+    CHECK(SDM_GetClockKHz() == SDM_DEFAULT_CLOCK_KHZ && SDM_GetBusWidth() == 4);
+
+    // An asynchronous read fails with the CRC error and backs off; the caller's retry succeeds
+    g_card.crc_until_dsw = true;
+    start_async(&req, &c, 60, 4, g_buf);
+    HOST_ServiceIRQs();
+    process_events();
+    CHECK(c.calls == 1 && !c.ok && g_card.crc_errors == 1);
+    HOST_ServiceIRQs();
+    process_events(); // the read the callback started
+    start_async(&req, &c, 60, 4, g_buf);
+    HOST_ServiceIRQs();
+    process_events();
+    CHECK(c.calls == 1 && c.ok && matches_card(g_buf, 60, 4));
+    HOST_ServiceIRQs();
+    process_events();
+    CHECK(!SDM_IsBusy() && g_card.max_data_khz <= SDM_DEFAULT_CLOCK_KHZ);
+}
+
+int main(void)
+{
+    CHECK(MSDCM_Attach());
+    test_init();
+    test_sdsc_on_msdc2();
+    test_read_write();
+    test_async_read();
+    test_blocking_drains_async();
+    test_card_change();
+    test_default_speed();
+    test_bus_width();
+    test_crc_backoff();
+    printf("sd_minimal_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""Render heap telemetry snapshots from the payload (MEM_ReportProfile in memory.c).
+
+The payload streams a snapshot over USB CDC when it receives 'H'. Build with
+-DPAYLOAD_MEMPROFILE=ON to get per call site and size class data.
+
+Usage:
+  heapreport.py --port COM7 [--interval 2]   request and render snapshots (needs pyserial)
+  heapreport.py capture.log                  render snapshots from a captured log
+  add --elf bin/payload.elf to resolve call sites with arm-none-eabi-addr2line
+  heapreport.py --port COM7 --trace session.trace
+                                             record a heap call trace (-DPAYLOAD_MEMTRACE=ON)
+                                             for tools/tlsfreplay.c
+
+Between consecutive snapshots the site table is sorted by allocations made in the
+interval, which shows who churns the heap, e.g. around a GUI repaint.
+"""
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+CLASS_LIMITS = [16 << i for i in range(16)]   # MEMPROF_CLASSES upper bounds
+FIELD = re.compile(r"(\w+)=(\S+)")
+
+
+class Snapshot:
+    def __init__(self):
+        self.heap = {}
+        self.fast = {}
+        self.scratch = {}
+        self.prof = {}
+        self.classes = []
+        self.sites = {}
+        self.slabs = []
+
+
+def fields(line):
+    return {k: int(v, 0) if v.isdigit() else v for k, v in FIELD.findall(line)}
+
+
+def parse(lines):
+    snap = None
+    for line in lines:
+        line = line.strip()
+        tag = line.split(" ", 1)[0]
+        if tag == "HEAP":
+            snap = Snapshot()
+            snap.heap = fields(line)
+        elif snap is None:
+            continue
+        elif tag == "FAST":
+            snap.fast = fields(line)
+        elif tag == "SCRATCH":
+            snap.scratch = fields(line)
+        elif tag == "PROF":
+            snap.prof = fields(line)
+        elif tag == "CLASS":
+            snap.classes = [int(v) for v in line.split()[1:]]
+        elif tag == "SITE":
+            addr = int(line.split()[1], 16)
+            snap.sites[addr] = fields(line)
+        elif tag == "SLAB":
+            snap.slabs.append((line.split()[1], fields(line)))
+        elif tag == "END":
+            yield snap
+            snap = None
+
+
+class Symbolizer:
+    def __init__(self, elf):
+        self.elf = elf
+        self.cache = {}
+        here = os.path.dirname(os.path.abspath(__file__))
+        tool = "arm-none-eabi-addr2line"
+        for root, _, files in os.walk(os.path.join(here, "..", "gcc")):
+            for f in files:
+                if f.startswith(tool):
+                    tool = os.path.join(root, f)
+                    break
+        self.tool = tool
+
+    def __call__(self, addr):
+        if not self.elf:
+            return ""
+        if addr not in self.cache:
+            # Return address points after the call instruction (ARM mode)
+            try:
+                out = subprocess.run([self.tool, "-f", "-s", "-e", self.elf, "0x%X" % (addr - 4)],
+                                     capture_output=True, text=True, check=True).stdout.split("\n")
+                self.cache[addr] = "%s (%s)" % (out[0], out[1])
+            except (OSError, subprocess.CalledProcessError, IndexError):
+                self.cache[addr] = "?"
+        return self.cache[addr]
+
+
+def render(snap, prev, symbolize, top):
+    h = snap.heap
+    print("=" * 78)
+    print("t=%.3fs  TLSF used %d (peak %d)  free %d  largest free %d  fragmentation %.1f%%" %
+          (h.get("t", 0) / 1e6, h.get("used", 0), h.get("peak", 0), h.get("free", 0),
+           h.get("largest", 0), h.get("frag", 0) / 10.0))
+    if snap.fast:
+        f = snap.fast
+        print("TCM pool used %d (peak %d)  free %d  largest free %d" %
+              (f["used"], f["peak"], f["free"], f["largest"]))
+    if snap.prof:
+        p = snap.prof
+        print("live %d bytes (peak %d)  allocs %d  frees %d  rate %d/s  untracked %d" %
+              (p["live"], p["peak"], p["allocs"], p["frees"], p["rate"], p["lost"]))
+    if snap.classes:
+        print("size classes:  " + "  ".join("<=%d:%d" % (CLASS_LIMITS[i], n)
+                                            for i, n in enumerate(snap.classes) if n))
+    if snap.sites:
+        rows = []
+        for addr, s in snap.sites.items():
+            delta = s["allocs"] - prev.sites[addr]["allocs"] if prev and addr in prev.sites else s["allocs"]
+            rows.append((delta, s["live"], addr, s))
+        rows.sort(reverse=True)
+        print("%-10s %8s %8s %6s %9s %9s  %s" % ("site", "allocs", "interval", "live#", "live", "peak", "function"))
+        for delta, _, addr, s in rows[:top]:
+            print("%08X   %8d %8d %6d %9d %9d  %s" %
+                  (addr, s["allocs"], delta, s["count"], s["live"], s["peak"], symbolize(addr)))
+    if snap.scratch:
+        s = snap.scratch
+        print("scratch arena %d bytes  used %d  peak %d  fallbacks %d" %
+              (s["size"], s["used"], s["peak"], s["fallbacks"]))
+    for name, s in snap.slabs:
+        print("slab %-12s %4d x %4d bytes  used %4d  peak %4d  fallbacks %d" %
+              (name, s["count"], s["size"], s["used"], s["peak"], s["fallbacks"]))
+
+
+def serial_lines(port, interval):
+    import serial   # pyserial
+    with serial.Serial(port, 115200, timeout=0.2) as sp:
+        while True:
+            sp.write(b"H")
+            deadline = time.time() + max(interval, 0.5)
+            buf = b""
+            while time.time() < deadline:
+                buf += sp.read(4096)
+                *lines, buf = buf.split(b"\n")
+                for line in lines:
+                    yield line.decode("ascii", "replace")
+            if not interval:
+                return
+
+
+def capture_trace(port, path):
+    import serial   # pyserial
+    with serial.Serial(port, 115200, timeout=0.5) as sp:
+        sp.write(b"R")
+        input("recording, run the session on the device and press Enter ")
+        sp.reset_input_buffer()
+        sp.write(b"T")
+        buf, records, idle = b"", None, 0
+        with open(path, "w") as out:
+            while idle < 10:
+                data = sp.read(65536)
+                idle = 0 if data else idle + 1
+                buf += data
+                *lines, buf = buf.split(b"\n")
+                for line in lines:
+                    line = line.decode("ascii", "replace").strip()
+                    if line.startswith("TRACE"):
+                        records = fields(line)
+                    if records is None:
+                        continue
+                    out.write(line + "\n")
+                    if line == "END":
+                        print("%d records, %d lost -> %s" % (records["records"], records["lost"], path))
+                        return
+    sys.exit("no complete trace received")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="captured CDC output, '-' for stdin")
+    parser.add_argument("--port", help="CDC serial port to request snapshots from")
+    parser.add_argument("--interval", type=float, default=0, help="seconds between requests, 0 for one")
+    parser.add_argument("--elf", help="payload.elf for call site names")
+    parser.add_argument("--top", type=int, default=20)
+    parser.add_argument("--trace", metavar="FILE", help="record a heap call trace from --port into FILE")
+    args = parser.parse_args()
+
+    if args.trace:
+        if not args.port:
+            parser.error("--trace needs --port")
+        capture_trace(args.port, args.trace)
+        return
+    if args.port:
+        lines = serial_lines(args.port, args.interval)
+    elif args.log:
+        lines = sys.stdin if args.log == "-" else open(args.log, errors="replace")
+    else:
+        parser.error("give a log file or --port")
+
+    symbolize = Symbolizer(args.elf)
+    prev = None
+    for snap in parse(lines):
+        render(snap, prev, symbolize, args.top)
+        prev = snap
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Resource archive packer for the payload RES_* reader (src/System/resource.c).
+
+Usage:
+  respack.py -o resources.bin DIR            pack every file under DIR
+  respack.py -o resources.bin name=path ...  pack explicit entries
+
+Entry names are the path relative to DIR without extension ("icon/battery").
+The type comes from the extension; append ":font|image|audio|blob" to an
+explicit entry to override it. Flash the output at the offset printed at the
+end (FlashCapacity - KVSREGIONSIZE - RESREGIONSIZE), no payload relink needed.
+"""
+import argparse
+import os
+import struct
+import sys
+
+RES_MAGIC = 0x31534552
+RES_VERSION = 1
+RES_ALIGNMENT = 4
+RES_MAXNAMELEN = 63
+
+# Must match TRESTYPE in resource.h
+TYPES = {"unknown": 0, "font": 1, "image": 2, "audio": 3, "blob": 4}
+EXTENSIONS = {
+    ".bfc": "font", ".fnt": "font",
+    ".bmp": "image", ".raw": "image", ".rgb": "image", ".img": "image",
+    ".pcm": "audio", ".wav": "audio", ".snd": "audio",
+}
+
+HEADER = struct.Struct("<IHHIII")   # TRESHEADER
+ENTRY = struct.Struct("<IIIHH")     # TRESENTRY
+
+
+def crc16(data):
+    """CalculateCRC16() from crc.c: reflected 0xA001, initial 0xFFFF."""
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def align(value):
+    return (value + RES_ALIGNMENT - 1) & ~(RES_ALIGNMENT - 1)
+
+
+def collect(args):
+    entries = {}
+    for arg in args:
+        if os.path.isdir(arg):
+            for root, _, files in os.walk(arg):
+                for f in files:
+                    path = os.path.join(root, f)
+                    name, ext = os.path.splitext(os.path.relpath(path, arg))
+                    entries[name.replace(os.sep, "/")] = (path, EXTENSIONS.get(ext.lower(), "blob"))
+        else:
+            name, sep, path = arg.partition("=")
+            if not sep:
+                sys.exit("bad entry '%s', expected name=path[:type]" % arg)
+            path, _, kind = path.partition(":")
+            if not kind:
+                kind = EXTENSIONS.get(os.path.splitext(path)[1].lower(), "blob")
+            if kind not in TYPES:
+                sys.exit("unknown type '%s'" % kind)
+            entries[name] = (path, kind)
+    for name in entries:
+        if not name or len(name.encode()) > RES_MAXNAMELEN:
+            sys.exit("bad entry name '%s'" % name)
+    return entries
+
+
+def pack(entries):
+    # strcmp() order, the reader does a binary search
+    names = sorted(entries, key=lambda n: n.encode())
+    index_end = HEADER.size + len(names) * ENTRY.size
+
+    name_blob = b""
+    name_offsets = []
+    for name in names:
+        name_offsets.append(index_end + len(name_blob))
+        name_blob += name.encode() + b"\0"
+    data_offset = align(index_end + len(name_blob))
+    name_blob += b"\xff" * (data_offset - index_end - len(name_blob))
+
+    data = b""
+    records = []
+    for name, name_offset in zip(names, name_offsets):
+        path, kind = entries[name]
+        with open(path, "rb") as f:
+            content = f.read()
+        offset = data_offset + len(data)
+        records.append(ENTRY.pack(name_offset, offset, len(content), TYPES[kind], crc16(content)))
+        data += content + b"\xff" * (align(len(content)) - len(content))
+
+    index = b"".join(records) + name_blob
+    header = HEADER.pack(RES_MAGIC, RES_VERSION, crc16(index), len(names), data_offset,
+                         data_offset + len(data))
+    return header + index + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--flash-size", type=lambda v: int(v, 0), default=8 << 20)
+    parser.add_argument("--kvs-size", type=lambda v: int(v, 0), default=64 << 10)
+    parser.add_argument("--region-size", type=lambda v: int(v, 0), default=1 << 20)
+    parser.add_argument("inputs", nargs="+")
+    args = parser.parse_args()
+
+    image = pack(collect(args.inputs))
+    if len(image) > args.region_size:
+        sys.exit("archive is %d bytes, region holds %d" % (len(image), args.region_size))
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print("%s: %d bytes, flash offset 0x%06X" %
+          (args.output, len(image), args.flash_size - args.kvs_size - args.region_size))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,326 @@
+/*
+* Replays a heap call trace recorded by the payload (MEM_DumpTrace in memory.c) against
+* src/System/tlsf.c compiled for the host, as a regression benchmark for allocator changes.
+*
+* Build:  cc -O2 -o tlsfreplay tools/tlsfreplay.c
+*         add -m32 to get the target's 32 bit block headers, and so its footprint
+*         (tests/CMakeLists.txt builds it too and replays tests/data/heap.trace)
+* Record: configure with -DPAYLOAD_MEMTRACE=ON, then
+*         tools/heapreport.py --port COM7 --trace session.trace
+* Usage:  tlsfreplay [-r runs] [-s samples] session.trace
+*
+* Reports per operation mean, 99th percentile and worst latency (TSC cycles on x86, ns
+* elsewhere), peak footprint and a fragmentation timeline. TCM pool calls (lower case
+* records) are replayed into a second pool of the recorded size.
+*
+* Pools hold the room for blocks they had on the device: a 64 bit host's control block is
+* larger, so its pools grow by the difference, and the footprint is reported net of it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../src/System/tlsf.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMEUNIT    "cycles"
+static inline uint64_t Now(void)
+{
+    return __rdtsc();
+}
+#else
+#define TIMEUNIT    "ns"
+static inline uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+enum {OP_MALLOC, OP_FREE, OP_REALLOC, OP_COUNT};
+
+typedef struct
+{
+    uint32_t Time;
+    uint32_t Ptr;
+    uint32_t OldPtr;
+    uint32_t Size;
+    uint8_t  Op;
+    uint8_t  Fast;
+} TREC;
+
+typedef struct
+{
+    uint32_t Key;                                                                                   // Device address, 0 = empty
+    void     *Block;
+} TSLOT;
+
+static TREC     *Recs;
+static size_t   RecsCount;
+static TSLOT    *Map[2];
+static size_t   MapMask;
+static uint64_t *Latency[OP_COUNT];
+static size_t   LatencyCount[OP_COUNT];
+
+static TSLOT *FindSlot(int Fast, uint32_t Key, int Insert)
+{
+    size_t i = ((Key >> 3) * 0x9E3779B1u) & MapMask;
+    TSLOT  *Tomb = NULL;
+
+    for(;; i = (i + 1) & MapMask)
+    {
+        TSLOT *Slot = &Map[Fast][i];
+
+        if (Slot->Key == Key) return Slot;
+        if ((Slot->Key == UINT32_MAX) && (Tomb == NULL)) Tomb = Slot;                              // Deleted entry
+        if (Slot->Key == 0)
+        {
+            if (!Insert) return NULL;
+            return (Tomb != NULL) ? Tomb : Slot;
+        }
+    }
+}
+
+static int LoadTrace(const char *Path, size_t *PoolSize, size_t *FastSize, uint32_t *Lost)
+{
+    FILE          *f = fopen(Path, "r");
+    char          Line[128], c;
+    size_t        Capacity = 0;
+    unsigned long Records, Lst, Pool, Fast;
+
+    if (f == NULL) return 0;
+    while(fgets(Line, sizeof(Line), f) != NULL)
+    {
+        if (sscanf(Line, "TRACE records=%lu lost=%lu pool=%lu fast=%lu", &Records, &Lst, &Pool, &Fast) == 4)
+        {
+            *PoolSize = Pool;
+            *FastSize = Fast;
+            *Lost = Lst;
+            continue;
+        }
+        if (!strncmp(Line, "END", 3)) break;
+        if (RecsCount == Capacity)
+        {
+            Capacity = (Capacity) ? Capacity * 2 : 4096;
+            Recs = realloc(Recs, Capacity * sizeof(TREC));
+        }
+
+        TREC *r = &Recs[RecsCount];
+
+        if (sscanf(Line, "%c %u %x %x %u", &c, &r->Time, &r->Ptr, &r->OldPtr, &r->Size) != 5) continue;
+        switch(c)
+        {
+        case 'M': case 'm': r->Op = OP_MALLOC; break;
+        case 'F': case 'f': r->Op = OP_FREE; break;
+        case 'R': case 'r': r->Op = OP_REALLOC; break;
+        default: continue;
+        }
+        r->Fast = (c >= 'a');
+        RecsCount++;
+    }
+    fclose(f);
+
+    return RecsCount != 0;
+}
+
+/* Room init_memory_pool leaves for blocks in a pool of Size bytes on the 32 bit target: tlsf_t
+   with 4 byte pointers, then the area header and the first and last block headers, 8 byte aligned */
+static size_t TargetUsable(size_t Size)
+{
+    const size_t Control = 4 * (3 + 2 * TLSF_STATISTIC + REAL_FLI + REAL_FLI * MAX_SLI);
+    size_t       Area;
+
+    if (Size < Control + 64) return 0;
+    Area = (Size - Control) & ~(size_t)7;
+    return (Area - 3 * 8 - 8) & ~(size_t)7;
+}
+
+/* Smallest host pool with the target's room for blocks (the same layout with host sizes) */
+static size_t HostPoolSize(size_t Size)
+{
+    return sizeof(tlsf_t) + ROUNDUP_SIZE(TargetUsable(Size) + 3 * BHDR_OVERHEAD + ROUNDUP_SIZE(sizeof(area_info_t)));
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t Fragmentation(void *Pool, size_t *Free, size_t *Largest)
+{
+    *Free = get_free_size(Pool, Largest);
+
+    return (*Free) ? 1000 - (uint32_t)((uint64_t)*Largest * 1000 / *Free) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *OpNames[OP_COUNT] = {"malloc", "free", "realloc"};
+    size_t   PoolSize = 3 * 1024 * 1024, FastSize = 4 * 1024, i, n, Done, Samples = 20;
+    size_t   HostSize[2], Usable[2], Extra[2];
+    uint32_t Lost = 0, Failed = 0, Skipped = 0, MaxFrag = 0;
+    uint64_t LiveBytes = 0, PeakLive = 0;
+    int      Runs = 1, Run, a;
+    void     *Pool[2];
+    const char *Path = NULL;
+
+    for(a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-r") && (a + 1 < argc)) Runs = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-s") && (a + 1 < argc)) Samples = strtoul(argv[++a], NULL, 0);
+        else Path = argv[a];
+    }
+    if ((Path == NULL) || (Runs < 1))
+    {
+        fprintf(stderr, "usage: %s [-r runs] [-s samples] session.trace\n", argv[0]);
+        return 2;
+    }
+    if (!LoadTrace(Path, &PoolSize, &FastSize, &Lost))
+    {
+        fprintf(stderr, "%s: no trace records\n", Path);
+        return 1;
+    }
+
+    for(MapMask = 1; MapMask < RecsCount * 2; MapMask <<= 1);
+    Map[0] = malloc(MapMask * sizeof(TSLOT));
+    Map[1] = malloc(MapMask * sizeof(TSLOT));
+    MapMask--;
+    for(i = 0; i < OP_COUNT; i++) Latency[i] = malloc(RecsCount * Runs * sizeof(uint64_t));
+    HostSize[0] = HostPoolSize(PoolSize);
+    HostSize[1] = HostPoolSize(FastSize);
+    if (!TargetUsable(PoolSize) || !TargetUsable(FastSize))
+    {
+        fprintf(stderr, "%s: pool %zu or TCM pool %zu too small for the TLSF control block\n",
+                Path, PoolSize, FastSize);
+        return 1;
+    }
+    Pool[0] = aligned_alloc(BLOCK_ALIGN, ROUNDUP_SIZE(HostSize[0]));
+    Pool[1] = aligned_alloc(BLOCK_ALIGN, ROUNDUP_SIZE(HostSize[1]));
+
+    printf("%s: %zu records, %u lost on the device, pool %zu, TCM pool %zu (host %zu, %zu)\n",
+           Path, RecsCount, Lost, PoolSize, FastSize, HostSize[0], HostSize[1]);
+    printf("%10s %8s %10s %10s %10s\n", "t ms", "op", "used", "largest", "frag %");
+
+    for(Run = 0; Run < Runs; Run++)
+    {
+        memset(Map[0], 0, (MapMask + 1) * sizeof(TSLOT));
+        memset(Map[1], 0, (MapMask + 1) * sizeof(TSLOT));
+        memset(Pool[0], 0, HostSize[0]);
+        memset(Pool[1], 0, HostSize[1]);
+        Usable[0] = init_memory_pool(HostSize[0], Pool[0]);
+        Usable[1] = init_memory_pool(HostSize[1], Pool[1]);
+        if ((Usable[0] == (size_t)-1) || (Usable[0] < TargetUsable(PoolSize)) ||
+                (Usable[1] == (size_t)-1) || (Usable[1] < TargetUsable(FastSize)))
+        {
+            fprintf(stderr, "host pools %zu and %zu do not give the target's room for blocks\n",
+                    HostSize[0], HostSize[1]);
+            return 1;
+        }
+        /* The host's control block beyond the target's, left out of the reported footprint */
+        Extra[0] = HostSize[0] - Usable[0] - (PoolSize - TargetUsable(PoolSize));
+        Extra[1] = HostSize[1] - Usable[1] - (FastSize - TargetUsable(FastSize));
+
+        for(n = Done = 0; n < RecsCount; n++)
+        {
+            TREC     *r = &Recs[n];
+            TSLOT    *Slot, *OldSlot = NULL;
+            void     *Block = NULL;
+            size_t   OldSize = 0;
+            uint64_t t0, t1;
+
+            if ((r->Op != OP_FREE) && !r->Ptr)
+            {
+                Skipped += !Run;                                                                    // Failed on the device too
+                continue;
+            }
+            if (r->Op != OP_MALLOC)
+            {
+                OldSlot = FindSlot(r->Fast, (r->Op == OP_FREE) ? r->Ptr : r->OldPtr, 0);
+                if (OldSlot == NULL)
+                {
+                    Skipped += !Run;                                                                // Allocated before recording
+                    continue;
+                }
+                OldSize = get_block_size(OldSlot->Block);
+            }
+
+            switch(r->Op)
+            {
+            case OP_MALLOC:
+                t0 = Now();
+                Block = malloc_ex(r->Size, Pool[r->Fast]);
+                t1 = Now();
+                break;
+            case OP_FREE:
+                t0 = Now();
+                free_ex(OldSlot->Block, Pool[r->Fast]);
+                t1 = Now();
+                break;
+            default:
+                t0 = Now();
+                Block = realloc_ex(OldSlot->Block, r->Size, Pool[r->Fast]);
+                t1 = Now();
+                break;
+            }
+            Latency[r->Op][LatencyCount[r->Op]++] = t1 - t0;
+
+            if (r->Op != OP_MALLOC)
+            {
+                if (!Run) LiveBytes -= OldSize;
+                OldSlot->Key = UINT32_MAX;
+            }
+            if (r->Op != OP_FREE)
+            {
+                if (Block == NULL)
+                {
+                    Failed += !Run;
+                    continue;
+                }
+                Slot = FindSlot(r->Fast, r->Ptr, 1);
+                Slot->Key = r->Ptr;
+                Slot->Block = Block;
+                if (!Run && ((LiveBytes += get_block_size(Block)) > PeakLive)) PeakLive = LiveBytes;
+            }
+
+            if (!Run)
+            {
+                size_t   Free, Largest;
+                uint32_t Frag = Fragmentation(Pool[0], &Free, &Largest);
+
+                if (Frag > MaxFrag) MaxFrag = Frag;
+                if (Samples && !(Done++ % ((RecsCount + Samples - 1) / Samples)))
+                    printf("%10.1f %8zu %10zu %10zu %10.1f\n", (r->Time - Recs[0].Time) / 1000.0, n,
+                           get_used_size(Pool[0]) - Extra[0], Largest, Frag / 10.0);
+            }
+        }
+    }
+
+    printf("\n%-8s %8s %10s %10s %10s   (%s, %d run%s)\n", "op", "count", "mean", "p99", "worst",
+           TIMEUNIT, Runs, (Runs > 1) ? "s" : "");
+    for(i = 0; i < OP_COUNT; i++)
+    {
+        uint64_t Sum = 0;
+
+        if (!LatencyCount[i]) continue;
+        for(n = 0; n < LatencyCount[i]; n++) Sum += Latency[i][n];
+        qsort(Latency[i], LatencyCount[i], sizeof(uint64_t), CompareU64);
+        printf("%-8s %8zu %10.1f %10llu %10llu\n", OpNames[i], LatencyCount[i] / Runs,
+               (double)Sum / LatencyCount[i],
+               (unsigned long long)Latency[i][LatencyCount[i] * 99 / 100],
+               (unsigned long long)Latency[i][LatencyCount[i] - 1]);
+    }
+    printf("\npeak footprint %zu bytes (TLSF used incl. headers), TCM pool %zu\n",
+           get_max_size(Pool[0]) - Extra[0], get_max_size(Pool[1]) - Extra[1]);
+    printf("peak live %llu bytes in blocks, worst fragmentation %.1f%%\n",
+           (unsigned long long)PeakLive, MaxFrag / 10.0);
+    printf("%u calls skipped (failed on the device or block older than the trace), %u failed here\n",
+           Skipped, Failed);
+
+    return (Failed) ? 1 : 0;
+}